@@ -93,7 +93,7 @@ void CL_Record_f (void){
 
 	// Send the server data
 	MSG_WriteByte(&msg, SVC_SERVERDATA);
-	MSG_WriteLong(&msg, PROTOCOL_VERSION);
+	MSG_WriteLong(&msg, cl.serverProtocol);	// Frames are recorded as received
 	MSG_WriteLong(&msg, 0x10000 + cl.serverCount);
 	MSG_WriteByte(&msg, 1);			// Demos are always attract loops
 	MSG_WriteString(&msg, cl.gameDir);
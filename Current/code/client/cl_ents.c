@@ -36,141 +36,16 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 /*
  =================
- CL_ParseEntityBits
+ CL_UpdateEntity
 
- Returns the entity number and the header bits
+ Makes the given state the current state of its entity
  =================
 */
-static int CL_ParseEntityBits (unsigned *bits){
-
-    unsigned    b, total;
-    int         number;
-
-    total = MSG_ReadByte(&net_message);
-
-    if (total & U_MOREBITS1){
-        b = MSG_ReadByte(&net_message);
-        total |= b<<8;
-    }
-    if (total & U_MOREBITS2){
-        b = MSG_ReadByte(&net_message);
-        total |= b<<16;
-    }
-    if (total & U_MOREBITS3){
-        b = MSG_ReadByte(&net_message);
-        total |= b<<24;
-    }
-
-	if (total & U_NUMBER16)
-		number = MSG_ReadShort(&net_message);
-    else
-		number = MSG_ReadByte(&net_message);
-
-    *bits = total;
-
-    return number;
-}
-
-/*
- =================
- CL_ParseDelta
-
- Can go from either a baseline or a previous packet entity
- =================
-*/
-static void CL_ParseDelta (entity_state_t *from, entity_state_t *to, int number, int bits){
-
-    // Set everything to the state we are delta'ing from
-    *to = *from;
-
-    VectorCopy(from->origin, to->old_origin);
-    to->number = number;
-
-    if (bits & U_MODEL)
-        to->modelindex = MSG_ReadByte(&net_message);
-    if (bits & U_MODEL2)
-        to->modelindex2 = MSG_ReadByte(&net_message);
-    if (bits & U_MODEL3)
-        to->modelindex3 = MSG_ReadByte(&net_message);
-    if (bits & U_MODEL4)
-        to->modelindex4 = MSG_ReadByte(&net_message);
-
-    if (bits & U_FRAME8)
-        to->frame = MSG_ReadByte(&net_message);
-    if (bits & U_FRAME16)
-        to->frame = MSG_ReadShort(&net_message);
-
-    if ((bits & U_SKIN8) && (bits & U_SKIN16))
-        to->skinnum = MSG_ReadLong(&net_message);
-    else if (bits & U_SKIN8)
-        to->skinnum = MSG_ReadByte(&net_message);
-    else if (bits & U_SKIN16)
-        to->skinnum = MSG_ReadShort(&net_message);
-
-    if ((bits & (U_EFFECTS8|U_EFFECTS16)) == (U_EFFECTS8|U_EFFECTS16))
-        to->effects = MSG_ReadLong(&net_message);
-    else if (bits & U_EFFECTS8)
-        to->effects = MSG_ReadByte(&net_message);
-    else if (bits & U_EFFECTS16)
-        to->effects = MSG_ReadShort(&net_message);
-
-    if ((bits & (U_RENDERFX8|U_RENDERFX16)) == (U_RENDERFX8|U_RENDERFX16))
-        to->renderfx = MSG_ReadLong(&net_message);
-    else if (bits & U_RENDERFX8)
-        to->renderfx = MSG_ReadByte(&net_message);
-    else if (bits & U_RENDERFX16)
-        to->renderfx = MSG_ReadShort(&net_message);
-
-    if (bits & U_ORIGIN1)
-        to->origin[0] = MSG_ReadCoord(&net_message);
-    if (bits & U_ORIGIN2)
-        to->origin[1] = MSG_ReadCoord(&net_message);
-    if (bits & U_ORIGIN3)
-        to->origin[2] = MSG_ReadCoord(&net_message);
-
-    if (bits & U_ANGLE1)
-        to->angles[0] = MSG_ReadAngle(&net_message);
-    if (bits & U_ANGLE2)
-        to->angles[1] = MSG_ReadAngle(&net_message);
-    if (bits & U_ANGLE3)
-        to->angles[2] = MSG_ReadAngle(&net_message);
-
-    if (bits & U_OLDORIGIN)
-        MSG_ReadPos(&net_message, to->old_origin);
-
-    if (bits & U_SOUND)
-        to->sound = MSG_ReadByte(&net_message);
-
-    if (bits & U_EVENT)
-        to->event = MSG_ReadByte(&net_message);
-    else
-        to->event = 0;
-
-    if (bits & U_SOLID)
-        to->solid = MSG_ReadShort(&net_message);
-}
-
-/*
- =================
- CL_DeltaEntity
-
- Parses deltas from the given base and adds the resulting entity to the
- current frame
- =================
-*/
-static void CL_DeltaEntity (frame_t *frame, entity_state_t *from, int number, int bits){
+static void CL_UpdateEntity (frame_t *frame, const entity_state_t *to){
 
     entity_t		*cent;
-    entity_state_t  *to;
-
-	frame->numEntities++;
-
-	cent = &cl.entities[number];
-
-    to = &cl.parseEntities[cl.parseEntitiesIndex & (MAX_PARSE_ENTITIES-1)];
-    cl.parseEntitiesIndex++;
 
-    CL_ParseDelta(from, to, number, bits);
+	cent = &cl.entities[to->number];
 
     // Some data changes will force no lerping
     if (to->modelindex != cent->current.modelindex || to->modelindex2 != cent->current.modelindex2 || to->modelindex3 != cent->current.modelindex3 || to->modelindex4 != cent->current.modelindex4)
@@ -202,6 +77,31 @@ static void CL_DeltaEntity (frame_t *frame, entity_state_t *from, int number, in
     cent->current = *to;
 }
 
+/*
+ =================
+ CL_DeltaEntity
+
+ Parses deltas from the given base and adds the resulting entity to the
+ current frame
+ =================
+*/
+static void CL_DeltaEntity (frame_t *frame, entity_state_t *from, int number, unsigned bits, qboolean bitPacked){
+
+    entity_state_t  *to;
+
+	frame->numEntities++;
+
+    to = &cl.parseEntities[cl.parseEntitiesIndex & (MAX_PARSE_ENTITIES-1)];
+    cl.parseEntitiesIndex++;
+
+    if (bitPacked)
+        MSG_ReadDeltaEntityBits(&net_message, from, to, number);
+    else
+        MSG_ReadDeltaEntity(&net_message, from, to, number, bits);
+
+	CL_UpdateEntity(frame, to);
+}
+
 /*
  =================
  CL_ParsePacketEntities
@@ -213,8 +113,13 @@ static void CL_DeltaEntity (frame_t *frame, entity_state_t *from, int number, in
 static void CL_ParsePacketEntities (frame_t *oldFrame, frame_t *newFrame){
 
     entity_state_t	*oldState;
-    int				newNum, oldNum;
-    int				bits, oldIndex;
+    int				newNum, oldNum, lastNum;
+    unsigned		bits;
+    int				oldIndex;
+    qboolean		bitPacked;
+
+    bitPacked = (cl.serverProtocol == PROTOCOL_VERSION_BITS);
+    lastNum = 0;
 
     newFrame->parseEntitiesIndex = cl.parseEntitiesIndex;
     newFrame->numEntities = 0;
@@ -233,7 +138,18 @@ static void CL_ParsePacketEntities (frame_t *oldFrame, frame_t *newFrame){
     }
 
     while (1){
-        newNum = CL_ParseEntityBits(&bits);
+        if (bitPacked){
+            newNum = MSG_ReadEntityNumberBits(&net_message, lastNum);
+            if (newNum && MSG_ReadBits(&net_message, 1))
+                bits = U_REMOVE;
+            else
+                bits = 0;
+
+            lastNum = newNum;
+        }
+        else
+            newNum = MSG_ReadEntityBits(&net_message, &bits);
+
         if (newNum >= MAX_EDICTS)
             Com_Error(ERR_DROP, "CL_ParsePacketEntities: newNum = %i", newNum);
 
@@ -247,7 +163,7 @@ static void CL_ParsePacketEntities (frame_t *oldFrame, frame_t *newFrame){
 			// One or more entities from the old packet are unchanged
 			CL_ShowNet(3, "Unchanged: %i", oldNum);
 
-			CL_DeltaEntity(newFrame, oldState, oldNum, 0);
+			CL_DeltaEntity(newFrame, oldState, oldNum, 0, false);
 
             oldIndex++;
 
@@ -283,7 +199,7 @@ static void CL_ParsePacketEntities (frame_t *oldFrame, frame_t *newFrame){
 			// Delta from previous state
 			CL_ShowNet(3, "Delta: %i", newNum);
 
-            CL_DeltaEntity(newFrame, oldState, newNum, bits);
+            CL_DeltaEntity(newFrame, oldState, newNum, bits, bitPacked);
 
             oldIndex++;
 
@@ -301,7 +217,7 @@ static void CL_ParsePacketEntities (frame_t *oldFrame, frame_t *newFrame){
 			// Delta from baseline
 			CL_ShowNet(3, "Baseline: %i", newNum);
 
-            CL_DeltaEntity(newFrame, &cl.entities[newNum].baseline, newNum, bits);
+            CL_DeltaEntity(newFrame, &cl.entities[newNum].baseline, newNum, bits, bitPacked);
             continue;
         }
     }
@@ -311,7 +227,7 @@ static void CL_ParsePacketEntities (frame_t *oldFrame, frame_t *newFrame){
 		// One or more entities from the old packet are unchanged
 		CL_ShowNet(3, "Unchanged: %i", oldNum);
 
-        CL_DeltaEntity(newFrame, oldState, oldNum, 0);
+        CL_DeltaEntity(newFrame, oldState, oldNum, 0, false);
 
         oldIndex++;
 
@@ -324,6 +240,44 @@ static void CL_ParsePacketEntities (frame_t *oldFrame, frame_t *newFrame){
     }
 }
 
+/*
+ =================
+ CL_ParseLocalSnapshot
+
+ A SVC_LOCALSNAPSHOT has just been parsed, take the player state and
+ entities from the snapshot that came with the loopback packet
+ =================
+*/
+static void CL_ParseLocalSnapshot (frame_t *newFrame){
+
+	loopSnapshot_t	*snapshot;
+	entity_state_t	*to;
+	int				i;
+
+	snapshot = NET_ReceivedLoopSnapshot(NS_CLIENT, newFrame->serverFrame);
+	if (!snapshot || net_from.type != NA_LOOPBACK)
+		Com_Error(ERR_DROP, "CL_ParseLocalSnapshot: no snapshot for frame %i", newFrame->serverFrame);
+
+	// Snapshots can't be recorded, so keep waiting for a delta compressed
+	// frame
+	if (cls.demoFile)
+		cls.demoWaiting = true;
+
+	newFrame->playerState = snapshot->playerState;
+
+	newFrame->parseEntitiesIndex = cl.parseEntitiesIndex;
+	newFrame->numEntities = snapshot->numEntities;
+
+	for (i = 0; i < snapshot->numEntities; i++){
+		to = &cl.parseEntities[cl.parseEntitiesIndex & (MAX_PARSE_ENTITIES-1)];
+		cl.parseEntitiesIndex++;
+
+		*to = snapshot->entities[i];
+
+		CL_UpdateEntity(newFrame, to);
+	}
+}
+
 /*
  =================
  CL_ParsePlayerState
@@ -332,7 +286,6 @@ static void CL_ParsePacketEntities (frame_t *oldFrame, frame_t *newFrame){
 static void CL_ParsePlayerState (frame_t *oldFrame, frame_t *newFrame){
 
     player_state_t  *state;
-    int				i, flags, statBits;
 
     state = &newFrame->playerState;
 
@@ -342,94 +295,13 @@ static void CL_ParsePlayerState (frame_t *oldFrame, frame_t *newFrame){
     else
         memset(state, 0, sizeof(player_state_t));
 
-    flags = MSG_ReadShort(&net_message);
-
-    // Parse the pmove_state_t
-    if (flags & PS_M_TYPE)
-        state->pmove.pm_type = MSG_ReadByte(&net_message);
-
-    if (flags & PS_M_ORIGIN){
-        state->pmove.origin[0] = MSG_ReadShort(&net_message);
-        state->pmove.origin[1] = MSG_ReadShort(&net_message);
-        state->pmove.origin[2] = MSG_ReadShort(&net_message);
-    }
-
-    if (flags & PS_M_VELOCITY){
-        state->pmove.velocity[0] = MSG_ReadShort(&net_message);
-        state->pmove.velocity[1] = MSG_ReadShort(&net_message);
-        state->pmove.velocity[2] = MSG_ReadShort(&net_message);
-    }
-
-    if (flags & PS_M_TIME)
-        state->pmove.pm_time = MSG_ReadByte(&net_message);
-
-    if (flags & PS_M_FLAGS)
-        state->pmove.pm_flags = MSG_ReadByte(&net_message);
-
-    if (flags & PS_M_GRAVITY)
-        state->pmove.gravity = MSG_ReadShort(&net_message);
-
-    if (flags & PS_M_DELTA_ANGLES){
-        state->pmove.delta_angles[0] = MSG_ReadShort(&net_message);
-        state->pmove.delta_angles[1] = MSG_ReadShort(&net_message);
-        state->pmove.delta_angles[2] = MSG_ReadShort(&net_message);
-    }
+    if (cl.serverProtocol == PROTOCOL_VERSION_BITS)
+        MSG_ReadDeltaPlayerStateBits(&net_message, state);
+    else
+        MSG_ReadDeltaPlayerState(&net_message, state);
 
     if (cl.demoPlaying)
         state->pmove.pm_type = PM_FREEZE;       // Demo playback
-
-    // Parse the rest of the player_state_t
-    if (flags & PS_VIEWOFFSET){
-        state->viewoffset[0] = MSG_ReadChar(&net_message) * 0.25;
-        state->viewoffset[1] = MSG_ReadChar(&net_message) * 0.25;
-        state->viewoffset[2] = MSG_ReadChar(&net_message) * 0.25;
-    }
-
-    if (flags & PS_VIEWANGLES){
-        state->viewangles[0] = MSG_ReadAngle16(&net_message);
-        state->viewangles[1] = MSG_ReadAngle16(&net_message);
-        state->viewangles[2] = MSG_ReadAngle16(&net_message);
-    }
-
-    if (flags & PS_KICKANGLES){
-        state->kick_angles[0] = MSG_ReadChar(&net_message) * 0.25;
-        state->kick_angles[1] = MSG_ReadChar(&net_message) * 0.25;
-        state->kick_angles[2] = MSG_ReadChar(&net_message) * 0.25;
-    }
-
-    if (flags & PS_WEAPONINDEX)
-        state->gunindex = MSG_ReadByte(&net_message);
-
-    if (flags & PS_WEAPONFRAME){
-        state->gunframe = MSG_ReadByte(&net_message);
-        state->gunoffset[0] = MSG_ReadChar(&net_message) * 0.25;
-        state->gunoffset[1] = MSG_ReadChar(&net_message) * 0.25;
-        state->gunoffset[2] = MSG_ReadChar(&net_message) * 0.25;
-        state->gunangles[0] = MSG_ReadChar(&net_message) * 0.25;
-        state->gunangles[1] = MSG_ReadChar(&net_message) * 0.25;
-        state->gunangles[2] = MSG_ReadChar(&net_message) * 0.25;
-    }
-
-    if (flags & PS_BLEND){
-        state->blend[0] = MSG_ReadByte(&net_message) / 255.0;
-        state->blend[1] = MSG_ReadByte(&net_message) / 255.0;
-        state->blend[2] = MSG_ReadByte(&net_message) / 255.0;
-        state->blend[3] = MSG_ReadByte(&net_message) / 255.0;
-    }
-
-    if (flags & PS_FOV)
-        state->fov = MSG_ReadByte(&net_message);
-
-    if (flags & PS_RDFLAGS)
-        state->rdflags = MSG_ReadByte(&net_message);
-
-    // Parse stats
-    statBits = MSG_ReadLong(&net_message);
-
-    for (i = 0; i < MAX_STATS; i++){
-        if (statBits & (1<<i))
-            state->stats[i] = MSG_ReadShort(&net_message);
-	}
 }
 
 /*
@@ -493,13 +365,14 @@ static void CL_FireEntityEvents (void){
 void CL_ParseBaseLine (void){
 
 	entity_state_t	*state, nullState;
-	int				bits, number;
+	unsigned		bits;
+	int				number;
 
 	memset(&nullState, 0, sizeof(entity_state_t));
 
-	number = CL_ParseEntityBits(&bits);
+	number = MSG_ReadEntityBits(&net_message, &bits);
 	state = &cl.entities[number].baseline;
-	CL_ParseDelta(&nullState, state, number, bits);
+	MSG_ReadDeltaEntity(&net_message, &nullState, state, number, bits);
 }
   
 /*
@@ -559,21 +432,30 @@ void CL_ParseFrame (void){
 
 	// Read player state
 	cmd = MSG_ReadByte(&net_message);
-	if (cmd != SVC_PLAYERINFO)
-		Com_Error(ERR_DROP, "CL_ParseFrame: not player state");
 
-	CL_ShowNet(2, "%3i: %s", net_message.readCount-1, svc_strings[cmd]);
+	if (cmd == SVC_LOCALSNAPSHOT){
+		CL_ShowNet(2, "%3i: %s", net_message.readCount-1, svc_strings[cmd]);
 
-	CL_ParsePlayerState(oldFrame, &cl.frame);
+		// Read player state and packet entities from the snapshot
+		CL_ParseLocalSnapshot(&cl.frame);
+	}
+	else {
+		if (cmd != SVC_PLAYERINFO)
+			Com_Error(ERR_DROP, "CL_ParseFrame: not player state");
 
-	// Read packet entities
-	cmd = MSG_ReadByte(&net_message);
-	if (cmd != SVC_PACKETENTITIES)
-		Com_Error(ERR_DROP, "CL_ParseFrame: not packet entities");
+		CL_ShowNet(2, "%3i: %s", net_message.readCount-1, svc_strings[cmd]);
 
-	CL_ShowNet(2, "%3i: %s", net_message.readCount-1, svc_strings[cmd]);
+		CL_ParsePlayerState(oldFrame, &cl.frame);
 
-	CL_ParsePacketEntities(oldFrame, &cl.frame);
+		// Read packet entities
+		cmd = MSG_ReadByte(&net_message);
+		if (cmd != SVC_PACKETENTITIES)
+			Com_Error(ERR_DROP, "CL_ParseFrame: not packet entities");
+
+		CL_ShowNet(2, "%3i: %s", net_message.readCount-1, svc_strings[cmd]);
+
+		CL_ParsePacketEntities(oldFrame, &cl.frame);
+	}
 
 	// Save the frame off in the backup array for later delta 
 	// comparisons
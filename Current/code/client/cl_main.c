@@ -38,6 +38,7 @@ cvar_t	*cl_showMiss;
 cvar_t	*cl_showMaterial;
 cvar_t	*cl_predict;
 cvar_t	*cl_timeOut;
+cvar_t	*cl_bitSnapshots;
 cvar_t	*cl_thirdPerson;
 cvar_t	*cl_thirdPersonRange;
 cvar_t	*cl_thirdPersonAngle;
@@ -327,7 +328,10 @@ static void CL_CheckForResend (void){
 		// We have gotten a challenge from the server, so try and connect
 		cvar_modifiedFlags &= ~CVAR_USERINFO;
 
-		NetChan_OutOfBandPrint(NS_CLIENT, cls.serverAddress, "connect %i %i %i \"%s\"\n", PROTOCOL_VERSION, Cvar_GetInteger("net_qport"), cls.serverChallenge, Cvar_UserInfo());
+		// Ask for bit packed snapshots and tell how large a fragmented
+		// message can be after the user info. Servers that don't know
+		// about these ignore the extra arguments.
+		NetChan_OutOfBandPrint(NS_CLIENT, cls.serverAddress, "connect %i %i %i \"%s\" %i %i\n", PROTOCOL_VERSION, Cvar_GetInteger("net_qport"), cls.serverChallenge, Cvar_UserInfo(), (cl_bitSnapshots->integerValue) ? PROTOCOL_VERSION_BITS : PROTOCOL_VERSION, MAX_MSGLEN);
 
 		break;
 	}
@@ -512,6 +516,40 @@ static void CL_ConnectionlessPacket (void){
 		Com_Printf(S_COLOR_YELLOW "Bad connectionless packet from %s:\n%s\n", NET_AdrToString(net_from), s);
 }
 
+/*
+ =================
+ CL_PacketEvent
+ =================
+*/
+static void CL_PacketEvent (void){
+
+	// Check for connectionless packet first
+	if (*(int *)net_message.data == -1){
+		CL_ConnectionlessPacket();
+		return;
+	}
+
+	// Dump it if not connected
+	if (cls.state < CA_CONNECTED)
+		return;
+
+	if (net_message.curSize < 8){
+		Com_DPrintf(S_COLOR_YELLOW "%s: runt packet\n", NET_AdrToString(net_from));
+		return;
+	}
+
+	// Packet from server
+	if (!NET_CompareAdr(net_from, cls.netChan.remoteAddress)){
+		Com_DPrintf(S_COLOR_YELLOW "%s: sequenced packet without connection\n", NET_AdrToString(net_from));
+		return;
+	}
+
+	if (!NetChan_Process(&cls.netChan, &net_message))
+		return;		// Wasn't accepted for some reason
+
+	CL_ParseServerMessage();
+}
+
 /*
  =================
  CL_ReadPackets
@@ -519,33 +557,22 @@ static void CL_ConnectionlessPacket (void){
 */
 static void CL_ReadPackets (void){
 
-	while (NET_GetPacket(NS_CLIENT, &net_from, &net_message)){
-		// Check for connectionless packet first
-		if (*(int *)net_message.data == -1){
-			CL_ConnectionlessPacket();
-			continue;
-		}
+	msg_t	message;
 
-		// Dump it if not connected
-		if (cls.state < CA_CONNECTED)
-			continue;
+	// Snapshots can't be recorded in demos, so ask for delta compressed
+	// frames while recording
+	NET_AcceptLoopSnapshots(NS_CLIENT, !cls.demoFile);
 
-		if (net_message.curSize < 8){
-			Com_DPrintf(S_COLOR_YELLOW "%s: runt packet\n", NET_AdrToString(net_from));
-			continue;
-		}
+	// Loopback packets are read in place
+	message = net_message;
 
-		// Packet from server
-		if (!NET_CompareAdr(net_from, cls.netChan.remoteAddress)){
-			Com_DPrintf(S_COLOR_YELLOW "%s: sequenced packet without connection\n", NET_AdrToString(net_from));
-			continue;
-		}
+	while (NET_ReadLoopPacket(NS_CLIENT, &net_from, &net_message))
+		CL_PacketEvent();
 
-		if (!NetChan_Process(&cls.netChan, &net_message))
-			continue;		// Wasn't accepted for some reason
+	net_message = message;
 
-		CL_ParseServerMessage();
-	}
+	while (NET_GetPacket(NS_CLIENT, &net_from, &net_message))
+		CL_PacketEvent();
 
 	// Check time-out
 	if (cls.state >= CA_CONNECTED && cls.realTime - cls.netChan.lastReceived > SEC2MS(cl_timeOut->floatValue)){
@@ -1429,6 +1456,7 @@ static void CL_InitLocal (void){
 	Cvar_Get("password", "", CVAR_USERINFO, "Server password");
 	Cvar_Get("spectator", "0", CVAR_USERINFO, "Spectator mode");
 	Cvar_Get("rate", "25000", CVAR_USERINFO | CVAR_ARCHIVE, "Network rate");
+	Cvar_Get("compress", "1", CVAR_USERINFO | CVAR_ARCHIVE, "Ask the server to compress network packets");
 	Cvar_Get("fov", "90", CVAR_USERINFO | CVAR_ARCHIVE, "Field of view");
 	cl_hand = Cvar_Get("hand", "0", CVAR_USERINFO | CVAR_ARCHIVE, "Player handedness");
 	cl_zoomFov = Cvar_Get("cl_zoomFov", "25", CVAR_ARCHIVE, "Field of view when zooming");
@@ -1440,6 +1468,7 @@ static void CL_InitLocal (void){
 	cl_showMaterial = Cvar_Get("cl_showMaterial", "0", CVAR_CHEAT, "Show material name, flags, and contents under crosshair");
 	cl_predict = Cvar_Get("cl_predict", "1", CVAR_ARCHIVE, "Predict player movement");
 	cl_timeOut = Cvar_Get("cl_timeOut", "120", 0, "Connection time out time in seconds");
+	cl_bitSnapshots = Cvar_Get("cl_bitSnapshots", "1", CVAR_ARCHIVE, "Ask the server for bit packed snapshots");
 	cl_thirdPerson = Cvar_Get("cl_thirdPerson", "0", CVAR_CHEAT, "Third-person camera mode");
 	cl_thirdPersonRange = Cvar_Get("cl_thirdPersonRange", "40", CVAR_CHEAT, "Third-person camera range");
 	cl_thirdPersonAngle = Cvar_Get("cl_thirdPersonAngle", "0", CVAR_CHEAT, "Third-person camera angle");
@@ -1644,8 +1673,13 @@ void CL_Frame (int msec){
 	if (msec > 5000)
 		cls.netChan.lastReceived = cls.realTime;
 
-	// Fetch results from server
-	CL_ReadPackets();
+	// Fetch results from server, unless the server thread is in the middle
+	// of a frame
+	if (Com_TryLockFrame()){
+		CL_ReadPackets();
+
+		Com_UnlockFrame();
+	}
 
 	// Get new events
 	Sys_GetEvents();
@@ -1654,7 +1688,11 @@ void CL_Frame (int msec){
 	IN_Frame();
 
 	// Process commands
-	Cbuf_Execute();
+	if (Com_TryLockFrame()){
+		Cbuf_Execute();
+
+		Com_UnlockFrame();
+	}
 
 	// Send intentions now
 	CL_SendCmd();
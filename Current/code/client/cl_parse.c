@@ -46,7 +46,8 @@ const char	*svc_strings[256] = {
 	"SVC_PLAYERINFO",
 	"SVC_PACKETENTITIES",
 	"SVC_DELTAPACKETENTITIES",
-	"SVC_FRAME"
+	"SVC_FRAME",
+	"SVC_LOCALSNAPSHOT"
 };
 
 
@@ -180,7 +181,7 @@ static void CL_ParseServerData (void){
 	// BIG HACK to let old demos continue to work
 	if (Com_ServerState() && PROTOCOL_VERSION == 34)
 		;
-	else if (cl.serverProtocol != PROTOCOL_VERSION)
+	else if (cl.serverProtocol != PROTOCOL_VERSION && cl.serverProtocol != PROTOCOL_VERSION_BITS)
 		Com_Error(ERR_DROP, "Server returned version %i, not %i", cl.serverProtocol, PROTOCOL_VERSION);
 
 	cl.serverCount = MSG_ReadLong(&net_message);
@@ -542,6 +543,7 @@ void CL_ParseServerMessage (void){
 		case SVC_PLAYERINFO:
 		case SVC_PACKETENTITIES:
 		case SVC_DELTAPACKETENTITIES:
+		case SVC_LOCALSNAPSHOT:
 			Com_Error(ERR_DROP, "CL_ParseServerMessage: out of place frame data");
 
 			break;
@@ -25,6 +25,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 static entity_state_t	*cl_solidEntities[MAX_PARSE_ENTITIES];
 static int				cl_numSolidEntities;
 
+// Prediction traces don't share the collision state with the local server
+static traceContext_t	cl_traceContext;
+
 
 /*
  =================
@@ -61,7 +64,7 @@ trace_t CL_Trace (const vec3_t start, const vec3_t mins, const vec3_t maxs, cons
 	int				i, xy, zd, zu, headNode;
 
 	// Check against world
-	trace = CM_BoxTrace(start, end, mins, maxs, 0, brushMask);
+	trace = CM_BoxTraceEx(&cl_traceContext, start, end, mins, maxs, 0, brushMask);
 	if (trace.fraction < 1.0){
 		if (entNumber)
 			*entNumber = 0;
@@ -85,7 +88,7 @@ trace_t CL_Trace (const vec3_t start, const vec3_t mins, const vec3_t maxs, cons
 			if (!cmodel)
 				continue;
 
-			tmp = CM_TransformedBoxTrace(start, end, mins, maxs, cmodel->headNode, brushMask, ent->origin, ent->angles);
+			tmp = CM_TransformedBoxTraceEx(&cl_traceContext, start, end, mins, maxs, cmodel->headNode, brushMask, ent->origin, ent->angles);
 		}
 		else {
 			if (brushOnly)
@@ -101,8 +104,8 @@ trace_t CL_Trace (const vec3_t start, const vec3_t mins, const vec3_t maxs, cons
 			bmins[2] = -zd;
 			bmaxs[2] = zu;
 
-			headNode = CM_HeadNodeForBox(bmins, bmaxs);
-			tmp = CM_TransformedBoxTrace(start, end, mins, maxs, headNode, brushMask, ent->origin, vec3_origin);
+			headNode = CM_HeadNodeForBoxEx(&cl_traceContext, bmins, bmaxs);
+			tmp = CM_TransformedBoxTraceEx(&cl_traceContext, start, end, mins, maxs, headNode, brushMask, ent->origin, vec3_origin);
 		}
 
 		if (tmp.allsolid || tmp.startsolid || tmp.fraction < trace.fraction){
@@ -138,7 +141,7 @@ int	CL_PointContents (const vec3_t point, int skipNumber){
 	cmodel_t		*cmodel;
 	int				i, contents;
 
-	contents = CM_PointContents(point, 0);
+	contents = CM_PointContentsEx(&cl_traceContext, point, 0);
 
 	for (i = 0; i < cl_numSolidEntities; i++){
 		ent = cl_solidEntities[i];
@@ -153,7 +156,7 @@ int	CL_PointContents (const vec3_t point, int skipNumber){
 		if (!cmodel)
 			continue;
 
-		contents |= CM_TransformedPointContents(point, cmodel->headNode, ent->origin, ent->angles);
+		contents |= CM_TransformedPointContentsEx(&cl_traceContext, point, cmodel->headNode, ent->origin, ent->angles);
 	}
 
 	return contents;
@@ -478,6 +478,7 @@ extern cvar_t	*cl_showMiss;
 extern cvar_t	*cl_showMaterial;
 extern cvar_t	*cl_predict;
 extern cvar_t	*cl_timeOut;
+extern cvar_t	*cl_bitSnapshots;
 extern cvar_t	*cl_thirdPerson;
 extern cvar_t	*cl_thirdPersonRange;
 extern cvar_t	*cl_thirdPersonAngle;
@@ -0,0 +1,140 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+// cl_null.c -- this file can stub out the entire client system for
+// pure dedicated servers
+
+
+#include "../qcommon/qcommon.h"
+
+
+/*
+ =================
+ Con_Print
+ =================
+*/
+void Con_Print (const char *text){
+
+}
+
+/*
+ =================
+ CL_WriteKeyBindings
+ =================
+*/
+void CL_WriteKeyBindings (fileHandle_t f){
+
+}
+
+/*
+ =================
+ CL_SetKeyEditMode
+ =================
+*/
+void CL_SetKeyEditMode (qboolean editMode){
+
+}
+
+/*
+ =================
+ CL_InitKeys
+ =================
+*/
+void CL_InitKeys (void){
+
+}
+
+/*
+ =================
+ CL_ShutdownKeys
+ =================
+*/
+void CL_ShutdownKeys (void){
+
+}
+
+/*
+ =================
+ CL_ForwardToServer
+
+ There is no local client to forward commands to, so anything that
+ reaches here is simply unknown
+ =================
+*/
+void CL_ForwardToServer (void){
+
+	Com_Printf("Unknown command \"%s\"\n", Cmd_Argv(0));
+}
+
+/*
+ =================
+ CL_Drop
+ =================
+*/
+void CL_Drop (void){
+
+}
+
+/*
+ =================
+ CL_MapLoading
+ =================
+*/
+void CL_MapLoading (void){
+
+}
+
+/*
+ =================
+ CL_AllowCheats
+ =================
+*/
+qboolean CL_AllowCheats (void){
+
+	return true;
+}
+
+/*
+ =================
+ CL_Frame
+ =================
+*/
+void CL_Frame (int msec){
+
+}
+
+/*
+ =================
+ CL_Init
+ =================
+*/
+void CL_Init (void){
+
+}
+
+/*
+ =================
+ CL_Shutdown
+ =================
+*/
+void CL_Shutdown (void){
+
+}
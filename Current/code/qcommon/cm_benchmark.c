@@ -0,0 +1,657 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+// cm_benchmark.c -- collision query benchmark
+
+
+#include "qcommon.h"
+
+
+/*
+ The collisionBenchmark command loads a map on its own and runs the same
+ random collision queries on it every time: point traces, box traces,
+ position tests, transformed traces against the inline models, point
+ contents and box leaf lists. The queries come from a seeded generator
+ that doesn't touch the state of rand, so a given map, seed and count
+ always make the same queries.
+
+ Every batch of queries runs twice, first in the order they were made,
+ scattered all over the map, then sorted by location so that queries
+ close to each other follow each other, much like the traces of the
+ entities of a game frame. The difference in speed shows how much the
+ queries depend on the cache. Both runs must give the same results.
+
+ The result of every query can be saved as a checksum in a golden file,
+ and later runs compared with it, so a change to the collision code can be
+ checked for both speed and correctness without a client. A run that
+ differs from the golden file ends in a fatal error, so scripts get a
+ failing exit code.
+
+ It is only available on dedicated servers, where a connected client
+ can't be relying on the collision map, and only while no server runs.
+*/
+
+#define BENCH_IDENT				(('N'<<24)+('B'<<16)+('M'<<8)+'C')	// "CMBN"
+#define BENCH_VERSION			1
+
+#define BENCH_EXTENSION			".cmb"
+
+#define BENCH_BATCH				4096
+#define BENCH_MAX_LEAFS			128			// Same as the server uses for an entity
+#define BENCH_BRUSH_COUNTS		1024		// Exact counts below this for the distribution
+#define BENCH_SHOW_DIFFS		8
+
+typedef enum {
+	BENCH_POINT_TRACE,
+	BENCH_BOX_TRACE,
+	BENCH_POSITION_TEST,
+	BENCH_TRANSFORMED_TRACE,
+	BENCH_POINT_CONTENTS,
+	BENCH_BOX_LEAFS,
+	MAX_BENCH_TESTS
+} benchTest_t;
+
+typedef struct {
+	vec3_t			start;
+	vec3_t			end;
+	vec3_t			mins;
+	vec3_t			maxs;
+
+	int				headNode;			// Of the inline model for transformed traces
+	vec3_t			origin;
+	vec3_t			angles;
+
+	unsigned		location;			// To sort the queries by
+} benchQuery_t;
+
+typedef struct {
+	trace_t			trace;
+	int				contents;
+
+	int				numLeafs;
+	int				topNode;
+	int				leafs[BENCH_MAX_LEAFS];
+
+	int				brushTests;
+	int				brushesAvoided;
+} benchResult_t;
+
+typedef struct {
+	int				numQueries;
+
+	double			scatteredTime;
+	double			coherentTime;
+
+	int				orderDiffs;			// Results that changed with the order
+	int				goldenDiffs;
+
+	int				brushCounts[BENCH_BRUSH_COUNTS+1];
+	int				maxBrushTests;
+	double			totalBrushTests;
+	double			totalBrushesAvoided;
+	double			totalLeafs;
+} benchStats_t;
+
+static const char			*cm_benchTestNames[MAX_BENCH_TESTS] = {"point traces", "box traces", "position tests", "transformed traces", "point contents", "box leafs"};
+
+static vec3_t				cm_benchHullMins[4] = {{-16, -16, -24}, {-16, -16, -24}, {-15, -15, -15}, {-4, -4, -4}};
+static vec3_t				cm_benchHullMaxs[4] = {{16, 16, 32}, {16, 16, 4}, {15, 15, 15}, {4, 4, 4}};
+
+static const benchQuery_t	*cm_benchSortQueries;
+
+
+/*
+ =================
+ CM_BenchLocation
+
+ Interleaves the bits of the position of the given point on a 64 unit
+ grid, so nearby points get nearby numbers
+ =================
+*/
+static unsigned CM_BenchLocation (const vec3_t point){
+
+	unsigned	location = 0;
+	int			cell[3];
+	int			i, j;
+
+	for (i = 0; i < 3; i++)
+		cell[i] = Clamp(((int)point[i] + 32768) >> 6, 0, 1023);
+
+	for (i = 0; i < 10; i++){
+		for (j = 0; j < 3; j++)
+			location |= ((cell[j] >> i) & 1) << (i * 3 + j);
+	}
+
+	return location;
+}
+
+/*
+ =================
+ CM_BenchMove
+
+ Half the moves are short like the steps of entities, the others long
+ like shots and sight checks
+ =================
+*/
+static void CM_BenchMove (benchQuery_t *query, unsigned *seed){
+
+	vec3_t	dir;
+	float	length;
+	int		i;
+
+	for (i = 0; i < 3; i++)
+		dir[i] = CM_RandomFloat(seed) * 2 - 1;
+
+	VectorNormalize(dir);
+
+	if (CM_RandomFloat(seed) < 0.5f)
+		length = CM_RandomFloat(seed) * 64;
+	else
+		length = CM_RandomFloat(seed) * 1024;
+
+	VectorMA(query->start, length, dir, query->end);
+}
+
+/*
+ =================
+ CM_MakeBenchQuery
+ =================
+*/
+static void CM_MakeBenchQuery (benchTest_t test, benchQuery_t *query, unsigned *seed, const cmodel_t *world, int numModels){
+
+	const cmodel_t	*model;
+	int				hull;
+	int				i;
+
+	memset(query, 0, sizeof(benchQuery_t));
+
+	// Pick a spot around the world, or an inline model moved somewhere
+	if (test == BENCH_TRANSFORMED_TRACE){
+		model = CM_InlineModel(va("*%i", 1 + (int)(CM_RandomFloat(seed) * (numModels - 1)) % (numModels - 1)));
+
+		query->headNode = model->headNode;
+
+		for (i = 0; i < 3; i++)
+			query->origin[i] = model->origin[i] + CM_RandomFloat(seed) * 512 - 256;
+
+		if (CM_RandomFloat(seed) < 0.5f){
+			for (i = 0; i < 3; i++)
+				query->angles[i] = CM_RandomFloat(seed) * 360;
+		}
+	}
+	else
+		model = world;
+
+	for (i = 0; i < 3; i++)
+		query->start[i] = query->origin[i] + model->mins[i] - 64 + CM_RandomFloat(seed) * (model->maxs[i] - model->mins[i] + 128);
+
+	switch (test){
+	case BENCH_POINT_TRACE:
+		CM_BenchMove(query, seed);
+		break;
+	case BENCH_BOX_TRACE:
+	case BENCH_POSITION_TEST:
+		hull = (int)(CM_RandomFloat(seed) * 4) & 3;
+
+		VectorCopy(cm_benchHullMins[hull], query->mins);
+		VectorCopy(cm_benchHullMaxs[hull], query->maxs);
+
+		if (test == BENCH_BOX_TRACE)
+			CM_BenchMove(query, seed);
+		else
+			VectorCopy(query->start, query->end);
+
+		break;
+	case BENCH_TRANSFORMED_TRACE:
+		// One in four is a point
+		hull = (int)(CM_RandomFloat(seed) * 4) & 3;
+
+		if (hull){
+			VectorCopy(cm_benchHullMins[hull], query->mins);
+			VectorCopy(cm_benchHullMaxs[hull], query->maxs);
+		}
+
+		CM_BenchMove(query, seed);
+		break;
+	case BENCH_POINT_CONTENTS:
+		VectorCopy(query->start, query->end);
+		break;
+	case BENCH_BOX_LEAFS:
+		for (i = 0; i < 3; i++){
+			query->mins[i] = query->start[i] - CM_RandomFloat(seed) * 128;
+			query->maxs[i] = query->start[i] + CM_RandomFloat(seed) * 128;
+		}
+
+		VectorCopy(query->start, query->end);
+		break;
+	default:
+		break;
+	}
+
+	query->location = CM_BenchLocation(query->start);
+}
+
+/*
+ =================
+ CM_SortBenchQueries
+ =================
+*/
+static int CM_SortBenchQueries (const void *elem1, const void *elem2){
+
+	unsigned	location1 = cm_benchSortQueries[*(const int *)elem1].location;
+	unsigned	location2 = cm_benchSortQueries[*(const int *)elem2].location;
+
+	if (location1 < location2)
+		return -1;
+	if (location1 > location2)
+		return 1;
+
+	return *(const int *)elem1 - *(const int *)elem2;
+}
+
+/*
+ =================
+ CM_RunBenchQuery
+ =================
+*/
+static void CM_RunBenchQuery (traceContext_t *ctx, benchTest_t test, const benchQuery_t *query, benchResult_t *result){
+
+	int		brushTests = ctx->numBrushTests;
+	int		brushesAvoided = ctx->numBrushesAvoided;
+
+	switch (test){
+	case BENCH_POINT_TRACE:
+		result->trace = CM_BoxTraceEx(ctx, query->start, query->end, vec3_origin, vec3_origin, 0, MASK_SHOT);
+		break;
+	case BENCH_BOX_TRACE:
+	case BENCH_POSITION_TEST:
+		result->trace = CM_BoxTraceEx(ctx, query->start, query->end, query->mins, query->maxs, 0, MASK_PLAYERSOLID);
+		break;
+	case BENCH_TRANSFORMED_TRACE:
+		result->trace = CM_TransformedBoxTraceEx(ctx, query->start, query->end, query->mins, query->maxs, query->headNode, MASK_PLAYERSOLID, query->origin, query->angles);
+		break;
+	case BENCH_POINT_CONTENTS:
+		result->contents = CM_PointContentsEx(ctx, query->start, 0);
+		break;
+	case BENCH_BOX_LEAFS:
+		result->numLeafs = CM_BoxLeafNums(query->mins, query->maxs, result->leafs, BENCH_MAX_LEAFS, &result->topNode);
+		break;
+	default:
+		break;
+	}
+
+	result->brushTests = ctx->numBrushTests - brushTests;
+	result->brushesAvoided = ctx->numBrushesAvoided - brushesAvoided;
+}
+
+/*
+ =================
+ CM_HashBenchResult
+
+ Returns a checksum of everything the query gave back
+ =================
+*/
+static unsigned CM_HashBenchResult (benchTest_t test, const benchResult_t *result){
+
+	struct {
+		float		fraction;
+		vec3_t		endPos;
+		vec3_t		normal;
+		float		dist;
+		int			contents;
+		int			solid;
+		char		surface[16];
+		int			surfaceFlags;
+		int			surfaceValue;
+	} trace;
+	const trace_t	*t = &result->trace;
+
+	switch (test){
+	case BENCH_POINT_CONTENTS:
+		return Com_BlockChecksum(&result->contents, sizeof(int));
+	case BENCH_BOX_LEAFS:
+		return Com_BlockChecksum(&result->topNode, sizeof(int)) ^ Com_BlockChecksum(result->leafs, result->numLeafs * sizeof(int));
+	default:
+		// Only the values, not the surface pointer, so it holds across runs
+		memset(&trace, 0, sizeof(trace));
+
+		trace.fraction = t->fraction;
+		VectorCopy(t->endpos, trace.endPos);
+		VectorCopy(t->plane.normal, trace.normal);
+		trace.dist = t->plane.dist;
+		trace.contents = t->contents;
+		trace.solid = t->allsolid | (t->startsolid << 1);
+
+		if (t->surface){
+			Q_strncpyz(trace.surface, t->surface->name, sizeof(trace.surface));
+			trace.surfaceFlags = t->surface->flags;
+			trace.surfaceValue = t->surface->value;
+		}
+
+		return Com_BlockChecksum(&trace, sizeof(trace));
+	}
+}
+
+/*
+ =================
+ CM_BrushCountPercentile
+ =================
+*/
+static int CM_BrushCountPercentile (const benchStats_t *stats, float fraction){
+
+	int		count = 0, target;
+	int		i;
+
+	target = (int)(stats->numQueries * fraction);
+
+	for (i = 0; i < BENCH_BRUSH_COUNTS; i++){
+		count += stats->brushCounts[i];
+		if (count > target)
+			return i;
+	}
+
+	return stats->maxBrushTests;
+}
+
+/*
+ =================
+ CM_PrintBenchStats
+ =================
+*/
+static void CM_PrintBenchStats (benchTest_t test, const benchStats_t *stats){
+
+	char	line[MAX_STRING_CHARS];
+	int		low, high, count;
+	int		i;
+
+	Com_Printf("%-18s %8i queries, %10.0f/sec scattered, %10.0f/sec coherent\n", cm_benchTestNames[test], stats->numQueries, stats->numQueries / stats->scatteredTime, stats->numQueries / stats->coherentTime);
+
+	if (test == BENCH_BOX_LEAFS)
+		Com_Printf("%-18s %.2f leafs per query\n", "", stats->totalLeafs / stats->numQueries);
+	else if (test != BENCH_POINT_CONTENTS){
+		Com_Printf("%-18s brushes tested: mean %.2f, 50%% %i, 90%% %i, 99%% %i, max %i, %.2f avoided by bounds\n", "", stats->totalBrushTests / stats->numQueries, CM_BrushCountPercentile(stats, 0.5f), CM_BrushCountPercentile(stats, 0.9f), CM_BrushCountPercentile(stats, 0.99f), stats->maxBrushTests, stats->totalBrushesAvoided / stats->numQueries);
+
+		// Grouped by powers of two
+		line[0] = 0;
+
+		for (low = 0; low <= BENCH_BRUSH_COUNTS; low = high + 1){
+			if (low < 2 || low == BENCH_BRUSH_COUNTS)
+				high = low;
+			else
+				high = (low << 1) - 1;
+
+			for (i = low, count = 0; i <= high; i++)
+				count += stats->brushCounts[i];
+
+			if (!count)
+				continue;
+
+			if (low == BENCH_BRUSH_COUNTS)
+				Q_strncatz(line, va(" %i+: %.1f%%", low, count * 100.0f / stats->numQueries), sizeof(line));
+			else if (low == high)
+				Q_strncatz(line, va(" %i: %.1f%%", low, count * 100.0f / stats->numQueries), sizeof(line));
+			else
+				Q_strncatz(line, va(" %i-%i: %.1f%%", low, high, count * 100.0f / stats->numQueries), sizeof(line));
+		}
+
+		Com_Printf("%-18s%s\n", "", line);
+	}
+
+	if (stats->orderDiffs)
+		Com_Printf(S_COLOR_RED "%-18s %i results changed with the query order\n", "", stats->orderDiffs);
+}
+
+/*
+ =================
+ CM_CollisionBenchmark_f
+ =================
+*/
+void CM_CollisionBenchmark_f (void){
+
+	benchStats_t	*stats, allStats[MAX_BENCH_TESTS];
+	benchQuery_t	*queries;
+	benchResult_t	*results, *coherentResults;
+	cmodel_t		*world;
+	fileHandle_t	f = 0;
+	char			mapName[MAX_QPATH], goldenName[MAX_OSPATH];
+	qboolean		writeGolden = false;
+	unsigned		checksum, seed, querySeed;
+	unsigned		hash, goldenHashes[BENCH_BATCH], header[6];
+	double			time;
+	int				numQueries, numModels, batch, batchSize;
+	int				*order, totalDiffs = 0, shownDiffs = 0;
+	int				numGolden = 0;
+	benchTest_t		test;
+	int				i;
+
+	if (Cmd_Argc() < 2 || Cmd_Argc() > 5){
+		Com_Printf("Usage: collisionBenchmark <map> [queries] [seed] [golden]\n");
+		return;
+	}
+
+	if (Com_ServerState()){
+		Com_Printf("Can't run a collision benchmark while a server is running\n");
+		return;
+	}
+
+	Q_snprintfz(mapName, sizeof(mapName), "maps/%s", Cmd_Argv(1));
+	Com_DefaultExtension(mapName, sizeof(mapName), ".bsp");
+
+	if (!FS_FileExists(mapName)){
+		Com_Printf("Can't find %s\n", mapName);
+		return;
+	}
+
+	if (Cmd_Argc() > 2)
+		numQueries = atoi(Cmd_Argv(2));
+	else
+		numQueries = 1000000;
+
+	if (numQueries < 1){
+		Com_Printf("Must run at least one query\n");
+		return;
+	}
+
+	if (Cmd_Argc() > 3)
+		seed = strtoul(Cmd_Argv(3), NULL, 10);
+	else
+		seed = 1;
+
+	world = CM_LoadMap(mapName, false, &checksum);
+	numModels = CM_NumInlineModels();
+
+	header[0] = BENCH_IDENT;
+	header[1] = BENCH_VERSION;
+	header[2] = checksum;
+	header[3] = seed;
+	header[4] = numQueries;
+	header[5] = MAX_BENCH_TESTS;
+
+	// Compare with the golden file, or write it if there isn't one yet
+	if (Cmd_Argc() > 4){
+		Q_snprintfz(goldenName, sizeof(goldenName), "benchmarks/%s", Cmd_Argv(4));
+		Com_DefaultExtension(goldenName, sizeof(goldenName), BENCH_EXTENSION);
+
+		if (FS_OpenFile(goldenName, &f, FS_READ) == -1){
+			FS_OpenFile(goldenName, &f, FS_WRITE);
+			if (!f){
+				Com_Printf("Couldn't write %s\n", goldenName);
+				CM_UnloadMap();
+				return;
+			}
+
+			writeGolden = true;
+
+			for (i = 0; i < 6; i++)
+				header[i] = LittleLong(header[i]);
+
+			FS_Write(header, sizeof(header), f);
+		}
+		else {
+			if (FS_Read(goldenHashes, sizeof(header), f) != sizeof(header))
+				i = 0;
+			else {
+				for (i = 0; i < 6; i++){
+					if (LittleLong(goldenHashes[i]) != header[i])
+						break;
+				}
+			}
+
+			if (i != 6){
+				FS_CloseFile(f);
+				CM_UnloadMap();
+
+				Com_Error(ERR_FATAL, "%s was made with a different map, seed, query count or version", goldenName);
+			}
+		}
+	}
+
+	Com_Printf("Running %i collision queries of each kind on %s (seed %u)\n", numQueries, mapName, seed);
+
+	queries = Z_Malloc(BENCH_BATCH * sizeof(benchQuery_t));
+	results = Z_Malloc(BENCH_BATCH * sizeof(benchResult_t));
+	coherentResults = Z_Malloc(BENCH_BATCH * sizeof(benchResult_t));
+	order = Z_Malloc(BENCH_BATCH * sizeof(int));
+
+	memset(allStats, 0, sizeof(allStats));
+
+	for (test = 0; test < MAX_BENCH_TESTS; test++){
+		traceContext_t	ctx;
+
+		stats = &allStats[test];
+
+		if (test == BENCH_TRANSFORMED_TRACE && numModels < 2){
+			Com_Printf("%-18s skipped, %s has no inline models\n", cm_benchTestNames[test], mapName);
+
+			// Keep the golden file in step
+			for (batch = 0; batch < numQueries; batch += BENCH_BATCH){
+				batchSize = min(numQueries - batch, BENCH_BATCH);
+
+				if (writeGolden){
+					memset(goldenHashes, 0, batchSize * sizeof(unsigned));
+					FS_Write(goldenHashes, batchSize * sizeof(unsigned), f);
+				}
+				else if (f)
+					FS_Read(goldenHashes, batchSize * sizeof(unsigned), f);
+			}
+
+			continue;
+		}
+
+		memset(&ctx, 0, sizeof(traceContext_t));
+
+		// Each kind has its own queries, whatever the others are
+		querySeed = seed + test * 7919;
+
+		for (batch = 0; batch < numQueries; batch += BENCH_BATCH){
+			batchSize = min(numQueries - batch, BENCH_BATCH);
+
+			for (i = 0; i < batchSize; i++){
+				CM_MakeBenchQuery(test, &queries[i], &querySeed, world, numModels);
+
+				order[i] = i;
+			}
+
+			cm_benchSortQueries = queries;
+			qsort(order, batchSize, sizeof(int), CM_SortBenchQueries);
+
+			// Scattered over the map
+			time = Sys_GetClockTicks();
+
+			for (i = 0; i < batchSize; i++)
+				CM_RunBenchQuery(&ctx, test, &queries[i], &results[i]);
+
+			stats->scatteredTime += Sys_GetClockTicks() - time;
+
+			// Sorted by location
+			time = Sys_GetClockTicks();
+
+			for (i = 0; i < batchSize; i++)
+				CM_RunBenchQuery(&ctx, test, &queries[order[i]], &coherentResults[order[i]]);
+
+			stats->coherentTime += Sys_GetClockTicks() - time;
+
+			// A golden file that ends early counts the missing results as
+			// differences
+			if (f && !writeGolden)
+				numGolden = FS_Read(goldenHashes, batchSize * sizeof(unsigned), f) / sizeof(unsigned);
+
+			for (i = 0; i < batchSize; i++){
+				hash = CM_HashBenchResult(test, &results[i]);
+
+				if (hash != CM_HashBenchResult(test, &coherentResults[i]))
+					stats->orderDiffs++;
+
+				stats->brushCounts[min(results[i].brushTests, BENCH_BRUSH_COUNTS)]++;
+				stats->maxBrushTests = max(stats->maxBrushTests, results[i].brushTests);
+				stats->totalBrushTests += results[i].brushTests;
+				stats->totalBrushesAvoided += results[i].brushesAvoided;
+				stats->totalLeafs += results[i].numLeafs;
+
+				if (writeGolden)
+					goldenHashes[i] = LittleLong(hash);
+				else if (f && (i >= numGolden || hash != LittleLong(goldenHashes[i]))){
+					stats->goldenDiffs++;
+
+					if (shownDiffs++ < BENCH_SHOW_DIFFS)
+						Com_Printf(S_COLOR_RED "%s %i differs: start (%g %g %g) end (%g %g %g)\n", cm_benchTestNames[test], batch + i, queries[i].start[0], queries[i].start[1], queries[i].start[2], queries[i].end[0], queries[i].end[1], queries[i].end[2]);
+				}
+			}
+
+			if (writeGolden)
+				FS_Write(goldenHashes, batchSize * sizeof(unsigned), f);
+		}
+
+		stats->numQueries = numQueries;
+
+		CM_FreeTraceContext(&ctx);
+
+		CM_PrintBenchStats(test, stats);
+	}
+
+	Z_Free(queries);
+	Z_Free(results);
+	Z_Free(coherentResults);
+	Z_Free(order);
+
+	CM_UnloadMap();
+
+	if (f){
+		FS_CloseFile(f);
+
+		if (writeGolden)
+			Com_Printf("Wrote golden results to %s\n", goldenName);
+		else {
+			for (test = 0; test < MAX_BENCH_TESTS; test++){
+				if (allStats[test].goldenDiffs)
+					Com_Printf(S_COLOR_RED "%s: %i of %i results differ from the golden run\n", cm_benchTestNames[test], allStats[test].goldenDiffs, numQueries);
+
+				totalDiffs += allStats[test].goldenDiffs;
+			}
+
+			// Exit with an error, so scripts can tell the run failed
+			if (totalDiffs)
+				Com_Error(ERR_FATAL, "Collision results differ from %s", goldenName);
+
+			Com_Printf("Collision results match %s\n", goldenName);
+		}
+	}
+}
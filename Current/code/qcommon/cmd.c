@@ -79,13 +79,19 @@ void Cbuf_AddText (const char *text){
 	if (len == 0)
 		return;
 
+	Com_Lock();
+
 	if (cmd_text.size + len >= CBUF_SIZE){
+		Com_Unlock();
+
 		Com_Printf("Cbuf_AddText: overflow\n");
 		return;
 	}
 
 	memcpy(cmd_text.buffer + cmd_text.size, text, len);
 	cmd_text.size += len;
+
+	Com_Unlock();
 }
 
 /*
@@ -104,7 +110,11 @@ void Cbuf_InsertText (const char *text){
 	if (len == 1)
 		return;
 
+	Com_Lock();
+
 	if (cmd_text.size + len >= CBUF_SIZE){
+		Com_Unlock();
+
 		Com_Printf("Cbuf_InsertText: overflow\n");
 		return;
 	}
@@ -119,6 +129,8 @@ void Cbuf_InsertText (const char *text){
 
 	// Add a \n
 	cmd_text.buffer[len-1] = '\n';
+
+	Com_Unlock();
 }
 
 /*
@@ -168,6 +180,8 @@ void Cbuf_Execute (void){
 			break;
 		}
 
+		Com_Lock();
+
 		// Find a \n  or ; line break
 		text = cmd_text.buffer;
 
@@ -198,6 +212,8 @@ void Cbuf_Execute (void){
 			memmove(text, text+i, cmd_text.size);
 		}
 
+		Com_Unlock();
+
 		// Execute the command line
 		Cmd_ExecuteString(line);
 	}
@@ -24,6 +24,42 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "qcommon.h"
 
+#if defined _M_X64 || defined __x86_64__ || defined __SSE__ || (defined _M_IX86_FP && _M_IX86_FP >= 1)
+#define CM_SSE					1
+#include <xmmintrin.h>
+#else
+#define CM_SSE					0
+#endif
+
+#if CM_SSE && defined __GNUC__
+#define CM_AVX					1
+#include <immintrin.h>
+#else
+#define CM_AVX					0
+#endif
+
+// Brush sides are also stored as packed planes in groups of eight, with
+// the normals and distances in separate arrays for the clipping kernels
+#define PACKED_GROUP_SIDES		8
+#define PACKED_GROUP_FLOATS		(PACKED_GROUP_SIDES * 4)
+#define MAX_PACKED_SIDES		32
+
+#define PACKED_PAD_DIST			1e30f	// Padding sides are never crossed
+
+// Leafs with many brushes keep their brushes in a tree of bounding boxes,
+// smaller leafs just check the bounds of each brush in order
+#define LEAF_TREE_MIN_BRUSHES	16
+#define BRUSH_NODE_BRUSHES		4
+#define MAX_BRUSH_TREE_DEPTH	64
+
+#define BRUSH_BOUNDS_UNKNOWN	999999	// For brushes without a single vertex
+
+typedef enum {
+	CLIP_KERNEL_SCALAR,
+	CLIP_KERNEL_SSE,
+	CLIP_KERNEL_AVX
+} clipKernelType_t;
+
 
 typedef struct {					// Used internally due to name len probs
 	char			name[32];
@@ -41,15 +77,30 @@ typedef struct {
 	int				area;
 	unsigned short	firstLeafBrush;
 	unsigned short	numLeafBrushes;
+
+	int				brushNode;			// Root of the brush tree, -1 if scanned in order
 } cleaf_t;
 
 typedef struct {
 	int				contents;
 	int				numSides;
 	int				firstBrushSide;
-	int				checkCount;		// To avoid repeated testings
+
+	int				firstPackedPlane;	// Float offset in packedPlanes
+	int				numPackedGroups;	// 0 if not packed
+
+	vec3_t			mins;
+	vec3_t			maxs;
 } cbrush_t;
 
+typedef struct {
+	vec3_t			mins;
+	vec3_t			maxs;
+	int				children[2];
+	int				firstBrush;			// Index in treeBrushes
+	int				numBrushes;			// 0 for inner nodes
+} cbrushnode_t;
+
 typedef struct {
 	cplane_t		*plane;
 	cmapsurface_t	*surface;
@@ -99,6 +150,16 @@ typedef struct {
 	int				numBrushSides;
 	cbrushside_t	*brushSides;
 
+	int				numPackedPlanes;
+	float			*packedPlanes;
+
+	int				numBrushNodes;
+	cbrushnode_t	*brushNodes;
+
+	int				numTreeBrushes;
+	unsigned short	*treeBrushes;		// Brush indices local to each leaf
+	int				numLeafBrushBits;	// Words needed to mark the brushes of any leaf
+
 	int				numNodes;
 	cnode_t			*nodes;
 
@@ -113,6 +174,11 @@ typedef struct {
 
 	int				numEntityChars;
 	char			*entityString;
+
+	int				visRowSize;		// Rounded up to a multiple of 4 bytes
+	int				numVisCacheRows;	// For each of PVS and PHS
+	int				*visCacheClusters;	// [2][numVisCacheRows], -1 if empty
+	byte			*visCache;			// [2][numVisCacheRows][visRowSize]
 } cm_t;
 
 static cm_t				cm;
@@ -120,14 +186,23 @@ static cm_t				cm;
 static cmapsurface_t	cm_nullSurface;
 static cmodel_t			cm_nullModel;
 
-// For statistics
-static int				cm_traces;
-static int				cm_pointContents;
+static int				cm_mapSequence;			// Changes with every map loaded
+
+static traceContext_t	cm_defaultContext;		// For the entry points without a context
+static traceContext_t	*cm_traceContexts;		// For statistics
 
 cvar_t					*cm_noAreas;
 cvar_t					*cm_showTrace;
-
+cvar_t					*cm_visCacheSize;
+cvar_t					*cm_clipKernel;
+
+static void	CM_PackBrushes (void);
+static void	CM_BoundBrushes (void);
+static void	CM_BuildLeafBrushTrees (void);
+static void	CM_SelectClipKernel (void);
+static void	CM_TestClipKernels_f (void);
 static void	CM_InitBoxHull (void);
+static void	CM_InitVisCache (void);
 static void	CM_FloodAreaConnections (qboolean clear);
 
 
@@ -326,7 +401,6 @@ static void CM_LoadBrushes (const byte *data, const lump_t *l){
 		out->contents = LittleLong(in->contents);
 		out->numSides = LittleLong(in->numSides);
 		out->firstBrushSide = LittleLong(in->firstSide);
-		out->checkCount = 0;
 	}
 }
 
@@ -360,6 +434,289 @@ static void CM_LoadBrushSides (const byte *data, const lump_t *l){
 	}
 }
 
+/*
+ =================
+ CM_PackBrushes
+
+ Stores the sides of every brush as packed planes for the clipping
+ kernels. Brushes with too many sides are left to the scalar code.
+ =================
+*/
+static void CM_PackBrushes (void){
+
+	cbrush_t	*brush;
+	cplane_t	*plane;
+	float		*out;
+	int			i, j, side;
+
+	cm.numPackedPlanes = 0;
+
+	for (i = 0, brush = cm.brushes; i < cm.numBrushes; i++, brush++){
+		if (!brush->numSides || brush->numSides > MAX_PACKED_SIDES){
+			brush->firstPackedPlane = 0;
+			brush->numPackedGroups = 0;
+			continue;
+		}
+
+		brush->firstPackedPlane = cm.numPackedPlanes;
+		brush->numPackedGroups = (brush->numSides + PACKED_GROUP_SIDES-1) / PACKED_GROUP_SIDES;
+
+		cm.numPackedPlanes += brush->numPackedGroups * PACKED_GROUP_FLOATS;
+	}
+
+	cm.packedPlanes = Z_Malloc(cm.numPackedPlanes * sizeof(float));
+
+	for (i = 0, brush = cm.brushes; i < cm.numBrushes; i++, brush++){
+		out = cm.packedPlanes + brush->firstPackedPlane;
+
+		for (j = 0; j < brush->numPackedGroups * PACKED_GROUP_SIDES; j++){
+			side = j % PACKED_GROUP_SIDES;
+
+			if (j >= brush->numSides){
+				out[side] = 0;
+				out[side+PACKED_GROUP_SIDES] = 0;
+				out[side+PACKED_GROUP_SIDES*2] = 0;
+				out[side+PACKED_GROUP_SIDES*3] = PACKED_PAD_DIST;
+			}
+			else {
+				plane = cm.brushSides[brush->firstBrushSide+j].plane;
+
+				out[side] = plane->normal[0];
+				out[side+PACKED_GROUP_SIDES] = plane->normal[1];
+				out[side+PACKED_GROUP_SIDES*2] = plane->normal[2];
+				out[side+PACKED_GROUP_SIDES*3] = plane->dist;
+			}
+
+			if (side == PACKED_GROUP_SIDES-1)
+				out += PACKED_GROUP_FLOATS;
+		}
+	}
+}
+
+/*
+ =================
+ CM_BoundBrushes
+
+ Finds the bounds of every brush. The axial sides give the bounds
+ directly, any missing ones are found from the corners of the brush.
+ =================
+*/
+static void CM_BoundBrushes (void){
+
+	cbrush_t	*brush;
+	cplane_t	*plane, *p1, *p2, *p3;
+	vec3_t		mins, maxs, corner, dir;
+	float		denom;
+	qboolean	found[2][3];
+	int			i, j, k, l, m;
+
+	for (i = 0, brush = cm.brushes; i < cm.numBrushes; i++, brush++){
+		memset(found, 0, sizeof(found));
+
+		VectorSet(brush->mins, -BRUSH_BOUNDS_UNKNOWN, -BRUSH_BOUNDS_UNKNOWN, -BRUSH_BOUNDS_UNKNOWN);
+		VectorSet(brush->maxs, BRUSH_BOUNDS_UNKNOWN, BRUSH_BOUNDS_UNKNOWN, BRUSH_BOUNDS_UNKNOWN);
+
+		for (j = 0; j < brush->numSides; j++){
+			plane = cm.brushSides[brush->firstBrushSide+j].plane;
+
+			for (k = 0; k < 3; k++){
+				if (plane->normal[k] == 1 && (!found[1][k] || plane->dist < brush->maxs[k])){
+					brush->maxs[k] = plane->dist;
+					found[1][k] = true;
+				}
+				else if (plane->normal[k] == -1 && (!found[0][k] || -plane->dist > brush->mins[k])){
+					brush->mins[k] = -plane->dist;
+					found[0][k] = true;
+				}
+			}
+		}
+
+		if (found[0][0] && found[0][1] && found[0][2] && found[1][0] && found[1][1] && found[1][2])
+			continue;
+
+		// Intersect every three sides and keep the corners inside the brush
+		ClearBounds(mins, maxs);
+
+		for (j = 0; j < brush->numSides; j++){
+			p1 = cm.brushSides[brush->firstBrushSide+j].plane;
+
+			for (k = j+1; k < brush->numSides; k++){
+				p2 = cm.brushSides[brush->firstBrushSide+k].plane;
+
+				for (l = k+1; l < brush->numSides; l++){
+					p3 = cm.brushSides[brush->firstBrushSide+l].plane;
+
+					CrossProduct(p2->normal, p3->normal, dir);
+					denom = DotProduct(p1->normal, dir);
+					if (fabs(denom) < 0.0001f)
+						continue;
+
+					VectorScale(dir, p1->dist, corner);
+					CrossProduct(p3->normal, p1->normal, dir);
+					VectorMA(corner, p2->dist, dir, corner);
+					CrossProduct(p1->normal, p2->normal, dir);
+					VectorMA(corner, p3->dist, dir, corner);
+					VectorScale(corner, 1.0f / denom, corner);
+
+					for (m = 0; m < brush->numSides; m++){
+						plane = cm.brushSides[brush->firstBrushSide+m].plane;
+
+						if (DotProduct(corner, plane->normal) - plane->dist > 0.1f)
+							break;
+					}
+
+					if (m == brush->numSides)
+						AddPointToBounds(corner, mins, maxs);
+				}
+			}
+		}
+
+		if (mins[0] > maxs[0])
+			continue;		// Degenerate, never culled
+
+		for (k = 0; k < 3; k++){
+			if (!found[0][k])
+				brush->mins[k] = mins[k] - 1;
+			if (!found[1][k])
+				brush->maxs[k] = maxs[k] + 1;
+		}
+	}
+}
+
+static const unsigned short	*cm_sortLeafBrushes;
+static int					cm_sortAxis;
+
+/*
+ =================
+ CM_SortBrushesByCenter
+ =================
+*/
+static int CM_SortBrushesByCenter (const void *elem1, const void *elem2){
+
+	const cbrush_t	*brush1 = &cm.brushes[cm_sortLeafBrushes[*(const unsigned short *)elem1]];
+	const cbrush_t	*brush2 = &cm.brushes[cm_sortLeafBrushes[*(const unsigned short *)elem2]];
+	float			center1, center2;
+
+	center1 = brush1->mins[cm_sortAxis] + brush1->maxs[cm_sortAxis];
+	center2 = brush2->mins[cm_sortAxis] + brush2->maxs[cm_sortAxis];
+
+	if (center1 < center2)
+		return -1;
+	if (center1 > center2)
+		return 1;
+
+	return 0;
+}
+
+/*
+ =================
+ CM_BuildBrushNode
+
+ Builds a tree over the given brushes of a leaf, splitting them in half
+ along the axis their centers are most spread out on
+ =================
+*/
+static int CM_BuildBrushNode (const unsigned short *leafBrushes, unsigned short *brushes, int numBrushes){
+
+	cbrushnode_t	*node;
+	cbrush_t		*brush;
+	vec3_t			mins, maxs, center;
+	int				nodeNum;
+	int				i;
+
+	nodeNum = cm.numBrushNodes++;
+	node = &cm.brushNodes[nodeNum];
+
+	ClearBounds(node->mins, node->maxs);
+	ClearBounds(mins, maxs);
+
+	for (i = 0; i < numBrushes; i++){
+		brush = &cm.brushes[leafBrushes[brushes[i]]];
+
+		AddPointToBounds(brush->mins, node->mins, node->maxs);
+		AddPointToBounds(brush->maxs, node->mins, node->maxs);
+
+		VectorAdd(brush->mins, brush->maxs, center);
+		AddPointToBounds(center, mins, maxs);
+	}
+
+	if (numBrushes <= BRUSH_NODE_BRUSHES){
+		node->children[0] = node->children[1] = -1;
+		node->firstBrush = brushes - cm.treeBrushes;
+		node->numBrushes = numBrushes;
+
+		return nodeNum;
+	}
+
+	cm_sortLeafBrushes = leafBrushes;
+
+	if (maxs[0] - mins[0] >= maxs[1] - mins[1] && maxs[0] - mins[0] >= maxs[2] - mins[2])
+		cm_sortAxis = 0;
+	else if (maxs[1] - mins[1] >= maxs[2] - mins[2])
+		cm_sortAxis = 1;
+	else
+		cm_sortAxis = 2;
+
+	qsort(brushes, numBrushes, sizeof(unsigned short), CM_SortBrushesByCenter);
+
+	node->firstBrush = 0;
+	node->numBrushes = 0;
+
+	// The node pointer stays valid, all the nodes were allocated up front
+	node->children[0] = CM_BuildBrushNode(leafBrushes, brushes, numBrushes >> 1);
+	node->children[1] = CM_BuildBrushNode(leafBrushes, brushes + (numBrushes >> 1), numBrushes - (numBrushes >> 1));
+
+	return nodeNum;
+}
+
+/*
+ =================
+ CM_BuildLeafBrushTrees
+
+ Gives the leafs with many brushes a tree of brush bounds, so a trace only
+ has to look at the brushes near its move
+ =================
+*/
+static void CM_BuildLeafBrushTrees (void){
+
+	cleaf_t	*leaf;
+	int		i, j;
+
+	cm.numTreeBrushes = 0;
+	cm.numLeafBrushBits = 0;
+
+	for (i = 0, leaf = cm.leafs; i < cm.numLeafs; i++, leaf++){
+		if (leaf->numLeafBrushes < LEAF_TREE_MIN_BRUSHES)
+			continue;
+
+		cm.numTreeBrushes += leaf->numLeafBrushes;
+
+		if (cm.numLeafBrushBits < (leaf->numLeafBrushes + 31) >> 5)
+			cm.numLeafBrushBits = (leaf->numLeafBrushes + 31) >> 5;
+	}
+
+	// Never more nodes than twice the number of brushes
+	cm.numBrushNodes = 0;
+	cm.brushNodes = Z_Malloc((cm.numTreeBrushes * 2 + 1) * sizeof(cbrushnode_t));
+	cm.treeBrushes = Z_Malloc((cm.numTreeBrushes + 1) * sizeof(unsigned short));
+
+	cm.numTreeBrushes = 0;
+
+	for (i = 0, leaf = cm.leafs; i < cm.numLeafs; i++, leaf++){
+		if (leaf->numLeafBrushes < LEAF_TREE_MIN_BRUSHES){
+			leaf->brushNode = -1;
+			continue;
+		}
+
+		for (j = 0; j < leaf->numLeafBrushes; j++)
+			cm.treeBrushes[cm.numTreeBrushes+j] = j;
+
+		leaf->brushNode = CM_BuildBrushNode(cm.leafBrushes + leaf->firstLeafBrush, cm.treeBrushes + cm.numTreeBrushes, leaf->numLeafBrushes);
+
+		cm.numTreeBrushes += leaf->numLeafBrushes;
+	}
+}
+
 /*
  =================
  CM_LoadNodes
@@ -578,7 +935,12 @@ cmodel_t *CM_LoadMap (const char *map, qboolean clientLoad, unsigned *checksum){
 	FS_FreeFile(data);
 
 	// Set up some needed things
+	CM_PackBrushes();
+	CM_BoundBrushes();
+	CM_BuildLeafBrushTrees();
+	CM_SelectClipKernel();
 	CM_InitBoxHull();
+	CM_InitVisCache();
 	CM_FloodAreaConnections(true);
 
 	*checksum = cm.checksum;
@@ -608,6 +970,12 @@ void CM_UnloadMap (void){
 		Z_Free(cm.brushes);
 	if (cm.brushSides)
 		Z_Free(cm.brushSides);
+	if (cm.packedPlanes)
+		Z_Free(cm.packedPlanes);
+	if (cm.brushNodes)
+		Z_Free(cm.brushNodes);
+	if (cm.treeBrushes)
+		Z_Free(cm.treeBrushes);
 	if (cm.nodes)
 		Z_Free(cm.nodes);
 	if (cm.models)
@@ -618,6 +986,8 @@ void CM_UnloadMap (void){
 		Z_Free(cm.areaPortals);
 	if (cm.entityString)
 		Z_Free(cm.entityString);
+	if (cm.visCache)
+		Z_Free(cm.visCache);
 
 	memset(&cm, 0, sizeof(cm_t));
 }
@@ -629,8 +999,16 @@ void CM_UnloadMap (void){
 */
 void CM_ClearStats (void){
 
-	cm_traces = 0;
-	cm_pointContents = 0;
+	traceContext_t	*ctx;
+
+	Com_Lock();
+	for (ctx = cm_traceContexts; ctx; ctx = ctx->next){
+		ctx->numTraces = 0;
+		ctx->numPointContents = 0;
+		ctx->numBrushTests = 0;
+		ctx->numBrushesAvoided = 0;
+	}
+	Com_Unlock();
 }
 
 /*
@@ -640,10 +1018,23 @@ void CM_ClearStats (void){
 */
 void CM_PrintStats (void){
 
+	traceContext_t	*ctx;
+	int				traces = 0, pointContents = 0;
+	int				brushTests = 0, brushesAvoided = 0;
+
 	if (!cm_showTrace->integerValue)
 		return;
 
-	Com_Printf("%i traces, %i points\n", cm_traces, cm_pointContents);
+	Com_Lock();
+	for (ctx = cm_traceContexts; ctx; ctx = ctx->next){
+		traces += ctx->numTraces;
+		pointContents += ctx->numPointContents;
+		brushTests += ctx->numBrushTests;
+		brushesAvoided += ctx->numBrushesAvoided;
+	}
+	Com_Unlock();
+
+	Com_Printf("%i traces, %i points, %i brush tests, %i avoided by bounds\n", traces, pointContents, brushTests, brushesAvoided);
 }
 
 /*
@@ -655,6 +1046,13 @@ void CM_Init (void){
 
 	cm_noAreas = Cvar_Get("cm_noAreas", "0", CVAR_CHEAT, "Don't consider area portals");
 	cm_showTrace = Cvar_Get("cm_showTrace", "0", CVAR_CHEAT, "Report trace statistics");
+	cm_visCacheSize = Cvar_Get("cm_visCacheSize", "4096", CVAR_ARCHIVE, "Memory budget in kilobytes for decompressed PVS / PHS rows");
+	cm_clipKernel = Cvar_Get("cm_clipKernel", "2", CVAR_ARCHIVE, "Brush clipping kernel (0 = scalar, 1 = SSE, 2 = AVX), takes effect on map load");
+
+	Cmd_AddCommand("testClipKernels", CM_TestClipKernels_f, "Compare the brush clipping kernels on random traces");
+
+	if (com_dedicated->integerValue)
+		Cmd_AddCommand("collisionBenchmark", CM_CollisionBenchmark_f, "Run random collision queries on a map and compare them with a golden run");
 }
 
 
@@ -776,10 +1174,10 @@ int	CM_LeafArea (int leafNum){
 
 // =====================================================================
 
-static cplane_t	*cm_boxPlanes;
-static int		cm_boxHeadNode;
-static cbrush_t	*cm_boxBrush;
-static cleaf_t	*cm_boxLeaf;
+static cplane_t			*cm_boxPlanes;
+static int				cm_boxHeadNode;
+static cbrush_t			*cm_boxBrush;
+static cleaf_t			*cm_boxLeaf;
 
 
 /*
@@ -788,6 +1186,8 @@ static cleaf_t	*cm_boxLeaf;
 
  Set up the planes and nodes so that the six floats of a bounding box
  can just be stored out and get a proper clipping hull structure.
+ The planes in the map only give the layout of the hull, each trace
+ context has its own copy to store the box in.
  =================
 */
 static void CM_InitBoxHull (void){
@@ -805,11 +1205,16 @@ static void CM_InitBoxHull (void){
 	cm_boxBrush->numSides = 6;
 	cm_boxBrush->firstBrushSide = cm.numBrushSides;
 	cm_boxBrush->contents = CONTENTS_MONSTER;
+	cm_boxBrush->firstPackedPlane = 0;
+	cm_boxBrush->numPackedGroups = 0;		// The planes change with every box
+	VectorSet(cm_boxBrush->mins, -BRUSH_BOUNDS_UNKNOWN, -BRUSH_BOUNDS_UNKNOWN, -BRUSH_BOUNDS_UNKNOWN);
+	VectorSet(cm_boxBrush->maxs, BRUSH_BOUNDS_UNKNOWN, BRUSH_BOUNDS_UNKNOWN, BRUSH_BOUNDS_UNKNOWN);
 
 	cm_boxLeaf = &cm.leafs[cm.numLeafs];
 	cm_boxLeaf->numLeafBrushes = 1;
 	cm_boxLeaf->firstLeafBrush = cm.numLeafBrushes;
 	cm_boxLeaf->contents = CONTENTS_MONSTER;
+	cm_boxLeaf->brushNode = -1;
 
 	cm.leafBrushes[cm.numLeafBrushes] = cm.numBrushes;
 
@@ -842,42 +1247,169 @@ static void CM_InitBoxHull (void){
 		p->normal[i>>1] = -1;
 		p->type = 3;
 		p->signbits = 0;
-	}	
+	}
+
+	// Brush check counts of the previous map are stale
+	cm_mapSequence++;
 }
 
 /*
  =================
- CM_HeadNodeForBox
- 
- To keep everything totally uniform, bounding boxes are turned into 
- small BSP trees instead of being compared directly
+ CM_ContextPlane
+
+ Box hull planes are taken from the given context
  =================
 */
-int	CM_HeadNodeForBox (const vec3_t mins, const vec3_t maxs){
+static Q_INLINE cplane_t *CM_ContextPlane (traceContext_t *ctx, cplane_t *plane){
+
+	if (plane < cm_boxPlanes)
+		return plane;
+
+	return &ctx->boxPlanes[plane - cm_boxPlanes];
+}
+
+/*
+ =================
+ CM_PrepareContext
+
+ Makes sure the given context has brush check counts and leaf brush bits
+ for the current map and is counted in the statistics
+ =================
+*/
+static void CM_PrepareContext (traceContext_t *ctx){
+
+	int		i;
+
+	if (!ctx->registered){
+		Com_Lock();
+		ctx->next = cm_traceContexts;
+		cm_traceContexts = ctx;
+		ctx->registered = true;
+		Com_Unlock();
+
+		// The box planes keep their layout, only the distances change
+		for (i = 0; i < 12; i++){
+			VectorClear(ctx->boxPlanes[i].normal);
+			ctx->boxPlanes[i].normal[i>>2] = (i & 1) ? -1 : 1;
+			ctx->boxPlanes[i].type = (i & 1) ? 3 : i>>2;
+			ctx->boxPlanes[i].signbits = 0;
+		}
+	}
+
+	if (ctx->mapSequence == cm_mapSequence)
+		return;
+
+	ctx->mapSequence = cm_mapSequence;
+
+	if (ctx->numBrushCheckCounts < cm.numBrushes + 1){
+		if (ctx->brushCheckCounts)
+			Z_Free(ctx->brushCheckCounts);
+
+		ctx->numBrushCheckCounts = cm.numBrushes + 1;
+		ctx->brushCheckCounts = Z_Malloc(ctx->numBrushCheckCounts * sizeof(int));
+	}
+
+	memset(ctx->brushCheckCounts, 0, ctx->numBrushCheckCounts * sizeof(int));
+	ctx->checkCount = 0;
+
+	if (ctx->numLeafBrushBits < cm.numLeafBrushBits){
+		if (ctx->leafBrushBits)
+			Z_Free(ctx->leafBrushBits);
+
+		ctx->numLeafBrushBits = cm.numLeafBrushBits;
+		ctx->leafBrushBits = Z_Malloc(ctx->numLeafBrushBits * sizeof(unsigned));
+	}
+}
+
+/*
+ =================
+ CM_FreeTraceContext
+ =================
+*/
+void CM_FreeTraceContext (traceContext_t *ctx){
+
+	traceContext_t	**prev;
+
+	if (ctx->registered){
+		Com_Lock();
+		for (prev = &cm_traceContexts; *prev; prev = &(*prev)->next){
+			if (*prev == ctx){
+				*prev = ctx->next;
+				break;
+			}
+		}
+		Com_Unlock();
+	}
+
+	if (ctx->brushCheckCounts)
+		Z_Free(ctx->brushCheckCounts);
+	if (ctx->leafBrushBits)
+		Z_Free(ctx->leafBrushBits);
+
+	memset(ctx, 0, sizeof(traceContext_t));
+}
+
+/*
+ =================
+ CM_HeadNodeForBoxEx
+
+ To keep everything totally uniform, bounding boxes are turned into
+ small BSP trees instead of being compared directly.
+ The hull is stored in the given context, and the returned head node is
+ only valid with it until the next call.
+ =================
+*/
+int CM_HeadNodeForBoxEx (traceContext_t *ctx, const vec3_t mins, const vec3_t maxs){
 
-	cm_boxPlanes[0].dist = maxs[0];
-	cm_boxPlanes[1].dist = -maxs[0];
-	cm_boxPlanes[2].dist = mins[0];
-	cm_boxPlanes[3].dist = -mins[0];
-	cm_boxPlanes[4].dist = maxs[1];
-	cm_boxPlanes[5].dist = -maxs[1];
-	cm_boxPlanes[6].dist = mins[1];
-	cm_boxPlanes[7].dist = -mins[1];
-	cm_boxPlanes[8].dist = maxs[2];
-	cm_boxPlanes[9].dist = -maxs[2];
-	cm_boxPlanes[10].dist = mins[2];
-	cm_boxPlanes[11].dist = -mins[2];
+	cplane_t	*planes = ctx->boxPlanes;
+
+	CM_PrepareContext(ctx);
+
+	planes[0].dist = maxs[0];
+	planes[1].dist = -maxs[0];
+	planes[2].dist = mins[0];
+	planes[3].dist = -mins[0];
+	planes[4].dist = maxs[1];
+	planes[5].dist = -maxs[1];
+	planes[6].dist = mins[1];
+	planes[7].dist = -mins[1];
+	planes[8].dist = maxs[2];
+	planes[9].dist = -maxs[2];
+	planes[10].dist = mins[2];
+	planes[11].dist = -mins[2];
+
+	VectorCopy(mins, ctx->boxMins);
+	VectorCopy(maxs, ctx->boxMaxs);
 
 	return cm_boxHeadNode;
 }
 
+/*
+ =================
+ CM_HeadNodeForBox
+
+ Uses the shared context, so callers that may run on the local server
+ thread must hold Com_Lock until they are done with the hull
+ =================
+*/
+int	CM_HeadNodeForBox (const vec3_t mins, const vec3_t maxs){
+
+	return CM_HeadNodeForBoxEx(&cm_defaultContext, mins, maxs);
+}
+
 
 // =====================================================================
 
-static int		cm_leafCount, cm_leafMaxCount;
-static int		*cm_leafList;
-static vec3_t	cm_leafMins, cm_leafMaxs;
-static int		cm_leafTopNode;
+typedef struct {
+	traceContext_t	*ctx;
+
+	int				count;
+	int				maxCount;
+	int				*list;
+	vec3_t			mins;
+	vec3_t			maxs;
+	int				topNode;
+} leafList_t;
 
 
 /*
@@ -887,7 +1419,7 @@ static int		cm_leafTopNode;
  Fills in a list of all the leafs touched
  =================
 */
-static void CM_RecursiveBoxLeafNums (int nodeNum){
+static void CM_RecursiveBoxLeafNums (leafList_t *ll, int nodeNum){
 
 	cnode_t		*node;
 	cplane_t	*plane;
@@ -895,17 +1427,17 @@ static void CM_RecursiveBoxLeafNums (int nodeNum){
 
 	while (1){
 		if (nodeNum < 0){
-			if (cm_leafCount >= cm_leafMaxCount)
+			if (ll->count >= ll->maxCount)
 				return;
-			
-			cm_leafList[cm_leafCount++] = -1 - nodeNum;
+
+			ll->list[ll->count++] = -1 - nodeNum;
 			return;
 		}
-	
+
 		node = &cm.nodes[nodeNum];
-		plane = node->plane;
+		plane = CM_ContextPlane(ll->ctx, node->plane);
 
-		side = BoxOnPlaneSide(cm_leafMins, cm_leafMaxs, plane);
+		side = BoxOnPlaneSide(ll->mins, ll->maxs, plane);
 
 		if (side == SIDE_FRONT)
 			nodeNum = node->children[0];
@@ -913,10 +1445,10 @@ static void CM_RecursiveBoxLeafNums (int nodeNum){
 			nodeNum = node->children[1];
 		else {
 			// Go down both
-			if (cm_leafTopNode == -1)
-				cm_leafTopNode = nodeNum;
-		
-			CM_RecursiveBoxLeafNums(node->children[0]);
+			if (ll->topNode == -1)
+				ll->topNode = nodeNum;
+
+			CM_RecursiveBoxLeafNums(ll, node->children[0]);
 			nodeNum = node->children[1];
 		}
 	}
@@ -927,21 +1459,24 @@ static void CM_RecursiveBoxLeafNums (int nodeNum){
  CM_BoxLeafNumsHeadNode
  =================
 */
-static int CM_BoxLeafNumsHeadNode (const vec3_t mins, const vec3_t maxs, int *list, int listSize, int headNode, int *topNode){
+static int CM_BoxLeafNumsHeadNode (traceContext_t *ctx, const vec3_t mins, const vec3_t maxs, int *list, int listSize, int headNode, int *topNode){
 
-	cm_leafList = list;
-	cm_leafCount = 0;
-	cm_leafMaxCount = listSize;
-	VectorCopy(mins, cm_leafMins);
-	VectorCopy(maxs, cm_leafMaxs);
-	cm_leafTopNode = -1;
+	leafList_t	ll;
 
-	CM_RecursiveBoxLeafNums(headNode);
+	ll.ctx = ctx;
+	ll.list = list;
+	ll.count = 0;
+	ll.maxCount = listSize;
+	VectorCopy(mins, ll.mins);
+	VectorCopy(maxs, ll.maxs);
+	ll.topNode = -1;
+
+	CM_RecursiveBoxLeafNums(&ll, headNode);
 
 	if (topNode)
-		*topNode = cm_leafTopNode;
+		*topNode = ll.topNode;
 
-	return cm_leafCount;
+	return ll.count;
 }
 
 /*
@@ -954,7 +1489,7 @@ int	CM_BoxLeafNums (const vec3_t mins, const vec3_t maxs, int *list, int listSiz
 	if (!cm.loaded)
 		return 0;
 
-	return CM_BoxLeafNumsHeadNode(mins, maxs, list, listSize, cm.models[0].headNode, topNode);
+	return CM_BoxLeafNumsHeadNode(NULL, mins, maxs, list, listSize, cm.models[0].headNode, topNode);
 }
 
 /*
@@ -962,17 +1497,15 @@ int	CM_BoxLeafNums (const vec3_t mins, const vec3_t maxs, int *list, int listSiz
  CM_RecursivePointLeafNum
  =================
 */
-static int CM_RecursivePointLeafNum (const vec3_t p, int nodeNum){
+static int CM_RecursivePointLeafNum (traceContext_t *ctx, const vec3_t p, int nodeNum){
 
 	cnode_t		*node;
 	int			side;
 
-	cm_pointContents++;		// Optimize counter
-
 	while (nodeNum >= 0){
 		node = &cm.nodes[nodeNum];
 
-		side = PointOnPlaneSide(p, 0.0, node->plane);
+		side = PointOnPlaneSide(p, 0.0, CM_ContextPlane(ctx, node->plane));
 
 		if (side == SIDE_BACK)
 			nodeNum = node->children[1];
@@ -992,40 +1525,43 @@ int CM_PointLeafNum (const vec3_t p){
 
 	if (!cm.loaded)
 		return 0;
-	
-	return CM_RecursivePointLeafNum(p, 0);
+
+	return CM_RecursivePointLeafNum(NULL, p, 0);
 }
 
 /*
  =================
- CM_PointContents
+ CM_PointContentsEx
  =================
 */
-int CM_PointContents (const vec3_t p, int headNode){
+int CM_PointContentsEx (traceContext_t *ctx, const vec3_t p, int headNode){
 
 	int		l;
 
 	if (!cm.loaded)
 		return 0;
 
-	l = CM_RecursivePointLeafNum(p, headNode);
+	CM_PrepareContext(ctx);
+
+	ctx->numPointContents++;	// Optimize counter
+
+	l = CM_RecursivePointLeafNum(ctx, p, headNode);
 
 	return cm.leafs[l].contents;
 }
 
 /*
  =================
- CM_TransformedPointContents
+ CM_TransformedPointContentsEx
 
  Handles offseting and rotation of the point for moving and rotating
  entities
  =================
 */
-int	CM_TransformedPointContents (const vec3_t p, int headNode, const vec3_t origin, const vec3_t angles){
+int	CM_TransformedPointContentsEx (traceContext_t *ctx, const vec3_t p, int headNode, const vec3_t origin, const vec3_t angles){
 
 	vec3_t	p2, temp;
 	vec3_t	axis[3];
-	int		l;
 
 	if (!cm.loaded)
 		return 0;
@@ -1039,9 +1575,39 @@ int	CM_TransformedPointContents (const vec3_t p, int headNode, const vec3_t orig
 	else
 		VectorSubtract(p, origin, p2);
 
-	l = CM_RecursivePointLeafNum(p2, headNode);
+	return CM_PointContentsEx(ctx, p2, headNode);
+}
+
+/*
+ =================
+ CM_PointContents
+ =================
+*/
+int CM_PointContents (const vec3_t p, int headNode){
 
-	return cm.leafs[l].contents;
+	int		contents;
+
+	Com_Lock();
+	contents = CM_PointContentsEx(&cm_defaultContext, p, headNode);
+	Com_Unlock();
+
+	return contents;
+}
+
+/*
+ =================
+ CM_TransformedPointContents
+ =================
+*/
+int	CM_TransformedPointContents (const vec3_t p, int headNode, const vec3_t origin, const vec3_t angles){
+
+	int		contents;
+
+	Com_Lock();
+	contents = CM_TransformedPointContentsEx(&cm_defaultContext, p, headNode, origin, angles);
+	Com_Unlock();
+
+	return contents;
 }
 
 
@@ -1056,32 +1622,511 @@ int	CM_TransformedPointContents (const vec3_t p, int headNode, const vec3_t orig
 // 1/32 epsilon to keep floating point happy
 #define	DIST_EPSILON	0.03125
 
-static vec3_t	cm_traceStart, cm_traceEnd;
-static vec3_t	cm_traceMins, cm_traceMaxs;
-static vec3_t	cm_traceExtents;
+// Results of the brush clipping kernels
+#define CLIP_START_OUT			1		// Start point is in front of a side
+#define CLIP_GET_OUT			2		// End point is in front of a side
+#define CLIP_MISS				4		// Completely in front of a side
+
+typedef int (*clipKernel_t)(const float *planes, int numGroups, const float *mins, const float *maxs, const float *p1, const float *p2, float *d1, float *d2, unsigned *cross);
+
+// The state of a single trace, kept on the stack of the caller
+typedef struct {
+	traceContext_t	*ctx;
+
+	vec3_t			start;
+	vec3_t			end;
+	vec3_t			mins;
+	vec3_t			maxs;
+	vec3_t			extents;
+
+	vec3_t			moveMins;		// Bounds of the whole move, for culling brushes
+	vec3_t			moveMaxs;
+
+	trace_t			trace;
+	int				contents;
+	qboolean		isPoint;		// Optimized case
+
+	int				checkCount;
+	int				*brushCheckCounts;
+
+	clipKernel_t	clipKernel;		// NULL clips brush sides one at a time
+} traceWork_t;
 
-static trace_t	cm_trace;
-static int		cm_traceContents;
-static qboolean	cm_traceIsPoint;		// Optimized case
+static clipKernel_t		cm_clipKernelFunc;
 
-static int		cm_traceCheckCount;
+
+#if CM_SSE
 
 /*
  =================
- CM_ClipBoxToBrush
+ CM_ClipKernelSSE
+
+ Finds the distances of the start and end points to the packed sides of a
+ brush, with the planes pushed out for the box, four sides at a time.
+ The sides crossed by the move are returned in the cross mask.
+ =================
+*/
+static int CM_ClipKernelSSE (const float *planes, int numGroups, const float *mins, const float *maxs, const float *p1, const float *p2, float *d1, float *d2, unsigned *cross){
+
+	__m128		minsX = _mm_set1_ps(mins[0]), minsY = _mm_set1_ps(mins[1]), minsZ = _mm_set1_ps(mins[2]);
+	__m128		maxsX = _mm_set1_ps(maxs[0]), maxsY = _mm_set1_ps(maxs[1]), maxsZ = _mm_set1_ps(maxs[2]);
+	__m128		p1X = _mm_set1_ps(p1[0]), p1Y = _mm_set1_ps(p1[1]), p1Z = _mm_set1_ps(p1[2]);
+	__m128		p2X = _mm_set1_ps(p2[0]), p2Y = _mm_set1_ps(p2[1]), p2Z = _mm_set1_ps(p2[2]);
+	__m128		zero = _mm_setzero_ps();
+	__m128		nX, nY, nZ, neg, ofsX, ofsY, ofsZ;
+	__m128		dist, dist1, dist2, out1, out2;
+	const float	*sides;
+	unsigned	crossBits = 0;
+	int			bits1, bits2;
+	int			flags = 0;
+	int			i;
+
+	for (i = 0; i < numGroups * PACKED_GROUP_SIDES; i += 4){
+		sides = planes + (i / PACKED_GROUP_SIDES) * PACKED_GROUP_FLOATS + (i % PACKED_GROUP_SIDES);
+
+		nX = _mm_loadu_ps(sides);
+		nY = _mm_loadu_ps(sides + PACKED_GROUP_SIDES);
+		nZ = _mm_loadu_ps(sides + PACKED_GROUP_SIDES*2);
+
+		// Push the planes out appropriately for mins/maxs
+		neg = _mm_cmplt_ps(nX, zero);
+		ofsX = _mm_or_ps(_mm_and_ps(neg, maxsX), _mm_andnot_ps(neg, minsX));
+		neg = _mm_cmplt_ps(nY, zero);
+		ofsY = _mm_or_ps(_mm_and_ps(neg, maxsY), _mm_andnot_ps(neg, minsY));
+		neg = _mm_cmplt_ps(nZ, zero);
+		ofsZ = _mm_or_ps(_mm_and_ps(neg, maxsZ), _mm_andnot_ps(neg, minsZ));
+
+		dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ofsX, nX), _mm_mul_ps(ofsY, nY)), _mm_mul_ps(ofsZ, nZ));
+		dist = _mm_sub_ps(_mm_loadu_ps(sides + PACKED_GROUP_SIDES*3), dist);
+
+		dist1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p1X, nX), _mm_mul_ps(p1Y, nY)), _mm_mul_ps(p1Z, nZ));
+		dist1 = _mm_sub_ps(dist1, dist);
+		dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p2X, nX), _mm_mul_ps(p2Y, nY)), _mm_mul_ps(p2Z, nZ));
+		dist2 = _mm_sub_ps(dist2, dist);
+
+		out1 = _mm_cmpgt_ps(dist1, zero);
+		out2 = _mm_cmpgt_ps(dist2, zero);
+
+		// If completely in front of a face, no intersection
+		if (_mm_movemask_ps(_mm_and_ps(out1, _mm_cmpge_ps(dist2, dist1))))
+			return CLIP_MISS;
+
+		bits1 = _mm_movemask_ps(out1);
+		bits2 = _mm_movemask_ps(out2);
+
+		if (bits1)
+			flags |= CLIP_START_OUT;
+		if (bits2)
+			flags |= CLIP_GET_OUT;
+
+		crossBits |= (unsigned)(bits1 | bits2) << i;
+
+		_mm_storeu_ps(d1 + i, dist1);
+		_mm_storeu_ps(d2 + i, dist2);
+	}
+
+	*cross = crossBits;
+
+	return flags;
+}
+
+#endif
+
+#if CM_AVX
+
+/*
+ =================
+ CM_ClipKernelAVX
+
+ Same as CM_ClipKernelSSE, eight sides at a time
+ =================
+*/
+__attribute__((target("avx")))
+static int CM_ClipKernelAVX (const float *planes, int numGroups, const float *mins, const float *maxs, const float *p1, const float *p2, float *d1, float *d2, unsigned *cross){
+
+	__m256		minsX = _mm256_set1_ps(mins[0]), minsY = _mm256_set1_ps(mins[1]), minsZ = _mm256_set1_ps(mins[2]);
+	__m256		maxsX = _mm256_set1_ps(maxs[0]), maxsY = _mm256_set1_ps(maxs[1]), maxsZ = _mm256_set1_ps(maxs[2]);
+	__m256		p1X = _mm256_set1_ps(p1[0]), p1Y = _mm256_set1_ps(p1[1]), p1Z = _mm256_set1_ps(p1[2]);
+	__m256		p2X = _mm256_set1_ps(p2[0]), p2Y = _mm256_set1_ps(p2[1]), p2Z = _mm256_set1_ps(p2[2]);
+	__m256		zero = _mm256_setzero_ps();
+	__m256		nX, nY, nZ, ofsX, ofsY, ofsZ;
+	__m256		dist, dist1, dist2, out1, out2;
+	const float	*sides;
+	unsigned	crossBits = 0;
+	int			bits1, bits2;
+	int			flags = 0;
+	int			i;
+
+	for (i = 0; i < numGroups; i++){
+		sides = planes + i * PACKED_GROUP_FLOATS;
+
+		nX = _mm256_loadu_ps(sides);
+		nY = _mm256_loadu_ps(sides + PACKED_GROUP_SIDES);
+		nZ = _mm256_loadu_ps(sides + PACKED_GROUP_SIDES*2);
+
+		// Push the planes out appropriately for mins/maxs
+		ofsX = _mm256_blendv_ps(minsX, maxsX, _mm256_cmp_ps(nX, zero, _CMP_LT_OQ));
+		ofsY = _mm256_blendv_ps(minsY, maxsY, _mm256_cmp_ps(nY, zero, _CMP_LT_OQ));
+		ofsZ = _mm256_blendv_ps(minsZ, maxsZ, _mm256_cmp_ps(nZ, zero, _CMP_LT_OQ));
+
+		dist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ofsX, nX), _mm256_mul_ps(ofsY, nY)), _mm256_mul_ps(ofsZ, nZ));
+		dist = _mm256_sub_ps(_mm256_loadu_ps(sides + PACKED_GROUP_SIDES*3), dist);
+
+		dist1 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p1X, nX), _mm256_mul_ps(p1Y, nY)), _mm256_mul_ps(p1Z, nZ));
+		dist1 = _mm256_sub_ps(dist1, dist);
+		dist2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p2X, nX), _mm256_mul_ps(p2Y, nY)), _mm256_mul_ps(p2Z, nZ));
+		dist2 = _mm256_sub_ps(dist2, dist);
+
+		out1 = _mm256_cmp_ps(dist1, zero, _CMP_GT_OQ);
+		out2 = _mm256_cmp_ps(dist2, zero, _CMP_GT_OQ);
+
+		// If completely in front of a face, no intersection
+		if (_mm256_movemask_ps(_mm256_and_ps(out1, _mm256_cmp_ps(dist2, dist1, _CMP_GE_OQ))))
+			return CLIP_MISS;
+
+		bits1 = _mm256_movemask_ps(out1);
+		bits2 = _mm256_movemask_ps(out2);
+
+		if (bits1)
+			flags |= CLIP_START_OUT;
+		if (bits2)
+			flags |= CLIP_GET_OUT;
+
+		crossBits |= (unsigned)(bits1 | bits2) << (i * PACKED_GROUP_SIDES);
+
+		_mm256_storeu_ps(d1 + i * PACKED_GROUP_SIDES, dist1);
+		_mm256_storeu_ps(d2 + i * PACKED_GROUP_SIDES, dist2);
+	}
+
+	*cross = crossBits;
+
+	return flags;
+}
+
+#endif
+
+/*
+ =================
+ CM_ClipKernelForType
+
+ Returns NULL if the kernel is not supported
+ =================
+*/
+static clipKernel_t CM_ClipKernelForType (int kernel){
+
+	switch (kernel){
+#if CM_SSE
+	case CLIP_KERNEL_SSE:
+		return CM_ClipKernelSSE;
+#endif
+#if CM_AVX
+	case CLIP_KERNEL_AVX:
+		if (!__builtin_cpu_supports("avx"))
+			return NULL;
+
+		return CM_ClipKernelAVX;
+#endif
+	}
+
+	return NULL;
+}
+
+/*
+ =================
+ CM_SelectClipKernel
+
+ Picks the best supported kernel up to the requested one. Without a
+ kernel, brush sides are clipped one at a time.
+ =================
+*/
+static void CM_SelectClipKernel (void){
+
+	int		kernel;
+
+	kernel = Clamp(cm_clipKernel->integerValue, CLIP_KERNEL_SCALAR, CLIP_KERNEL_AVX);
+
+	for (cm_clipKernelFunc = NULL; kernel > CLIP_KERNEL_SCALAR; kernel--){
+		cm_clipKernelFunc = CM_ClipKernelForType(kernel);
+		if (cm_clipKernelFunc)
+			break;
+	}
+}
+
+/*
+ =================
+ CM_ClipBoxToPackedBrush
+ =================
+*/
+static void CM_ClipBoxToPackedBrush (traceWork_t *tw, cbrush_t *brush){
+
+	float			d1[MAX_PACKED_SIDES], d2[MAX_PACKED_SIDES];
+	float			enterFrac, leaveFrac;
+	float			f;
+	unsigned		cross;
+	int				leadSide = -1;
+	int				flags;
+	int				i;
+
+	flags = tw->clipKernel(cm.packedPlanes + brush->firstPackedPlane, brush->numPackedGroups, tw->mins, tw->maxs, tw->start, tw->end, d1, d2, &cross);
+	if (flags & CLIP_MISS)
+		return;
+
+	if (!(flags & CLIP_START_OUT)){
+		// Original point was inside brush
+		tw->trace.startsolid = true;
+		if (!(flags & CLIP_GET_OUT))
+			tw->trace.allsolid = true;
+
+		return;
+	}
+
+	enterFrac = -1;
+	leaveFrac = 1;
+
+	// Go through the crossed faces in order, so the same side is picked
+	// as the lead side on ties
+	for (i = 0; cross; i++, cross >>= 1){
+		if (!(cross & 1))
+			continue;
+
+		if (d1[i] > d2[i]){
+			// Enter
+			f = (d1[i] - DIST_EPSILON) / (d1[i] - d2[i]);
+			if (f > enterFrac){
+				enterFrac = f;
+				leadSide = i;
+			}
+		}
+		else {
+			// Leave
+			f = (d1[i] + DIST_EPSILON) / (d1[i] - d2[i]);
+			if (f < leaveFrac)
+				leaveFrac = f;
+		}
+	}
+
+	if (enterFrac < leaveFrac){
+		if (enterFrac > -1 && enterFrac < tw->trace.fraction){
+			if (enterFrac < 0)
+				enterFrac = 0;
+
+			tw->trace.fraction = enterFrac;
+			tw->trace.plane = *cm.brushSides[brush->firstBrushSide+leadSide].plane;
+			tw->trace.surface = &(cm.brushSides[brush->firstBrushSide+leadSide].surface->c);
+			tw->trace.contents = brush->contents;
+		}
+	}
+}
+
+/*
+ =================
+ CM_TestBoxInPackedBrush
+ =================
+*/
+static void CM_TestBoxInPackedBrush (traceWork_t *tw, cbrush_t *brush){
+
+	float			d1[MAX_PACKED_SIDES], d2[MAX_PACKED_SIDES];
+	unsigned		cross;
+
+	// With the same start and end points, any side the box is in front of
+	// makes a miss
+	if (tw->clipKernel(cm.packedPlanes + brush->firstPackedPlane, brush->numPackedGroups, tw->mins, tw->maxs, tw->start, tw->start, d1, d2, &cross) & CLIP_MISS)
+		return;
+
+	// Inside this brush
+	tw->trace.startsolid = tw->trace.allsolid = true;
+	tw->trace.fraction = 0;
+	tw->trace.contents = brush->contents;
+}
+
+
+/*
+ =================
+ CM_SetBoxPlane
+
+ Fills in the plane of the given side of a box the same way the box hull
+ does
+ =================
+*/
+static void CM_SetBoxPlane (cplane_t *plane, int side, const vec3_t boxMins, const vec3_t boxMaxs){
+
+	int		axis = side >> 1;
+
+	memset(plane, 0, sizeof(cplane_t));
+
+	if (side & 1){
+		plane->normal[axis] = -1;
+		plane->dist = -boxMins[axis];
+		plane->type = 3;
+	}
+	else {
+		plane->normal[axis] = 1;
+		plane->dist = boxMaxs[axis];
+		plane->type = axis;
+	}
+}
+
+/*
+ =================
+ CM_ClipBoxToBox
+
+ Clips the move against the sides of a box, in the order of the box hull
+ brush. This is CM_ClipBoxToBrush with the axial planes worked out.
+ =================
+*/
+static void CM_ClipBoxToBox (traceWork_t *tw, const vec3_t boxMins, const vec3_t boxMaxs){
+
+	const float	*mins = tw->mins, *maxs = tw->maxs;
+	const float	*p1 = tw->start, *p2 = tw->end;
+	float		dist, d1, d2;
+	float		enterFrac, leaveFrac;
+	float		f;
+	qboolean	getOut, startOut;
+	int			leadSide;
+	int			i, axis;
+
+	enterFrac = -1;
+	leaveFrac = 1;
+
+	getOut = false;
+	startOut = false;
+	leadSide = -1;
+
+	for (i = 0; i < 6; i++){
+		axis = i >> 1;
+
+		// Push the plane out appropriately for mins/maxs
+		if (i & 1){
+			dist = -boxMins[axis] + maxs[axis];
+
+			d1 = -p1[axis] - dist;
+			d2 = -p2[axis] - dist;
+		}
+		else {
+			dist = boxMaxs[axis] - mins[axis];
+
+			d1 = p1[axis] - dist;
+			d2 = p2[axis] - dist;
+		}
+
+		if (d2 > 0)
+			getOut = true;	// End point is not in solid
+		if (d1 > 0)
+			startOut = true;
+
+		// If completely in front of face, no intersection
+		if (d1 > 0 && d2 >= d1)
+			return;
+
+		if (d1 <= 0 && d2 <= 0)
+			continue;
+
+		// Crosses face
+		if (d1 > d2){
+			// Enter
+			f = (d1 - DIST_EPSILON) / (d1 - d2);
+			if (f > enterFrac){
+				enterFrac = f;
+				leadSide = i;
+			}
+		}
+		else {
+			// Leave
+			f = (d1 + DIST_EPSILON) / (d1 - d2);
+			if (f < leaveFrac)
+				leaveFrac = f;
+		}
+	}
+
+	if (!startOut){
+		// Original point was inside box
+		tw->trace.startsolid = true;
+		if (!getOut)
+			tw->trace.allsolid = true;
+
+		return;
+	}
+
+	if (enterFrac < leaveFrac){
+		if (enterFrac > -1 && enterFrac < tw->trace.fraction){
+			if (enterFrac < 0)
+				enterFrac = 0;
+
+			tw->trace.fraction = enterFrac;
+			CM_SetBoxPlane(&tw->trace.plane, leadSide, boxMins, boxMaxs);
+			tw->trace.surface = &(cm_nullSurface.c);
+			tw->trace.contents = CONTENTS_MONSTER;
+		}
+	}
+}
+
+/*
+ =================
+ CM_TestBoxInBox
  =================
 */
-static void CM_ClipBoxToBrush (const vec3_t mins, const vec3_t maxs, const vec3_t p1, const vec3_t p2, trace_t *trace, cbrush_t *brush){
+static void CM_TestBoxInBox (traceWork_t *tw, const vec3_t boxMins, const vec3_t boxMaxs){
+
+	const float	*mins = tw->mins, *maxs = tw->maxs;
+	const float	*p = tw->start;
+	float		dist, d;
+	int			i, axis;
+
+	for (i = 0; i < 6; i++){
+		axis = i >> 1;
+
+		// Push the plane out appropriately for mins/maxs
+		if (i & 1){
+			dist = -boxMins[axis] + maxs[axis];
+
+			d = -p[axis] - dist;
+		}
+		else {
+			dist = boxMaxs[axis] - mins[axis];
+
+			d = p[axis] - dist;
+		}
+
+		// If completely in front of face, no intersection
+		if (d > 0)
+			return;
+	}
+
+	// Inside this box
+	tw->trace.startsolid = tw->trace.allsolid = true;
+	tw->trace.fraction = 0;
+	tw->trace.contents = CONTENTS_MONSTER;
+}
+
+/*
+ =================
+ CM_ClipBoxToBrush
+ =================
+*/
+static void CM_ClipBoxToBrush (traceWork_t *tw, cbrush_t *brush){
 
 	int				i, j;
 	cbrushside_t	*side, *leadSide;
 	cplane_t		*plane, *clipPlane;
+	const float		*mins = tw->mins, *maxs = tw->maxs;
+	const float		*p1 = tw->start, *p2 = tw->end;
+	trace_t			*trace = &tw->trace;
 	vec3_t			ofs;
 	float			dist, d1, d2;
 	float			enterFrac, leaveFrac;
 	float			f;
 	qboolean		getOut, startOut;
 
+	if (brush == cm_boxBrush){
+		CM_ClipBoxToBox(tw, tw->ctx->boxMins, tw->ctx->boxMaxs);
+		return;
+	}
+
+	if (brush->numPackedGroups && tw->clipKernel){
+		CM_ClipBoxToPackedBrush(tw, brush);
+		return;
+	}
+
 	enterFrac = -1;
 	leaveFrac = 1;
 	clipPlane = NULL;
@@ -1095,9 +2140,9 @@ static void CM_ClipBoxToBrush (const vec3_t mins, const vec3_t maxs, const vec3_
 
 	for (i = 0; i < brush->numSides; i++){
 		side = &cm.brushSides[brush->firstBrushSide+i];
-		plane = side->plane;
+		plane = CM_ContextPlane(tw->ctx, side->plane);
 
-		if (!cm_traceIsPoint){
+		if (!tw->isPoint){
 			// General box case
 			if (plane->type < PLANE_NON_AXIAL){
 				// Push the plane out appropriately for mins/maxs
@@ -1193,20 +2238,32 @@ static void CM_ClipBoxToBrush (const vec3_t mins, const vec3_t maxs, const vec3_
  CM_TestBoxInBrush
  =================
 */
-static void CM_TestBoxInBrush (const vec3_t mins, const vec3_t maxs, const vec3_t p, trace_t *trace, cbrush_t *brush){
+static void CM_TestBoxInBrush (traceWork_t *tw, cbrush_t *brush){
 
 	int				i, j;
 	cbrushside_t	*side;
 	cplane_t		*plane;
+	const float		*mins = tw->mins, *maxs = tw->maxs;
+	const float		*p = tw->start;
 	vec3_t			ofs;
 	float			dist, d;
 
+	if (brush == cm_boxBrush){
+		CM_TestBoxInBox(tw, tw->ctx->boxMins, tw->ctx->boxMaxs);
+		return;
+	}
+
+	if (brush->numPackedGroups && tw->clipKernel){
+		CM_TestBoxInPackedBrush(tw, brush);
+		return;
+	}
+
 	if (!brush->numSides)
 		return;
 
 	for (i = 0; i < brush->numSides; i++){
 		side = &cm.brushSides[brush->firstBrushSide+i];
-		plane = side->plane;
+		plane = CM_ContextPlane(tw->ctx, side->plane);
 
 		// General box case
 		if (plane->type < PLANE_NON_AXIAL){
@@ -1238,77 +2295,171 @@ static void CM_TestBoxInBrush (const vec3_t mins, const vec3_t maxs, const vec3_
 	}
 
 	// Inside this brush
-	trace->startsolid = trace->allsolid = true;
-	trace->fraction = 0;
-	trace->contents = brush->contents;
+	tw->trace.startsolid = tw->trace.allsolid = true;
+	tw->trace.fraction = 0;
+	tw->trace.contents = brush->contents;
 }
 
 /*
  =================
- CM_TraceToLeaf
+ CM_BoundsInMove
  =================
 */
-static void CM_TraceToLeaf (int leafNum){
+static Q_INLINE qboolean CM_BoundsInMove (const traceWork_t *tw, const vec3_t mins, const vec3_t maxs){
 
-	int			i;
-	int			brushNum;
-	cleaf_t		*leaf;
-	cbrush_t	*brush;
+	if (mins[0] > tw->moveMaxs[0] || mins[1] > tw->moveMaxs[1] || mins[2] > tw->moveMaxs[2])
+		return false;
+	if (maxs[0] < tw->moveMins[0] || maxs[1] < tw->moveMins[1] || maxs[2] < tw->moveMins[2])
+		return false;
 
-	leaf = &cm.leafs[leafNum];
-	if (!(leaf->contents & cm_traceContents))
-		return;
+	return true;
+}
 
-	// Trace line against all brushes in the leaf
-	for (i = 0; i < leaf->numLeafBrushes; i++){
-		brushNum = cm.leafBrushes[leaf->firstLeafBrush+i];
-		brush = &cm.brushes[brushNum];
+/*
+ =================
+ CM_MarkLeafBrushes
+
+ Walks the brush tree of the given leaf and marks the brushes that overlap
+ the move in the leaf brush bits of the context. Returns the number of
+ words to look at.
+ =================
+*/
+static int CM_MarkLeafBrushes (traceWork_t *tw, const cleaf_t *leaf){
 
-		if (brush->checkCount == cm_traceCheckCount)
-			continue;		// Already checked this brush in another leaf
-		brush->checkCount = cm_traceCheckCount;
+	const unsigned short	*leafBrushes = cm.leafBrushes + leaf->firstLeafBrush;
+	unsigned				*bits = tw->ctx->leafBrushBits;
+	cbrushnode_t			*node;
+	cbrush_t				*brush;
+	int						stack[MAX_BRUSH_TREE_DEPTH], depth = 0;
+	int						numWords, numMarked = 0;
+	int						i, local;
 
-		if (!(brush->contents & cm_traceContents))
+	numWords = (leaf->numLeafBrushes + 31) >> 5;
+	memset(bits, 0, numWords * sizeof(unsigned));
+
+	stack[depth++] = leaf->brushNode;
+
+	while (depth){
+		node = &cm.brushNodes[stack[--depth]];
+
+		if (!CM_BoundsInMove(tw, node->mins, node->maxs))
 			continue;
 
-		CM_ClipBoxToBrush(cm_traceMins, cm_traceMaxs, cm_traceStart, cm_traceEnd, &cm_trace, brush);
-		if (!cm_trace.fraction)
-			return;
+		if (!node->numBrushes){
+			stack[depth++] = node->children[1];
+			stack[depth++] = node->children[0];
+			continue;
+		}
+
+		for (i = 0; i < node->numBrushes; i++){
+			local = cm.treeBrushes[node->firstBrush+i];
+			brush = &cm.brushes[leafBrushes[local]];
+
+			if (!CM_BoundsInMove(tw, brush->mins, brush->maxs))
+				continue;
+
+			bits[local >> 5] |= 1U << (local & 31);
+			numMarked++;
+		}
 	}
+
+	tw->ctx->numBrushesAvoided += leaf->numLeafBrushes - numMarked;
+
+	return numWords;
 }
 
 /*
  =================
- CM_TestInLeaf
+ CM_CheckLeafBrushes
+
+ Runs the given test on all the brushes in the leaf the move may touch.
+ The brushes are always tested in the order of the leaf, so the result
+ doesn't depend on the brush tree.
  =================
 */
-static void CM_TestInLeaf (int leafNum){
+static Q_INLINE void CM_CheckLeafBrushes (traceWork_t *tw, int leafNum, void (*checkBrush)(traceWork_t *, cbrush_t *)){
 
-	int			i;
-	int			brushNum;
+	int			i, numWords;
+	int			brushNum, local;
+	unsigned	bits;
 	cleaf_t		*leaf;
 	cbrush_t	*brush;
 
 	leaf = &cm.leafs[leafNum];
-	if (!(leaf->contents & cm_traceContents))
+	if (!(leaf->contents & tw->contents))
 		return;
 
-	// Trace line against all brushes in the leaf
-	for (i = 0; i < leaf->numLeafBrushes; i++){
-		brushNum = cm.leafBrushes[leaf->firstLeafBrush+i];
-		brush = &cm.brushes[brushNum];
+	if (leaf->brushNode == -1){
+		for (i = 0; i < leaf->numLeafBrushes; i++){
+			brushNum = cm.leafBrushes[leaf->firstLeafBrush+i];
+			brush = &cm.brushes[brushNum];
 
-		if (brush->checkCount == cm_traceCheckCount)
-			continue;		// Already checked this brush in another leaf
-		brush->checkCount = cm_traceCheckCount;
+			if (!CM_BoundsInMove(tw, brush->mins, brush->maxs)){
+				tw->ctx->numBrushesAvoided++;
+				continue;
+			}
 
-		if (!(brush->contents & cm_traceContents))
-			continue;
+			if (tw->brushCheckCounts[brushNum] == tw->checkCount)
+				continue;		// Already checked this brush in another leaf
+			tw->brushCheckCounts[brushNum] = tw->checkCount;
 
-		CM_TestBoxInBrush(cm_traceMins, cm_traceMaxs, cm_traceStart, &cm_trace, brush);
-		if (!cm_trace.fraction)
-			return;
+			if (!(brush->contents & tw->contents))
+				continue;
+
+			tw->ctx->numBrushTests++;
+
+			checkBrush(tw, brush);
+			if (!tw->trace.fraction)
+				return;
+		}
+
+		return;
 	}
+
+	numWords = CM_MarkLeafBrushes(tw, leaf);
+
+	for (i = 0; i < numWords; i++){
+		for (local = i << 5, bits = tw->ctx->leafBrushBits[i]; bits; local++, bits >>= 1){
+			if (!(bits & 1))
+				continue;
+
+			brushNum = cm.leafBrushes[leaf->firstLeafBrush+local];
+			brush = &cm.brushes[brushNum];
+
+			if (tw->brushCheckCounts[brushNum] == tw->checkCount)
+				continue;		// Already checked this brush in another leaf
+			tw->brushCheckCounts[brushNum] = tw->checkCount;
+
+			if (!(brush->contents & tw->contents))
+				continue;
+
+			tw->ctx->numBrushTests++;
+
+			checkBrush(tw, brush);
+			if (!tw->trace.fraction)
+				return;
+		}
+	}
+}
+
+/*
+ =================
+ CM_TraceToLeaf
+ =================
+*/
+static void CM_TraceToLeaf (traceWork_t *tw, int leafNum){
+
+	CM_CheckLeafBrushes(tw, leafNum, CM_ClipBoxToBrush);
+}
+
+/*
+ =================
+ CM_TestInLeaf
+ =================
+*/
+static void CM_TestInLeaf (traceWork_t *tw, int leafNum){
+
+	CM_CheckLeafBrushes(tw, leafNum, CM_TestBoxInBrush);
 }
 
 /*
@@ -1316,7 +2467,7 @@ static void CM_TestInLeaf (int leafNum){
  CM_RecursiveHullCheck
  =================
 */
-static void CM_RecursiveHullCheck (int num, float pf1, float pf2, const vec3_t p1, const vec3_t p2){
+static void CM_RecursiveHullCheck (traceWork_t *tw, int num, float pf1, float pf2, const vec3_t p1, const vec3_t p2){
 
 	cnode_t		*node;
 	cplane_t	*plane;
@@ -1327,46 +2478,46 @@ static void CM_RecursiveHullCheck (int num, float pf1, float pf2, const vec3_t p
 	int			side;
 	float		midf;
 
-	if (cm_trace.fraction <= pf1)
+	if (tw->trace.fraction <= pf1)
 		return;		// Already hit something nearer
 
 	// If < 0, we are in a leaf node
 	if (num < 0){
-		CM_TraceToLeaf(-1-num);
+		CM_TraceToLeaf(tw, -1-num);
 		return;
 	}
 
 	// Find the point distances to the separating plane and the offset
 	// for the size of the box
 	node = &cm.nodes[num];
-	plane = node->plane;
+	plane = CM_ContextPlane(tw->ctx, node->plane);
 
 	if (plane->type < PLANE_NON_AXIAL){
 		d1 = p1[plane->type] - plane->dist;
 		d2 = p2[plane->type] - plane->dist;
 
-		offset = cm_traceExtents[plane->type];
+		offset = tw->extents[plane->type];
 	}
 	else {
 		d1 = DotProduct(p1, plane->normal) - plane->dist;
 		d2 = DotProduct(p2, plane->normal) - plane->dist;
 
-		if (cm_traceIsPoint)
+		if (tw->isPoint)
 			offset = 0;
 		else
-			offset = fabs(cm_traceExtents[0]*plane->normal[0]) + fabs(cm_traceExtents[1]*plane->normal[1]) + fabs(cm_traceExtents[2]*plane->normal[2]);
+			offset = fabs(tw->extents[0]*plane->normal[0]) + fabs(tw->extents[1]*plane->normal[1]) + fabs(tw->extents[2]*plane->normal[2]);
 	}
 
 	// See which sides we need to consider
 	if (d1 >= offset && d2 >= offset){
-		CM_RecursiveHullCheck(node->children[0], pf1, pf2, p1, p2);
+		CM_RecursiveHullCheck(tw, node->children[0], pf1, pf2, p1, p2);
 		return;
 	}
 	if (d1 < -offset && d2 < -offset){
-		CM_RecursiveHullCheck(node->children[1], pf1, pf2, p1, p2);
+		CM_RecursiveHullCheck(tw, node->children[1], pf1, pf2, p1, p2);
 		return;
 	}
-	
+
 	// Put the crosspoint DIST_EPSILON pixels on the near side
 	if (d1 < d2){
 		dist = 1.0 / (d1 - d2);
@@ -1398,7 +2549,7 @@ static void CM_RecursiveHullCheck (int num, float pf1, float pf2, const vec3_t p
 	mid[1] = p1[1] + (p2[1] - p1[1]) * frac1;
 	mid[2] = p1[2] + (p2[2] - p1[2]) * frac1;
 
-	CM_RecursiveHullCheck(node->children[side], pf1, midf, p1, mid);
+	CM_RecursiveHullCheck(tw, node->children[side], pf1, midf, p1, mid);
 
 	// Go past the node
 	if (frac2 < 0)
@@ -1412,98 +2563,121 @@ static void CM_RecursiveHullCheck (int num, float pf1, float pf2, const vec3_t p
 	mid[1] = p1[1] + (p2[1] - p1[1]) * frac2;
 	mid[2] = p1[2] + (p2[2] - p1[2]) * frac2;
 
-	CM_RecursiveHullCheck(node->children[side^1], midf, pf2, mid, p2);
+	CM_RecursiveHullCheck(tw, node->children[side^1], midf, pf2, mid, p2);
 }
 
 /*
  =================
- CM_BoxTrace
+ CM_BoxTraceEx
+
+ Only uses the given context, so traces through different contexts can
+ run at the same time
  =================
 */
-trace_t CM_BoxTrace (const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, int headNode, int brushMask){
+trace_t CM_BoxTraceEx (traceContext_t *ctx, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, int headNode, int brushMask){
+
+	traceWork_t	tw;
+	int			i;
 
 	// Fill in a default trace
-	memset(&cm_trace, 0, sizeof(trace_t));
-	cm_trace.fraction = 1;
-	cm_trace.surface = &(cm_nullSurface.c);
+	memset(&tw.trace, 0, sizeof(trace_t));
+	tw.trace.fraction = 1;
+	tw.trace.surface = &(cm_nullSurface.c);
 
 	if (!cm.loaded)
-		return cm_trace;
+		return tw.trace;
+
+	CM_PrepareContext(ctx);
 
-	cm_traceCheckCount++;	// For multi-check avoidance
-	cm_traces++;			// Optimize counter
+	ctx->checkCount++;		// For multi-check avoidance
+	ctx->numTraces++;		// Optimize counter
 
-	cm_traceContents = brushMask;
-	VectorCopy(start, cm_traceStart);
-	VectorCopy(end, cm_traceEnd);
-	VectorCopy(mins, cm_traceMins);
-	VectorCopy(maxs, cm_traceMaxs);
+	tw.ctx = ctx;
+	tw.checkCount = ctx->checkCount;
+	tw.brushCheckCounts = ctx->brushCheckCounts;
+
+	if (ctx->forceClipKernel)
+		tw.clipKernel = CM_ClipKernelForType(ctx->clipKernel);
+	else
+		tw.clipKernel = cm_clipKernelFunc;
+
+	tw.contents = brushMask;
+	VectorCopy(start, tw.start);
+	VectorCopy(end, tw.end);
+	VectorCopy(mins, tw.mins);
+	VectorCopy(maxs, tw.maxs);
+
+	// Brushes outside the bounds of the move can't be hit. Sides within
+	// DIST_EPSILON of the end can still clip it, so leave some room.
+	for (i = 0; i < 3; i++){
+		if (start[i] < end[i]){
+			tw.moveMins[i] = (start[i] + mins[i]) - 1;
+			tw.moveMaxs[i] = (end[i] + maxs[i]) + 1;
+		}
+		else {
+			tw.moveMins[i] = (end[i] + mins[i]) - 1;
+			tw.moveMaxs[i] = (start[i] + maxs[i]) + 1;
+		}
+	}
 
 	// Check for position test special case
 	if (VectorCompare(start, end)){
-		int		i;
-		vec3_t	c1, c2;
 		int		leafs[1024], numLeafs;
 		int		topNode;
 
-		for (i = 0; i < 3; i++){
-			c1[i] = (start[i] + mins[i]) - 1;
-			c2[i] = (start[i] + maxs[i]) + 1;
-		}
-
-		numLeafs = CM_BoxLeafNumsHeadNode(c1, c2, leafs, 1024, headNode, &topNode);
+		numLeafs = CM_BoxLeafNumsHeadNode(ctx, tw.moveMins, tw.moveMaxs, leafs, 1024, headNode, &topNode);
 
 		for (i = 0; i < numLeafs; i++){
-			CM_TestInLeaf(leafs[i]);
-			if (cm_trace.allsolid)
+			CM_TestInLeaf(&tw, leafs[i]);
+			if (tw.trace.allsolid)
 				break;
 		}
 
-		VectorCopy(start, cm_trace.endpos);
+		VectorCopy(start, tw.trace.endpos);
 
-		return cm_trace;
+		return tw.trace;
 	}
 
 	// Check for point special case
 	if (VectorCompare(mins, vec3_origin) && VectorCompare(maxs, vec3_origin)){
-		cm_traceIsPoint = true;
+		tw.isPoint = true;
 
-		VectorClear(cm_traceExtents);
+		VectorClear(tw.extents);
 	}
 	else {
-		cm_traceIsPoint = false;
+		tw.isPoint = false;
 
-		cm_traceExtents[0] = -mins[0] > maxs[0] ? -mins[0] : maxs[0];
-		cm_traceExtents[1] = -mins[1] > maxs[1] ? -mins[1] : maxs[1];
-		cm_traceExtents[2] = -mins[2] > maxs[2] ? -mins[2] : maxs[2];
+		tw.extents[0] = -mins[0] > maxs[0] ? -mins[0] : maxs[0];
+		tw.extents[1] = -mins[1] > maxs[1] ? -mins[1] : maxs[1];
+		tw.extents[2] = -mins[2] > maxs[2] ? -mins[2] : maxs[2];
 	}
 
 	// General sweeping through world
-	CM_RecursiveHullCheck(headNode, 0, 1, start, end);
+	CM_RecursiveHullCheck(&tw, headNode, 0, 1, start, end);
 
-	if (cm_trace.fraction == 1.0){
-		cm_trace.endpos[0] = end[0];
-		cm_trace.endpos[1] = end[1];
-		cm_trace.endpos[2] = end[2];
+	if (tw.trace.fraction == 1.0){
+		tw.trace.endpos[0] = end[0];
+		tw.trace.endpos[1] = end[1];
+		tw.trace.endpos[2] = end[2];
 	}
 	else {
-		cm_trace.endpos[0] = start[0] + (end[0] - start[0]) * cm_trace.fraction;
-		cm_trace.endpos[1] = start[1] + (end[1] - start[1]) * cm_trace.fraction;
-		cm_trace.endpos[2] = start[2] + (end[2] - start[2]) * cm_trace.fraction;
+		tw.trace.endpos[0] = start[0] + (end[0] - start[0]) * tw.trace.fraction;
+		tw.trace.endpos[1] = start[1] + (end[1] - start[1]) * tw.trace.fraction;
+		tw.trace.endpos[2] = start[2] + (end[2] - start[2]) * tw.trace.fraction;
 	}
 
-	return cm_trace;
+	return tw.trace;
 }
 
 /*
  =================
- CM_TransformedBoxTrace
+ CM_TransformedBoxTraceEx
 
  Handles offseting and rotation of the points for moving and rotating
  entities
  =================
 */
-trace_t	CM_TransformedBoxTrace (const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, int headNode, int brushMask, const vec3_t origin, const vec3_t angles){
+trace_t	CM_TransformedBoxTraceEx (traceContext_t *ctx, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, int headNode, int brushMask, const vec3_t origin, const vec3_t angles){
 
 	trace_t		trace;
 	vec3_t		start2, end2, angles2, temp;
@@ -1529,7 +2703,7 @@ trace_t	CM_TransformedBoxTrace (const vec3_t start, const vec3_t end, const vec3
 	}
 
 	// Sweep the box through the world
-	trace = CM_BoxTrace(start2, end2, mins, maxs, headNode, brushMask);
+	trace = CM_BoxTraceEx(ctx, start2, end2, mins, maxs, headNode, brushMask);
 
 	if (rotated && trace.fraction != 1.0){
 		VectorNegate(angles, angles2);
@@ -1553,6 +2727,290 @@ trace_t	CM_TransformedBoxTrace (const vec3_t start, const vec3_t end, const vec3
 	return trace;
 }
 
+/*
+ =================
+ CM_BoxTraceToBoxEx
+
+ Gives the same result as CM_TransformedBoxTraceEx through the hull made
+ by CM_HeadNodeForBoxEx for the given box, without building it or
+ walking its nodes. Every node of the hull leads to its only leaf, so the
+ box is clipped once against the whole move.
+ =================
+*/
+trace_t CM_BoxTraceToBoxEx (traceContext_t *ctx, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, const vec3_t boxMins, const vec3_t boxMaxs, int brushMask, const vec3_t origin){
+
+	traceWork_t	tw;
+
+	// Fill in a default trace
+	memset(&tw.trace, 0, sizeof(trace_t));
+	tw.trace.fraction = 1;
+	tw.trace.surface = &(cm_nullSurface.c);
+
+	if (!cm.loaded)
+		return tw.trace;
+
+	CM_PrepareContext(ctx);
+
+	ctx->numTraces++;		// Optimize counter
+
+	if (brushMask & CONTENTS_MONSTER){
+		tw.ctx = ctx;
+
+		VectorSubtract(start, origin, tw.start);
+		VectorSubtract(end, origin, tw.end);
+		VectorCopy(mins, tw.mins);
+		VectorCopy(maxs, tw.maxs);
+
+		// Check for position test special case
+		if (VectorCompare(tw.start, tw.end))
+			CM_TestBoxInBox(&tw, boxMins, boxMaxs);
+		else
+			CM_ClipBoxToBox(&tw, boxMins, boxMaxs);
+	}
+
+	if (tw.trace.fraction == 1.0){
+		tw.trace.endpos[0] = end[0];
+		tw.trace.endpos[1] = end[1];
+		tw.trace.endpos[2] = end[2];
+	}
+	else {
+		tw.trace.endpos[0] = start[0] + (end[0] - start[0]) * tw.trace.fraction;
+		tw.trace.endpos[1] = start[1] + (end[1] - start[1]) * tw.trace.fraction;
+		tw.trace.endpos[2] = start[2] + (end[2] - start[2]) * tw.trace.fraction;
+	}
+
+	return tw.trace;
+}
+
+/*
+ =================
+ CM_BoxTrace
+
+ The shared context is used, so the local server thread and the client
+ take turns
+ =================
+*/
+trace_t CM_BoxTrace (const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, int headNode, int brushMask){
+
+	trace_t	trace;
+
+	Com_Lock();
+	trace = CM_BoxTraceEx(&cm_defaultContext, start, end, mins, maxs, headNode, brushMask);
+	Com_Unlock();
+
+	return trace;
+}
+
+/*
+ =================
+ CM_TransformedBoxTrace
+ =================
+*/
+trace_t	CM_TransformedBoxTrace (const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, int headNode, int brushMask, const vec3_t origin, const vec3_t angles){
+
+	trace_t	trace;
+
+	Com_Lock();
+	trace = CM_TransformedBoxTraceEx(&cm_defaultContext, start, end, mins, maxs, headNode, brushMask, origin, angles);
+	Com_Unlock();
+
+	return trace;
+}
+
+/*
+ =================
+ CM_RandomFloat
+
+ Returns a reproducible random number between 0 and 1, without touching
+ the state of rand
+ =================
+*/
+float CM_RandomFloat (unsigned *seed){
+
+	*seed = *seed * 1103515245 + 12345;
+
+	return (float)((*seed >> 8) & 0xFFFF) / 65536.0f;
+}
+
+/*
+ =================
+ CM_CompareTraces
+ =================
+*/
+static qboolean CM_CompareTraces (const trace_t *trace1, const trace_t *trace2){
+
+	if (trace1->allsolid != trace2->allsolid || trace1->startsolid != trace2->startsolid)
+		return false;
+
+	if (trace1->fraction != trace2->fraction || !VectorCompare(trace1->endpos, trace2->endpos))
+		return false;
+
+	if (!VectorCompare(trace1->plane.normal, trace2->plane.normal) || trace1->plane.dist != trace2->plane.dist)
+		return false;
+
+	if (trace1->surface != trace2->surface || trace1->contents != trace2->contents)
+		return false;
+
+	return true;
+}
+
+#define CLIP_TEST_BATCH			16384
+
+typedef struct {
+	vec3_t			start;
+	vec3_t			end;
+	vec3_t			angles;
+	int				hull;
+	int				model;
+} clipQuery_t;
+
+/*
+ =================
+ CM_TestClipKernels_f
+
+ Runs the same random traces through the current map with brush sides
+ clipped one at a time and with every kernel the CPU supports, and reports
+ the speed of each and any result that differs
+ =================
+*/
+static void CM_TestClipKernels_f (void){
+
+	static vec3_t		hullMins[4] = {{0, 0, 0}, {-16, -16, -24}, {-16, -16, -24}, {-15, -15, -15}};
+	static vec3_t		hullMaxs[4] = {{0, 0, 0}, {16, 16, 32}, {16, 16, 4}, {15, 15, 15}};
+	static const char	*kernelNames[3] = {"scalar", "SSE", "AVX"};
+	traceContext_t		ctx;
+	qboolean			supported[3];
+	clipQuery_t			*queries, *query;
+	trace_t				*baseline, trace;
+	cmodel_t			*model;
+	vec3_t				dir;
+	unsigned			seed = 1;
+	double				time, times[3], maxErrors[3];
+	int					mismatches[3];
+	int					numQueries, batch, batchSize;
+	int					kernel;
+	int					i, j;
+
+	if (Cmd_Argc() > 2){
+		Com_Printf("Usage: testClipKernels [traces]\n");
+		return;
+	}
+
+	if (!cm.loaded){
+		Com_Printf("No map loaded\n");
+		return;
+	}
+
+	if (Cmd_Argc() == 2)
+		numQueries = atoi(Cmd_Argv(1));
+	else
+		numQueries = 100000;
+
+	if (numQueries < 1){
+		Com_Printf("Must run at least one trace\n");
+		return;
+	}
+
+	supported[CLIP_KERNEL_SCALAR] = true;
+
+	for (kernel = CLIP_KERNEL_SCALAR; kernel <= CLIP_KERNEL_AVX; kernel++){
+		if (kernel != CLIP_KERNEL_SCALAR){
+			supported[kernel] = (CM_ClipKernelForType(kernel) != NULL);
+			if (!supported[kernel])
+				Com_Printf("%-6s not supported\n", kernelNames[kernel]);
+		}
+
+		times[kernel] = 0.0;
+		maxErrors[kernel] = 0.0;
+		mismatches[kernel] = 0;
+	}
+
+	// The kernel is picked through our own context, so traces made on the
+	// server thread meanwhile are not affected
+	memset(&ctx, 0, sizeof(traceContext_t));
+	ctx.forceClipKernel = true;
+
+	// The queries are made in batches to keep the memory use down
+	queries = Z_Malloc(CLIP_TEST_BATCH * sizeof(clipQuery_t));
+	baseline = Z_Malloc(CLIP_TEST_BATCH * sizeof(trace_t));
+
+	for (batch = 0; batch < numQueries; batch += CLIP_TEST_BATCH){
+		batchSize = numQueries - batch;
+		if (batchSize > CLIP_TEST_BATCH)
+			batchSize = CLIP_TEST_BATCH;
+
+		// One in four against an inline model, one in eight a position test
+		for (i = 0, query = queries; i < batchSize; i++, query++){
+			query->hull = (int)(CM_RandomFloat(&seed) * 4) & 3;
+
+			if (cm.numModels > 1 && CM_RandomFloat(&seed) < 0.25f)
+				query->model = 1 + (int)(CM_RandomFloat(&seed) * (cm.numModels - 1)) % (cm.numModels - 1);
+			else
+				query->model = 0;
+
+			model = &cm.models[query->model];
+
+			for (j = 0; j < 3; j++){
+				query->start[j] = model->mins[j] - 64 + CM_RandomFloat(&seed) * (model->maxs[j] - model->mins[j] + 128);
+				dir[j] = CM_RandomFloat(&seed) * 2 - 1;
+			}
+
+			if (CM_RandomFloat(&seed) < 0.125f)
+				VectorCopy(query->start, query->end);
+			else
+				VectorMA(query->start, CM_RandomFloat(&seed) * 1024, dir, query->end);
+
+			if (query->model && CM_RandomFloat(&seed) < 0.5f){
+				for (j = 0; j < 3; j++)
+					query->angles[j] = CM_RandomFloat(&seed) * 360;
+			}
+			else
+				VectorClear(query->angles);
+		}
+
+		for (kernel = CLIP_KERNEL_SCALAR; kernel <= CLIP_KERNEL_AVX; kernel++){
+			if (!supported[kernel])
+				continue;
+
+			ctx.clipKernel = kernel;
+
+			time = Sys_GetClockTicks();
+
+			for (i = 0, query = queries; i < batchSize; i++, query++){
+				model = &cm.models[query->model];
+
+				if (query->model)
+					trace = CM_TransformedBoxTraceEx(&ctx, query->start, query->end, hullMins[query->hull], hullMaxs[query->hull], model->headNode, MASK_ALL, model->origin, query->angles);
+				else
+					trace = CM_BoxTraceEx(&ctx, query->start, query->end, hullMins[query->hull], hullMaxs[query->hull], model->headNode, MASK_ALL);
+
+				if (kernel == CLIP_KERNEL_SCALAR)
+					baseline[i] = trace;
+				else if (!CM_CompareTraces(&trace, &baseline[i])){
+					mismatches[kernel]++;
+
+					if (fabs(trace.fraction - baseline[i].fraction) > maxErrors[kernel])
+						maxErrors[kernel] = fabs(trace.fraction - baseline[i].fraction);
+				}
+			}
+
+			times[kernel] += Sys_GetClockTicks() - time;
+		}
+	}
+
+	CM_FreeTraceContext(&ctx);
+
+	Z_Free(queries);
+	Z_Free(baseline);
+
+	for (kernel = CLIP_KERNEL_SCALAR; kernel <= CLIP_KERNEL_AVX; kernel++){
+		if (kernel == CLIP_KERNEL_SCALAR)
+			Com_Printf("%-6s %i traces in %.3f seconds, %.0f traces/sec\n", kernelNames[kernel], numQueries, times[kernel], numQueries / times[kernel]);
+		else if (supported[kernel])
+			Com_Printf("%-6s %i traces in %.3f seconds, %.0f traces/sec, %i mismatches (largest fraction difference %g)\n", kernelNames[kernel], numQueries, times[kernel], numQueries / times[kernel], mismatches[kernel], maxErrors[kernel]);
+	}
+}
+
 
 /*
  =======================================================================
@@ -1609,6 +3067,76 @@ static void CM_DecompressVis (const byte *in, byte *out){
 	} while (vis - out < row);
 }
 
+/*
+ =================
+ CM_InitVisCache
+
+ Decompressed PVS / PHS rows are kept around, because the server asks
+ for the same few clusters many times each frame. If the budget set by
+ cm_visCacheSize can't hold every row, clusters share cache rows.
+ =================
+*/
+static void CM_InitVisCache (void){
+
+	int		size, i;
+
+	if (!cm.numClusters || !cm.numVisibility)
+		return;
+
+	cm.visRowSize = ((cm.numClusters+31)>>5)<<2;
+
+	size = cm_visCacheSize->integerValue << 10;
+	if (size <= 0)
+		return;
+
+	cm.numVisCacheRows = size / (cm.visRowSize * 2 + sizeof(int) * 2);
+	if (cm.numVisCacheRows > cm.numClusters)
+		cm.numVisCacheRows = cm.numClusters;
+	if (cm.numVisCacheRows < 1){
+		cm.numVisCacheRows = 0;
+		return;
+	}
+
+	cm.visCache = Z_Malloc(cm.numVisCacheRows * (cm.visRowSize * 2 + sizeof(int) * 2));
+	cm.visCacheClusters = (int *)(cm.visCache + cm.numVisCacheRows * cm.visRowSize * 2);
+
+	memset(cm.visCache, 0, cm.numVisCacheRows * cm.visRowSize * 2);
+
+	for (i = 0; i < cm.numVisCacheRows * 2; i++)
+		cm.visCacheClusters[i] = -1;
+
+	if (cm.numVisCacheRows < cm.numClusters)
+		Com_DPrintf("CM_InitVisCache: caching %i of %i clusters\n", cm.numVisCacheRows, cm.numClusters);
+}
+
+/*
+ =================
+ CM_CachedVis
+
+ Returns the decompressed row for the given cluster, or NULL if rows
+ aren't cached
+ =================
+*/
+static byte *CM_CachedVis (int cluster, int type){
+
+	byte	*row;
+	int		index;
+
+	if (!cm.numVisCacheRows)
+		return NULL;
+
+	index = type * cm.numVisCacheRows + cluster % cm.numVisCacheRows;
+	row = cm.visCache + index * cm.visRowSize;
+
+	if (cm.visCacheClusters[index] != cluster){
+		CM_DecompressVis((byte *)cm.visibility + cm.visibility->bitOfs[cluster][type], row);
+
+		cm.visCacheClusters[index] = cluster;
+	}
+
+	return row;
+}
+
 /*
  =================
  CM_ClusterPVS
@@ -1616,6 +3144,8 @@ static void CM_DecompressVis (const byte *in, byte *out){
 */
 byte *CM_ClusterPVS (int cluster){
 
+	byte	*row;
+
 	if (!cm.loaded || !cm.numClusters){
 		memset(cm_pvsRow, 0xFF, 1);
 		return cm_pvsRow;
@@ -1623,8 +3153,13 @@ byte *CM_ClusterPVS (int cluster){
 
 	if (cluster == -1 || cm.numVisibility == 0)
 		memset(cm_pvsRow, 0xFF, (cm.numClusters+7)>>3);
-	else
+	else {
+		row = CM_CachedVis(cluster, VIS_PVS);
+		if (row)
+			return row;
+
 		CM_DecompressVis((byte *)cm.visibility + cm.visibility->bitOfs[cluster][VIS_PVS], cm_pvsRow);
+	}
 
 	return cm_pvsRow;
 }
@@ -1636,6 +3171,8 @@ byte *CM_ClusterPVS (int cluster){
 */
 byte *CM_ClusterPHS (int cluster){
 
+	byte	*row;
+
 	if (!cm.loaded || !cm.numClusters){
 		memset(cm_phsRow, 0xFF, 1);
 		return cm_phsRow;
@@ -1643,8 +3180,13 @@ byte *CM_ClusterPHS (int cluster){
 
 	if (cluster == -1 || cm.numVisibility == 0)
 		memset(cm_phsRow, 0xFF, (cm.numClusters+7)>>3);
-	else
+	else {
+		row = CM_CachedVis(cluster, VIS_PHS);
+		if (row)
+			return row;
+
 		CM_DecompressVis((byte *)cm.visibility + cm.visibility->bitOfs[cluster][VIS_PHS], cm_phsRow);
+	}
 
 	return cm_phsRow;
 }
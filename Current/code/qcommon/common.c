@@ -38,11 +38,14 @@ static void		(*com_rdFlush)(int target, char *buffer);
 
 static FILE		*com_logFileHandle;
 
+static void		*com_mutex;
+
 static int		com_serverState;
 
 static qboolean	com_allowCheats;
 
 static jmp_buf	com_abortFrame;
+static jmp_buf	com_serverAbortFrame;
 
 qboolean		com_configModified = false;
 
@@ -68,6 +71,7 @@ cvar_t	*com_zoneMegs;
 cvar_t	*com_hunkMegs;
 cvar_t	*com_maxFPS;
 cvar_t	*com_logFile;
+cvar_t	*com_serverThread;
 
 
 /*
@@ -235,8 +239,15 @@ void Com_Printf (const char *fmt, ...){
 #endif
 	va_end(argPtr);
 
+	if (com_mutex)
+		Sys_LockMutex(com_mutex);
+
 	if (com_rdTarget){
 		Com_Redirect(string);
+
+		if (com_mutex)
+			Sys_UnlockMutex(com_mutex);
+
 		return;
 	}
 
@@ -255,6 +266,9 @@ void Com_Printf (const char *fmt, ...){
 
 		Com_LogPrint(string);
 	}
+
+	if (com_mutex)
+		Sys_UnlockMutex(com_mutex);
 }
 
 /*
@@ -343,8 +357,18 @@ void Com_Error (int code, const char *fmt, ...){
 		Com_Printf("ERROR: %s\n", string);
 		Com_Printf("*****************************\n");
 
+		// Wait for the server thread to finish its frame
+		Com_LockFrame();
+
 		SV_Shutdown(va("Server crashed: %s\n", string), false);
 
+		// The local client will be dropped by the server over the
+		// loopback, so just exit the server frame
+		if (!Sys_IsMainThread()){
+			recursive = false;
+			longjmp(com_serverAbortFrame, -1);
+		}
+
 		CL_Drop();
 
 		recursive = false;
@@ -493,6 +517,401 @@ void Com_Pause_f (void){
 }
 
 
+/*
+ =======================================================================
+
+ JOB THREADS
+
+ Jobs are handed out one index at a time to the calling thread and a
+ pool of worker threads, so uneven jobs balance themselves out
+
+ =======================================================================
+*/
+
+typedef struct {
+	int				numWorkers;
+	void			*workers[MAX_JOB_THREADS];
+	int				threadNums[MAX_JOB_THREADS];
+
+	void			*mutex;
+	void			*startSemaphore;
+	void			*doneSemaphore;
+
+	qboolean		quit;
+
+	void			(*func)(int job, int thread, void *data);
+	void			*data;
+	int				numJobs;
+	int				nextJob;
+} jobPool_t;
+
+static jobPool_t	com_jobs;
+
+
+/*
+ =================
+ Com_ExecuteJobs
+
+ Runs jobs until there are none left
+ =================
+*/
+static void Com_ExecuteJobs (int thread){
+
+	int		job;
+
+	while (1){
+		Sys_LockMutex(com_jobs.mutex);
+		job = com_jobs.nextJob++;
+		Sys_UnlockMutex(com_jobs.mutex);
+
+		if (job >= com_jobs.numJobs)
+			break;
+
+		com_jobs.func(job, thread, com_jobs.data);
+	}
+}
+
+/*
+ =================
+ Com_JobThread
+ =================
+*/
+static void Com_JobThread (void *data){
+
+	int		thread = *(int *)data;
+
+	while (1){
+		Sys_WaitSemaphore(com_jobs.startSemaphore);
+
+		if (com_jobs.quit)
+			break;
+
+		Com_ExecuteJobs(thread);
+
+		Sys_PostSemaphore(com_jobs.doneSemaphore);
+	}
+}
+
+/*
+ =================
+ Com_ShutdownJobs
+ =================
+*/
+static void Com_ShutdownJobs (void){
+
+	int		i;
+
+	if (!com_jobs.numWorkers)
+		return;
+
+	com_jobs.quit = true;
+
+	for (i = 0; i < com_jobs.numWorkers; i++)
+		Sys_PostSemaphore(com_jobs.startSemaphore);
+
+	for (i = 0; i < com_jobs.numWorkers; i++)
+		Sys_WaitForThread(com_jobs.workers[i]);
+
+	Sys_DestroySemaphore(com_jobs.startSemaphore);
+	Sys_DestroySemaphore(com_jobs.doneSemaphore);
+	Sys_DestroyMutex(com_jobs.mutex);
+
+	memset(&com_jobs, 0, sizeof(jobPool_t));
+}
+
+/*
+ =================
+ Com_InitJobs
+ =================
+*/
+static void Com_InitJobs (int numWorkers){
+
+	int		i;
+
+	com_jobs.mutex = Sys_CreateMutex();
+	com_jobs.startSemaphore = Sys_CreateSemaphore(0);
+	com_jobs.doneSemaphore = Sys_CreateSemaphore(0);
+
+	for (i = 0; i < numWorkers; i++){
+		com_jobs.threadNums[i] = i + 1;
+		com_jobs.workers[i] = Sys_CreateThread(Com_JobThread, &com_jobs.threadNums[i]);
+	}
+
+	com_jobs.numWorkers = numWorkers;
+
+	Com_DPrintf("Started %i job threads\n", numWorkers);
+}
+
+/*
+ =================
+ Com_RunJobs
+
+ Calls func for every job index in [0, numJobs) using up to numThreads
+ threads, including the calling one. func is also given the number of the
+ thread it runs on, 0 for the calling thread, so jobs can keep scratch
+ space per thread. Returns when all the jobs are done.
+ Jobs must not call Com_Error, failures have to be flagged and handled by
+ the calling thread once the jobs are done.
+ =================
+*/
+void Com_RunJobs (int numThreads, int numJobs, void (*func)(int job, int thread, void *data), void *data){
+
+	int		i;
+
+	if (numThreads > MAX_JOB_THREADS + 1)
+		numThreads = MAX_JOB_THREADS + 1;
+
+	// Run single threaded if we can
+	if (numThreads <= 1 || numJobs <= 1){
+		for (i = 0; i < numJobs; i++)
+			func(i, 0, data);
+
+		return;
+	}
+
+	// Start or restart the worker threads if needed
+	if (com_jobs.numWorkers != numThreads - 1){
+		Com_ShutdownJobs();
+		Com_InitJobs(numThreads - 1);
+	}
+
+	com_jobs.func = func;
+	com_jobs.data = data;
+	com_jobs.numJobs = numJobs;
+	com_jobs.nextJob = 0;
+
+	// Wake up the workers and help them out
+	for (i = 0; i < com_jobs.numWorkers; i++)
+		Sys_PostSemaphore(com_jobs.startSemaphore);
+
+	Com_ExecuteJobs(0);
+
+	for (i = 0; i < com_jobs.numWorkers; i++)
+		Sys_WaitSemaphore(com_jobs.doneSemaphore);
+}
+
+
+/*
+ =======================================================================
+
+ SERVER THREAD
+
+ A listen server can run on its own thread, so the client keeps drawing
+ while the game runs a heavy frame. The local client only talks to it
+ through the loopback buffers.
+
+ The server thread holds the frame lock while it runs a frame. The client
+ only takes it to read packets and execute commands, and skips those if the
+ server is in the middle of a frame, so it never waits for the game. The
+ systems both sides use at any time are guarded by Com_Lock.
+
+ =======================================================================
+*/
+
+#define SERVER_THREAD_MSEC		5		// How often the loopback is checked
+
+typedef struct {
+	void			*thread;
+	void			*frameMutex;
+	int				frameLocks[2];		// Indexed by Sys_IsMainThread
+	int				locks[2];			// Com_Lock depth, indexed by Sys_IsMainThread
+
+	qboolean		quit;
+} serverThread_t;
+
+static serverThread_t	com_server;
+
+
+/*
+ =================
+ Com_Lock
+ =================
+*/
+void Com_Lock (void){
+
+	if (!com_server.frameMutex)
+		return;
+
+	Sys_LockMutex(com_mutex);
+
+	com_server.locks[Sys_IsMainThread()]++;
+}
+
+/*
+ =================
+ Com_Unlock
+ =================
+*/
+void Com_Unlock (void){
+
+	if (!com_server.frameMutex)
+		return;
+
+	com_server.locks[Sys_IsMainThread()]--;
+
+	Sys_UnlockMutex(com_mutex);
+}
+
+/*
+ =================
+ Com_LockFrame
+ =================
+*/
+void Com_LockFrame (void){
+
+	if (!com_server.frameMutex)
+		return;
+
+	Sys_LockMutex(com_server.frameMutex);
+
+	com_server.frameLocks[Sys_IsMainThread()]++;
+}
+
+/*
+ =================
+ Com_TryLockFrame
+ =================
+*/
+qboolean Com_TryLockFrame (void){
+
+	if (!com_server.frameMutex)
+		return true;
+
+	if (!Sys_TryLockMutex(com_server.frameMutex))
+		return false;
+
+	com_server.frameLocks[Sys_IsMainThread()]++;
+
+	return true;
+}
+
+/*
+ =================
+ Com_UnlockFrame
+ =================
+*/
+void Com_UnlockFrame (void){
+
+	if (!com_server.frameMutex)
+		return;
+
+	com_server.frameLocks[Sys_IsMainThread()]--;
+
+	Sys_UnlockMutex(com_server.frameMutex);
+}
+
+/*
+ =================
+ Com_ReleaseFrame
+
+ Releases every frame lock and Com_Lock held by the calling thread, after
+ an error aborted the frame
+ =================
+*/
+static void Com_ReleaseFrame (void){
+
+	if (!com_server.frameMutex)
+		return;
+
+	while (com_server.locks[Sys_IsMainThread()])
+		Com_Unlock();
+
+	while (com_server.frameLocks[Sys_IsMainThread()])
+		Com_UnlockFrame();
+}
+
+/*
+ =================
+ Com_ServerFrame
+ =================
+*/
+static void Com_ServerFrame (void){
+
+	static int	lastTime;
+	int			timeout, time, msec;
+
+	if (setjmp(com_serverAbortFrame)){
+		// An error occurred, exit the entire frame
+		NetChan_ResetMessage();
+		Com_ReleaseFrame();
+		return;
+	}
+
+	// Sleep until a packet arrives or the next server frame is due, but
+	// keep checking for loopback packets from the local client
+	timeout = SV_FrameTimeout();
+	if (timeout > SERVER_THREAD_MSEC)
+		timeout = SERVER_THREAD_MSEC;
+
+	NET_Sleep(timeout);
+
+	Com_LockFrame();
+
+	time = Sys_Milliseconds();
+	if (lastTime > time)
+		lastTime = time;
+
+	msec = time - lastTime;
+	lastTime = time;
+
+	SV_Frame(msec);
+
+	Com_UnlockFrame();
+}
+
+/*
+ =================
+ Com_ServerThread
+ =================
+*/
+static void Com_ServerThread (void *data){
+
+	while (!com_server.quit)
+		Com_ServerFrame();
+}
+
+/*
+ =================
+ Com_StartServerThread
+ =================
+*/
+static void Com_StartServerThread (void){
+
+	if (com_server.thread)
+		return;
+
+	com_server.frameMutex = Sys_CreateMutex();
+	com_server.quit = false;
+
+	com_server.thread = Sys_CreateThread(Com_ServerThread, NULL);
+
+	Com_DPrintf("Started server thread\n");
+}
+
+/*
+ =================
+ Com_StopServerThread
+ =================
+*/
+static void Com_StopServerThread (void){
+
+	if (!com_server.thread)
+		return;
+
+	// The server thread may be waiting for a frame lock held by us
+	Com_ReleaseFrame();
+
+	com_server.quit = true;
+
+	Sys_WaitForThread(com_server.thread);
+	Sys_DestroyMutex(com_server.frameMutex);
+
+	memset(&com_server, 0, sizeof(serverThread_t));
+
+	Com_DPrintf("Stopped server thread\n");
+}
+
+
 /*
  =======================================================================
 
@@ -608,8 +1027,21 @@ static void Com_ParseCommandLine (char *cmdLine){
 
 			com_argv[com_argc++] = cmdLine;
 
-			while (*cmdLine && ((*cmdLine > 32) && (*cmdLine <= 126)))
+			// Quoted arguments are kept together, quotes included, so
+			// they survive being turned back into commands
+			while (*cmdLine && ((*cmdLine > 32) && (*cmdLine <= 126))){
+				if (*cmdLine == '\"'){
+					cmdLine++;
+
+					while (*cmdLine && *cmdLine != '\"')
+						cmdLine++;
+
+					if (!*cmdLine)
+						break;
+				}
+
 				cmdLine++;
+			}
 
 			if (*cmdLine){
 				*cmdLine = 0;
@@ -633,6 +1065,9 @@ void Com_Init (char *cmdLine){
 	if (setjmp(com_abortFrame))
 		Sys_Error("Error during initialization");
 
+	// Printing may happen from more than one thread
+	com_mutex = Sys_CreateMutex();
+
 	Com_Printf("%s (%s)\n", Q2E_VERSION, __DATE__);
 
 	// We need to call Com_InitMemory twice, because some strings and
@@ -681,6 +1116,7 @@ void Com_Init (char *cmdLine){
 	com_hunkMegs = Cvar_Get("com_hunkMegs", "128", CVAR_ARCHIVE | CVAR_LATCH, "Reserved space for hunk memory in megabytes");
 	com_maxFPS = Cvar_Get("com_maxFPS", "0", CVAR_ARCHIVE, "Lock framerate");
 	com_logFile = Cvar_Get("com_logFile", "0", 0, "Log console messages");
+	com_serverThread = Cvar_Get("com_serverThread", "0", CVAR_ARCHIVE, "Run a listen server on its own thread");
 
 	Cmd_AddCommand("quit", Com_Quit_f, "Quit the game");
 	Cmd_AddCommand("error", Com_Error_f, "Test an error");
@@ -705,12 +1141,13 @@ void Com_Init (char *cmdLine){
 	// Add the late commands
 	if (com_dedicated->integerValue)
 		Com_AddLateCommands();
-	else
+	else {
 		Sys_ShowConsole(true);
 
 		// If the user didn't give any commands, play the logo cinematic
 		if (!Com_AddLateCommands())
 			Cbuf_AddText("cinematic idlog.cin\n");
+	}
 
 	Com_Printf("======= Quake II Evolved Initialized =======\n");
 
@@ -728,14 +1165,27 @@ void Com_Frame (void){
 	static int	lastTime;
 	int			msec, minMsec = 1;
 
-	if (setjmp(com_abortFrame))
-		return;			// An error occurred, exit the entire frame
+	if (setjmp(com_abortFrame)){
+		// An error occurred, exit the entire frame. The error could have
+		// left net_message pointing at a packet read in place.
+		NetChan_ResetMessage();
+		Com_ReleaseFrame();
+		return;
+	}
+
+	// Start or stop the server thread if needed
+	if (com_serverThread->integerValue && !com_dedicated->integerValue)
+		Com_StartServerThread();
+	else
+		Com_StopServerThread();
 
 	// Update the config file if needed
 	if (com_configModified){
 		com_configModified = false;
 
+		Com_Lock();
 		Com_WriteConfig("q2econfig.cfg");
+		Com_Unlock();
 	}
 
 	// Clear com_speeds statistics
@@ -753,6 +1203,11 @@ void Com_Frame (void){
 			minMsec = 1000 / com_maxFPS->integerValue;
 	}
 
+	// A dedicated server has nothing to draw, so sleep until a packet
+	// arrives or the next server frame is due
+	if (com_dedicated->integerValue)
+		NET_Sleep(SV_FrameTimeout());
+
 	// Main event loop
 	do {
 		com_frameTime = Sys_GetEvents();
@@ -782,17 +1237,24 @@ void Com_Frame (void){
 	if (msec < 1)
 		msec = 1;
 
-	// Process commands
-	Cbuf_Execute();
+	// Process commands and check if cheats are allowed, unless the server
+	// thread is in the middle of a frame
+	if (Com_TryLockFrame()){
+		Cvar_FreeRetiredValues();
 
-	// Check if cheats are allowed
-	Com_SetAllowCheats();
+		Cbuf_Execute();
+
+		Com_SetAllowCheats();
+
+		Com_UnlockFrame();
+	}
 
 	// Run server and client frames
 	if (com_speeds->integerValue)
 		com_timeBefore = Sys_Milliseconds();
 
-	SV_Frame(msec);
+	if (!com_server.thread)
+		SV_Frame(msec);
 
 	if (com_speeds->integerValue)
 		com_timeBetween = Sys_Milliseconds();
@@ -837,8 +1299,12 @@ void Com_Shutdown (void){
 
 	isDown = true;
 
+	if (Sys_IsMainThread())
+		Com_StopServerThread();
+
 	SV_Shutdown("Server quit\n", false);
 	CL_Shutdown();
+	Com_ShutdownJobs();
 	NET_Shutdown();
 	FS_Shutdown();
 	CL_ShutdownKeys();
@@ -35,6 +35,62 @@ cvar_t		*cvar_vars;
 qboolean	cvar_allowCheats = true;
 int			cvar_modifiedFlags = 0;
 
+typedef struct retiredValue_s {
+	char					*value;
+	struct retiredValue_s	*next;
+} retiredValue_t;
+
+static retiredValue_t	*cvar_retiredValues;
+
+
+/*
+ =================
+ Cvar_FreeValue
+
+ The client may be reading a value replaced on the server thread, so those
+ are kept until Cvar_FreeRetiredValues is called
+ =================
+*/
+static void Cvar_FreeValue (char *value){
+
+	retiredValue_t	*retired;
+
+	if (Sys_IsMainThread()){
+		FreeString(value);
+		return;
+	}
+
+	retired = Z_MallocSmall(sizeof(retiredValue_t));
+	retired->value = value;
+	retired->next = cvar_retiredValues;
+	cvar_retiredValues = retired;
+}
+
+/*
+ =================
+ Cvar_FreeRetiredValues
+
+ Frees the values replaced on the server thread. Must be called from the
+ main thread, while the server thread is out of its frame.
+ =================
+*/
+void Cvar_FreeRetiredValues (void){
+
+	retiredValue_t	*retired, *next;
+
+	Com_Lock();
+
+	for (retired = cvar_retiredValues; retired; retired = next){
+		next = retired->next;
+
+		FreeString(retired->value);
+		Z_Free(retired);
+	}
+
+	cvar_retiredValues = NULL;
+
+	Com_Unlock();
+}
 
 /*
  =================
@@ -112,14 +168,14 @@ cvar_t *Cvar_FindVariable (const char *name){
 
 /*
  =================
- Cvar_Get
+ Cvar_GetVariable
 
  If the variable already exists, the value will be set to the latched
  value (if any).
  The flags will be OR'ed in if the variable exists.
  =================
 */
-cvar_t *Cvar_Get (const char *name, const char *value, int flags, const char *description){
+static cvar_t *Cvar_GetVariable (const char *name, const char *value, int flags, const char *description){
 
 	cvar_t		*cvar;
 	unsigned	hash;
@@ -130,7 +186,7 @@ cvar_t *Cvar_Get (const char *name, const char *value, int flags, const char *de
 
 		// Update latched variables
 		if (cvar->latchedValue){
-			FreeString(cvar->value);
+			Cvar_FreeValue(cvar->value);
 
 			cvar->value = cvar->latchedValue;
 			cvar->floatValue = atof(cvar->latchedValue);
@@ -140,12 +196,12 @@ cvar_t *Cvar_Get (const char *name, const char *value, int flags, const char *de
 
 		// Reset value is always set internally
 		if (value){
-			FreeString(cvar->resetValue);
+			Cvar_FreeValue(cvar->resetValue);
 			cvar->resetValue = CopyString(value);
 
 			// Read only variables always use values set internally
 			if (cvar->flags & CVAR_ROM){
-				FreeString(cvar->value);
+				Cvar_FreeValue(cvar->value);
 
 				cvar->value = CopyString(value);
 				cvar->floatValue = atof(cvar->value);
@@ -217,12 +273,12 @@ cvar_t *Cvar_Get (const char *name, const char *value, int flags, const char *de
 
 /*
  =================
- Cvar_Set
+ Cvar_SetVariable
 
  Will create the variable if it doesn't exist
  =================
 */
-static cvar_t *Cvar_Set (const char *name, const char *value, int flags, qboolean force){
+static cvar_t *Cvar_SetVariable (const char *name, const char *value, int flags, qboolean force){
 
 	cvar_t	*cvar;
 
@@ -230,7 +286,7 @@ static cvar_t *Cvar_Set (const char *name, const char *value, int flags, qboolea
 
 	cvar = Cvar_FindVariable(name);
 	if (!cvar)	// Create it
-		return Cvar_Get(name, value, flags, NULL);
+		return Cvar_GetVariable(name, value, flags, NULL);
 
 	cvar->flags |= flags;
 
@@ -269,7 +325,7 @@ static cvar_t *Cvar_Set (const char *name, const char *value, int flags, qboolea
 				if (!Q_stricmp(cvar->latchedValue, value))
 					return cvar;
 
-				FreeString(cvar->latchedValue);
+				Cvar_FreeValue(cvar->latchedValue);
 				cvar->latchedValue = NULL;
 			}
 
@@ -284,7 +340,7 @@ static cvar_t *Cvar_Set (const char *name, const char *value, int flags, qboolea
 	}
 	else {
 		if (cvar->latchedValue){
-			FreeString(cvar->latchedValue);
+			Cvar_FreeValue(cvar->latchedValue);
 			cvar->latchedValue = NULL;
 		}
 	}
@@ -292,7 +348,7 @@ static cvar_t *Cvar_Set (const char *name, const char *value, int flags, qboolea
 	if (!Q_stricmp(cvar->value, value))
 		return cvar;		// Not changed
 
-	FreeString(cvar->value);
+	Cvar_FreeValue(cvar->value);
 
 	cvar->value = CopyString(value);
 	cvar->floatValue = atof(cvar->value);
@@ -306,6 +362,38 @@ static cvar_t *Cvar_Set (const char *name, const char *value, int flags, qboolea
 	return cvar;
 }
 
+/*
+ =================
+ Cvar_Get
+ =================
+*/
+cvar_t *Cvar_Get (const char *name, const char *value, int flags, const char *description){
+
+	cvar_t	*cvar;
+
+	Com_Lock();
+	cvar = Cvar_GetVariable(name, value, flags, description);
+	Com_Unlock();
+
+	return cvar;
+}
+
+/*
+ =================
+ Cvar_Set
+ =================
+*/
+static cvar_t *Cvar_Set (const char *name, const char *value, int flags, qboolean force){
+
+	cvar_t	*cvar;
+
+	Com_Lock();
+	cvar = Cvar_SetVariable(name, value, flags, force);
+	Com_Unlock();
+
+	return cvar;
+}
+
 /*
  =================
  Cvar_GetString
@@ -460,12 +548,13 @@ qboolean Cvar_Command (void){
  Cvar_BitInfo
  =================
 */
-static char *Cvar_BitInfo (int bit){
+static char *Cvar_BitInfo (int bit, char *info){
 
-	static char	info[MAX_INFO_STRING];
 	char		value[MAX_INFO_VALUE];
 	cvar_t		*cvar;
 
+	Com_Lock();
+
 	info[0] = 0;
 
 	for (cvar = cvar_vars; cvar; cvar = cvar->next){
@@ -480,6 +569,8 @@ static char *Cvar_BitInfo (int bit){
 			Info_SetValueForKey(info, cvar->name, cvar->value);
 	}
 
+	Com_Unlock();
+
 	return info;
 }
 
@@ -492,7 +583,9 @@ static char *Cvar_BitInfo (int bit){
 */
 char *Cvar_UserInfo (void){
 
-	return Cvar_BitInfo(CVAR_USERINFO);
+	static char	info[MAX_INFO_STRING];
+
+	return Cvar_BitInfo(CVAR_USERINFO, info);
 }
 
 /*
@@ -504,7 +597,9 @@ char *Cvar_UserInfo (void){
 */
 char *Cvar_ServerInfo (void){
 
-	return Cvar_BitInfo(CVAR_SERVERINFO);
+	static char	info[MAX_INFO_STRING];
+
+	return Cvar_BitInfo(CVAR_SERVERINFO, info);
 }
 
 /*
@@ -913,6 +1008,8 @@ void Cvar_Shutdown (void){
 	Cmd_RemoveCommand("reset");
 	Cmd_RemoveCommand("cvar_restart");
 	Cmd_RemoveCommand("listCvars");
+
+	Cvar_FreeRetiredValues();
 }
 
 
@@ -985,17 +1082,21 @@ gamecvar_t *Cvar_GameUpdateOrCreate (cvar_t *cvar){
 */
 gamecvar_t *Cvar_GameGet (char *name, char *value, int flags){
 
-	cvar_t	*cvar;
+	cvar_t		*cvar;
+	gamecvar_t	*gameVar;
 
 	// HACK: the game library may want to know the game dir
 	if (!Q_stricmp(name, "game"))
 		name = "fs_game";
 
-	cvar = Cvar_Get(name, value, flags | CVAR_GAMEVAR, NULL);
-	if (!cvar)
-		return NULL;
+	Com_Lock();
 
-	return Cvar_GameUpdateOrCreate(cvar);
+	cvar = Cvar_GetVariable(name, value, flags | CVAR_GAMEVAR, NULL);
+	gameVar = (cvar) ? Cvar_GameUpdateOrCreate(cvar) : NULL;
+
+	Com_Unlock();
+
+	return gameVar;
 }
 
 /*
@@ -1005,13 +1106,17 @@ gamecvar_t *Cvar_GameGet (char *name, char *value, int flags){
 */
 gamecvar_t *Cvar_GameSet (char *name, char *value){
 
-	cvar_t	*cvar;
+	cvar_t		*cvar;
+	gamecvar_t	*gameVar;
 
-	cvar = Cvar_Set(name, value, CVAR_GAMEVAR, true);
-	if (!cvar)
-		return NULL;
+	Com_Lock();
 
-	return Cvar_GameUpdateOrCreate(cvar);
+	cvar = Cvar_SetVariable(name, value, CVAR_GAMEVAR, true);
+	gameVar = (cvar) ? Cvar_GameUpdateOrCreate(cvar) : NULL;
+
+	Com_Unlock();
+
+	return gameVar;
 }
 
 /*
@@ -1021,11 +1126,15 @@ gamecvar_t *Cvar_GameSet (char *name, char *value){
 */
 gamecvar_t *Cvar_GameForceSet (char *name, char *value){
 
-	cvar_t	*cvar;
+	cvar_t		*cvar;
+	gamecvar_t	*gameVar;
 
-	cvar = Cvar_Set(name, value, CVAR_GAMEVAR, true);
-	if (!cvar)
-		return NULL;
+	Com_Lock();
+
+	cvar = Cvar_SetVariable(name, value, CVAR_GAMEVAR, true);
+	gameVar = (cvar) ? Cvar_GameUpdateOrCreate(cvar) : NULL;
 
-	return Cvar_GameUpdateOrCreate(cvar);
+	Com_Unlock();
+
+	return gameVar;
 }
@@ -382,7 +382,10 @@ int FS_OpenFile (const char *name, fileHandle_t *f, fsMode_t mode){
 		return -1;
 	}
 
-	// Create a new file handle
+	// Create a new file handle. The local server may open files on its
+	// own thread.
+	Com_Lock();
+
 	file = FS_HandleForFile(f);
 
 	file->active = true;
@@ -391,6 +394,8 @@ int FS_OpenFile (const char *name, fileHandle_t *f, fsMode_t mode){
 	file->realFile = realFile;
 	file->zipFile = zipFile;
 
+	Com_Unlock();
+
 	return size;
 }
 
@@ -412,7 +417,9 @@ void FS_CloseFile (fileHandle_t f){
 		unzClose(file->zipFile);
 	}
 
+	Com_Lock();
 	memset(file, 0, sizeof(file_t));
+	Com_Unlock();
 }
 
 /*
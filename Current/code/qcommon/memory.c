@@ -146,6 +146,8 @@ void *Z_TagMalloc (int size, int tag){
 	memBlock_t	*start, *rover, *block, *fragment;
 	int			extra;
 
+	Com_Lock();
+
 	// If main zone is not initialized or tag is -1 use the small zone
 	if (mainZone == NULL || tag == -1)
 		zone = smallZone;
@@ -217,6 +219,8 @@ void *Z_TagMalloc (int size, int tag){
 	// Marker for memory trash testing
 	*(int *)((byte *)block + block->size - sizeof(int)) = ZONEID;
 
+	Com_Unlock();
+
 	return (void *)((byte *)block + sizeof(memBlock_t));
 }
 
@@ -248,6 +252,8 @@ void Z_Free (void *ptr){
 
 	zone = block->zone;
 
+	Com_Lock();
+
 	// Decrement counters
 	zone->blocks--;
 	zone->bytes -= block->size;
@@ -279,6 +285,8 @@ void Z_Free (void *ptr){
 		if (other == zone->rover)
 			zone->rover = block;
 	}
+
+	Com_Unlock();
 }
 
 /*
@@ -290,6 +298,8 @@ void Z_FreeTags (int tag){
 
 	memZone_t	*zone;
 
+	Com_Lock();
+
 	// Small zone
 	zone = smallZone;
 
@@ -315,6 +325,8 @@ void Z_FreeTags (int tag){
 
 		zone->rover = zone->rover->next;
 	} while (zone->rover != &zone->blockList);
+
+	Com_Unlock();
 }
 
 
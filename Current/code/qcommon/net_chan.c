@@ -27,12 +27,39 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
  PACKET HEADER
  -------------
- 31	sequence
+ 29	sequence
+ 1	is this packet a fragment of a larger message
+ 1	is the payload Huffman compressed
  1	does this message contain a reliable payload
  31	acknowledge sequence
  1	acknowledge receipt of even/odd message
  16	qport
 
+ FRAGMENT HEADER
+ ---------------
+ 16	start offset of the fragment in the message payload
+ 16	fragment length
+
+ A message that doesn't fit in a single packet is split into fragments
+ of FRAGMENT_SIZE bytes, all sent at once with the same sequence. The
+ last fragment is shorter than FRAGMENT_SIZE, and may be empty. The
+ receiver collects the fragments in any order and processes the message
+ once all of them arrived. A partial message is thrown away when a
+ fragment of a newer message arrives or after FRAGMENT_TIMEOUT.
+
+ The remote side only gets messages larger than a packet if it said it
+ can reassemble them, see NetChan_SetMaxMessageLength. Loopback messages
+ are never fragmented.
+
+ A compressed payload is the reliable part (if any) and the unreliable
+ part, each written as a short with its uncompressed length followed by
+ the Huffman codes. The reliable part uses an adaptive code, the
+ unreliable part uses the static code. A packet is only sent compressed
+ if that makes it smaller.
+
+ The server compresses packets to clients that ask for it in their user
+ info. Clients compress their packets as long as the server does.
+
  The remote connection never knows if it missed a reliable message, the
  local side detects that it has been dropped by seeing a sequence
  acknowledge higher than the last reliable sequence, but without the
@@ -90,6 +117,13 @@ cvar_t		*net_qport;
 cvar_t		*net_showPackets;
 cvar_t		*net_showDrop;
 
+#define	SEQUENCE_COMPRESSED		(1<<30)
+#define	SEQUENCE_FRAGMENTED		(1<<29)
+#define	SEQUENCE_MASK			((1<<29)-1)
+
+#define	FRAGMENT_SIZE			(MAX_PACKETLEN - 100)
+#define	FRAGMENT_TIMEOUT		1000
+
 
 /*
  =================
@@ -108,6 +142,20 @@ void NetChan_Init (void){
 	net_showDrop = Cvar_Get("net_showDrop", "0", 0, "Report dropped packets");
 
 	MSG_Init(&net_message, net_messageBuffer, sizeof(net_messageBuffer), false);
+
+	Huff_Init();
+}
+
+/*
+ =================
+ NetChan_ResetMessage
+
+ Points net_message back at its own buffer
+ =================
+*/
+void NetChan_ResetMessage (void){
+
+	MSG_Init(&net_message, net_messageBuffer, sizeof(net_messageBuffer), false);
 }
 
 /*
@@ -119,7 +167,7 @@ void NetChan_Init (void){
 */
 void NetChan_OutOfBand (netSrc_t sock, const netAdr_t adr, const void *data, int length){
 
-	byte	buffer[MAX_MSGLEN];
+	byte	buffer[MAX_PACKETLEN];
 	msg_t	msg;
 
 	// Write the packet header
@@ -141,12 +189,12 @@ void NetChan_OutOfBand (netSrc_t sock, const netAdr_t adr, const void *data, int
 */
 void NetChan_OutOfBandPrint (netSrc_t sock, const netAdr_t adr, const char *fmt, ...){
 
-	char	string[MAX_MSGLEN - 4];
+	char	string[MAX_PACKETLEN - 4];
 	va_list	argPtr;
 
 	va_start(argPtr, fmt);
 #ifdef SECURE
-	vsnprintf_s(string, sizeof(string), MAX_MSGLEN - 4, fmt, argPtr);
+	vsnprintf_s(string, sizeof(string), MAX_PACKETLEN - 4, fmt, argPtr);
 #else
 	vsnprintf(string, sizeof(string), fmt, argPtr);
 #endif
@@ -173,7 +221,144 @@ void NetChan_Setup (netSrc_t sock, netChan_t *chan, const netAdr_t adr, int qpor
 	chan->incomingSequence = 0;
 	chan->outgoingSequence = 1;
 
-	MSG_Init(&chan->message, chan->messageBuffer, sizeof(chan->messageBuffer), true);
+	// Assume the remote side can't reassemble fragmented messages
+	chan->maxMessageLength = MAX_PACKETLEN;
+
+	MSG_Init(&chan->message, chan->messageBuffer, MAX_PACKETLEN - 16, true);
+}
+
+/*
+ =================
+ NetChan_SetMaxMessageLength
+
+ Sets the largest message the remote side can reassemble. Must be called
+ before anything is written to the channel.
+ =================
+*/
+void NetChan_SetMaxMessageLength (netChan_t *chan, int length){
+
+	if (length < MAX_PACKETLEN)
+		length = MAX_PACKETLEN;
+	else if (length > MAX_MSGLEN)
+		length = MAX_MSGLEN;
+
+	chan->maxMessageLength = length;
+
+	MSG_Init(&chan->message, chan->messageBuffer, length - 16, true);
+}
+
+/*
+ =================
+ NetChan_Compress
+
+ Writes the compressed packet payload. Returns false as soon as it doesn't
+ fit in the message.
+ =================
+*/
+static qboolean NetChan_Compress (netChan_t *chan, msg_t *msg, qboolean sendReliable, const byte *data, int length){
+
+	if (sendReliable){
+		if (msg->curSize + 2 > msg->maxSize)
+			return false;
+
+		MSG_WriteShort(msg, chan->reliableLength);
+
+		if (!Huff_Encode(msg, chan->reliableBuffer, chan->reliableLength, true))
+			return false;
+	}
+
+	if (msg->curSize + 2 > msg->maxSize)
+		return false;
+
+	MSG_WriteShort(msg, length);
+
+	return Huff_Encode(msg, data, length, false);
+}
+
+/*
+ =================
+ NetChan_Decompress
+
+ Replaces the compressed payload of the message with the uncompressed
+ one. Returns false if the payload is corrupt.
+ =================
+*/
+static qboolean NetChan_Decompress (msg_t *msg, qboolean reliable){
+
+	byte	buffer[MAX_MSGLEN];
+	int		headerSize, size, length;
+
+	headerSize = msg->readCount;
+	size = 0;
+
+	if (reliable){
+		length = MSG_ReadShort(msg);
+		if (length < 0 || length > sizeof(buffer))
+			return false;
+
+		if (!Huff_Decode(msg, buffer, length, true))
+			return false;
+
+		size = length;
+	}
+
+	length = MSG_ReadShort(msg);
+	if (length < 0 || size + length > sizeof(buffer))
+		return false;
+
+	if (!Huff_Decode(msg, buffer + size, length, false))
+		return false;
+
+	size += length;
+
+	if (msg->readCount != msg->curSize || headerSize + size > msg->maxSize)
+		return false;
+
+	memcpy(msg->data + headerSize, buffer, size);
+
+	msg->curSize = headerSize + size;
+	msg->readCount = headerSize;
+	msg->bit = 0;
+
+	return true;
+}
+
+/*
+ =================
+ NetChan_TransmitFragments
+
+ Sends a message that doesn't fit in a single packet as several fragments
+ =================
+*/
+static int NetChan_TransmitFragments (netChan_t *chan, unsigned sequence, const msg_t *msg, int headerSize){
+
+	byte	buffer[MAX_PACKETLEN];
+	msg_t	fragment;
+	int		start = 0, length, bytes = 0;
+
+	// A message that is a multiple of FRAGMENT_SIZE ends with an empty
+	// fragment, so the receiver knows there are no more to follow
+	do {
+		length = msg->curSize - headerSize - start;
+		if (length > FRAGMENT_SIZE)
+			length = FRAGMENT_SIZE;
+
+		MSG_Init(&fragment, buffer, sizeof(buffer), false);
+
+		MSG_WriteLong(&fragment, sequence);
+		MSG_Write(&fragment, msg->data + 4, headerSize - 4);
+
+		MSG_WriteShort(&fragment, start);
+		MSG_WriteShort(&fragment, length);
+		MSG_Write(&fragment, msg->data + headerSize + start, length);
+
+		NET_SendPacket(chan->sock, chan->remoteAddress, fragment.data, fragment.curSize);
+
+		bytes += fragment.curSize;
+		start += length;
+	} while (length == FRAGMENT_SIZE);
+
+	return bytes;
 }
 
 /*
@@ -185,19 +370,23 @@ void NetChan_Setup (netSrc_t sock, netChan_t *chan, const netAdr_t adr, int qpor
 
  A 0 length will still generate a packet and deal with the reliable 
  messages.
+
+ Returns the number of bytes sent.
  =================
 */
-void NetChan_Transmit (netChan_t *chan, const void *data, int length){
+int NetChan_Transmit (netChan_t *chan, const void *data, int length){
 
-	byte		buffer[MAX_MSGLEN];
-	msg_t		msg;
+	byte		buffer[MAX_MSGLEN], *loopBuffer;
+	byte		compressedBuffer[MAX_MSGLEN];
+	msg_t		msg, compressed;
 	qboolean	sendReliable = false;
 	unsigned	w1, w2;
+	int			headerSize, bytes;
 
 	// Check for message overflow
 	if (chan->message.overflowed){
 		Com_Printf(S_COLOR_YELLOW "%s: outgoing message overflow\n", NET_AdrToString(chan->remoteAddress));
-		return;
+		return 0;
 	}
 
 	// If the remote side dropped the last reliable message, resend it
@@ -216,10 +405,19 @@ void NetChan_Transmit (netChan_t *chan, const void *data, int length){
 		chan->reliableSequence ^= 1;
 	}
 
-	// Write the packet header
-	MSG_Init(&msg, buffer, sizeof(buffer), false);
+	// Write the packet header. Loopback packets are written straight into
+	// the buffer the local peer reads them from.
+	if (chan->remoteAddress.type == NA_LOOPBACK)
+		loopBuffer = NET_LoopBuffer(chan->sock, chan->maxMessageLength);
+	else
+		loopBuffer = NULL;
+
+	if (loopBuffer)
+		MSG_Init(&msg, loopBuffer, chan->maxMessageLength, false);
+	else
+		MSG_Init(&msg, buffer, chan->maxMessageLength, false);
 
-	w1 = (chan->outgoingSequence & ~(1<<31)) | (sendReliable<<31);
+	w1 = (chan->outgoingSequence & SEQUENCE_MASK) | (sendReliable<<31);
 	w2 = (chan->incomingSequence & ~(1<<31)) | (chan->incomingReliableSequence<<31);
 
 	chan->outgoingSequence++;
@@ -229,8 +427,10 @@ void NetChan_Transmit (netChan_t *chan, const void *data, int length){
 	MSG_WriteLong(&msg, w2);
 
 	// Send the qport if we are a client
-	if (chan->sock == NS_CLIENT)
-		MSG_WriteShort(&msg, net_qport->integerValue);
+	if (chan->sock != NS_SERVER)
+		MSG_WriteShort(&msg, chan->qport);
+
+	headerSize = msg.curSize;
 
 	// Copy the reliable message to the packet first
 	if (sendReliable){
@@ -241,11 +441,35 @@ void NetChan_Transmit (netChan_t *chan, const void *data, int length){
 	// Add the unreliable part if space is available
 	if (msg.maxSize - msg.curSize >= length)
 		MSG_Write(&msg, data, length);
-	else
+	else {
 		Com_Printf(S_COLOR_YELLOW "%s: dumped unreliable\n", NET_AdrToString(chan->remoteAddress));
+		length = 0;
+	}
 
-	// Send the datagram
-	NET_SendPacket(chan->sock, chan->remoteAddress, msg.data, msg.curSize);
+	// Compress the payload if that makes the packet smaller. The
+	// compressed packet is given less room than the uncompressed one, so
+	// coding stops as soon as it isn't worth it.
+	if (chan->compression && msg.curSize > headerSize){
+		MSG_Init(&compressed, compressedBuffer, msg.curSize - 1, false);
+
+		MSG_WriteLong(&compressed, w1 | SEQUENCE_COMPRESSED);
+		MSG_Write(&compressed, msg.data + 4, headerSize - 4);
+
+		if (NetChan_Compress(chan, &compressed, sendReliable, (const byte *)data, length)){
+			msg = compressed;
+			w1 |= SEQUENCE_COMPRESSED;
+		}
+	}
+
+	// Send the datagram, split into fragments if it doesn't fit in a
+	// single packet
+	if (msg.curSize > MAX_PACKETLEN && chan->remoteAddress.type != NA_LOOPBACK)
+		bytes = NetChan_TransmitFragments(chan, w1 | SEQUENCE_FRAGMENTED, &msg, headerSize);
+	else {
+		NET_SendPacket(chan->sock, chan->remoteAddress, msg.data, msg.curSize);
+
+		bytes = msg.curSize;
+	}
 
 	if (net_showPackets->integerValue){
 		if (chan->sock == NS_CLIENT)
@@ -258,6 +482,95 @@ void NetChan_Transmit (netChan_t *chan, const void *data, int length){
 		else
 			Com_Printf("send %4i : s=%i ack=%i rack=%i\n", msg.curSize, chan->outgoingSequence - 1, chan->incomingSequence, chan->incomingReliableSequence);
 	}
+
+	return bytes;
+}
+
+/*
+ =================
+ NetChan_Reassemble
+
+ Adds a fragment to the partial message. Once all the fragments arrived
+ the fragment payload is replaced with the whole message and true is
+ returned.
+ =================
+*/
+static qboolean NetChan_Reassemble (netChan_t *chan, msg_t *msg, int sequence, int start, int length){
+
+	int		time = Sys_Milliseconds();
+	int		index;
+
+	if (start < 0 || start % FRAGMENT_SIZE || length < 0 || length > FRAGMENT_SIZE){
+		if (net_showDrop->integerValue)
+			Com_Printf("%s: bad fragment %i at %i\n", NET_AdrToString(chan->remoteAddress), start, sequence);
+
+		return false;
+	}
+
+	if (start + length > sizeof(chan->fragmentBuffer) || msg->readCount + length != msg->curSize){
+		if (net_showDrop->integerValue)
+			Com_Printf("%s: bad fragment %i at %i\n", NET_AdrToString(chan->remoteAddress), start, sequence);
+
+		return false;
+	}
+
+	// A fragment of an older message came in late
+	if (sequence < chan->fragmentSequence)
+		return false;
+
+	// Start collecting a new message, throwing away any partial one
+	if (sequence > chan->fragmentSequence){
+		chan->fragmentSequence = sequence;
+		chan->fragmentTime = time;
+		chan->fragmentMask = 0;
+		chan->fragmentCount = 0;
+		chan->fragmentLength = 0;
+	}
+	else if (time - chan->fragmentTime > FRAGMENT_TIMEOUT){
+		if (chan->fragmentMask && net_showDrop->integerValue)
+			Com_Printf("%s: fragmented message %i timed out\n", NET_AdrToString(chan->remoteAddress), sequence);
+
+		chan->fragmentMask = 0;
+		chan->fragmentCount = 0;
+
+		return false;
+	}
+
+	index = start / FRAGMENT_SIZE;
+
+	// The last fragment is shorter than the others, and tells how many
+	// there are
+	if (length < FRAGMENT_SIZE){
+		if (chan->fragmentCount && chan->fragmentCount != index + 1)
+			return false;
+
+		chan->fragmentCount = index + 1;
+		chan->fragmentLength = start + length;
+	}
+	else if (chan->fragmentCount && index >= chan->fragmentCount)
+		return false;
+
+	memcpy(chan->fragmentBuffer + start, msg->data + msg->readCount, length);
+	chan->fragmentMask |= (1 << index);
+
+	// Wait for the rest of the message
+	if (!chan->fragmentCount || chan->fragmentMask != (1 << chan->fragmentCount) - 1)
+		return false;
+
+	chan->fragmentMask = 0;
+	chan->fragmentCount = 0;
+
+	// The fragment header is not needed anymore, so the payload is copied
+	// over it and only the packet header counts against the buffer size
+	msg->readCount -= 4;
+
+	if (msg->readCount + chan->fragmentLength > msg->maxSize)
+		return false;
+
+	memcpy(msg->data + msg->readCount, chan->fragmentBuffer, chan->fragmentLength);
+	msg->curSize = msg->readCount + chan->fragmentLength;
+
+	return true;
 }
 
 /*
@@ -272,6 +585,8 @@ qboolean NetChan_Process (netChan_t *chan, msg_t *msg){
 
 	unsigned	sequence, sequenceAck;
 	unsigned	reliableAck, reliableMessage;
+	qboolean	compressedMessage, fragmentedMessage;
+	int			fragmentStart = 0, fragmentLength = 0;
 	int			qport;
 
 	MSG_BeginReading(msg);
@@ -286,10 +601,18 @@ qboolean NetChan_Process (netChan_t *chan, msg_t *msg){
 
 	reliableMessage = sequence >> 31;
 	reliableAck = sequenceAck >> 31;
+	compressedMessage = (sequence & SEQUENCE_COMPRESSED) != 0;
+	fragmentedMessage = (sequence & SEQUENCE_FRAGMENTED) != 0;
 
-	sequence &= ~(1<<31);
+	sequence &= SEQUENCE_MASK;
 	sequenceAck &= ~(1<<31);	
 
+	// Read the fragment header
+	if (fragmentedMessage){
+		fragmentStart = MSG_ReadShort(msg);
+		fragmentLength = MSG_ReadShort(msg);
+	}
+
 	if (net_showPackets->integerValue){
 		if (chan->sock == NS_CLIENT)
 			Com_Printf("CL ");
@@ -310,6 +633,27 @@ qboolean NetChan_Process (netChan_t *chan, msg_t *msg){
 		return false;
 	}
 
+	// Collect the fragments until the whole message arrived
+	if (fragmentedMessage){
+		if (!NetChan_Reassemble(chan, msg, sequence, fragmentStart, fragmentLength))
+			return false;
+	}
+
+	// Uncompress the payload before anything is changed, so a corrupt
+	// packet is simply dropped
+	if (compressedMessage){
+		if (!NetChan_Decompress(msg, reliableMessage)){
+			if (net_showDrop->integerValue)
+				Com_Printf("%s: corrupt compressed packet %i\n", NET_AdrToString(chan->remoteAddress), sequence);
+
+			return false;
+		}
+	}
+
+	// Clients compress their packets as long as the server does
+	if (chan->sock != NS_SERVER)
+		chan->compression = compressedMessage;
+
 	// Dropped packets don't keep the message from being used
 	chan->dropped = sequence - (chan->incomingSequence+1);
 	if (chan->dropped > 0){
@@ -0,0 +1,334 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+// net_huff.c -- Huffman coding of netchan payloads
+
+
+#include "qcommon.h"
+
+
+#define HUFF_MAX_BITS			32
+
+#define HUFF_ADAPT_INTERVAL		64		// Rebuild the adaptive code after this many symbols, then at every doubling
+#define HUFF_ADAPT_WEIGHT		16		// Weight of a seen symbol against the starting weights
+
+typedef struct {
+	int			weights[256];
+
+	int			lengths[256];
+	unsigned	codes[256];				// Bit reversed, so they can be written LSB first
+
+	int			count[HUFF_MAX_BITS+1];	// Number of codes of each length
+	unsigned	firstCode[HUFF_MAX_BITS+1];
+	int			firstSymbol[HUFF_MAX_BITS+1];
+	byte		symbols[256];			// Sorted by code
+} huffCode_t;
+
+// Hand-tuned symbol weights, scaled to a total of about 16384. Reliable
+// payloads are mostly config strings, prints and stufftext, so their
+// weights follow lower case text and digits. Unreliable ones are mostly
+// snapshots and user commands, where zero and small values dominate.
+static const int	huff_reliableWeights[256] = {
+	1491, 105, 329, 33, 98, 128, 2, 2, 151, 433, 65, 25, 77, 449, 149, 1,
+	1, 1, 1, 1, 1, 149, 1, 1, 1, 1, 1, 1, 74, 2, 2, 2,
+	931, 15, 73, 44, 16, 16, 16, 19, 14, 15, 57, 17, 88, 79, 173, 287,
+	271, 279, 234, 76, 152, 93, 142, 66, 135, 81, 7, 7, 81, 7, 7, 7,
+	7, 40, 23, 49, 30, 40, 9, 14, 16, 9, 7, 12, 7, 21, 2, 30,
+	30, 5, 28, 44, 30, 2, 2, 2, 2, 2, 2, 2, 128, 2, 2, 107,
+	2, 700, 310, 191, 423, 620, 201, 318, 125, 457, 37, 40, 305, 538, 535, 329,
+	167, 21, 437, 349, 631, 249, 230, 163, 129, 124, 23, 1, 1, 1, 1, 1,
+	149, 1, 1, 149, 1, 1, 1, 1, 1, 1, 149, 2, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 74, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 74, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 74, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 74, 1, 1, 1
+};
+
+static const int	huff_unreliableWeights[256] = {
+	3957, 957, 649, 125, 143, 103, 79, 71, 97, 51, 246, 151, 89, 22, 57, 26,
+	65, 104, 86, 30, 106, 33, 60, 26, 29, 12, 18, 36, 104, 20, 17, 28,
+	184, 30, 28, 14, 16, 34, 27, 31, 33, 32, 46, 25, 115, 23, 42, 52,
+	57, 146, 53, 41, 34, 31, 30, 19, 34, 33, 21, 35, 95, 22, 28, 165,
+	70, 25, 12, 31, 23, 17, 13, 13, 22, 12, 212, 14, 14, 16, 15, 11,
+	23, 13, 10, 19, 33, 20, 19, 22, 41, 19, 44, 23, 18, 16, 16, 15,
+	17, 32, 100, 21, 433, 21, 19, 23, 19, 32, 13, 13, 21, 12, 32, 14,
+	18, 21, 21, 20, 25, 17, 13, 11, 13, 11, 14, 16, 22, 12, 88, 94,
+	954, 96, 64, 14, 20, 15, 42, 55, 23, 12, 122, 13, 17, 9, 24, 50,
+	97, 11, 10, 16, 29, 10, 14, 43, 11, 10, 12, 8, 19, 18, 28, 100,
+	12, 31, 12, 9, 11, 9, 11, 12, 12, 12, 11, 10, 14, 9, 12, 9,
+	35, 10, 18, 20, 13, 19, 22, 11, 17, 10, 11, 11, 11, 15, 10, 14,
+	116, 318, 19, 20, 25, 17, 12, 16, 415, 12, 58, 30, 96, 34, 47, 15,
+	32, 19, 17, 28, 15, 11, 13, 26, 12, 10, 14, 12, 78, 16, 11, 14,
+	15, 17, 14, 15, 14, 16, 11, 14, 17, 11, 39, 40, 96, 13, 13, 9,
+	20, 12, 20, 24, 12, 18, 25, 10, 28, 17, 17, 25, 65, 47, 56, 376
+};
+
+static huffCode_t	huff_reliable;
+static huffCode_t	huff_unreliable;
+
+
+/*
+ =================
+ Huff_SortWeights
+ =================
+*/
+static int Huff_SortWeights (const void *elem1, const void *elem2){
+
+	const int	*w1 = (const int *)elem1;
+	const int	*w2 = (const int *)elem2;
+
+	// Ties are broken by symbol so both sides build the same code
+	if (w1[0] != w2[0])
+		return w1[0] - w2[0];
+
+	return w1[1] - w2[1];
+}
+
+/*
+ =================
+ Huff_BuildCode
+
+ Builds a canonical Huffman code from the current weights. All weights
+ must be positive so every symbol gets a code.
+ =================
+*/
+static void Huff_BuildCode (huffCode_t *huff){
+
+	int			leaves[256][2];
+	int			weights[511], parents[511], depths[511];
+	int			position[HUFF_MAX_BITS+1];
+	int			leaf, node, numNodes, next;
+	int			child[2];
+	int			i, j, length;
+	unsigned	code;
+
+	for (i = 0; i < 256; i++){
+		leaves[i][0] = huff->weights[i];
+		leaves[i][1] = i;
+	}
+
+	qsort(leaves, 256, sizeof(leaves[0]), Huff_SortWeights);
+
+	for (i = 0; i < 256; i++)
+		weights[i] = leaves[i][0];
+
+	// Internal nodes are created in ascending weight order, so the two
+	// lightest nodes are always at the front of one of the two queues
+	leaf = 0;
+	node = 256;
+
+	for (numNodes = 256; numNodes < 511; numNodes++){
+		for (j = 0; j < 2; j++){
+			if (leaf < 256 && (node == numNodes || weights[leaf] <= weights[node]))
+				child[j] = leaf++;
+			else
+				child[j] = node++;
+		}
+
+		weights[numNodes] = weights[child[0]] + weights[child[1]];
+		parents[child[0]] = numNodes;
+		parents[child[1]] = numNodes;
+	}
+
+	// Find the code lengths, the root is the last node
+	depths[510] = 0;
+
+	for (i = 509; i >= 0; i--)
+		depths[i] = depths[parents[i]] + 1;
+
+	memset(huff->count, 0, sizeof(huff->count));
+
+	for (i = 0; i < 256; i++){
+		length = depths[i];
+		if (length > HUFF_MAX_BITS)
+			Com_Error(ERR_FATAL, "Huff_BuildCode: code length %i > %i", length, HUFF_MAX_BITS);
+
+		huff->lengths[leaves[i][1]] = length;
+		huff->count[length]++;
+	}
+
+	// Assign the canonical codes, in symbol order within each length
+	code = 0;
+	next = 0;
+
+	for (length = 1; length <= HUFF_MAX_BITS; length++){
+		code = (code + huff->count[length-1]) << 1;
+
+		huff->firstCode[length] = code;
+		huff->firstSymbol[length] = next;
+
+		position[length] = next;
+		next += huff->count[length];
+	}
+
+	for (i = 0; i < 256; i++){
+		length = huff->lengths[i];
+		next = position[length]++;
+
+		huff->symbols[next] = i;
+
+		// Reverse the code
+		code = huff->firstCode[length] + (next - huff->firstSymbol[length]);
+
+		huff->codes[i] = 0;
+		for (j = 0; j < length; j++){
+			if (code & (1U << j))
+				huff->codes[i] |= 1U << (length - 1 - j);
+		}
+	}
+}
+
+/*
+ =================
+ Huff_DecodeSymbol
+ =================
+*/
+static int Huff_DecodeSymbol (const huffCode_t *huff, msg_t *msg){
+
+	unsigned	code = 0;
+	int			length;
+
+	for (length = 1; length <= HUFF_MAX_BITS; length++){
+		code = (code << 1) | MSG_ReadBits(msg, 1);
+
+		if (code - huff->firstCode[length] < (unsigned)huff->count[length])
+			return huff->symbols[huff->firstSymbol[length] + code - huff->firstCode[length]];
+	}
+
+	return -1;
+}
+
+/*
+ =================
+ Huff_InitAdaptive
+
+ The adaptive code starts out as the hand-tuned reliable code and follows
+ the statistics of the message as it goes
+ =================
+*/
+static void Huff_InitAdaptive (huffCode_t *huff){
+
+	*huff = huff_reliable;
+}
+
+/*
+ =================
+ Huff_Adapt
+ =================
+*/
+static void Huff_Adapt (huffCode_t *huff, int symbol, int index){
+
+	int		count = index + 1;
+
+	huff->weights[symbol] += HUFF_ADAPT_WEIGHT;
+
+	// Rebuilding is much slower than coding, so a whole message only
+	// costs a few rebuilds
+	if (count >= HUFF_ADAPT_INTERVAL && !(count & (count - 1)))
+		Huff_BuildCode(huff);
+}
+
+/*
+ =================
+ Huff_Encode
+
+ Writes length bytes of data as Huffman codes. Adaptive coding is meant
+ for reliable payloads, which are mostly text. Returns false if the codes
+ don't fit in the message.
+ =================
+*/
+qboolean Huff_Encode (msg_t *msg, const byte *data, int length, qboolean adaptive){
+
+	huffCode_t	adaptiveCode;
+	huffCode_t	*huff;
+	int			i;
+
+	if (adaptive){
+		huff = &adaptiveCode;
+		Huff_InitAdaptive(huff);
+	}
+	else
+		huff = &huff_unreliable;
+
+	for (i = 0; i < length; i++){
+		if (MSG_NumBits(msg) + huff->lengths[data[i]] > (msg->maxSize << 3))
+			return false;
+
+		MSG_WriteBits(msg, huff->codes[data[i]], huff->lengths[data[i]]);
+
+		if (adaptive)
+			Huff_Adapt(huff, data[i], i);
+	}
+
+	return true;
+}
+
+/*
+ =================
+ Huff_Decode
+
+ Reads length bytes written with Huff_Encode. Returns false if the
+ message is corrupt.
+ =================
+*/
+qboolean Huff_Decode (msg_t *msg, byte *data, int length, qboolean adaptive){
+
+	huffCode_t	adaptiveCode;
+	huffCode_t	*huff;
+	int			i, symbol;
+
+	if (adaptive){
+		huff = &adaptiveCode;
+		Huff_InitAdaptive(huff);
+	}
+	else
+		huff = &huff_unreliable;
+
+	for (i = 0; i < length; i++){
+		symbol = Huff_DecodeSymbol(huff, msg);
+		if (symbol == -1 || msg->readCount > msg->curSize)
+			return false;
+
+		data[i] = symbol;
+
+		if (adaptive)
+			Huff_Adapt(huff, symbol, i);
+	}
+
+	return true;
+}
+
+/*
+ =================
+ Huff_Init
+ =================
+*/
+void Huff_Init (void){
+
+	memcpy(huff_reliable.weights, huff_reliableWeights, sizeof(huff_reliable.weights));
+	Huff_BuildCode(&huff_reliable);
+
+	memcpy(huff_unreliable.weights, huff_unreliableWeights, sizeof(huff_unreliable.weights));
+	Huff_BuildCode(&huff_unreliable);
+}
@@ -0,0 +1,358 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+// net_loop.c -- loopback buffers for the local player
+
+
+#include "qcommon.h"
+
+
+/*
+ The local client and server exchange packets through a fixed ring of
+ buffers for each side. If the receiver falls too far behind, new packets
+ are dropped just like an overflowing UDP socket would do, and the net
+ channel recovers them.
+
+ The sender can ask for the buffer of its next packet with NET_LoopBuffer
+ and write the packet in place. The receiver can read packets in place
+ with NET_ReadLoopPacket, the buffer of the last read packet is kept
+ untouched until the next one is read.
+
+ When the local server runs on its own thread, the client may send packets
+ while the server reads them, so the rings are guarded by Com_Lock. Packets
+ are only written and read in place outside of it, in slots the other side
+ never touches. The slots never move and their buffers are only freed at
+ shutdown, so a buffer handed out remains valid after the lock is released.
+
+ Each buffer can also carry a snapshot of the server frame, so the local
+ client can take the player state and entities as they are instead of
+ parsing them out of a delta compressed message.
+*/
+
+#define LOOPBACK_MSGS			16		// Must be a power of two, each slot may hold a snapshot of MAX_EDICTS entities
+
+typedef struct {
+	byte			*data;
+	int				size;
+	int				dataLen;
+
+	loopSnapshot_t	snapshot;
+} loopMsg_t;
+
+typedef struct {
+	loopMsg_t		msgs[LOOPBACK_MSGS];
+	int				get;
+	int				send;
+
+	qboolean		acceptSnapshots;
+} loopback_t;
+
+static loopback_t	net_loopbacks[2];
+
+
+/*
+ =================
+ NET_NextLoopMsg
+
+ Returns the slot the next packet will be sent in, or NULL if the ring is
+ full
+ =================
+*/
+static loopMsg_t *NET_NextLoopMsg (loopback_t *loop){
+
+	// Never hand out the slot of the packet being read
+	if (loop->send - loop->get + 1 >= LOOPBACK_MSGS)
+		return NULL;
+
+	return &loop->msgs[loop->send & (LOOPBACK_MSGS-1)];
+}
+
+/*
+ =================
+ NET_ReadLoopPacket
+
+ Points the given message at the next packet received on the given
+ socket, without copying it. The data remains valid until the next packet
+ is read.
+ =================
+*/
+qboolean NET_ReadLoopPacket (netSrc_t sock, netAdr_t *from, msg_t *msg){
+
+	loopback_t	*loop;
+	loopMsg_t	*loopMsg;
+
+	// Load test clients only talk over UDP
+	if (sock >= NS_LOADCLIENT)
+		return false;
+
+	loop = &net_loopbacks[sock];
+
+	Com_Lock();
+
+	if (loop->get >= loop->send){
+		Com_Unlock();
+		return false;
+	}
+
+	// The previous packet is released, so is the snapshot it carried
+	loop->msgs[(loop->get - 1) & (LOOPBACK_MSGS-1)].snapshot.frameNum = -1;
+
+	loopMsg = &loop->msgs[loop->get & (LOOPBACK_MSGS-1)];
+	loop->get++;
+
+	MSG_Init(msg, loopMsg->data, loopMsg->size, false);
+	msg->curSize = loopMsg->dataLen;
+
+	Com_Unlock();
+
+	memset(from, 0, sizeof(netAdr_t));
+	from->type = NA_LOOPBACK;
+
+	return true;
+}
+
+/*
+ =================
+ NET_GetLoopPacket
+
+ Copies the next packet received on the given socket to the given message
+ =================
+*/
+qboolean NET_GetLoopPacket (netSrc_t sock, netAdr_t *from, msg_t *msg){
+
+	msg_t	loopMsg;
+
+	if (!NET_ReadLoopPacket(sock, from, &loopMsg))
+		return false;
+
+	if (loopMsg.curSize > msg->maxSize){
+		Com_Printf(S_COLOR_RED "NET_GetLoopPacket: oversize packet\n");
+		return false;
+	}
+
+	memcpy(msg->data, loopMsg.data, loopMsg.curSize);
+	msg->curSize = loopMsg.curSize;
+
+	return true;
+}
+
+/*
+ =================
+ NET_LoopBuffer
+
+ Returns a buffer of at least the given size for the next loopback packet
+ sent from the given socket, or NULL if the receiver is too far behind. A
+ packet sent from this buffer is not copied.
+ =================
+*/
+byte *NET_LoopBuffer (netSrc_t sock, int size){
+
+	loopMsg_t	*loopMsg;
+	byte		*data;
+
+	Com_Lock();
+
+	loopMsg = NET_NextLoopMsg(&net_loopbacks[sock^1]);
+	if (!loopMsg){
+		Com_Unlock();
+		return NULL;
+	}
+
+	if (size < MAX_PACKETLEN)
+		size = MAX_PACKETLEN;
+
+	if (loopMsg->size < size){
+		if (loopMsg->data)
+			Z_Free(loopMsg->data);
+
+		loopMsg->data = Z_Malloc(size);
+		loopMsg->size = size;
+	}
+
+	data = loopMsg->data;
+
+	Com_Unlock();
+
+	return data;
+}
+
+/*
+ =================
+ NET_SendLoopPacket
+ =================
+*/
+qboolean NET_SendLoopPacket (netSrc_t sock, const netAdr_t to, const void *data, int length){
+
+	loopback_t	*loop;
+	loopMsg_t	*loopMsg;
+
+	if (to.type != NA_LOOPBACK || sock >= NS_LOADCLIENT)
+		return false;
+
+	loop = &net_loopbacks[sock^1];
+
+	Com_Lock();
+
+	// Drop the packet if the receiver is too far behind
+	loopMsg = NET_NextLoopMsg(loop);
+	if (!loopMsg){
+		Com_Unlock();
+		return true;
+	}
+
+	// Copy the packet unless it was written in place
+	if (loopMsg->data != data){
+		NET_LoopBuffer(sock, length);
+
+		memcpy(loopMsg->data, data, length);
+	}
+
+	loopMsg->dataLen = length;
+
+	loop->send++;
+
+	Com_Unlock();
+
+	return true;
+}
+
+/*
+ =================
+ NET_LoopPacketsPending
+ =================
+*/
+qboolean NET_LoopPacketsPending (netSrc_t sock){
+
+	qboolean	pending;
+
+	Com_Lock();
+	pending = (net_loopbacks[sock].get < net_loopbacks[sock].send);
+	Com_Unlock();
+
+	return pending;
+}
+
+/*
+ =================
+ NET_AcceptLoopSnapshots
+
+ Lets the sender on the other side know whether snapshots can be taken
+ in place of delta compressed frames
+ =================
+*/
+void NET_AcceptLoopSnapshots (netSrc_t sock, qboolean accept){
+
+	net_loopbacks[sock].acceptSnapshots = accept;
+}
+
+/*
+ =================
+ NET_LoopSnapshot
+
+ Returns the snapshot that will be carried by the next loopback packet
+ sent from the given socket, or NULL if the receiver doesn't accept
+ snapshots or is too far behind
+ =================
+*/
+loopSnapshot_t *NET_LoopSnapshot (netSrc_t sock){
+
+	loopback_t	*loop;
+	loopMsg_t	*loopMsg;
+
+	loop = &net_loopbacks[sock^1];
+
+	if (!loop->acceptSnapshots)
+		return NULL;
+
+	Com_Lock();
+
+	loopMsg = NET_NextLoopMsg(loop);
+	if (!loopMsg){
+		Com_Unlock();
+		return NULL;
+	}
+
+	if (!loopMsg->snapshot.entities)
+		loopMsg->snapshot.entities = Z_Malloc(MAX_EDICTS * sizeof(entity_state_t));
+
+	Com_Unlock();
+
+	return &loopMsg->snapshot;
+}
+
+/*
+ =================
+ NET_ReceivedLoopSnapshot
+
+ Returns the snapshot carried by the last packet read on the given socket
+ if it is for the given frame, or NULL
+ =================
+*/
+loopSnapshot_t *NET_ReceivedLoopSnapshot (netSrc_t sock, int frameNum){
+
+	loopback_t	*loop;
+	loopMsg_t	*loopMsg;
+
+	loop = &net_loopbacks[sock];
+
+	Com_Lock();
+
+	if (!loop->get){
+		Com_Unlock();
+		return NULL;
+	}
+
+	// The slot of the last read packet is left alone by the sender until
+	// the next packet is read
+	loopMsg = &loop->msgs[(loop->get - 1) & (LOOPBACK_MSGS-1)];
+
+	Com_Unlock();
+
+	if (!loopMsg->snapshot.entities || loopMsg->snapshot.frameNum != frameNum)
+		return NULL;
+
+	return &loopMsg->snapshot;
+}
+
+/*
+ =================
+ NET_ShutdownLoopback
+ =================
+*/
+void NET_ShutdownLoopback (void){
+
+	loopback_t	*loop;
+	int			i, j;
+
+	for (i = 0; i < 2; i++){
+		loop = &net_loopbacks[i];
+
+		for (j = 0; j < LOOPBACK_MSGS; j++){
+			if (loop->msgs[j].data)
+				Z_Free(loop->msgs[j].data);
+
+			if (loop->msgs[j].snapshot.entities)
+				Z_Free(loop->msgs[j].snapshot.entities);
+		}
+
+		memset(loop, 0, sizeof(loopback_t));
+	}
+}
@@ -38,6 +38,7 @@ void MSG_Init (msg_t *msg, byte *data, int maxSize, qboolean allowOverflow){
 	msg->maxSize = maxSize;
 	msg->curSize = 0;
 	msg->readCount = 0;
+	msg->bit = 0;
 }
 
 /*
@@ -49,6 +50,7 @@ void MSG_Clear (msg_t *msg){
 
 	msg->overflowed = false;
 	msg->curSize = 0;
+	msg->bit = 0;
 }
 
 /*
@@ -71,6 +73,7 @@ byte *MSG_GetSpace (msg_t *msg, int length){
 
 		msg->overflowed = true;
 		msg->curSize = 0;
+		msg->bit = 0;
 	}
 
 	data = msg->data + msg->curSize;
@@ -512,6 +515,442 @@ void MSG_WriteDeltaEntity (msg_t *msg, const entity_state_t *from, const entity_
 // =====================================================================
 
 
+/*
+ =================
+ MSG_WriteBits
+
+ Writes the low bits of value, least significant bit first. Consecutive
+ calls share bytes, but any other write starts a new byte.
+ =================
+*/
+void MSG_WriteBits (msg_t *msg, int value, int bits){
+
+	unsigned	v;
+	byte		*buf;
+	int			put;
+
+	if (bits < 1 || bits > 32)
+		Com_Error(ERR_FATAL, "MSG_WriteBits: bad bit count %i", bits);
+
+	v = value;
+	if (bits < 32)
+		v &= (1U << bits) - 1;
+
+	// Only continue the last byte if it was written by MSG_WriteBits
+	if (!(msg->bit & 7) || (msg->bit >> 3) != msg->curSize - 1)
+		msg->bit = msg->curSize << 3;
+
+	while (bits){
+		if (!(msg->bit & 7)){
+			buf = MSG_GetSpace(msg, 1);
+			buf[0] = 0;
+
+			msg->bit = (msg->curSize - 1) << 3;
+		}
+
+		put = 8 - (msg->bit & 7);
+		if (put > bits)
+			put = bits;
+
+		msg->data[msg->bit >> 3] |= (v & ((1 << put) - 1)) << (msg->bit & 7);
+
+		v >>= put;
+		bits -= put;
+		msg->bit += put;
+	}
+}
+
+/*
+ =================
+ MSG_WriteBitData
+
+ Appends numBits bits previously written with MSG_WriteBits to an
+ empty message
+ =================
+*/
+void MSG_WriteBitData (msg_t *msg, const byte *data, int numBits){
+
+	int		i;
+
+	for (i = 0; numBits >= 8; i++, numBits -= 8)
+		MSG_WriteBits(msg, data[i], 8);
+
+	if (numBits)
+		MSG_WriteBits(msg, data[i], numBits);
+}
+
+/*
+ =================
+ MSG_NumBits
+
+ Returns the size of the message in bits
+ =================
+*/
+int MSG_NumBits (const msg_t *msg){
+
+	if ((msg->bit & 7) && (msg->bit >> 3) == msg->curSize - 1)
+		return msg->bit;
+
+	return msg->curSize << 3;
+}
+
+/*
+ =================
+ MSG_WriteDeltaBits
+
+ Writes a 16 bit value as a small signed delta when it fits, or as an
+ absolute value otherwise
+ =================
+*/
+static void MSG_WriteDeltaBits (msg_t *msg, int from, int to, int smallBits){
+
+	int		delta;
+
+	delta = (short)(to - from);
+
+	if (delta >= -(1 << (smallBits-1)) && delta < (1 << (smallBits-1))){
+		MSG_WriteBits(msg, 0, 1);
+		MSG_WriteBits(msg, delta, smallBits);
+	}
+	else {
+		MSG_WriteBits(msg, 1, 1);
+		MSG_WriteBits(msg, to, 16);
+	}
+}
+
+/*
+ =================
+ MSG_WriteSizedBits
+
+ Writes a 2 bit size code followed by an 8, 16 or 32 bit value, using the
+ same size thresholds as the byte encoding
+ =================
+*/
+static void MSG_WriteSizedBits (msg_t *msg, int value, unsigned limit16){
+
+	if ((unsigned)value < 0x100){
+		MSG_WriteBits(msg, 0, 2);
+		MSG_WriteBits(msg, value, 8);
+	}
+	else if ((unsigned)value < limit16){
+		MSG_WriteBits(msg, 1, 2);
+		MSG_WriteBits(msg, value, 16);
+	}
+	else {
+		MSG_WriteBits(msg, 2, 2);
+		MSG_WriteBits(msg, value, 32);
+	}
+}
+
+/*
+ =================
+ MSG_WriteEntityNumberBits
+
+ Entity numbers in a bit packed snapshot are ascending, so most of them
+ are sent as a short step from the previous one
+ =================
+*/
+void MSG_WriteEntityNumberBits (msg_t *msg, int number, int lastNumber){
+
+	if (number > lastNumber && number - lastNumber <= 16){
+		MSG_WriteBits(msg, 1, 1);
+		MSG_WriteBits(msg, number - lastNumber - 1, 4);
+		return;
+	}
+
+	MSG_WriteBits(msg, 0, 1);
+	MSG_WriteBits(msg, number, ENTITYNUM_BITS);
+}
+
+/*
+ =================
+ MSG_WriteDeltaEntityBits
+
+ Bit packed version of MSG_WriteDeltaEntity. The entity number is not
+ part of the record. Coordinates keep the 1/8 unit precision of the byte
+ encoding and are only sent when their quantized value changed, so the
+ client ends up with exactly the same state.
+ Writes nothing if the entity has not changed and force is false.
+ =================
+*/
+void MSG_WriteDeltaEntityBits (msg_t *msg, const entity_state_t *from, const entity_state_t *to, qboolean force, qboolean newEntity){
+
+	int		fromOrigin[3], toOrigin[3], oldOrigin[3];
+	int		fromAngles[3], toAngles[3];
+	int		origin = 0, angles = 0, other = 0;
+	int		i;
+
+	if (!to->number)
+		Com_Error(ERR_DROP, "MSG_WriteDeltaEntityBits: unset entity number");
+	if (to->number >= MAX_EDICTS)
+		Com_Error(ERR_DROP, "MSG_WriteDeltaEntityBits: number >= MAX_EDICTS");
+
+	for (i = 0; i < 3; i++){
+		fromOrigin[i] = (short)(int)(from->origin[i] * 8);
+		toOrigin[i] = (short)(int)(to->origin[i] * 8);
+		oldOrigin[i] = (short)(int)(to->old_origin[i] * 8);
+
+		fromAngles[i] = (int)(from->angles[i] * 256.0/360) & 255;
+		toAngles[i] = (int)(to->angles[i] * 256.0/360) & 255;
+
+		if (toOrigin[i] != fromOrigin[i])
+			origin |= 1 << i;
+		if (toAngles[i] != fromAngles[i])
+			angles |= 1 << i;
+	}
+
+	if (to->modelindex != from->modelindex)
+		other |= EB_MODEL;
+	if (to->modelindex2 != from->modelindex2)
+		other |= EB_MODEL2;
+	if (to->modelindex3 != from->modelindex3)
+		other |= EB_MODEL3;
+	if (to->modelindex4 != from->modelindex4)
+		other |= EB_MODEL4;
+	if (to->skinnum != from->skinnum)
+		other |= EB_SKIN;
+	if (to->effects != from->effects)
+		other |= EB_EFFECTS;
+	if (to->renderfx != from->renderfx)
+		other |= EB_RENDERFX;
+	if (to->sound != from->sound)
+		other |= EB_SOUND;
+	if (to->solid != from->solid)
+		other |= EB_SOLID;
+	if (newEntity || (to->renderfx & RF_BEAM))
+		other |= EB_OLDORIGIN;
+
+	if (!origin && !angles && !other && to->frame == from->frame && !to->event && !force)
+		return;		// Nothing to send!
+
+	// Origin
+	if (origin){
+		MSG_WriteBits(msg, 1, 1);
+		MSG_WriteBits(msg, origin, 3);
+
+		for (i = 0; i < 3; i++){
+			if (origin & (1 << i))
+				MSG_WriteDeltaBits(msg, fromOrigin[i], toOrigin[i], 10);
+		}
+	}
+	else
+		MSG_WriteBits(msg, 0, 1);
+
+	// Angles
+	if (angles){
+		MSG_WriteBits(msg, 1, 1);
+		MSG_WriteBits(msg, angles, 3);
+
+		for (i = 0; i < 3; i++){
+			if (angles & (1 << i))
+				MSG_WriteBits(msg, toAngles[i], 8);
+		}
+	}
+	else
+		MSG_WriteBits(msg, 0, 1);
+
+	// Frame, usually just advanced by one
+	if (to->frame != from->frame){
+		MSG_WriteBits(msg, 1, 1);
+
+		if (to->frame == from->frame + 1)
+			MSG_WriteBits(msg, 1, 1);
+		else {
+			MSG_WriteBits(msg, 0, 1);
+
+			if (to->frame < 256){
+				MSG_WriteBits(msg, 0, 1);
+				MSG_WriteBits(msg, to->frame, 8);
+			}
+			else {
+				MSG_WriteBits(msg, 1, 1);
+				MSG_WriteBits(msg, to->frame, 16);
+			}
+		}
+	}
+	else
+		MSG_WriteBits(msg, 0, 1);
+
+	// Event is not delta compressed, just 0 compressed
+	if (to->event){
+		MSG_WriteBits(msg, 1, 1);
+		MSG_WriteBits(msg, to->event, 8);
+	}
+	else
+		MSG_WriteBits(msg, 0, 1);
+
+	// Everything else changes rarely
+	if (!other){
+		MSG_WriteBits(msg, 0, 1);
+		return;
+	}
+
+	MSG_WriteBits(msg, 1, 1);
+	MSG_WriteBits(msg, other, EB_BITS);
+
+	if (other & EB_MODEL)
+		MSG_WriteBits(msg, to->modelindex, 8);
+	if (other & EB_MODEL2)
+		MSG_WriteBits(msg, to->modelindex2, 8);
+	if (other & EB_MODEL3)
+		MSG_WriteBits(msg, to->modelindex3, 8);
+	if (other & EB_MODEL4)
+		MSG_WriteBits(msg, to->modelindex4, 8);
+
+	if (other & EB_SKIN)
+		MSG_WriteSizedBits(msg, to->skinnum, 0x10000);
+	if (other & EB_EFFECTS)
+		MSG_WriteSizedBits(msg, to->effects, 0x8000);
+	if (other & EB_RENDERFX)
+		MSG_WriteSizedBits(msg, to->renderfx, 0x8000);
+
+	if (other & EB_SOUND)
+		MSG_WriteBits(msg, to->sound, 8);
+	if (other & EB_SOLID)
+		MSG_WriteBits(msg, to->solid, 16);
+
+	// Usually the same as the origin, except for beams
+	if (other & EB_OLDORIGIN){
+		for (i = 0; i < 3; i++){
+			if (oldOrigin[i] != toOrigin[i]){
+				MSG_WriteBits(msg, 1, 1);
+				MSG_WriteDeltaBits(msg, toOrigin[i], oldOrigin[i], 10);
+			}
+			else
+				MSG_WriteBits(msg, 0, 1);
+		}
+	}
+}
+
+/*
+ =================
+ MSG_WriteDeltaPlayerStateBits
+
+ Bit packed version of the SVC_PLAYERINFO payload. The flags are the
+ PS_* bits computed for the byte encoding.
+ =================
+*/
+void MSG_WriteDeltaPlayerStateBits (msg_t *msg, const player_state_t *from, const player_state_t *to, int flags){
+
+	int		statBits;
+	int		i;
+
+	MSG_WriteBits(msg, flags, 15);
+
+	// Write the pmove_state_t
+	if (flags & PS_M_TYPE)
+		MSG_WriteBits(msg, to->pmove.pm_type, 8);
+
+	if (flags & PS_M_ORIGIN){
+		for (i = 0; i < 3; i++){
+			if (to->pmove.origin[i] != from->pmove.origin[i]){
+				MSG_WriteBits(msg, 1, 1);
+				MSG_WriteDeltaBits(msg, from->pmove.origin[i], to->pmove.origin[i], 12);
+			}
+			else
+				MSG_WriteBits(msg, 0, 1);
+		}
+	}
+
+	if (flags & PS_M_VELOCITY){
+		for (i = 0; i < 3; i++){
+			if (to->pmove.velocity[i] != from->pmove.velocity[i]){
+				MSG_WriteBits(msg, 1, 1);
+				MSG_WriteDeltaBits(msg, from->pmove.velocity[i], to->pmove.velocity[i], 12);
+			}
+			else
+				MSG_WriteBits(msg, 0, 1);
+		}
+	}
+
+	if (flags & PS_M_TIME)
+		MSG_WriteBits(msg, to->pmove.pm_time, 8);
+
+	if (flags & PS_M_FLAGS)
+		MSG_WriteBits(msg, to->pmove.pm_flags, 8);
+
+	if (flags & PS_M_GRAVITY)
+		MSG_WriteBits(msg, to->pmove.gravity, 16);
+
+	if (flags & PS_M_DELTA_ANGLES){
+		MSG_WriteBits(msg, to->pmove.delta_angles[0], 16);
+		MSG_WriteBits(msg, to->pmove.delta_angles[1], 16);
+		MSG_WriteBits(msg, to->pmove.delta_angles[2], 16);
+	}
+
+	// Write the rest of the player_state_t
+	if (flags & PS_VIEWOFFSET){
+		MSG_WriteBits(msg, (int)(to->viewoffset[0]*4), 8);
+		MSG_WriteBits(msg, (int)(to->viewoffset[1]*4), 8);
+		MSG_WriteBits(msg, (int)(to->viewoffset[2]*4), 8);
+	}
+
+	if (flags & PS_VIEWANGLES){
+		MSG_WriteBits(msg, ANGLE2SHORT(to->viewangles[0]), 16);
+		MSG_WriteBits(msg, ANGLE2SHORT(to->viewangles[1]), 16);
+		MSG_WriteBits(msg, ANGLE2SHORT(to->viewangles[2]), 16);
+	}
+
+	if (flags & PS_KICKANGLES){
+		MSG_WriteBits(msg, (int)(to->kick_angles[0]*4), 8);
+		MSG_WriteBits(msg, (int)(to->kick_angles[1]*4), 8);
+		MSG_WriteBits(msg, (int)(to->kick_angles[2]*4), 8);
+	}
+
+	if (flags & PS_WEAPONINDEX)
+		MSG_WriteBits(msg, to->gunindex, 8);
+
+	if (flags & PS_WEAPONFRAME){
+		MSG_WriteBits(msg, to->gunframe, 8);
+		MSG_WriteBits(msg, (int)(to->gunoffset[0]*4), 8);
+		MSG_WriteBits(msg, (int)(to->gunoffset[1]*4), 8);
+		MSG_WriteBits(msg, (int)(to->gunoffset[2]*4), 8);
+		MSG_WriteBits(msg, (int)(to->gunangles[0]*4), 8);
+		MSG_WriteBits(msg, (int)(to->gunangles[1]*4), 8);
+		MSG_WriteBits(msg, (int)(to->gunangles[2]*4), 8);
+	}
+
+	if (flags & PS_BLEND){
+		MSG_WriteBits(msg, (int)(to->blend[0]*255), 8);
+		MSG_WriteBits(msg, (int)(to->blend[1]*255), 8);
+		MSG_WriteBits(msg, (int)(to->blend[2]*255), 8);
+		MSG_WriteBits(msg, (int)(to->blend[3]*255), 8);
+	}
+
+	if (flags & PS_FOV)
+		MSG_WriteBits(msg, (int)to->fov, 8);
+
+	if (flags & PS_RDFLAGS)
+		MSG_WriteBits(msg, to->rdflags, 8);
+
+	// Write stats, most of them change by small amounts
+	statBits = 0;
+	for (i = 0; i < MAX_STATS; i++){
+		if (to->stats[i] != from->stats[i])
+			statBits |= 1 << i;
+	}
+
+	if (!statBits){
+		MSG_WriteBits(msg, 0, 1);
+		return;
+	}
+
+	MSG_WriteBits(msg, 1, 1);
+
+	for (i = 0; i < MAX_STATS; i++){
+		if (statBits & (1 << i)){
+			MSG_WriteBits(msg, 1, 1);
+			MSG_WriteDeltaBits(msg, from->stats[i], to->stats[i], 8);
+		}
+		else
+			MSG_WriteBits(msg, 0, 1);
+	}
+}
+
+
+// =====================================================================
+
+
 /*
  =================
  MSG_BeginReading
@@ -520,6 +959,7 @@ void MSG_WriteDeltaEntity (msg_t *msg, const entity_state_t *from, const entity_
 void MSG_BeginReading (msg_t *msg){
 
 	msg->readCount = 0;
+	msg->bit = 0;
 }
 
 /*
@@ -782,6 +1222,223 @@ void MSG_ReadDeltaUserCmd (msg_t *msg, const usercmd_t *from, usercmd_t *to){
 	to->lightlevel = MSG_ReadByte(msg);
 }
 
+/*
+ =================
+ MSG_ReadEntityBits
+
+ Reads the header of a record written with MSG_WriteDeltaEntity. Returns
+ the entity number and the header bits.
+ =================
+*/
+int MSG_ReadEntityBits (msg_t *msg, unsigned *bits){
+
+	unsigned	b, total;
+	int			number;
+
+	total = MSG_ReadByte(msg);
+
+	if (total & U_MOREBITS1){
+		b = MSG_ReadByte(msg);
+		total |= b<<8;
+	}
+	if (total & U_MOREBITS2){
+		b = MSG_ReadByte(msg);
+		total |= b<<16;
+	}
+	if (total & U_MOREBITS3){
+		b = MSG_ReadByte(msg);
+		total |= b<<24;
+	}
+
+	if (total & U_NUMBER16)
+		number = MSG_ReadShort(msg);
+	else
+		number = MSG_ReadByte(msg);
+
+	*bits = total;
+
+	return number;
+}
+
+/*
+ =================
+ MSG_ReadDeltaEntity
+
+ Reads the rest of a record written with MSG_WriteDeltaEntity. Can go from
+ either a baseline or a previous packet entity.
+ =================
+*/
+void MSG_ReadDeltaEntity (msg_t *msg, const entity_state_t *from, entity_state_t *to, int number, unsigned bits){
+
+	// Set everything to the state we are delta'ing from
+	*to = *from;
+
+	VectorCopy(from->origin, to->old_origin);
+	to->number = number;
+
+	if (bits & U_MODEL)
+		to->modelindex = MSG_ReadByte(msg);
+	if (bits & U_MODEL2)
+		to->modelindex2 = MSG_ReadByte(msg);
+	if (bits & U_MODEL3)
+		to->modelindex3 = MSG_ReadByte(msg);
+	if (bits & U_MODEL4)
+		to->modelindex4 = MSG_ReadByte(msg);
+
+	if (bits & U_FRAME8)
+		to->frame = MSG_ReadByte(msg);
+	if (bits & U_FRAME16)
+		to->frame = MSG_ReadShort(msg);
+
+	if ((bits & U_SKIN8) && (bits & U_SKIN16))
+		to->skinnum = MSG_ReadLong(msg);
+	else if (bits & U_SKIN8)
+		to->skinnum = MSG_ReadByte(msg);
+	else if (bits & U_SKIN16)
+		to->skinnum = MSG_ReadShort(msg);
+
+	if ((bits & (U_EFFECTS8|U_EFFECTS16)) == (U_EFFECTS8|U_EFFECTS16))
+		to->effects = MSG_ReadLong(msg);
+	else if (bits & U_EFFECTS8)
+		to->effects = MSG_ReadByte(msg);
+	else if (bits & U_EFFECTS16)
+		to->effects = MSG_ReadShort(msg);
+
+	if ((bits & (U_RENDERFX8|U_RENDERFX16)) == (U_RENDERFX8|U_RENDERFX16))
+		to->renderfx = MSG_ReadLong(msg);
+	else if (bits & U_RENDERFX8)
+		to->renderfx = MSG_ReadByte(msg);
+	else if (bits & U_RENDERFX16)
+		to->renderfx = MSG_ReadShort(msg);
+
+	if (bits & U_ORIGIN1)
+		to->origin[0] = MSG_ReadCoord(msg);
+	if (bits & U_ORIGIN2)
+		to->origin[1] = MSG_ReadCoord(msg);
+	if (bits & U_ORIGIN3)
+		to->origin[2] = MSG_ReadCoord(msg);
+
+	if (bits & U_ANGLE1)
+		to->angles[0] = MSG_ReadAngle(msg);
+	if (bits & U_ANGLE2)
+		to->angles[1] = MSG_ReadAngle(msg);
+	if (bits & U_ANGLE3)
+		to->angles[2] = MSG_ReadAngle(msg);
+
+	if (bits & U_OLDORIGIN)
+		MSG_ReadPos(msg, to->old_origin);
+
+	if (bits & U_SOUND)
+		to->sound = MSG_ReadByte(msg);
+
+	if (bits & U_EVENT)
+		to->event = MSG_ReadByte(msg);
+	else
+		to->event = 0;
+
+	if (bits & U_SOLID)
+		to->solid = MSG_ReadShort(msg);
+}
+
+/*
+ =================
+ MSG_ReadDeltaPlayerState
+
+ Reads a player state written in the byte encoding over the given state
+ =================
+*/
+void MSG_ReadDeltaPlayerState (msg_t *msg, player_state_t *state){
+
+	int		flags, statBits;
+	int		i;
+
+	flags = MSG_ReadShort(msg);
+
+	// Parse the pmove_state_t
+	if (flags & PS_M_TYPE)
+		state->pmove.pm_type = MSG_ReadByte(msg);
+
+	if (flags & PS_M_ORIGIN){
+		state->pmove.origin[0] = MSG_ReadShort(msg);
+		state->pmove.origin[1] = MSG_ReadShort(msg);
+		state->pmove.origin[2] = MSG_ReadShort(msg);
+	}
+
+	if (flags & PS_M_VELOCITY){
+		state->pmove.velocity[0] = MSG_ReadShort(msg);
+		state->pmove.velocity[1] = MSG_ReadShort(msg);
+		state->pmove.velocity[2] = MSG_ReadShort(msg);
+	}
+
+	if (flags & PS_M_TIME)
+		state->pmove.pm_time = MSG_ReadByte(msg);
+
+	if (flags & PS_M_FLAGS)
+		state->pmove.pm_flags = MSG_ReadByte(msg);
+
+	if (flags & PS_M_GRAVITY)
+		state->pmove.gravity = MSG_ReadShort(msg);
+
+	if (flags & PS_M_DELTA_ANGLES){
+		state->pmove.delta_angles[0] = MSG_ReadShort(msg);
+		state->pmove.delta_angles[1] = MSG_ReadShort(msg);
+		state->pmove.delta_angles[2] = MSG_ReadShort(msg);
+	}
+
+	// Parse the rest of the player_state_t
+	if (flags & PS_VIEWOFFSET){
+		state->viewoffset[0] = MSG_ReadChar(msg) * 0.25;
+		state->viewoffset[1] = MSG_ReadChar(msg) * 0.25;
+		state->viewoffset[2] = MSG_ReadChar(msg) * 0.25;
+	}
+
+	if (flags & PS_VIEWANGLES){
+		state->viewangles[0] = MSG_ReadAngle16(msg);
+		state->viewangles[1] = MSG_ReadAngle16(msg);
+		state->viewangles[2] = MSG_ReadAngle16(msg);
+	}
+
+	if (flags & PS_KICKANGLES){
+		state->kick_angles[0] = MSG_ReadChar(msg) * 0.25;
+		state->kick_angles[1] = MSG_ReadChar(msg) * 0.25;
+		state->kick_angles[2] = MSG_ReadChar(msg) * 0.25;
+	}
+
+	if (flags & PS_WEAPONINDEX)
+		state->gunindex = MSG_ReadByte(msg);
+
+	if (flags & PS_WEAPONFRAME){
+		state->gunframe = MSG_ReadByte(msg);
+		state->gunoffset[0] = MSG_ReadChar(msg) * 0.25;
+		state->gunoffset[1] = MSG_ReadChar(msg) * 0.25;
+		state->gunoffset[2] = MSG_ReadChar(msg) * 0.25;
+		state->gunangles[0] = MSG_ReadChar(msg) * 0.25;
+		state->gunangles[1] = MSG_ReadChar(msg) * 0.25;
+		state->gunangles[2] = MSG_ReadChar(msg) * 0.25;
+	}
+
+	if (flags & PS_BLEND){
+		state->blend[0] = MSG_ReadByte(msg) / 255.0;
+		state->blend[1] = MSG_ReadByte(msg) / 255.0;
+		state->blend[2] = MSG_ReadByte(msg) / 255.0;
+		state->blend[3] = MSG_ReadByte(msg) / 255.0;
+	}
+
+	if (flags & PS_FOV)
+		state->fov = MSG_ReadByte(msg);
+
+	if (flags & PS_RDFLAGS)
+		state->rdflags = MSG_ReadByte(msg);
+
+	// Parse stats
+	statBits = MSG_ReadLong(msg);
+
+	for (i = 0; i < MAX_STATS; i++){
+		if (statBits & (1<<i))
+			state->stats[i] = MSG_ReadShort(msg);
+	}
+}
+
 /*
  =================
  MSG_ReadData
@@ -794,3 +1451,296 @@ void MSG_ReadData (msg_t *msg, void *buffer, int size){
 	for (i = 0; i < size; i++)
 		((byte *)buffer)[i] = MSG_ReadByte(msg);
 }
+
+
+// =====================================================================
+
+
+/*
+ =================
+ MSG_ReadBits
+
+ Reads an unsigned value written with MSG_WriteBits. Reading past the end
+ returns zero bits and leaves readCount past curSize.
+ =================
+*/
+int MSG_ReadBits (msg_t *msg, int bits){
+
+	unsigned	value;
+	int			get, got;
+
+	if (bits < 1 || bits > 32)
+		Com_Error(ERR_FATAL, "MSG_ReadBits: bad bit count %i", bits);
+
+	// Only continue the last byte if it was read by MSG_ReadBits
+	if (!(msg->bit & 7) || (msg->bit >> 3) != msg->readCount - 1)
+		msg->bit = msg->readCount << 3;
+
+	value = 0;
+
+	for (got = 0; got < bits; got += get){
+		if (!(msg->bit & 7))
+			msg->readCount++;
+
+		get = 8 - (msg->bit & 7);
+		if (get > bits - got)
+			get = bits - got;
+
+		if ((msg->bit >> 3) < msg->curSize)
+			value |= ((unsigned)(msg->data[msg->bit >> 3] >> (msg->bit & 7)) & ((1 << get) - 1)) << got;
+
+		msg->bit += get;
+	}
+
+	return value;
+}
+
+/*
+ =================
+ MSG_ReadDeltaBits
+ =================
+*/
+static int MSG_ReadDeltaBits (msg_t *msg, int from, int smallBits){
+
+	int		delta;
+
+	if (MSG_ReadBits(msg, 1))
+		return (short)MSG_ReadBits(msg, 16);
+
+	delta = MSG_ReadBits(msg, smallBits);
+	if (delta & (1 << (smallBits-1)))
+		delta -= 1 << smallBits;
+
+	return (short)(from + delta);
+}
+
+/*
+ =================
+ MSG_ReadSizedBits
+ =================
+*/
+static int MSG_ReadSizedBits (msg_t *msg){
+
+	switch (MSG_ReadBits(msg, 2)){
+	case 0:
+		return MSG_ReadBits(msg, 8);
+	case 1:
+		return (short)MSG_ReadBits(msg, 16);
+	default:
+		return MSG_ReadBits(msg, 32);
+	}
+}
+
+/*
+ =================
+ MSG_ReadEntityNumberBits
+ =================
+*/
+int MSG_ReadEntityNumberBits (msg_t *msg, int lastNumber){
+
+	if (MSG_ReadBits(msg, 1))
+		return lastNumber + 1 + MSG_ReadBits(msg, 4);
+
+	return MSG_ReadBits(msg, ENTITYNUM_BITS);
+}
+
+/*
+ =================
+ MSG_ReadDeltaEntityBits
+
+ Reads a record written with MSG_WriteDeltaEntityBits. The result matches
+ what the byte encoding would have produced.
+ =================
+*/
+void MSG_ReadDeltaEntityBits (msg_t *msg, const entity_state_t *from, entity_state_t *to, int number){
+
+	int		origin[3], other;
+	int		i, bits;
+
+	// Set everything to the state we are delta'ing from
+	*to = *from;
+
+	VectorCopy(from->origin, to->old_origin);
+	to->number = number;
+
+	for (i = 0; i < 3; i++)
+		origin[i] = (short)(int)(from->origin[i] * 8);
+
+	// Origin
+	if (MSG_ReadBits(msg, 1)){
+		bits = MSG_ReadBits(msg, 3);
+
+		for (i = 0; i < 3; i++){
+			if (!(bits & (1 << i)))
+				continue;
+
+			origin[i] = MSG_ReadDeltaBits(msg, origin[i], 10);
+			to->origin[i] = origin[i] * 0.125;
+		}
+	}
+
+	// Angles
+	if (MSG_ReadBits(msg, 1)){
+		bits = MSG_ReadBits(msg, 3);
+
+		for (i = 0; i < 3; i++){
+			if (bits & (1 << i))
+				to->angles[i] = (char)MSG_ReadBits(msg, 8) * (360.0/256);
+		}
+	}
+
+	// Frame
+	if (MSG_ReadBits(msg, 1)){
+		if (MSG_ReadBits(msg, 1))
+			to->frame = from->frame + 1;
+		else if (MSG_ReadBits(msg, 1))
+			to->frame = (short)MSG_ReadBits(msg, 16);
+		else
+			to->frame = MSG_ReadBits(msg, 8);
+	}
+
+	// Event
+	if (MSG_ReadBits(msg, 1))
+		to->event = MSG_ReadBits(msg, 8);
+	else
+		to->event = 0;
+
+	// Everything else
+	if (!MSG_ReadBits(msg, 1))
+		return;
+
+	other = MSG_ReadBits(msg, EB_BITS);
+
+	if (other & EB_MODEL)
+		to->modelindex = MSG_ReadBits(msg, 8);
+	if (other & EB_MODEL2)
+		to->modelindex2 = MSG_ReadBits(msg, 8);
+	if (other & EB_MODEL3)
+		to->modelindex3 = MSG_ReadBits(msg, 8);
+	if (other & EB_MODEL4)
+		to->modelindex4 = MSG_ReadBits(msg, 8);
+
+	if (other & EB_SKIN)
+		to->skinnum = MSG_ReadSizedBits(msg);
+	if (other & EB_EFFECTS)
+		to->effects = MSG_ReadSizedBits(msg);
+	if (other & EB_RENDERFX)
+		to->renderfx = MSG_ReadSizedBits(msg);
+
+	if (other & EB_SOUND)
+		to->sound = MSG_ReadBits(msg, 8);
+	if (other & EB_SOLID)
+		to->solid = (short)MSG_ReadBits(msg, 16);
+
+	if (other & EB_OLDORIGIN){
+		for (i = 0; i < 3; i++){
+			if (MSG_ReadBits(msg, 1))
+				to->old_origin[i] = MSG_ReadDeltaBits(msg, origin[i], 10) * 0.125;
+			else
+				to->old_origin[i] = origin[i] * 0.125;
+		}
+	}
+}
+
+/*
+ =================
+ MSG_ReadDeltaPlayerStateBits
+
+ Reads a player state written with MSG_WriteDeltaPlayerStateBits. The
+ given state holds the state we are delta'ing from.
+ =================
+*/
+void MSG_ReadDeltaPlayerStateBits (msg_t *msg, player_state_t *state){
+
+	int		flags;
+	int		i;
+
+	flags = MSG_ReadBits(msg, 15);
+
+	// Parse the pmove_state_t
+	if (flags & PS_M_TYPE)
+		state->pmove.pm_type = MSG_ReadBits(msg, 8);
+
+	if (flags & PS_M_ORIGIN){
+		for (i = 0; i < 3; i++){
+			if (MSG_ReadBits(msg, 1))
+				state->pmove.origin[i] = MSG_ReadDeltaBits(msg, state->pmove.origin[i], 12);
+		}
+	}
+
+	if (flags & PS_M_VELOCITY){
+		for (i = 0; i < 3; i++){
+			if (MSG_ReadBits(msg, 1))
+				state->pmove.velocity[i] = MSG_ReadDeltaBits(msg, state->pmove.velocity[i], 12);
+		}
+	}
+
+	if (flags & PS_M_TIME)
+		state->pmove.pm_time = MSG_ReadBits(msg, 8);
+
+	if (flags & PS_M_FLAGS)
+		state->pmove.pm_flags = MSG_ReadBits(msg, 8);
+
+	if (flags & PS_M_GRAVITY)
+		state->pmove.gravity = MSG_ReadBits(msg, 16);
+
+	if (flags & PS_M_DELTA_ANGLES){
+		state->pmove.delta_angles[0] = MSG_ReadBits(msg, 16);
+		state->pmove.delta_angles[1] = MSG_ReadBits(msg, 16);
+		state->pmove.delta_angles[2] = MSG_ReadBits(msg, 16);
+	}
+
+	// Parse the rest of the player_state_t
+	if (flags & PS_VIEWOFFSET){
+		state->viewoffset[0] = (char)MSG_ReadBits(msg, 8) * 0.25;
+		state->viewoffset[1] = (char)MSG_ReadBits(msg, 8) * 0.25;
+		state->viewoffset[2] = (char)MSG_ReadBits(msg, 8) * 0.25;
+	}
+
+	if (flags & PS_VIEWANGLES){
+		state->viewangles[0] = SHORT2ANGLE((short)MSG_ReadBits(msg, 16));
+		state->viewangles[1] = SHORT2ANGLE((short)MSG_ReadBits(msg, 16));
+		state->viewangles[2] = SHORT2ANGLE((short)MSG_ReadBits(msg, 16));
+	}
+
+	if (flags & PS_KICKANGLES){
+		state->kick_angles[0] = (char)MSG_ReadBits(msg, 8) * 0.25;
+		state->kick_angles[1] = (char)MSG_ReadBits(msg, 8) * 0.25;
+		state->kick_angles[2] = (char)MSG_ReadBits(msg, 8) * 0.25;
+	}
+
+	if (flags & PS_WEAPONINDEX)
+		state->gunindex = MSG_ReadBits(msg, 8);
+
+	if (flags & PS_WEAPONFRAME){
+		state->gunframe = MSG_ReadBits(msg, 8);
+		state->gunoffset[0] = (char)MSG_ReadBits(msg, 8) * 0.25;
+		state->gunoffset[1] = (char)MSG_ReadBits(msg, 8) * 0.25;
+		state->gunoffset[2] = (char)MSG_ReadBits(msg, 8) * 0.25;
+		state->gunangles[0] = (char)MSG_ReadBits(msg, 8) * 0.25;
+		state->gunangles[1] = (char)MSG_ReadBits(msg, 8) * 0.25;
+		state->gunangles[2] = (char)MSG_ReadBits(msg, 8) * 0.25;
+	}
+
+	if (flags & PS_BLEND){
+		state->blend[0] = MSG_ReadBits(msg, 8) / 255.0;
+		state->blend[1] = MSG_ReadBits(msg, 8) / 255.0;
+		state->blend[2] = MSG_ReadBits(msg, 8) / 255.0;
+		state->blend[3] = MSG_ReadBits(msg, 8) / 255.0;
+	}
+
+	if (flags & PS_FOV)
+		state->fov = MSG_ReadBits(msg, 8);
+
+	if (flags & PS_RDFLAGS)
+		state->rdflags = MSG_ReadBits(msg, 8);
+
+	// Parse stats
+	if (!MSG_ReadBits(msg, 1))
+		return;
+
+	for (i = 0; i < MAX_STATS; i++){
+		if (MSG_ReadBits(msg, 1))
+			state->stats[i] = MSG_ReadDeltaBits(msg, state->stats[i], 8);
+	}
+}
@@ -39,12 +39,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #define	PROTOCOL_VERSION		34
+#define	PROTOCOL_VERSION_BITS	35		// Bit packed snapshots, negotiated at connect
 
 #define	UPDATE_BACKUP			16
 #define	UPDATE_MASK				(UPDATE_BACKUP-1)
 
 // Server to client
-enum {
+typedef enum {
 	SVC_BAD,
 
 	// These ops are known to the game library
@@ -69,11 +70,12 @@ enum {
 	SVC_PLAYERINFO,				// variable
 	SVC_PACKETENTITIES,			// [...]
 	SVC_DELTAPACKETENTITIES,	// [...]
-	SVC_FRAME
+	SVC_FRAME,
+	SVC_LOCALSNAPSHOT			// Player state and entities are in the loopback snapshot
 } svcOps_t;
 
 // Client to server
-enum {
+typedef enum {
 	CLC_BAD,
 	CLC_NOP, 		
 	CLC_MOVE,					// [usercmd_t]
@@ -155,6 +157,22 @@ enum {
 #define	U_SOUND					(1<<26)
 #define	U_SOLID					(1<<27)
 
+// Bit packed entity_state_t communication (PROTOCOL_VERSION_BITS).
+// These flag the rarely changing fields of a record.
+#define	EB_MODEL				(1<<0)
+#define	EB_MODEL2				(1<<1)
+#define	EB_MODEL3				(1<<2)
+#define	EB_MODEL4				(1<<3)
+#define	EB_SKIN					(1<<4)
+#define	EB_EFFECTS				(1<<5)
+#define	EB_RENDERFX				(1<<6)
+#define	EB_SOUND				(1<<7)
+#define	EB_SOLID				(1<<8)
+#define	EB_OLDORIGIN			(1<<9)
+#define	EB_BITS					10
+
+#define	ENTITYNUM_BITS			10			// Enough for MAX_EDICTS
+
 /*
  =======================================================================
 
@@ -179,6 +197,7 @@ extern cvar_t	*com_zoneMegs;
 extern cvar_t	*com_hunkMegs;
 extern cvar_t	*com_maxFPS;
 extern cvar_t	*com_logFile;
+extern cvar_t	*com_serverThread;
 
 // This is set each time a key binding or archive variable is changed so
 // that the system knows to save it to the config file
@@ -208,6 +227,21 @@ void		Com_SetServerState (int state);
 
 qboolean	Com_AllowCheats (void);
 
+#define MAX_JOB_THREADS				32		// Worker threads, not counting the calling one
+
+void		Com_RunJobs (int numThreads, int numJobs, void (*func)(int job, int thread, void *data), void *data);
+
+// While the local server runs on its own thread, Com_Lock guards the
+// systems shared by the client and server (memory, variables, the command
+// buffer, files, collision and the loopback buffers), and the frame lock
+// keeps client packets and commands from running in the middle of a server
+// frame. All of these do nothing otherwise.
+void		Com_Lock (void);
+void		Com_Unlock (void);
+void		Com_LockFrame (void);
+qboolean	Com_TryLockFrame (void);
+void		Com_UnlockFrame (void);
+
 void		Com_Init (char *cmdLine);
 void		Com_Frame (void);
 void		Com_Shutdown (void);
@@ -608,6 +642,10 @@ char		*Cvar_UserInfo (void);
 // Returns an info string containing all the CVAR_SERVERINFO variables
 char		*Cvar_ServerInfo (void);
 
+// Frees the values replaced on the server thread, which the client may
+// have been reading
+void		Cvar_FreeRetiredValues (void);
+
 void		Cvar_Init (void);
 void		Cvar_Shutdown (void);
 
@@ -632,6 +670,7 @@ typedef struct {
 	int				maxSize;
 	int				curSize;
 	int				readCount;
+	int				bit;			// Bit cursor of MSG_WriteBits / MSG_ReadBits
 } msg_t;
 
 void		MSG_Init (msg_t *msg, byte *data, int maxSize, qboolean allowOverflow);
@@ -654,6 +693,13 @@ void		MSG_WriteDir (msg_t *msg, const vec3_t dir);
 void		MSG_WriteDeltaUserCmd (msg_t *msg, const struct usercmd_s *from, const struct usercmd_s *to);
 void		MSG_WriteDeltaEntity (msg_t *msg, const struct entity_state_s *from, const struct entity_state_s *to, qboolean force, qboolean newEntity);
 
+void		MSG_WriteBits (msg_t *msg, int value, int bits);
+void		MSG_WriteBitData (msg_t *msg, const byte *data, int numBits);
+int			MSG_NumBits (const msg_t *msg);
+void		MSG_WriteEntityNumberBits (msg_t *msg, int number, int lastNumber);
+void		MSG_WriteDeltaEntityBits (msg_t *msg, const struct entity_state_s *from, const struct entity_state_s *to, qboolean force, qboolean newEntity);
+void		MSG_WriteDeltaPlayerStateBits (msg_t *msg, const player_state_t *from, const player_state_t *to, int flags);
+
 void		MSG_BeginReading (msg_t *msg);
 int			MSG_ReadChar (msg_t *msg);
 int			MSG_ReadByte (msg_t *msg);
@@ -668,8 +714,20 @@ float		MSG_ReadAngle (msg_t *msg);
 float		MSG_ReadAngle16 (msg_t *msg);
 void		MSG_ReadDir (msg_t *msg, vec3_t dir);
 void		MSG_ReadDeltaUserCmd (msg_t *msg, const struct usercmd_s *from, struct usercmd_s *to);
+int			MSG_ReadEntityBits (msg_t *msg, unsigned *bits);
+void		MSG_ReadDeltaEntity (msg_t *msg, const struct entity_state_s *from, struct entity_state_s *to, int number, unsigned bits);
+void		MSG_ReadDeltaPlayerState (msg_t *msg, player_state_t *state);
 void		MSG_ReadData (msg_t *msg, void *buffer, int size);
 
+int			MSG_ReadBits (msg_t *msg, int bits);
+int			MSG_ReadEntityNumberBits (msg_t *msg, int lastNumber);
+void		MSG_ReadDeltaEntityBits (msg_t *msg, const struct entity_state_s *from, struct entity_state_s *to, int number);
+void		MSG_ReadDeltaPlayerStateBits (msg_t *msg, player_state_t *state);
+
+void		Huff_Init (void);
+qboolean	Huff_Encode (msg_t *msg, const byte *data, int length, qboolean adaptive);
+qboolean	Huff_Decode (msg_t *msg, byte *data, int length, qboolean adaptive);
+
 /*
  =======================================================================
 
@@ -683,11 +741,16 @@ void		MSG_ReadData (msg_t *msg, void *buffer, int size);
 #define	PORT_SERVER				27910
 #define	PORT_ANY				-1
 
-#define	MAX_MSGLEN				1400		// Max length of a message
+#define	MAX_PACKETLEN			1400		// Max length of a single packet
+#define	MAX_MSGLEN				16384		// Max length of a message, which can be fragmented
+
+#define	MAX_LOAD_CLIENTS		256			// Sockets reserved for the load test clients
 
 typedef enum {
 	NS_CLIENT, 
-	NS_SERVER
+	NS_SERVER,
+	NS_LOADCLIENT,											// First load test client socket
+	NS_MAXSOCKETS = NS_LOADCLIENT + MAX_LOAD_CLIENTS
 } netSrc_t;
 
 typedef enum {
@@ -708,12 +771,39 @@ qboolean	NET_IsLocalAddress (const netAdr_t adr);
 char		*NET_AdrToString (const netAdr_t adr);
 qboolean	NET_StringToAdr (const char *s, netAdr_t *adr);
 
+#define	MAX_PACKET_BATCH		64		// Max packets read or queued at once
+
 qboolean	NET_GetPacket (netSrc_t sock, netAdr_t *from, msg_t *message);
+int			NET_GetPackets (netSrc_t sock, netAdr_t *from, msg_t *messages, int maxPackets);
 void		NET_SendPacket (netSrc_t sock, const netAdr_t to, const void *data, int length);
+void		NET_QueuePackets (netSrc_t sock);
+void		NET_FlushPackets (netSrc_t sock);
+void		NET_Sleep (int msec);
+qboolean	NET_OpenSocket (netSrc_t sock);
+void		NET_CloseSocket (netSrc_t sock);
 
 void		NET_Init (void);
 void		NET_Shutdown (void);
 
+// A snapshot of a server frame passed to the local client along with a
+// loopback packet
+typedef struct {
+	int				frameNum;
+	player_state_t	playerState;
+	int				numEntities;
+	entity_state_t	*entities;		// [MAX_EDICTS]
+} loopSnapshot_t;
+
+qboolean	NET_ReadLoopPacket (netSrc_t sock, netAdr_t *from, msg_t *message);
+qboolean	NET_GetLoopPacket (netSrc_t sock, netAdr_t *from, msg_t *message);
+byte		*NET_LoopBuffer (netSrc_t sock, int size);
+qboolean	NET_SendLoopPacket (netSrc_t sock, const netAdr_t to, const void *data, int length);
+qboolean	NET_LoopPacketsPending (netSrc_t sock);
+void		NET_AcceptLoopSnapshots (netSrc_t sock, qboolean accept);
+loopSnapshot_t	*NET_LoopSnapshot (netSrc_t sock);
+loopSnapshot_t	*NET_ReceivedLoopSnapshot (netSrc_t sock, int frameNum);
+void		NET_ShutdownLoopback (void);
+
 typedef struct {
 	netSrc_t		sock;
 
@@ -725,6 +815,9 @@ typedef struct {
 	netAdr_t		remoteAddress;
 	int				qport;							// qport value to write when transmitting
 
+	qboolean		compression;					// Huffman compress outgoing packets
+	int				maxMessageLength;				// Largest message the remote side can reassemble
+
 	// Sequencing variables
 	int				incomingSequence;
 	int				incomingAcknowledged;
@@ -742,16 +835,26 @@ typedef struct {
 	// Message is copied to this buffer when it is first transfered
 	int				reliableLength;
 	byte			reliableBuffer[MAX_MSGLEN-16];	// Unacked reliable message
+
+	// Fragments of an incoming message are collected in this buffer
+	int				fragmentSequence;
+	int				fragmentTime;					// For time-outs
+	int				fragmentMask;					// One bit for each fragment received
+	int				fragmentCount;					// 0 until the last fragment is received
+	int				fragmentLength;
+	byte			fragmentBuffer[MAX_MSGLEN];
 } netChan_t;
 
 extern netAdr_t	net_from;
 extern msg_t	net_message;
 
 void		NetChan_Init (void);
+void		NetChan_ResetMessage (void);
 void		NetChan_OutOfBand (netSrc_t sock, const netAdr_t adr, const void *data, int length);
 void		NetChan_OutOfBandPrint (netSrc_t sock, const netAdr_t adr, const char *fmt, ...);
 void		NetChan_Setup (netSrc_t sock, netChan_t *chan, const netAdr_t adr, int qport);
-void		NetChan_Transmit (netChan_t *chan, const void *data, int length);
+void		NetChan_SetMaxMessageLength (netChan_t *chan, int length);
+int			NetChan_Transmit (netChan_t *chan, const void *data, int length);
 qboolean	NetChan_Process (netChan_t *chan, msg_t *msg);
 
 /*
@@ -769,6 +872,35 @@ typedef struct cmodel_s {
 	int				headNode;
 } cmodel_t;
 
+// A trace context holds the brush check counts and the box hull used by
+// collision queries. Queries made through different contexts don't share
+// any state, so each thread can trace through its own. Contexts must be
+// zero filled before their first use.
+typedef struct traceContext_s {
+	int				mapSequence;		// Map the check counts are for
+	int				checkCount;			// To avoid repeated testings
+	int				*brushCheckCounts;
+	int				numBrushCheckCounts;
+
+	unsigned		*leafBrushBits;		// Brushes of a leaf that overlap a move
+	int				numLeafBrushBits;
+
+	cplane_t		boxPlanes[12];
+	vec3_t			boxMins;
+	vec3_t			boxMaxs;
+
+	int				numTraces;			// For statistics
+	int				numPointContents;
+	int				numBrushTests;
+	int				numBrushesAvoided;
+
+	qboolean		forceClipKernel;	// Clip brushes with clipKernel instead of the
+	int				clipKernel;			// kernel picked for the CPU, to compare them
+
+	qboolean		registered;
+	struct traceContext_s	*next;
+} traceContext_t;
+
 void		CM_Init (void);
 
 cmodel_t	*CM_LoadMap (const char *name, qboolean clientLoad, unsigned *checksum);
@@ -777,6 +909,9 @@ void		CM_UnloadMap (void);
 void		CM_ClearStats (void);
 void		CM_PrintStats (void);
 
+// Only registered on dedicated servers
+void		CM_CollisionBenchmark_f (void);
+
 int			CM_NumInlineModels (void);
 cmodel_t	*CM_InlineModel (const char *name);
 
@@ -787,8 +922,16 @@ int			CM_LeafContents (int leafNum);
 int			CM_LeafCluster (int leafNum);
 int			CM_LeafArea (int leafNum);
 
-// Creates a clipping hull for an arbitrary box
+// Returns a reproducible random number between 0 and 1, for the collision
+// tests and benchmarks
+float		CM_RandomFloat (unsigned *seed);
+
+void		CM_FreeTraceContext (traceContext_t *ctx);
+
+// Creates a clipping hull for an arbitrary box, valid with the context it
+// was made with until the next call
 int			CM_HeadNodeForBox (const vec3_t mins, const vec3_t maxs);
+int			CM_HeadNodeForBoxEx (traceContext_t *ctx, const vec3_t mins, const vec3_t maxs);
 
 // Call with topNode set to the headNode, returns with topNode set to
 // the first node that splits the box
@@ -799,9 +942,17 @@ int			CM_PointLeafNum (const vec3_t p);
 // Returns an OR'ed contents mask
 int			CM_PointContents (const vec3_t p, int headNode);
 int			CM_TransformedPointContents (const vec3_t p, int headNode, const vec3_t origin, const vec3_t angles);
+int			CM_PointContentsEx (traceContext_t *ctx, const vec3_t p, int headNode);
+int			CM_TransformedPointContentsEx (traceContext_t *ctx, const vec3_t p, int headNode, const vec3_t origin, const vec3_t angles);
 
+// The versions without a context share one under Com_Lock
 trace_t		CM_BoxTrace (const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, int headNode, int brushMask);
 trace_t		CM_TransformedBoxTrace (const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, int headNode, int brushMask, const vec3_t origin, const vec3_t angles);
+trace_t		CM_BoxTraceEx (traceContext_t *ctx, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, int headNode, int brushMask);
+trace_t		CM_TransformedBoxTraceEx (traceContext_t *ctx, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, int headNode, int brushMask, const vec3_t origin, const vec3_t angles);
+
+// Same result as a transformed trace through the hull of the given box
+trace_t		CM_BoxTraceToBoxEx (traceContext_t *ctx, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, const vec3_t boxMins, const vec3_t boxMaxs, int brushMask, const vec3_t origin);
 
 byte		*CM_ClusterPVS (int cluster);
 byte		*CM_ClusterPHS (int cluster);
@@ -835,10 +986,13 @@ void		PMove (pmove_t *pmove);
 */
 
 #ifdef WIN32
-	void		Sys_ShowConsole (qboolean show);
 	void		Sys_CreateConsole (void);
+#else
+	qboolean	Sys_StdinActive (void);
 #endif
 
+void		Sys_ShowConsole (qboolean show);
+
 char		**Sys_ListFilteredFiles (const char *directory, const char *filter, qboolean sort, int *numFiles);
 char		**Sys_ListFiles (const char *directory, const char *extension, qboolean sort, int *numFiles);
 void		Sys_FreeFileList (char **fileList);
@@ -861,8 +1015,28 @@ int		Sys_GetEvents (void);
 void		Sys_Init (void);
 void		Sys_Quit (void);
 
+void		*Sys_CreateThread (void (*func)(void *data), void *data);
+void		Sys_WaitForThread (void *thread);
+qboolean	Sys_IsMainThread (void);
+
+void		*Sys_CreateMutex (void);
+void		Sys_DestroyMutex (void *mutex);
+void		Sys_LockMutex (void *mutex);
+qboolean	Sys_TryLockMutex (void *mutex);
+void		Sys_UnlockMutex (void *mutex);
+
+void		*Sys_CreateSemaphore (int count);
+void		Sys_DestroySemaphore (void *semaphore);
+void		Sys_WaitSemaphore (void *semaphore);
+void		Sys_PostSemaphore (void *semaphore);
+
+// Both act as full memory barriers
+int		Sys_AtomicRead (volatile int *value);
+int		Sys_AtomicCompareExchange (volatile int *value, int comparand, int exchange);
+
 void		*Sys_LoadGame (void *import);
 void		Sys_UnloadGame (void);
+qboolean	Sys_GameSharesRand (void);
 
 /*
  =======================================================================
@@ -889,6 +1063,7 @@ void		CL_Init (void);
 void		CL_Shutdown (void);
 
 qboolean	SV_AllowCheats (void);
+int			SV_FrameTimeout (void);
 void		SV_Frame (int msec);
 void		SV_Init (void);
 void		SV_Shutdown (const char *message, qboolean reconnect);
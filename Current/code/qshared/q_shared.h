@@ -26,7 +26,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define __Q_SHARED_H__
 
 
-#ifndef __MINGW32__
+#ifdef _MSC_VER
 
 #pragma warning (disable : 4005)	// macro redefinition
 #pragma warning (disable : 4018)	// signed/usigned mismatch
@@ -96,6 +96,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #if defined __i386__
 #define BUILDSTRING		"Linux-i386"
+#elif defined __x86_64__
+#define BUILDSTRING		"Linux-x86_64"
 #elif defined __axp__
 #define BUILDSTRING		"Linux-AXP"
 #else
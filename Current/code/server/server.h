@@ -28,11 +28,26 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 
 #define	LATENCY_COUNTS		16
-#define	RATE_MESSAGES		10
+#define	RATE_BURST_MSEC		200		// The rate token bucket holds this much time worth of bytes
 
 // MAX_CHALLENGES is made large to prevent a denial of service attack 
 // that could cycle all of them out before legitimate users connected
 #define	MAX_CHALLENGES		1024
+#define	CHALLENGE_HASH_SIZE	1024
+#define	CHALLENGE_TIMEOUT	30000	// Challenges older than this many milliseconds are not accepted
+
+// Connectionless packets are rate limited for each source address, and
+// for all of them together
+#define	MAX_QUERY_ADDRESSES	1024
+#define	QUERY_HASH_SIZE		1024
+#define	QUERY_BURST_MSEC	2000	// The query token buckets hold this much time worth of packets
+
+// Connected clients are hashed by base address and qport, so incoming
+// packets can be matched to a client without scanning them all
+#define	CLIENT_HASH_SIZE	1024
+
+// Leafs around the view point that make up the fat PVS
+#define	MAX_FAT_CLUSTERS	64
 
 typedef enum {
 	SS_DEAD,		// No map loaded
@@ -58,6 +73,11 @@ typedef struct {
 	char			configStrings[MAX_CONFIGSTRINGS][MAX_QPATH];
 	entity_state_t	baselines[MAX_EDICTS];
 
+	// Config strings changed since they were last sent, so a string
+	// changed several times in a frame is only sent once
+	unsigned		configStringsChanged[(MAX_CONFIGSTRINGS+31) >> 5];
+	qboolean		configStringsPending;
+
 	// The multicast buffer is used to send a message to a set of 
 	// clients. It is only used to marshall data until SV_Multicast is
 	// called.
@@ -66,6 +86,15 @@ typedef struct {
 
 	// Demo server information
 	fileHandle_t	demoFile;
+
+	// Responses to status and info queries, built at most once per frame
+	int				statusFrame;		// sv.frameNum + 1 when valid
+	int				statusLength;
+	char			statusResponse[MAX_PACKETLEN];
+
+	int				infoFrame;
+	int				infoLength;
+	char			infoResponse[80];
 } server_t;
 
 typedef enum {
@@ -80,10 +109,42 @@ typedef struct {
 	byte			areaBits[MAX_MAP_AREAS/8];	// portalarea visibility bits
 	player_state_t	ps;
 	int				numEntities;
-	int				firstEntity;		// Into the circular sv_packet_entities[]
+	int				firstEntity;		// Into the circular svs.clientEntityNums[]
+	int				frameNum;			// Server frame the shared states are from
 	int				sentTime;			// For ping calculations
 } clientFrame_t;
 
+// Client frames only store entity numbers. The states themselves are
+// stored once per server frame and shared by all the clients. When an
+// entity update is deferred to save bandwidth, the client keeps an older
+// state, so the number also says how many frames older its state is.
+#define	FRAMEENT_OWNED			0x8000		// Owned by the client, so not sent as solid
+#define	FRAMEENT_AGE			0x3C00
+#define	FRAMEENT_AGE_SHIFT		10
+#define	FRAMEENT_MAX_AGE		15
+#define	FRAMEENT_MASK			0x03FF		// Enough for MAX_EDICTS
+
+// The shared states are kept long enough for the oldest state a deferred
+// entity can point to in a frame that can still be delta'ed from
+#define	FRAMEENTITIES_BACKUP	(UPDATE_BACKUP*2)
+#define	FRAMEENTITIES_MASK		(FRAMEENTITIES_BACKUP-1)
+
+// Rank of an entity update when the snapshot doesn't fit in the rate
+typedef struct {
+	float			priority;
+	int				index;
+} entityRank_t;
+
+// Scratch space for deferring entity updates, one for each job thread
+// writing snapshots, so the threads don't need it on their stacks
+typedef struct {
+	byte			header[MAX_MSGLEN];		// Start of the snapshot, to write it again
+	int				costs[MAX_EDICTS];
+	int				waits[MAX_EDICTS];
+	byte			deferred[MAX_EDICTS];
+	entityRank_t	ranks[MAX_EDICTS];
+} snapshotScratch_t;
+
 // A client can leave the server in one of four ways:
 //	- Dropping properly by quiting or disconnecting
 //	- Timing out if no valid messages are received for time-out seconds
@@ -104,9 +165,12 @@ typedef struct client_s {
 	int				frameLatency[LATENCY_COUNTS];
 	int				ping;
 
-	int				messageSize[RATE_MESSAGES];	// Used to rate drop packets
 	int				rate;
-	int				suppressCount;		// Number of messages rate suppressed
+	int				rateTokens;			// Bytes that can be sent, refilled at the rate
+	int				rateTime;			// svs.realTime of the last refill
+	int				snapshotBudget;		// Bytes the next snapshot can use, -1 if unlimited
+	int				suppressCount;		// Number of snapshots with deferred entities
+	byte			*entityWait;		// Snapshots a new entity has been deferred for, into svs.clientEntityWaits
 
 	edict_t			*edict;				// EDICT_NUM(client number + 1)
 	char			name[32];			// Extracted from user info, high bits masked
@@ -123,6 +187,7 @@ typedef struct client_s {
 	int				lastConnect;
 
 	int				challenge;			// Challenge of this user, randomly generated
+	int				protocol;			// PROTOCOL_VERSION or PROTOCOL_VERSION_BITS
 
 	netChan_t		netChan;
 
@@ -130,14 +195,64 @@ typedef struct client_s {
 	fileHandle_t	downloadFile;
 	int				downloadSize;
 	int				downloadOffset;
+
+	struct client_s	*nextHash;			// Next client in the same hash chain
+
+	// Snapshot building state, only valid while building the frame
+	vec3_t			viewOrigin;
+	int				viewArea;
+	byte			*fatPVS;
+	byte			*phs;
+	snapshotScratch_t	*scratch;		// Of the job thread writing the snapshot
+	int				numFatClusters;		// The fat PVS is kept until these change
+	int				fatClusters[MAX_FAT_CLUSTERS];
+
+	// Location of the client entity for picking multicast recipients,
+	// kept until the entity moves
+	qboolean		locationValid;
+	vec3_t			locationOrigin;
+	int				locationCluster;
+	int				locationArea;
+	int				numVisibleEntities;
+	unsigned short	*visibleEntities;	// Into svs.clientVisibleEntities
+
+	// The snapshot datagram, written by a job thread and sent from the
+	// main thread. The buffer is as large as the negotiated message length.
+	msg_t			snapshot;
+	byte			*snapshotBuffer;
+	qboolean		datagramOverflowed;
+	qboolean		snapshotFailed;		// Couldn't be written, drop the client
 } client_t;
 
+// Encoded entity deltas from a given frame, or from the baseline, to the
+// current frame, in both the byte and the bit packed encoding
+#define	MAX_DELTA_BYTES			64
+#define	DELTACACHE_BUSY			-1
+#define	DELTACACHE_ENTRIES		(MAX_EDICTS * (UPDATE_BACKUP+1) * 2)
+
 typedef struct {
+	volatile int	stamp;				// (sv.frameNum << 1) | 1 when valid
+	int				fromFrame;			// -1 = baseline
+	int				size;				// In bits for the bit packed encoding
+	byte			data[MAX_DELTA_BYTES];
+} deltaCache_t;
+
+typedef struct challenge_s {
 	netAdr_t		adr;
 	int				challenge;
 	int				time;
+
+	struct challenge_s	*nextHash;
 } challenge_t;
 
+typedef struct queryBucket_s {
+	netAdr_t		adr;
+	int				tokens;				// In thousandths of a packet
+	int				time;
+
+	struct queryBucket_s	*nextHash;
+} queryBucket_t;
+
 typedef struct {
 	qboolean		initialized;				// sv_init has completed
 	int				realTime;					// Always increasing, no clamping, etc...
@@ -147,13 +262,33 @@ typedef struct {
 	int				spawnCount;					// Incremented each server start. Used to check late spawns
 
 	client_t		*clients;					// [maxclients]
+	client_t		*clientHash[CLIENT_HASH_SIZE];	// Non-free clients by address and qport
 	int				nextClientEntities;			// Next client entity to use
 	int				numClientEntities;			// maxclients*UPDATE_BACKUP*MAX_PACKET_ENTITIES
-	entity_state_t	*clientEntities;			// [numClientEntities]
+	unsigned short	*clientEntityNums;			// [numClientEntities]
+	entity_state_t	*frameEntities;				// [FRAMEENTITIES_BACKUP*MAX_EDICTS]
+	deltaCache_t	*deltaCache;				// [DELTACACHE_ENTRIES]
+
+	byte			*clientVis;					// Fat PVS and PHS of each client
+	int				clientVisBytes;				// Size of a single PVS or PHS
+
+	int				maxClientEdicts;			// Entities the game can have, at most MAX_EDICTS
+	unsigned short	*clientVisibleEntities;		// [maxclients*maxClientEdicts]
+	byte			*clientEntityWaits;			// [maxclients*maxClientEdicts]
+
+	snapshotScratch_t	*snapshotScratch[MAX_JOB_THREADS+1];	// Allocated when a thread first needs it
 
 	int				lastHeartbeat;
 
 	challenge_t		challenges[MAX_CHALLENGES];	// To prevent invalid IPs from connecting
+	challenge_t		*challengeHash[CHALLENGE_HASH_SIZE];	// By base address
+	int				nextChallenge;				// Slots are reused in the order they were taken
+
+	queryBucket_t	queryBuckets[MAX_QUERY_ADDRESSES];	// Connectionless packet rate of each address
+	queryBucket_t	*queryHash[QUERY_HASH_SIZE];	// By base address
+	int				nextQueryBucket;
+	queryBucket_t	queryTotal;					// Query rate of all addresses together
+	queryBucket_t	connectTotal;				// Connection attempt rate of all addresses together
 
 	// Server record values
 	fileHandle_t	demoFile;
@@ -161,12 +296,26 @@ typedef struct {
 	byte			demoMulticastBuffer[MAX_MSGLEN];
 } serverStatic_t;
 
+// Time spent by the game linking entities and clipping against the
+// world, only measured while replaying user commands
+typedef struct {
+	qboolean		enabled;
+
+	double			linkTime;					// In seconds
+	double			clipTime;
+
+	int				numLinks;
+	int				numClips;
+} worldTimes_t;
+
 // =====================================================================
 
+#define EDICT_WORDS			(MAX_EDICTS >> 5)	// Size of an entity bit vector
+
 #define EDICT_NUM(n)		((edict_t *)((byte *)ge->edicts + ge->edict_size*(n)))
 #define NUM_FOR_EDICT(e)	(((byte *)(e)-(byte *)ge->edicts) / ge->edict_size)
 
-#define	OUTPUTBUF_LENGTH	(MAX_MSGLEN - 16)
+#define	OUTPUTBUF_LENGTH	(MAX_PACKETLEN - 16)
 
 typedef enum {
 	RD_NONE,
@@ -184,6 +333,8 @@ extern char				sv_outputBuf[OUTPUTBUF_LENGTH];
 
 extern game_export_t	*ge;
 
+extern worldTimes_t		sv_worldTimes;
+
 extern cvar_t	*sv_cheats;
 extern cvar_t	*sv_maxClients;
 extern cvar_t	*sv_hostName;
@@ -202,11 +353,23 @@ extern cvar_t	*sv_enforceTime;
 extern cvar_t	*sv_allowDownload;
 extern cvar_t	*sv_publicServer;
 extern cvar_t	*sv_rconPassword;
+extern cvar_t	*sv_snapshotThreads;
+extern cvar_t	*sv_bitSnapshots;
+extern cvar_t	*sv_compression;
+extern cvar_t	*sv_localSnapshots;
+extern cvar_t	*sv_queryRate;
+extern cvar_t	*sv_queryTotalRate;
+extern cvar_t	*sv_loadTestCmdRate;
+extern cvar_t	*sv_loadTestMoves;
+extern cvar_t	*sv_loadTestRate;
+extern cvar_t	*sv_loadTestBitSnapshots;
 
 int		SV_ModelIndex (const char *name);
 int		SV_SoundIndex (const char *name);
 int		SV_ImageIndex (const char *name);
 
+void	SV_InitClientSnapshots (client_t *cl);
+void	SV_FreeClient (client_t *cl);
 void	SV_DropClient (client_t *cl);
 void	SV_UserInfoChanged (client_t *cl);
 
@@ -225,15 +388,40 @@ void	SV_ServerStopRecord_f (void);
 void	SV_KillServer_f (void);
 void	SV_ServerCommand_f (void);
 void	SV_ConSay_f (void);
+void	SV_LoadTest_f (void);
+void	SV_ServerRecordCmds_f (void);
+void	SV_ServerStopRecordCmds_f (void);
+void	SV_ServerReplayCmds_f (void);
 
 void	SV_InitGame (void);
 void	SV_Map (const char *levelString, qboolean attractLoop, qboolean loadGame);
 
 void	SV_FlushRedirect (redirect_t redirect, char *outputBuf);
 
+int		SV_LoadTestTimeout (int timeout);
+qboolean	SV_IsLoadTestAddress (const netAdr_t adr);
+void	SV_LoadTestFrameTime (double msec);
+void	SV_RunLoadTest (void);
+
+void	SV_RecordCmdSpawn (serverState_t serverState);
+void	SV_RecordCmdConnect (const client_t *cl, const char *userInfo, int maxMessageLength);
+void	SV_RecordCmdUserInfo (const client_t *cl);
+void	SV_RecordCmdBegin (const client_t *cl);
+void	SV_RecordCmdCommand (const client_t *cl, const char *text);
+void	SV_RecordCmdMove (const client_t *cl, const usercmd_t *cmd);
+void	SV_RecordCmdDisconnect (const client_t *cl);
+void	SV_RecordCmdFrame (void);
+void	SV_StopCmdRecord (void);
+void	SV_StopCmdReplay (void);
+
+void	SV_ClearGameEvents (void);
+
+void	SV_WriteClientDatagrams (client_t **clients, int numClients);
 void	SV_SendClientMessages (void);
 void	SV_ParseClientMessage (client_t *cl);
 
+void	SV_ConfigStringChanged (int index);
+void	SV_FlushConfigStrings (void);
 void	SV_Multicast (vec3_t origin, multicast_t to);
 void	SV_StartSound (vec3_t origin, edict_t *entity, int channel, int sound, float volume, float attenuation, float timeOfs);
 void	SV_ClientPrintf (client_t *cl, int level, const char *fmt, ...);
@@ -246,13 +434,14 @@ void	SV_ReadLevelFile (void);
 
 void	SV_WriteFrameToClient (client_t *cl, msg_t *msg);
 void	SV_RecordDemoMessage (void);
-void	SV_BuildClientFrame (client_t *cl);
+void	SV_BuildClientFrames (client_t **clients, int numClients);
 
 void	SV_InitGameProgs (void);
 void	SV_ShutdownGameProgs (void);
 
 // Called after the world model has been loaded, before linking any entities
 void	SV_ClearWorld (void);
+void	SV_ShutdownWorld (void);
 
 // Call before removing an entity, and before trying to move one, so it
 // doesn't clip against itself
@@ -273,6 +462,14 @@ void	SV_LinkEdict (edict_t *ent);
 // Does this always return the world?
 int		SV_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list, int maxCount, int areaType);
 
+// ORs the entities that were linked into any of the clusters in the
+// given bit vector into an EDICT_WORDS bit vector. Entities marked by
+// headnode are always added.
+void	SV_ClusterEntities (const byte *bitVector, unsigned *entities);
+
+// Cached CM_PointLeafNum, for the world model only
+int		SV_PointLeafNum (const vec3_t p);
+
 // mins and maxs are relative.
 // If the entire move stays in a solid volume, trace.allsolid will be 
 // set, trace.startsolid will be set, and trace.fraction will be 0.
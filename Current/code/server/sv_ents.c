@@ -22,6 +22,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "server.h"
 
 
+static unsigned		sv_sendEntities[EDICT_WORDS];	// Entities that can be sent this frame
+static unsigned		sv_beamEntities[EDICT_WORDS];	// Beams are checked against the PHS
+
+
 /*
  =======================================================================
 
@@ -31,53 +35,242 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 
+
 /*
  =================
- SV_EmitPacketEntities
+ SV_FrameEntityNum
 
- Writes a delta update of an entity_state_t list to the message
+ Returns the entity number slot of an entity in a client frame
  =================
 */
-static void SV_EmitPacketEntities (clientFrame_t *from, clientFrame_t *to, msg_t *msg){
+static unsigned short *SV_FrameEntityNum (clientFrame_t *frame, int index){
+
+	return &svs.clientEntityNums[(frame->firstEntity+index)%svs.numClientEntities];
+}
+
+/*
+ =================
+ SV_FrameEntityState
+
+ Returns the shared state of an entity in a client frame, and how many
+ frames older than the client frame it is. Entities owned by the client
+ are copied to the given state and marked as non-solid.
+ =================
+*/
+static entity_state_t *SV_FrameEntityState (clientFrame_t *frame, int index, entity_state_t *owned, int *age){
+
+	entity_state_t	*entities;
+	int				num;
+
+	num = *SV_FrameEntityNum(frame, index);
+
+	*age = (num & FRAMEENT_AGE) >> FRAMEENT_AGE_SHIFT;
+
+	entities = svs.frameEntities + ((frame->frameNum - *age) & FRAMEENTITIES_MASK) * MAX_EDICTS;
+
+	if (!(num & FRAMEENT_OWNED))
+		return &entities[num & FRAMEENT_MASK];
+
+	// Don't mark players missiles as solid
+	*owned = entities[num & FRAMEENT_MASK];
+	owned->solid = 0;
+
+	return owned;
+}
+
+/*
+ =================
+ SV_WriteCachedDeltaEntity
+
+ Clients that delta an entity from the same frame (or from the baseline
+ if fromFrame is -1) all get the same bytes, so the first one to encode
+ it this frame stores them for the others. Safe to run on any thread.
+ Bit packed records are always written to an empty message.
+ =================
+*/
+static void SV_WriteCachedDeltaEntity (msg_t *msg, const entity_state_t *from, const entity_state_t *to, qboolean force, qboolean newEntity, int fromFrame, qboolean bitPacked){
+
+	deltaCache_t	*cache;
+	int				index, stamp, valid, start;
+
+	if (fromFrame == -1)
+		index = to->number * (UPDATE_BACKUP+1) + UPDATE_BACKUP;
+	else
+		index = to->number * (UPDATE_BACKUP+1) + (fromFrame & UPDATE_MASK);
+
+	cache = &svs.deltaCache[(index << 1) + bitPacked];
+
+	valid = (sv.frameNum << 1) | 1;
+
+	stamp = Sys_AtomicRead(&cache->stamp);
+	if (stamp == valid && cache->fromFrame == fromFrame){
+		if (bitPacked)
+			MSG_WriteBitData(msg, cache->data, cache->size);
+		else
+			MSG_Write(msg, cache->data, cache->size);
+
+		return;
+	}
+
+	// If another thread is writing this entry, just encode it again
+	if (stamp == valid || stamp == DELTACACHE_BUSY || Sys_AtomicCompareExchange(&cache->stamp, stamp, DELTACACHE_BUSY) != stamp){
+		if (bitPacked)
+			MSG_WriteDeltaEntityBits(msg, from, to, force, newEntity);
+		else
+			MSG_WriteDeltaEntity(msg, from, to, force, newEntity);
+
+		return;
+	}
+
+	start = msg->curSize;
+
+	if (bitPacked)
+		MSG_WriteDeltaEntityBits(msg, from, to, force, newEntity);
+	else
+		MSG_WriteDeltaEntity(msg, from, to, force, newEntity);
+
+	if (msg->overflowed || msg->curSize - start > MAX_DELTA_BYTES){
+		Sys_AtomicCompareExchange(&cache->stamp, DELTACACHE_BUSY, stamp);
+		return;
+	}
+
+	cache->fromFrame = fromFrame;
+
+	if (bitPacked)
+		cache->size = MSG_NumBits(msg);
+	else
+		cache->size = msg->curSize - start;
+
+	memcpy(cache->data, msg->data + start, msg->curSize - start);
+
+	Sys_AtomicCompareExchange(&cache->stamp, DELTACACHE_BUSY, valid);
+}
+
+/*
+ =================
+ SV_WriteDeltaEntity
+
+ Writes an entity delta in the encoding of the client. Bit packed records
+ don't carry the entity number, so they are built first and the number is
+ only written if there is something to send.
+ =================
+*/
+static void SV_WriteDeltaEntity (msg_t *msg, const entity_state_t *from, const entity_state_t *to, qboolean force, qboolean newEntity, int fromFrame, qboolean cached, int *lastNum){
+
+	msg_t	record;
+	byte	recordBuffer[MAX_DELTA_BYTES];
+
+	if (!lastNum){
+		if (cached)
+			SV_WriteCachedDeltaEntity(msg, from, to, force, newEntity, fromFrame, false);
+		else
+			MSG_WriteDeltaEntity(msg, from, to, force, newEntity);
+
+		return;
+	}
+
+	MSG_Init(&record, recordBuffer, sizeof(recordBuffer), false);
+
+	if (cached)
+		SV_WriteCachedDeltaEntity(&record, from, to, force, newEntity, fromFrame, true);
+	else
+		MSG_WriteDeltaEntityBits(&record, from, to, force, newEntity);
+
+	if (!record.curSize)
+		return;
+
+	MSG_WriteEntityNumberBits(msg, to->number, *lastNum);
+	MSG_WriteBits(msg, 0, 1);
+	MSG_WriteBitData(msg, record.data, MSG_NumBits(&record));
+
+	*lastNum = to->number;
+}
+
+/*
+ =================
+ SV_WritePacketEntities
+
+ Writes the entity updates from one client frame to the next. Without a
+ deferred list, the size in bits of every update is stored in costs, and
+ how many snapshots out of date the client would be without it in waits.
+
+ Updates marked in deferred are not sent. A deferred entity keeps the
+ state the client already has, and a deferred new entity is left out of
+ the frame.
+ =================
+*/
+static void SV_WritePacketEntities (client_t *cl, clientFrame_t *from, int fromFrame, clientFrame_t *to, msg_t *msg, qboolean bitPacked, int *costs, int *waits, const byte *deferred){
 
 	entity_state_t	*oldState, *newState;
-	int				oldIndex, newIndex;
-	int				oldNum, newNum;
+	entity_state_t	oldOwned, newOwned;
+	int				oldIndex, newIndex, numEntities;
+	int				oldNum, newNum, oldAge, newAge;
 	int				fromNumEntities;
-	int				bits;
+	int				bits, start, lastNum, *bitNum;
 
-	MSG_WriteByte(msg, SVC_PACKETENTITIES);
+	// Bit packed entity numbers are relative to the last one written
+	lastNum = 0;
+	bitNum = (bitPacked) ? &lastNum : NULL;
 
 	if (!from)
 		fromNumEntities = 0;
 	else
 		fromNumEntities = from->numEntities;
 
+	oldState = newState = NULL;
+	oldAge = newAge = 0;
+
 	newIndex = 0;
 	oldIndex = 0;
+	numEntities = 0;
 	while (newIndex < to->numEntities || oldIndex < fromNumEntities){
 		if (newIndex >= to->numEntities)
 			newNum = 9999;
 		else {
-			newState = &svs.clientEntities[(to->firstEntity+newIndex)%svs.numClientEntities];
+			newState = SV_FrameEntityState(to, newIndex, &newOwned, &newAge);
 			newNum = newState->number;
+
+			// MSG_WriteDeltaEntity would throw an error for a bad number,
+			// which a job can't do, so the client is dropped instead
+			if (newNum <= 0 || newNum >= MAX_EDICTS){
+				cl->snapshotFailed = true;
+				break;
+			}
 		}
 
 		if (oldIndex >= fromNumEntities)
 			oldNum = 9999;
 		else {
-			oldState = &svs.clientEntities[(from->firstEntity+oldIndex)%svs.numClientEntities];
+			oldState = SV_FrameEntityState(from, oldIndex, &oldOwned, &oldAge);
 			oldNum = oldState->number;
 		}
 
 		if (newNum == oldNum){
+			if (deferred && deferred[newIndex]){
+				// The client keeps the old state
+				*SV_FrameEntityNum(to, numEntities++) = (*SV_FrameEntityNum(from, oldIndex) & ~FRAMEENT_AGE) | ((oldAge + sv.frameNum - fromFrame) << FRAMEENT_AGE_SHIFT);
+
+				oldIndex++;
+				newIndex++;
+				continue;
+			}
+
 			// Delta update from old position.
 			// Because the force parm is false, this will not result in
 			// any bytes being emited if the entity has not changed at 
 			// all.
 			// Note that players are always 'newentities', this updates 
 			// their oldorigin always and prevents warping.
-			MSG_WriteDeltaEntity(msg, oldState, newState, false, newState->number <= sv_maxClients->integerValue);
+			start = MSG_NumBits(msg);
+
+			SV_WriteDeltaEntity(msg, oldState, newState, false, newState->number <= sv_maxClients->integerValue, fromFrame, (!oldAge && oldState != &oldOwned && newState != &newOwned), bitNum);
+
+			if (!deferred){
+				costs[newIndex] = MSG_NumBits(msg) - start;
+				waits[newIndex] = oldAge + sv.frameNum - fromFrame;
+			}
+
+			*SV_FrameEntityNum(to, numEntities++) = *SV_FrameEntityNum(to, newIndex);
 
 			oldIndex++;
 			newIndex++;
@@ -85,8 +278,26 @@ static void SV_EmitPacketEntities (clientFrame_t *from, clientFrame_t *to, msg_t
 		}
 
 		if (newNum < oldNum){
+			if (deferred && deferred[newIndex]){
+				cl->entityWait[newNum] = (waits[newIndex] < 255) ? waits[newIndex] : 255;
+
+				newIndex++;
+				continue;
+			}
+
 			// This is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity(msg, &sv.baselines[newNum], newState, true, true);
+			start = MSG_NumBits(msg);
+
+			SV_WriteDeltaEntity(msg, &sv.baselines[newNum], newState, true, true, -1, (newState != &newOwned), bitNum);
+
+			if (!deferred){
+				costs[newIndex] = MSG_NumBits(msg) - start;
+				waits[newIndex] = cl->entityWait[newNum] + 1;
+			}
+
+			cl->entityWait[newNum] = 0;
+
+			*SV_FrameEntityNum(to, numEntities++) = *SV_FrameEntityNum(to, newIndex);
 
 			newIndex++;
 			continue;
@@ -94,6 +305,16 @@ static void SV_EmitPacketEntities (clientFrame_t *from, clientFrame_t *to, msg_t
 
 		if (newNum > oldNum){
 			// The old entity isn't present in the new message
+			if (bitPacked){
+				MSG_WriteEntityNumberBits(msg, oldNum, lastNum);
+				MSG_WriteBits(msg, 1, 1);
+
+				lastNum = oldNum;
+
+				oldIndex++;
+				continue;
+			}
+
 			bits = U_REMOVE;
 			if (oldNum >= 256)
 				bits |= U_NUMBER16 | U_MOREBITS1;
@@ -112,7 +333,172 @@ static void SV_EmitPacketEntities (clientFrame_t *from, clientFrame_t *to, msg_t
 		}
 	}
 
-	MSG_WriteShort(msg, 0);	// End of packet entities
+	if (bitPacked)
+		MSG_WriteEntityNumberBits(msg, 0, lastNum);
+	else
+		MSG_WriteShort(msg, 0);	// End of packet entities
+
+	to->numEntities = numEntities;
+}
+
+/*
+ =================
+ SV_CompareEntityRanks
+ =================
+*/
+static int SV_CompareEntityRanks (const void *elem1, const void *elem2){
+
+	const entityRank_t	*rank1 = (const entityRank_t *)elem1;
+	const entityRank_t	*rank2 = (const entityRank_t *)elem2;
+
+	if (rank1->priority > rank2->priority)
+		return -1;
+	if (rank1->priority < rank2->priority)
+		return 1;
+
+	return rank1->index - rank2->index;
+}
+
+/*
+ =================
+ SV_DeferEntities
+
+ Ranks the entity updates by distance, visibility and how out of date
+ the client is, and marks the ones that don't fit in the budget as
+ deferred. The client's own entity, entities with an event, and entities
+ that can't wait any longer, are always sent. Returns true if anything was
+ deferred.
+ =================
+*/
+static qboolean SV_DeferEntities (client_t *cl, clientFrame_t *to, const int *costs, const int *waits, int budget, byte *deferred){
+
+	entityRank_t	*ranks = cl->scratch->ranks;
+	entity_state_t	*state, owned;
+	vec3_t			forward, delta;
+	float			priority;
+	int				i, age, clientNum, numRanks = 0;
+	qboolean		defer = false;
+
+	AngleVectors(to->ps.viewangles, forward, NULL, NULL);
+
+	clientNum = NUM_FOR_EDICT(cl->edict);
+
+	for (i = 0; i < to->numEntities; i++){
+		deferred[i] = 0;
+
+		if (costs[i] <= 0)
+			continue;	// Nothing to send
+
+		state = SV_FrameEntityState(to, i, &owned, &age);
+
+		// Events would be lost if they were deferred
+		if (state->number == clientNum || state->event || waits[i] > FRAMEENT_MAX_AGE){
+			budget -= costs[i];
+			continue;
+		}
+
+		// Closer entities and the ones the client has been missing for
+		// longer go first
+		VectorSubtract(state->origin, cl->viewOrigin, delta);
+		priority = (waits[i] + 1) / (VectorNormalize(delta) + 64.0f);
+
+		// Entities in front of the view and players count more
+		if (DotProduct(delta, forward) > 0.0f)
+			priority *= 2.0f;
+
+		if (state->number <= sv_maxClients->integerValue)
+			priority *= 2.0f;
+
+		ranks[numRanks].priority = priority;
+		ranks[numRanks].index = i;
+		numRanks++;
+	}
+
+	qsort(ranks, numRanks, sizeof(entityRank_t), SV_CompareEntityRanks);
+
+	// Send the most important updates that still fit
+	for (i = 0; i < numRanks; i++){
+		if (costs[ranks[i].index] <= budget){
+			budget -= costs[ranks[i].index];
+			continue;
+		}
+
+		deferred[ranks[i].index] = 1;
+		defer = true;
+	}
+
+	return defer;
+}
+
+/*
+ =================
+ SV_EmitPacketEntities
+
+ Writes a delta update of an entity_state_t list to the message. If the
+ update doesn't fit in the rate budget of the client, or in the message,
+ the less important entities are deferred and it is written again.
+ =================
+*/
+static void SV_EmitPacketEntities (client_t *cl, clientFrame_t *from, int fromFrame, clientFrame_t *to, msg_t *msg, qboolean bitPacked){
+
+	byte	*header = cl->scratch->header;
+	int		*costs = cl->scratch->costs, *waits = cl->scratch->waits;
+	byte	*deferred = cl->scratch->deferred;
+	int		i, limit, reliable, budget, start, startBit, fixed;
+
+	MSG_WriteByte(msg, SVC_PACKETENTITIES);
+
+	start = msg->curSize;
+	startBit = msg->bit;
+
+	memcpy(header, msg->data, start);
+
+	SV_WritePacketEntities(cl, from, fromFrame, to, msg, bitPacked, costs, waits, NULL);
+
+	// Leave room for the packet header, the reliable message and the
+	// multicast datagram
+	limit = msg->maxSize;
+	if (cl->snapshotBudget >= 0 && cl->snapshotBudget < limit)
+		limit = cl->snapshotBudget;
+
+	reliable = cl->netChan.message.curSize;
+	if (reliable < cl->netChan.reliableLength)
+		reliable = cl->netChan.reliableLength;
+
+	budget = limit - start - cl->datagram.curSize - reliable - 16;
+	if (budget < 0)
+		budget = 0;
+
+	budget <<= 3;
+
+	if (!msg->overflowed && MSG_NumBits(msg) - (start << 3) <= budget)
+		return;
+
+	// Removals and the end of the list are always sent. An update that
+	// was cut by an overflow is counted as the largest delta.
+	fixed = msg->overflowed ? 0 : MSG_NumBits(msg) - (start << 3);
+
+	for (i = 0; i < to->numEntities; i++){
+		if (costs[i] < 0)
+			costs[i] = MAX_DELTA_BYTES << 3;
+
+		fixed -= costs[i];
+	}
+
+	if (fixed > 0)
+		budget -= fixed;
+
+	// Write it again without the deferred entities
+	memcpy(msg->data, header, start);
+
+	msg->curSize = start;
+	msg->bit = startBit;
+	msg->overflowed = false;
+
+	if (SV_DeferEntities(cl, to, costs, waits, budget, deferred))
+		cl->suppressCount++;
+
+	SV_WritePacketEntities(cl, from, fromFrame, to, msg, bitPacked, costs, waits, deferred);
 }
 
 /*
@@ -120,7 +506,7 @@ static void SV_EmitPacketEntities (clientFrame_t *from, clientFrame_t *to, msg_t
  SV_WritePlayerStateToClient
  =================
 */
-static void SV_WritePlayerStateToClient (clientFrame_t *from, clientFrame_t *to, msg_t *msg){
+static void SV_WritePlayerStateToClient (clientFrame_t *from, clientFrame_t *to, msg_t *msg, qboolean bitPacked){
 
 	player_state_t	*newPS, *oldPS, dummy;
 	int				i, flags, statBits;
@@ -182,6 +568,12 @@ static void SV_WritePlayerStateToClient (clientFrame_t *from, clientFrame_t *to,
 
 	// Write it
 	MSG_WriteByte(msg, SVC_PLAYERINFO);
+
+	if (bitPacked){
+		MSG_WriteDeltaPlayerStateBits(msg, oldPS, newPS, flags);
+		return;
+	}
+
 	MSG_WriteShort(msg, flags);
 
 	// Write the pmove_state_t
@@ -275,6 +667,27 @@ static void SV_WritePlayerStateToClient (clientFrame_t *from, clientFrame_t *to,
 	}
 }
 
+/*
+ =================
+ SV_WriteLocalSnapshot
+
+ Copies the frame to the snapshot carried by the next loopback packet, so
+ the local client doesn't have to parse it
+ =================
+*/
+static void SV_WriteLocalSnapshot (clientFrame_t *frame, loopSnapshot_t *snapshot){
+
+	entity_state_t	owned;
+	int				i, age;
+
+	snapshot->frameNum = sv.frameNum;
+	snapshot->playerState = frame->ps;
+	snapshot->numEntities = frame->numEntities;
+
+	for (i = 0; i < frame->numEntities; i++)
+		snapshot->entities[i] = *SV_FrameEntityState(frame, i, &owned, &age);
+}
+
 /*
  =================
  SV_WriteFrameToClient
@@ -283,12 +696,18 @@ static void SV_WritePlayerStateToClient (clientFrame_t *from, clientFrame_t *to,
 void SV_WriteFrameToClient (client_t *cl, msg_t *msg){
 
 	clientFrame_t	*frame, *oldFrame;
+	loopSnapshot_t	*snapshot = NULL;
 	int				lastFrame;
 
 	// This is the frame we are creating
 	frame = &cl->frames[sv.frameNum & UPDATE_MASK];
 
-	if (cl->lastFrame <= 0){
+	// The local client can take the frame as it is, without any delta
+	// compression
+	if (sv_localSnapshots->integerValue && cl->netChan.remoteAddress.type == NA_LOOPBACK)
+		snapshot = NET_LoopSnapshot(cl->netChan.sock);
+
+	if (snapshot || cl->lastFrame <= 0){
 		// Client is asking for a retransmit
 		oldFrame = NULL;
 		lastFrame = -1;
@@ -307,18 +726,25 @@ void SV_WriteFrameToClient (client_t *cl, msg_t *msg){
 	MSG_WriteByte(msg, SVC_FRAME);
 	MSG_WriteLong(msg, sv.frameNum);
 	MSG_WriteLong(msg, lastFrame);			// What we are delta'ing from
-	MSG_WriteByte(msg, cl->suppressCount);	// Rate dropped packets
+	MSG_WriteByte(msg, cl->suppressCount);	// Snapshots with deferred entities
 	cl->suppressCount = 0;
 
 	// Send over the areabits
 	MSG_WriteByte(msg, frame->areaBytes);
 	MSG_Write(msg, frame->areaBits, frame->areaBytes);
 
+	if (snapshot){
+		SV_WriteLocalSnapshot(frame, snapshot);
+
+		MSG_WriteByte(msg, SVC_LOCALSNAPSHOT);
+		return;
+	}
+
 	// Delta encode the player state
-	SV_WritePlayerStateToClient(oldFrame, frame, msg);
+	SV_WritePlayerStateToClient(oldFrame, frame, msg, (cl->protocol == PROTOCOL_VERSION_BITS));
 
 	// Delta encode the entities
-	SV_EmitPacketEntities(oldFrame, frame, msg);
+	SV_EmitPacketEntities(cl, oldFrame, lastFrame, frame, msg, (cl->protocol == PROTOCOL_VERSION_BITS));
 }
 
 
@@ -330,22 +756,18 @@ void SV_WriteFrameToClient (client_t *cl, msg_t *msg){
  =======================================================================
 */
 
-static byte		sv_fatPVS[65536/8];		// 32767 is MAX_MAP_LEAFS
-
-
 /*
  =================
- SV_FatPVS
+ SV_FatPVSClusters
 
  The client will interpolate the view position, so we can't use a single 
- PVS point
+ PVS point. Returns the sorted list of clusters around the view position.
  =================
 */
-static void SV_FatPVS (vec3_t org){
+static int SV_FatPVSClusters (const vec3_t org, int *clusters){
 
-	int		leafs[64];
-	int		i, j, count, longs;
-	byte	*src;
+	int		leafs[MAX_FAT_CLUSTERS];
+	int		i, j, k, cluster, count, numClusters;
 	vec3_t	mins, maxs;
 
 	for (i = 0; i < 3; i++){
@@ -353,50 +775,79 @@ static void SV_FatPVS (vec3_t org){
 		maxs[i] = org[i] + 8;
 	}
 
-	count = CM_BoxLeafNums(mins, maxs, leafs, 64, NULL);
+	count = CM_BoxLeafNums(mins, maxs, leafs, MAX_FAT_CLUSTERS, NULL);
 	if (count < 1)
 		Com_Error(ERR_DROP, "SV_FatPVS: count < 1");
 
-	longs = (CM_NumClusters()+31)>>5;
-
-	// Convert leafs to clusters
-	for (i = 0; i < count; i++)
-		leafs[i] = CM_LeafCluster(leafs[i]);
+	// Convert leafs to clusters, dropping the duplicates
+	numClusters = 0;
 
-	memcpy(sv_fatPVS, CM_ClusterPVS(leafs[0]), longs<<2);
+	for (i = 0; i < count; i++){
+		cluster = CM_LeafCluster(leafs[i]);
 
-	// Or in all the other leaf bits
-	for (i = 1; i < count; i++){
-		for (j = 0; j < i; j++){
-			if (leafs[i] == leafs[j])
+		for (j = 0; j < numClusters; j++){
+			if (clusters[j] >= cluster)
 				break;
 		}
 
-		if (j != i)
+		if (j < numClusters && clusters[j] == cluster)
 			continue;		// Already have the cluster we want
 
-		src = CM_ClusterPVS(leafs[i]);
+		for (k = numClusters; k > j; k--)
+			clusters[k] = clusters[k-1];
+
+		clusters[j] = cluster;
+		numClusters++;
+	}
+
+	return numClusters;
+}
+
+/*
+ =================
+ SV_FatPVS
+ =================
+*/
+static void SV_FatPVS (const int *clusters, int numClusters, byte *fatPVS){
+
+	int		i, j, longs;
+	byte	*src;
+
+	longs = (CM_NumClusters()+31)>>5;
+
+	// Nothing is visible without a cluster
+	if (numClusters < 1){
+		memset(fatPVS, 0, longs<<2);
+		return;
+	}
+
+	memcpy(fatPVS, CM_ClusterPVS(clusters[0]), longs<<2);
+
+	// Or in all the other cluster bits
+	for (i = 1; i < numClusters; i++){
+		src = CM_ClusterPVS(clusters[i]);
 		for (j = 0; j < longs; j++)
-			((long *)sv_fatPVS)[j] |= ((long *)src)[j];
+			((unsigned *)fatPVS)[j] |= ((unsigned *)src)[j];
 	}
 }
 
 /*
  =================
- SV_BuildClientFrame
+ SV_SetupClientFrame
 
- Decides which entities are going to be visible to the client
+ Finds the view point, visible areas, PVS and PHS for the client. The fat
+ PVS is reused if the client touches the same clusters as on the last
+ frame, or as a client that was set up earlier this frame. This uses the
+ shared collision model buffers, so it must run on the main thread.
  =================
 */
-void SV_BuildClientFrame (client_t *cl){
+static void SV_SetupClientFrame (client_t **clients, int index, byte *fatPVS, byte *phs, int visBytes){
 
-	int				i, e;
-	vec3_t			org, delta;
-	edict_t			*edict, *clEdict;
+	client_t		*cl = clients[index], *other;
+	edict_t			*clEdict;
 	clientFrame_t	*frame;
-	entity_state_t	*state;
-	int				l, leafNum, area, cluster;
-	byte			*phs, *bitVector;
+	int				clusters[MAX_FAT_CLUSTERS];
+	int				i, leafNum, cluster, numClusters;
 
 	clEdict = cl->edict;
 	if (!clEdict->client)
@@ -408,100 +859,246 @@ void SV_BuildClientFrame (client_t *cl){
 	frame->sentTime = svs.realTime; // Save it for ping calc later
 
 	// Find the client's PVS
-	org[0] = clEdict->client->ps.pmove.origin[0] * 0.125 + clEdict->client->ps.viewoffset[0];
-	org[1] = clEdict->client->ps.pmove.origin[1] * 0.125 + clEdict->client->ps.viewoffset[1];
-	org[2] = clEdict->client->ps.pmove.origin[2] * 0.125 + clEdict->client->ps.viewoffset[2];
+	cl->viewOrigin[0] = clEdict->client->ps.pmove.origin[0] * 0.125 + clEdict->client->ps.viewoffset[0];
+	cl->viewOrigin[1] = clEdict->client->ps.pmove.origin[1] * 0.125 + clEdict->client->ps.viewoffset[1];
+	cl->viewOrigin[2] = clEdict->client->ps.pmove.origin[2] * 0.125 + clEdict->client->ps.viewoffset[2];
 
-	leafNum = CM_PointLeafNum(org);
-	area = CM_LeafArea(leafNum);
+	leafNum = CM_PointLeafNum(cl->viewOrigin);
 	cluster = CM_LeafCluster(leafNum);
 
+	cl->viewArea = CM_LeafArea(leafNum);
+	cl->fatPVS = fatPVS;
+	cl->phs = phs;
+
 	// Calculate the visible areas
-	frame->areaBytes = CM_WriteAreaBits(frame->areaBits, area);
+	frame->areaBytes = CM_WriteAreaBits(frame->areaBits, cl->viewArea);
 
 	// Grab the current player_state_t
 	frame->ps = clEdict->client->ps;
 
-	SV_FatPVS(org);
-	phs = CM_ClusterPHS(cluster);
+	memcpy(phs, CM_ClusterPHS(cluster), visBytes);
 
-	// Build up the list of visible entities
-	frame->numEntities = 0;
-	frame->firstEntity = svs.nextClientEntities;
+	// Build the fat PVS, unless it is already known
+	numClusters = SV_FatPVSClusters(cl->viewOrigin, clusters);
 
-	for (e = 1; e < ge->num_edicts; e++){
-		edict = EDICT_NUM(e);
+	if (numClusters == cl->numFatClusters && !memcmp(clusters, cl->fatClusters, numClusters * sizeof(int)))
+		return;		// Still valid from the last frame
 
-		// Ignore ents without visible models
-		if (edict->svflags & SVF_NOCLIENT)
+	cl->numFatClusters = numClusters;
+	memcpy(cl->fatClusters, clusters, numClusters * sizeof(int));
+
+	for (i = 0; i < index; i++){
+		other = clients[i];
+
+		if (!other->edict->client)
 			continue;
 
-		// Ignore ents without visible models unless they have an effect
-		if (!edict->s.modelindex && !edict->s.effects && !edict->s.sound && !edict->s.event)
+		if (numClusters == other->numFatClusters && !memcmp(clusters, other->fatClusters, numClusters * sizeof(int))){
+			memcpy(fatPVS, other->fatPVS, visBytes);
+			return;
+		}
+	}
+
+	SV_FatPVS(clusters, numClusters, fatPVS);
+}
+
+/*
+ =================
+ SV_CullClientFrame
+
+ Decides which entities are going to be visible to the client. The
+ candidates come from the cluster index, and are then checked exactly
+ like a full scan would. Safe to run on any thread.
+ =================
+*/
+static void SV_CullClientFrame (int job, int thread, void *data){
+
+	client_t		*cl = ((client_t **)data)[job];
+	unsigned		candidates[EDICT_WORDS];
+	int				i, j, e;
+	vec3_t			delta;
+	edict_t			*edict, *clEdict;
+	int				l;
+	byte			*bitVector;
+
+	cl->numVisibleEntities = 0;
+
+	clEdict = cl->edict;
+	if (!clEdict->client)
+		return;		// Not in game yet
+
+	// Gather the entities linked into the PVS, plus all beams and the
+	// client itself, out of the entities that can be sent this frame
+	memset(candidates, 0, sizeof(candidates));
+
+	SV_ClusterEntities(cl->fatPVS, candidates);
+
+	e = NUM_FOR_EDICT(clEdict);
+	candidates[e >> 5] |= 1 << (e & 31);
+
+	for (i = 0; i < EDICT_WORDS; i++)
+		candidates[i] = (candidates[i] | sv_beamEntities[i]) & sv_sendEntities[i];
+
+	for (i = 0; i < EDICT_WORDS; i++){
+		if (!candidates[i])
 			continue;
 
-		// Ignore if not touching a PV leaf
-		if (edict != clEdict){
-			// Check area
-			if (!CM_AreasConnected(area, edict->areanum)){
-				// Doors can legally straddle two areas, so we may need 
-				// to check another one
-				if (!edict->areanum2 || !CM_AreasConnected(area, edict->areanum2))
-					continue;		// Blocked by a door
-			}
+		for (j = 0; j < 32; j++){
+			if (!(candidates[i] & (1 << j)))
+				continue;
+
+			e = (i << 5) + j;
+			edict = EDICT_NUM(e);
+
+			// Ignore if not touching a PV leaf
+			if (edict != clEdict){
+				// Check area
+				if (!CM_AreasConnected(cl->viewArea, edict->areanum)){
+					// Doors can legally straddle two areas, so we may
+					// need to check another one
+					if (!edict->areanum2 || !CM_AreasConnected(cl->viewArea, edict->areanum2))
+						continue;		// Blocked by a door
+				}
 
-			// Beams just check one point for PHS
-			if (edict->s.renderfx & RF_BEAM){
-				l = edict->clusternums[0];
-				if (!(phs[l >> 3] & (1 << (l&7))))
-					continue;
-			}
-			else {
-				// FIXME: if an entity has a model and a sound, but
-				// isn't in the PVS, only the PHS, clear the model
-				bitVector = sv_fatPVS;
-
-				if (edict->num_clusters == -1){
-					// Too many leafs for individual check, go by headnode
-					if (!CM_HeadNodeVisible(edict->headnode, bitVector))
+				// Beams just check one point for PHS
+				if (edict->s.renderfx & RF_BEAM){
+					l = edict->clusternums[0];
+					if (!(cl->phs[l >> 3] & (1 << (l&7))))
 						continue;
 				}
 				else {
-					// Check individual leafs
-					for (i = 0; i < edict->num_clusters; i++){
-						l = edict->clusternums[i];
-						if (bitVector[l >> 3] & (1 << (l&7)))
-							break;
+					// FIXME: if an entity has a model and a sound, but
+					// isn't in the PVS, only the PHS, clear the model
+					bitVector = cl->fatPVS;
+
+					if (edict->num_clusters == -1){
+						// Too many leafs for individual check, go by
+						// headnode
+						if (!CM_HeadNodeVisible(edict->headnode, bitVector))
+							continue;
+					}
+					else {
+						// Check individual leafs
+						for (l = 0; l < edict->num_clusters; l++){
+							if (bitVector[edict->clusternums[l] >> 3] & (1 << (edict->clusternums[l]&7)))
+								break;
+						}
+
+						if (l == edict->num_clusters)
+							continue;		// Not visible
 					}
 
-					if (i == edict->num_clusters)
-						continue;		// Not visible
-				}
-
-				if (!edict->s.modelindex){
-					// Don't send sounds if they will be attenuated away
-					VectorSubtract(org, edict->s.origin, delta);
-					if (VectorLength(delta) > 400)
-						continue;
+					if (!edict->s.modelindex){
+						// Don't send sounds if they will be attenuated
+						// away
+						VectorSubtract(cl->viewOrigin, edict->s.origin, delta);
+						if (VectorLength(delta) > 400)
+							continue;
+					}
 				}
 			}
+
+			if (edict->owner == clEdict)
+				cl->visibleEntities[cl->numVisibleEntities++] = e | FRAMEENT_OWNED;
+			else
+				cl->visibleEntities[cl->numVisibleEntities++] = e;
 		}
+	}
+}
+
+/*
+ =================
+ SV_BuildClientFrames
+
+ Builds the frames for a list of clients. The entity states are copied
+ once into the shared frameEntities array, and each client frame only
+ gets a list of entity numbers. Entity culling is spread over
+ sv_snapshotThreads threads, and space in the clientEntityNums array is
+ handed out in client order, so the result is the same no matter how
+ many threads are used.
+ =================
+*/
+void SV_BuildClientFrames (client_t **clients, int numClients){
+
+	client_t		*cl;
+	clientFrame_t	*frame;
+	entity_state_t	*entities;
+	edict_t			*edict;
+	int				i, e, first, count, visBytes;
+
+	// Allocate PVS / PHS space for every client
+	visBytes = ((CM_NumClusters()+31)>>5)<<2;
+	if (!visBytes)
+		visBytes = 4;
+
+	if (svs.clientVisBytes != visBytes){
+		if (svs.clientVis)
+			Z_Free(svs.clientVis);
+
+		svs.clientVis = Z_Malloc(sv_maxClients->integerValue * visBytes * 2);
+		svs.clientVisBytes = visBytes;
+	}
+
+	// Copy the states of all the entities that could be sent to anyone,
+	// making sure the entity numbers are valid
+	entities = svs.frameEntities + (sv.frameNum & FRAMEENTITIES_MASK) * MAX_EDICTS;
+
+	memset(sv_sendEntities, 0, sizeof(sv_sendEntities));
+	memset(sv_beamEntities, 0, sizeof(sv_beamEntities));
+
+	for (e = 1; e < ge->num_edicts; e++){
+		edict = EDICT_NUM(e);
+
+		if (edict->svflags & SVF_NOCLIENT)
+			continue;
+
+		if (!edict->s.modelindex && !edict->s.effects && !edict->s.sound && !edict->s.event)
+			continue;
 
-		// Add it to the circular clientEntities array
 		if (edict->s.number != e){
 			Com_DPrintf(S_COLOR_YELLOW "FIXING EDICT->S.NUMBER != E!!!\n");
 			edict->s.number = e;
 		}
 
-		state = &svs.clientEntities[svs.nextClientEntities%svs.numClientEntities];
-		*state = edict->s;
+		entities[e] = edict->s;
+
+		sv_sendEntities[e >> 5] |= 1 << (e & 31);
+		if (edict->s.renderfx & RF_BEAM)
+			sv_beamEntities[e >> 5] |= 1 << (e & 31);
+	}
+
+	for (i = 0; i < numClients; i++){
+		cl = clients[i];
+
+		e = cl - svs.clients;
+		SV_SetupClientFrame(clients, i, svs.clientVis + visBytes * (e*2), svs.clientVis + visBytes * (e*2+1), visBytes);
+	}
+
+	Com_RunJobs(sv_snapshotThreads->integerValue, numClients, SV_CullClientFrame, clients);
+
+	// Store the entity numbers in the circular clientEntityNums array
+	for (i = 0; i < numClients; i++){
+		cl = clients[i];
+
+		if (!cl->edict->client)
+			continue;		// Not in game yet
+
+		frame = &cl->frames[sv.frameNum & UPDATE_MASK];
+
+		frame->numEntities = cl->numVisibleEntities;
+		frame->firstEntity = svs.nextClientEntities;
+		frame->frameNum = sv.frameNum;
+
+		svs.nextClientEntities += cl->numVisibleEntities;
 
-		// Don't mark players missiles as solid
-		if (edict->owner == cl->edict)
-			state->solid = 0;
+		// Split the copy if it wraps around
+		first = frame->firstEntity % svs.numClientEntities;
+		count = svs.numClientEntities - first;
+		if (count > cl->numVisibleEntities)
+			count = cl->numVisibleEntities;
 
-		svs.nextClientEntities++;
-		frame->numEntities++;
+		memcpy(svs.clientEntityNums + first, cl->visibleEntities, count * sizeof(unsigned short));
+		memcpy(svs.clientEntityNums, cl->visibleEntities + count, (cl->numVisibleEntities - count) * sizeof(unsigned short));
 	}
 }
 
@@ -27,6 +27,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 game_export_t	*ge;
 
+worldTimes_t	sv_worldTimes;
+
 
 /*
  =================
@@ -49,8 +51,13 @@ static void SVG_Unicast (edict_t *edict, qboolean reliable){
 
 	client = svs.clients + (e-1);
 
-	if (reliable)
+	if (reliable){
+		// The message may refer to config strings that haven't been sent
+		// yet
+		SV_FlushConfigStrings();
+
 		MSG_Write(&client->netChan.message, sv.multicast.data, sv.multicast.curSize);
+	}
 	else
 		MSG_Write(&client->datagram, sv.multicast.data, sv.multicast.curSize);
 
@@ -204,6 +211,10 @@ static void SVG_ConfigString (int index, char *string){
 	if (!string)
 		string = "";
 
+	// Games often set a string to the value it already has
+	if (!Q_strcmp(sv.configStrings[index], string))
+		return;
+
 	// Change the string in sv
 #ifdef SECURE
 	strcpy_s(sv.configStrings[index], sizeof(sv.configStrings[index]), string);
@@ -211,14 +222,8 @@ static void SVG_ConfigString (int index, char *string){
 	strcpy(sv.configStrings[index], string);
 #endif
 
-	if (sv.state != SS_LOADING){
-		// Send the update to everyone
-		MSG_Clear(&sv.multicast);
-		MSG_WriteChar(&sv.multicast, SVC_CONFIGSTRING);
-		MSG_WriteShort(&sv.multicast, index);
-		MSG_WriteString(&sv.multicast, string);
-		SV_Multicast(vec3_origin, MULTICAST_ALL_R);
-	}
+	// Send the update to everyone
+	SV_ConfigStringChanged(index);
 }
 
 /*
@@ -325,12 +330,12 @@ static qboolean SVG_InPVS (vec3_t p1, vec3_t p2){
 	int		area1, area2;
 	byte	*mask;
 
-	leafNum = CM_PointLeafNum(p1);
+	leafNum = SV_PointLeafNum(p1);
 	cluster = CM_LeafCluster(leafNum);
 	area1 = CM_LeafArea(leafNum);
 	mask = CM_ClusterPVS(cluster);
 
-	leafNum = CM_PointLeafNum(p2);
+	leafNum = SV_PointLeafNum(p2);
 	cluster = CM_LeafCluster(leafNum);
 	area2 = CM_LeafArea(leafNum);
 
@@ -357,12 +362,12 @@ static qboolean SVG_InPHS (vec3_t p1, vec3_t p2){
 	int		area1, area2;
 	byte	*mask;
 
-	leafNum = CM_PointLeafNum(p1);
+	leafNum = SV_PointLeafNum(p1);
 	cluster = CM_LeafCluster(leafNum);
 	area1 = CM_LeafArea(leafNum);
 	mask = CM_ClusterPHS(cluster);
 
-	leafNum = CM_PointLeafNum(p2);
+	leafNum = SV_PointLeafNum(p2);
 	cluster = CM_LeafCluster(leafNum);
 	area2 = CM_LeafArea(leafNum);
 
@@ -435,6 +440,119 @@ static void SVG_FreeTags (int tag){
 }
 
 
+/*
+ =================
+ SVG_LinkEdict
+ =================
+*/
+static void SVG_LinkEdict (edict_t *edict){
+
+	double	time;
+
+	if (!sv_worldTimes.enabled){
+		SV_LinkEdict(edict);
+		return;
+	}
+
+	time = Sys_GetClockTicks();
+
+	SV_LinkEdict(edict);
+
+	sv_worldTimes.linkTime += Sys_GetClockTicks() - time;
+	sv_worldTimes.numLinks++;
+}
+
+/*
+ =================
+ SVG_UnlinkEdict
+ =================
+*/
+static void SVG_UnlinkEdict (edict_t *edict){
+
+	double	time;
+
+	if (!sv_worldTimes.enabled){
+		SV_UnlinkEdict(edict);
+		return;
+	}
+
+	time = Sys_GetClockTicks();
+
+	SV_UnlinkEdict(edict);
+
+	sv_worldTimes.linkTime += Sys_GetClockTicks() - time;
+	sv_worldTimes.numLinks++;
+}
+
+/*
+ =================
+ SVG_AreaEdicts
+ =================
+*/
+static int SVG_AreaEdicts (vec3_t mins, vec3_t maxs, edict_t **list, int maxCount, int areaType){
+
+	double	time;
+	int		count;
+
+	if (!sv_worldTimes.enabled)
+		return SV_AreaEdicts(mins, maxs, list, maxCount, areaType);
+
+	time = Sys_GetClockTicks();
+
+	count = SV_AreaEdicts(mins, maxs, list, maxCount, areaType);
+
+	sv_worldTimes.clipTime += Sys_GetClockTicks() - time;
+	sv_worldTimes.numClips++;
+
+	return count;
+}
+
+/*
+ =================
+ SVG_Trace
+ =================
+*/
+static trace_t SVG_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *passEdict, int contentMask){
+
+	trace_t	trace;
+	double	time;
+
+	if (!sv_worldTimes.enabled)
+		return SV_Trace(start, mins, maxs, end, passEdict, contentMask);
+
+	time = Sys_GetClockTicks();
+
+	trace = SV_Trace(start, mins, maxs, end, passEdict, contentMask);
+
+	sv_worldTimes.clipTime += Sys_GetClockTicks() - time;
+	sv_worldTimes.numClips++;
+
+	return trace;
+}
+
+/*
+ =================
+ SVG_PointContents
+ =================
+*/
+static int SVG_PointContents (vec3_t p){
+
+	double	time;
+	int		contents;
+
+	if (!sv_worldTimes.enabled)
+		return SV_PointContents(p);
+
+	time = Sys_GetClockTicks();
+
+	contents = SV_PointContents(p);
+
+	sv_worldTimes.clipTime += Sys_GetClockTicks() - time;
+	sv_worldTimes.numClips++;
+
+	return contents;
+}
+
 // =====================================================================
 
 
@@ -481,11 +599,11 @@ void SV_InitGameProgs (void){
 	import.multicast = SV_Multicast;
 	import.bprintf = SV_BroadcastPrintf;
 	import.positioned_sound = SV_StartSound;
-	import.linkentity = SV_LinkEdict;
-	import.unlinkentity = SV_UnlinkEdict;
-	import.BoxEdicts = SV_AreaEdicts;
-	import.trace = SV_Trace;
-	import.pointcontents = SV_PointContents;
+	import.linkentity = SVG_LinkEdict;
+	import.unlinkentity = SVG_UnlinkEdict;
+	import.BoxEdicts = SVG_AreaEdicts;
+	import.trace = SVG_Trace;
+	import.pointcontents = SVG_PointContents;
 	import.Pmove = PMove;
 
 	import.modelindex = SV_ModelIndex;
@@ -44,14 +44,8 @@ static int SV_FindIndex (const char *name, int start, int max){
 
 	Q_strncpyz(sv.configStrings[start+i], name, sizeof(sv.configStrings[start+i]));
 
-	if (sv.state != SS_LOADING){
-		// Send the update to everyone
-		MSG_Clear(&sv.multicast);
-		MSG_WriteChar(&sv.multicast, SVC_CONFIGSTRING);
-		MSG_WriteShort(&sv.multicast, start+i);
-		MSG_WriteString(&sv.multicast, name);
-		SV_Multicast(vec3_origin, MULTICAST_ALL_R);
-	}
+	// Send the update to everyone
+	SV_ConfigStringChanged(start+i);
 
 	return i;
 }
@@ -194,6 +188,10 @@ static void SV_SpawnServer (const char *server, const char *spawnPoint, qboolean
 
 	memset(&sv, 0, sizeof(server_t));
 
+	// Cached entity deltas refer to the frame numbers of the last level
+	if (svs.deltaCache)
+		memset(svs.deltaCache, 0, DELTACACHE_ENTRIES * sizeof(deltaCache_t));
+
 	sv.attractLoop = attractLoop;
 	sv.loadGame = loadGame;
 	Q_strncpyz(sv.name, server, sizeof(sv.name));
@@ -218,6 +216,8 @@ static void SV_SpawnServer (const char *server, const char *spawnPoint, qboolean
 			svs.clients[i].state = CS_CONNECTED;
 
 		svs.clients[i].lastFrame = -1;
+		svs.clients[i].numFatClusters = 0;	// Rebuild the fat PVS
+		svs.clients[i].locationValid = false;
 	}
 
 	if (serverState == SS_GAME){
@@ -245,6 +245,9 @@ static void SV_SpawnServer (const char *server, const char *spawnPoint, qboolean
 	sv.state = SS_LOADING;
 	Com_SetServerState(sv.state);
 
+	// Start or stop recording user commands
+	SV_RecordCmdSpawn(serverState);
+
 	// Load and spawn all other entities
 	ge->SpawnEntities(sv.name, CM_EntityString(), (char *)spawnPoint);
 
@@ -329,17 +332,27 @@ void SV_InitGame (void){
 	svs.spawnCount = rand();
 	svs.clients = Z_Malloc(sv_maxClients->integerValue * sizeof(client_t));
 	svs.numClientEntities = sv_maxClients->integerValue * UPDATE_BACKUP*64;
-	svs.clientEntities = Z_Malloc(svs.numClientEntities * sizeof(entity_state_t));
+	svs.clientEntityNums = Z_Malloc(svs.numClientEntities * sizeof(unsigned short));
+	svs.frameEntities = Z_Malloc(FRAMEENTITIES_BACKUP * MAX_EDICTS * sizeof(entity_state_t));
+	svs.deltaCache = Z_Malloc(DELTACACHE_ENTRIES * sizeof(deltaCache_t));
 
 	// Send a heartbeat immediately
 	svs.lastHeartbeat = -9999999;
 
 	memset(svs.clients, 0, sv_maxClients->integerValue * sizeof(client_t));
-	memset(svs.clientEntities, 0, svs.numClientEntities * sizeof(entity_state_t));
+	memset(svs.clientEntityNums, 0, svs.numClientEntities * sizeof(unsigned short));
+	memset(svs.frameEntities, 0, FRAMEENTITIES_BACKUP * MAX_EDICTS * sizeof(entity_state_t));
+	memset(svs.deltaCache, 0, DELTACACHE_ENTRIES * sizeof(deltaCache_t));
 
 	// Init game
 	SV_InitGameProgs();
 
+	// Entity lists of the clients only need to be as large as the game
+	// allows
+	svs.maxClientEdicts = (ge->max_edicts < MAX_EDICTS) ? ge->max_edicts : MAX_EDICTS;
+	svs.clientVisibleEntities = Z_Malloc(sv_maxClients->integerValue * svs.maxClientEdicts * sizeof(unsigned short));
+	svs.clientEntityWaits = Z_Malloc(sv_maxClients->integerValue * svs.maxClientEdicts);
+
 	for (e = 0; e < sv_maxClients->integerValue; e++){
 		edict = EDICT_NUM(e+1);
 		edict->s.number = e+1;
@@ -0,0 +1,1227 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+#include "server.h"
+
+
+/*
+ The loadTest command connects a number of headless clients to a server,
+ the local one by default, to measure how it holds up under load.
+
+ Each client has its own UDP socket and net channel, and goes through the
+ same handshake as a real client: it asks for a challenge, connects,
+ answers the commands of the precache sequence, then sends a stream of
+ user commands and parses every snapshot it gets back. Entities are
+ tracked by number only, which is all the delta parsing needs.
+
+ When the test ends a report is printed with the server frame times (for
+ the local server only), the bandwidth used by each client and the
+ snapshot latency, which is the time from sending a user command until
+ a snapshot that acknowledges it arrives.
+*/
+
+#define LOADTEST_RESEND			1000		// Milliseconds between handshake retries
+
+#define LOADTEST_CMD_BACKUP		64			// Must be a power of two
+#define LOADTEST_CMD_MASK		(LOADTEST_CMD_BACKUP-1)
+
+#define LOADTEST_PARSE_ENTITIES	1024		// Must be a power of two
+#define LOADTEST_PARSE_MASK		(LOADTEST_PARSE_ENTITIES-1)
+
+#define LOADTEST_BUCKETS		2000
+
+typedef enum {
+	LC_DISCONNECTED,						// Rejected or dropped by the server
+	LC_CHALLENGING,							// Waiting for a challenge
+	LC_CONNECTING,							// Waiting for the connect reply
+	LC_CONNECTED,							// Going through the precache sequence
+	LC_ACTIVE								// Got a valid frame, sending user commands
+} loadClientState_t;
+
+typedef struct {
+	qboolean			valid;
+	int					serverFrame;
+
+	player_state_t		playerState;
+
+	int					numEntities;
+	int					parseEntitiesIndex;		// Into the entityNums ring
+} loadFrame_t;
+
+typedef struct {
+	loadClientState_t	state;
+	int					index;
+
+	int					qport;
+	int					challenge;
+	int					lastResend;
+
+	netChan_t			netChan;
+	int					protocol;
+
+	// Snapshots are parsed against the frame they are delta'ed from
+	loadFrame_t			frames[UPDATE_BACKUP];
+	loadFrame_t			*frame;						// Last valid frame
+	int					entityNums[LOADTEST_PARSE_ENTITIES];
+	int					parseEntitiesIndex;
+
+	// User commands, along with the time they were sent, for latency
+	usercmd_t			cmds[LOADTEST_CMD_BACKUP];
+	double				cmdTimes[LOADTEST_CMD_BACKUP];
+	int					lastAcknowledged;
+	int					lastCmdTime;
+	int					nextCmdTime;
+
+	// Movement
+	float				yaw;
+	float				yawSpeed;
+	int					forwardMove;
+	int					sideMove;
+	int					upMove;
+	int					buttons;
+	int					nextMoveTime;
+
+	// Statistics
+	int					bytesSent;
+	int					bytesReceived;
+	int					numFrames;
+	int					numEntities;
+	qboolean			parseError;
+} loadClient_t;
+
+typedef struct {
+	float				bucketSize;				// In milliseconds
+	int					counts[LOADTEST_BUCKETS];
+
+	int					numSamples;
+	double				total;
+	double				max;
+} loadHistogram_t;
+
+typedef struct {
+	qboolean			active;
+
+	netAdr_t			address;
+
+	int					numClients;
+	loadClient_t		*clients;
+
+	int					startTime;
+	int					endTime;
+
+	loadHistogram_t		frameTimes;
+	loadHistogram_t		latencies;
+
+	char				lastPrint[MAX_STRING_CHARS];	// Last rejection
+} loadTest_t;
+
+static loadTest_t	sv_loadTest;
+
+static msg_t		sv_loadMessage;
+static byte			sv_loadMessageBuffer[MAX_MSGLEN];
+
+
+/*
+ =================
+ SV_AddSample
+ =================
+*/
+static void SV_AddSample (loadHistogram_t *histogram, double value){
+
+	int		bucket;
+
+	bucket = value / histogram->bucketSize;
+	bucket = Clamp(bucket, 0, LOADTEST_BUCKETS-1);
+
+	histogram->counts[bucket]++;
+
+	histogram->numSamples++;
+	histogram->total += value;
+
+	if (histogram->max < value)
+		histogram->max = value;
+}
+
+/*
+ =================
+ SV_Percentile
+
+ Returns the upper bound of the bucket holding the given fraction of the
+ samples
+ =================
+*/
+static double SV_Percentile (const loadHistogram_t *histogram, float fraction){
+
+	double	value;
+	int		count, target;
+	int		i;
+
+	target = ceil(histogram->numSamples * fraction);
+	if (target < 1)
+		target = 1;
+
+	for (i = 0, count = 0; i < LOADTEST_BUCKETS; i++){
+		count += histogram->counts[i];
+		if (count >= target)
+			break;
+	}
+
+	value = (i + 1) * histogram->bucketSize;
+	if (value > histogram->max)
+		value = histogram->max;
+
+	return value;
+}
+
+/*
+ =================
+ SV_PrintHistogram
+ =================
+*/
+static void SV_PrintHistogram (const char *name, const loadHistogram_t *histogram){
+
+	if (!histogram->numSamples){
+		Com_Printf("%s: no samples\n", name);
+		return;
+	}
+
+	Com_Printf("%s: %i samples, avg %.2f, p50 %.2f, p90 %.2f, p99 %.2f, max %.2f ms\n", name, histogram->numSamples, histogram->total / histogram->numSamples, SV_Percentile(histogram, 0.50f), SV_Percentile(histogram, 0.90f), SV_Percentile(histogram, 0.99f), histogram->max);
+}
+
+
+/*
+ =======================================================================
+
+ SNAPSHOT PARSING
+
+ =======================================================================
+*/
+
+
+/*
+ =================
+ SV_LoadClientError
+ =================
+*/
+static void SV_LoadClientError (loadClient_t *cl, const char *message){
+
+	Com_Printf(S_COLOR_YELLOW "Load client %i: %s\n", cl->index, message);
+
+	cl->state = LC_DISCONNECTED;
+	cl->parseError = true;
+}
+
+/*
+ =================
+ SV_LoadClientAddEntity
+ =================
+*/
+static void SV_LoadClientAddEntity (loadClient_t *cl, loadFrame_t *frame, int number){
+
+	cl->entityNums[cl->parseEntitiesIndex & LOADTEST_PARSE_MASK] = number;
+	cl->parseEntitiesIndex++;
+
+	frame->numEntities++;
+}
+
+/*
+ =================
+ SV_LoadClientNextOldEntity
+
+ Steps to the next entity of the frame being delta'ed from, and returns
+ its number
+ =================
+*/
+static int SV_LoadClientNextOldEntity (const loadClient_t *cl, const loadFrame_t *oldFrame, int *oldIndex){
+
+	if (!oldFrame || ++(*oldIndex) >= oldFrame->numEntities)
+		return 99999;
+
+	return cl->entityNums[(oldFrame->parseEntitiesIndex + *oldIndex) & LOADTEST_PARSE_MASK];
+}
+
+/*
+ =================
+ SV_LoadClientParseEntities
+
+ Merges the entity updates with the entities of the frame they are
+ delta'ed from
+ =================
+*/
+static qboolean SV_LoadClientParseEntities (loadClient_t *cl, msg_t *msg, const loadFrame_t *oldFrame, loadFrame_t *newFrame){
+
+	entity_state_t	nullState, state;
+	int				newNum, oldNum, lastNum;
+	int				oldIndex;
+	unsigned		bits;
+	qboolean		bitPacked;
+
+	memset(&nullState, 0, sizeof(entity_state_t));
+
+	bitPacked = (cl->protocol == PROTOCOL_VERSION_BITS);
+	lastNum = 0;
+
+	newFrame->parseEntitiesIndex = cl->parseEntitiesIndex;
+	newFrame->numEntities = 0;
+
+	oldIndex = -1;
+	oldNum = SV_LoadClientNextOldEntity(cl, oldFrame, &oldIndex);
+
+	while (1){
+		if (bitPacked){
+			newNum = MSG_ReadEntityNumberBits(msg, lastNum);
+			if (newNum && MSG_ReadBits(msg, 1))
+				bits = U_REMOVE;
+			else
+				bits = 0;
+
+			lastNum = newNum;
+		}
+		else
+			newNum = MSG_ReadEntityBits(msg, &bits);
+
+		if (newNum >= MAX_EDICTS || msg->readCount > msg->curSize)
+			return false;
+
+		if (!newNum)
+			break;
+
+		// Entities from the old frame that are unchanged
+		while (oldNum < newNum){
+			SV_LoadClientAddEntity(cl, newFrame, oldNum);
+
+			oldNum = SV_LoadClientNextOldEntity(cl, oldFrame, &oldIndex);
+		}
+
+		// The entity present in the old frame is removed
+		if (bits & U_REMOVE){
+			oldNum = SV_LoadClientNextOldEntity(cl, oldFrame, &oldIndex);
+			continue;
+		}
+
+		// Delta from either the old frame or the baseline. The values are
+		// not used, so the state we are delta'ing from doesn't matter.
+		if (bitPacked)
+			MSG_ReadDeltaEntityBits(msg, &nullState, &state, newNum);
+		else
+			MSG_ReadDeltaEntity(msg, &nullState, &state, newNum, bits);
+
+		SV_LoadClientAddEntity(cl, newFrame, newNum);
+
+		if (oldNum == newNum)
+			oldNum = SV_LoadClientNextOldEntity(cl, oldFrame, &oldIndex);
+	}
+
+	// Any remaining entities in the old frame are unchanged
+	while (oldNum != 99999){
+		SV_LoadClientAddEntity(cl, newFrame, oldNum);
+
+		oldNum = SV_LoadClientNextOldEntity(cl, oldFrame, &oldIndex);
+	}
+
+	return true;
+}
+
+/*
+ =================
+ SV_LoadClientParseFrame
+ =================
+*/
+static qboolean SV_LoadClientParseFrame (loadClient_t *cl, msg_t *msg){
+
+	loadFrame_t	frame, *oldFrame;
+	byte		areaBits[MAX_MAP_AREAS/8];
+	double		time;
+	int			deltaFrame, len;
+	int			sequence;
+
+	memset(&frame, 0, sizeof(loadFrame_t));
+
+	frame.serverFrame = MSG_ReadLong(msg);
+	deltaFrame = MSG_ReadLong(msg);
+	MSG_ReadByte(msg);		// Suppress count
+
+	// Find the frame this one is delta'ed from
+	if (deltaFrame <= 0){
+		oldFrame = NULL;
+		frame.valid = true;
+	}
+	else {
+		oldFrame = &cl->frames[deltaFrame & UPDATE_MASK];
+
+		if (oldFrame->valid && oldFrame->serverFrame == deltaFrame && cl->parseEntitiesIndex - oldFrame->parseEntitiesIndex <= LOADTEST_PARSE_ENTITIES-128)
+			frame.valid = true;
+	}
+
+	len = MSG_ReadByte(msg);
+	if (len < 0 || len > sizeof(areaBits))
+		return false;
+
+	MSG_ReadData(msg, areaBits, len);
+
+	// Read the player state
+	if (MSG_ReadByte(msg) != SVC_PLAYERINFO)
+		return false;
+
+	if (oldFrame)
+		frame.playerState = oldFrame->playerState;
+
+	if (cl->protocol == PROTOCOL_VERSION_BITS)
+		MSG_ReadDeltaPlayerStateBits(msg, &frame.playerState);
+	else
+		MSG_ReadDeltaPlayerState(msg, &frame.playerState);
+
+	// Read the packet entities
+	if (MSG_ReadByte(msg) != SVC_PACKETENTITIES)
+		return false;
+
+	if (!SV_LoadClientParseEntities(cl, msg, oldFrame, &frame))
+		return false;
+
+	cl->frames[frame.serverFrame & UPDATE_MASK] = frame;
+
+	if (!frame.valid)
+		return true;
+
+	cl->frame = &cl->frames[frame.serverFrame & UPDATE_MASK];
+
+	if (cl->state == LC_CONNECTED)
+		cl->state = LC_ACTIVE;
+
+	cl->numFrames++;
+	cl->numEntities += frame.numEntities;
+
+	// Take the latency of the user commands this snapshot acknowledges
+	time = Sys_GetClockTicks();
+
+	sequence = cl->netChan.incomingAcknowledged - LOADTEST_CMD_BACKUP + 1;
+	if (sequence <= cl->lastAcknowledged)
+		sequence = cl->lastAcknowledged + 1;
+
+	for ( ; sequence <= cl->netChan.incomingAcknowledged; sequence++){
+		if (!cl->cmdTimes[sequence & LOADTEST_CMD_MASK])
+			continue;
+
+		SV_AddSample(&sv_loadTest.latencies, (time - cl->cmdTimes[sequence & LOADTEST_CMD_MASK]) * 1000.0);
+
+		cl->cmdTimes[sequence & LOADTEST_CMD_MASK] = 0.0;
+	}
+
+	cl->lastAcknowledged = cl->netChan.incomingAcknowledged;
+
+	return true;
+}
+
+/*
+ =================
+ SV_LoadClientStuffText
+
+ Answers the commands a real client would get through the command buffer
+ =================
+*/
+static void SV_LoadClientStuffText (loadClient_t *cl, const char *text){
+
+	char	line[MAX_STRING_CHARS];
+	int		i;
+
+	while (*text){
+		for (i = 0; *text && *text != '\n'; text++){
+			if (i < sizeof(line) - 1)
+				line[i++] = *text;
+		}
+		line[i] = 0;
+
+		if (*text)
+			text++;
+
+		Cmd_TokenizeString(line);
+
+		if (!Q_stricmp(Cmd_Argv(0), "cmd")){
+			MSG_WriteByte(&cl->netChan.message, CLC_STRINGCMD);
+			MSG_WriteString(&cl->netChan.message, Cmd_Args());
+		}
+		else if (!Q_stricmp(Cmd_Argv(0), "precache")){
+			MSG_WriteByte(&cl->netChan.message, CLC_STRINGCMD);
+			MSG_WriteString(&cl->netChan.message, va("begin %s\n", Cmd_Argv(1)));
+		}
+		else if (!Q_stricmp(Cmd_Argv(0), "changing"))
+			cl->state = LC_CONNECTED;
+		else if (!Q_stricmp(Cmd_Argv(0), "reconnect")){
+			cl->state = LC_CONNECTED;
+
+			MSG_WriteByte(&cl->netChan.message, CLC_STRINGCMD);
+			MSG_WriteString(&cl->netChan.message, "new");
+		}
+	}
+}
+
+/*
+ =================
+ SV_LoadClientParseMessage
+
+ Parses a sequenced message. Temp entities are not parsed, so they end
+ the message, but the server writes them after the frame.
+ =================
+*/
+static void SV_LoadClientParseMessage (loadClient_t *cl, msg_t *msg){
+
+	entity_state_t	nullState, state;
+	vec3_t			origin;
+	unsigned		bits;
+	int				number, flags;
+	int				cmd, size;
+
+	memset(&nullState, 0, sizeof(entity_state_t));
+
+	while (1){
+		if (msg->readCount > msg->curSize){
+			SV_LoadClientError(cl, "bad server message");
+			return;
+		}
+
+		cmd = MSG_ReadByte(msg);
+		if (cmd == -1)
+			return;
+
+		switch (cmd){
+		case SVC_NOP:
+
+			break;
+		case SVC_DISCONNECT:
+			cl->state = LC_DISCONNECTED;
+
+			return;
+		case SVC_RECONNECT:
+			// Go through the whole handshake again
+			cl->state = LC_CHALLENGING;
+			cl->lastResend = -99999;
+
+			return;
+		case SVC_PRINT:
+			MSG_ReadByte(msg);
+			MSG_ReadString(msg);
+
+			break;
+		case SVC_CENTERPRINT:
+		case SVC_LAYOUT:
+			MSG_ReadString(msg);
+
+			break;
+		case SVC_STUFFTEXT:
+			SV_LoadClientStuffText(cl, MSG_ReadString(msg));
+
+			break;
+		case SVC_SERVERDATA:
+			cl->protocol = MSG_ReadLong(msg);
+			MSG_ReadLong(msg);		// Spawn count
+			MSG_ReadByte(msg);		// Attract loop
+			MSG_ReadString(msg);	// Game dir
+			MSG_ReadShort(msg);		// Player number
+			MSG_ReadString(msg);	// Level name
+
+			cl->state = LC_CONNECTED;
+			cl->frame = NULL;
+
+			memset(cl->frames, 0, sizeof(cl->frames));
+
+			break;
+		case SVC_CONFIGSTRING:
+			MSG_ReadShort(msg);
+			MSG_ReadString(msg);
+
+			break;
+		case SVC_SPAWNBASELINE:
+			number = MSG_ReadEntityBits(msg, &bits);
+			MSG_ReadDeltaEntity(msg, &nullState, &state, number, bits);
+
+			break;
+		case SVC_INVENTORY:
+			msg->readCount += MAX_ITEMS * 2;
+
+			break;
+		case SVC_DOWNLOAD:
+			size = MSG_ReadShort(msg);
+			MSG_ReadByte(msg);		// Percent
+
+			if (size > 0)
+				msg->readCount += size;
+
+			break;
+		case SVC_SOUND:
+			flags = MSG_ReadByte(msg);
+			MSG_ReadByte(msg);		// Sound index
+
+			if (flags & SND_VOLUME)
+				MSG_ReadByte(msg);
+			if (flags & SND_ATTENUATION)
+				MSG_ReadByte(msg);
+			if (flags & SND_OFFSET)
+				MSG_ReadByte(msg);
+			if (flags & SND_ENT)
+				MSG_ReadShort(msg);
+			if (flags & SND_POS)
+				MSG_ReadPos(msg, origin);
+
+			break;
+		case SVC_MUZZLEFLASH:
+		case SVC_MUZZLEFLASH2:
+			MSG_ReadShort(msg);
+			MSG_ReadByte(msg);
+
+			break;
+		case SVC_TEMP_ENTITY:
+			return;
+		case SVC_FRAME:
+			if (!SV_LoadClientParseFrame(cl, msg)){
+				SV_LoadClientError(cl, "bad frame");
+				return;
+			}
+
+			break;
+		default:
+			SV_LoadClientError(cl, va("illegible server message %i", cmd));
+
+			return;
+		}
+	}
+}
+
+
+/*
+ =======================================================================
+
+ LOAD TEST CLIENTS
+
+ =======================================================================
+*/
+
+
+/*
+ =================
+ SV_LoadClientConnectionless
+ =================
+*/
+static void SV_LoadClientConnectionless (loadClient_t *cl, const netAdr_t from, msg_t *msg){
+
+	char	*s;
+
+	MSG_BeginReading(msg);
+	MSG_ReadLong(msg);		// Skip the -1 marker
+
+	s = MSG_ReadStringLine(msg);
+
+	Cmd_TokenizeString(s);
+
+	// Challenge from the server we are connecting to
+	if (!Q_stricmp(Cmd_Argv(0), "challenge")){
+		if (cl->state != LC_CHALLENGING)
+			return;
+
+		cl->challenge = atoi(Cmd_Argv(1));
+		cl->state = LC_CONNECTING;
+		cl->lastResend = -99999;	// Connect right away
+
+		return;
+	}
+
+	// Server connection
+	if (!Q_stricmp(Cmd_Argv(0), "client_connect")){
+		if (cl->state != LC_CONNECTING)
+			return;
+
+		NetChan_Setup(cl->netChan.sock, &cl->netChan, from, cl->qport);
+
+		cl->state = LC_CONNECTED;
+		cl->protocol = PROTOCOL_VERSION;
+		cl->frame = NULL;
+		cl->lastAcknowledged = 0;
+
+		memset(cl->frames, 0, sizeof(cl->frames));
+		memset(cl->cmdTimes, 0, sizeof(cl->cmdTimes));
+
+		MSG_WriteByte(&cl->netChan.message, CLC_STRINGCMD);
+		MSG_WriteString(&cl->netChan.message, "new");
+
+		return;
+	}
+
+	// Print command from somewhere, usually a rejection
+	if (!Q_stricmp(Cmd_Argv(0), "print")){
+		s = MSG_ReadString(msg);
+
+		Q_strncpyz(sv_loadTest.lastPrint, s, sizeof(sv_loadTest.lastPrint));
+
+		Com_DPrintf("Load client %i: %s", cl->index, s);
+		return;
+	}
+}
+
+/*
+ =================
+ SV_LoadClientReadPackets
+ =================
+*/
+static void SV_LoadClientReadPackets (loadClient_t *cl){
+
+	netAdr_t	from;
+
+	MSG_Init(&sv_loadMessage, sv_loadMessageBuffer, sizeof(sv_loadMessageBuffer), false);
+
+	while (NET_GetPacket(cl->netChan.sock, &from, &sv_loadMessage)){
+		if (!NET_CompareBaseAdr(from, sv_loadTest.address))
+			continue;
+
+		cl->bytesReceived += sv_loadMessage.curSize;
+
+		if (*(int *)sv_loadMessage.data == -1){
+			SV_LoadClientConnectionless(cl, from, &sv_loadMessage);
+			continue;
+		}
+
+		if (cl->state < LC_CONNECTED)
+			continue;
+
+		if (!NetChan_Process(&cl->netChan, &sv_loadMessage))
+			continue;
+
+		SV_LoadClientParseMessage(cl, &sv_loadMessage);
+
+		if (cl->state == LC_DISCONNECTED)
+			break;
+	}
+}
+
+/*
+ =================
+ SV_LoadClientMove
+
+ Fills in the next user command, either with random moves or with a
+ scripted pattern of running in circles and firing
+ =================
+*/
+static void SV_LoadClientMove (loadClient_t *cl, usercmd_t *cmd, int time){
+
+	int		msec;
+
+	msec = time - cl->lastCmdTime;
+	cl->lastCmdTime = time;
+
+	msec = Clamp(msec, 1, 250);
+
+	if (sv_loadTestMoves->integerValue){
+		// Run in circles, firing one second out of three and jumping
+		// every now and then, with each client in a different phase
+		time += cl->index * 250;
+
+		cl->yawSpeed = 90.0f;
+		cl->forwardMove = 400;
+		cl->sideMove = 0;
+		cl->upMove = ((time % 3000) < 100) ? 200 : 0;
+		cl->buttons = ((time % 3000) < 1000) ? BUTTON_ATTACK : 0;
+	}
+	else if (time >= cl->nextMoveTime){
+		// Pick another random move
+		cl->nextMoveTime = time + 500 + (rand() % 1500);
+
+		cl->yawSpeed = crand() * 180.0f;
+		cl->forwardMove = ((rand() % 3) - 1) * 400;
+		cl->sideMove = ((rand() % 3) - 1) * 400;
+		cl->upMove = (frand() < 0.1f) ? 200 : 0;
+		cl->buttons = (frand() < 0.3f) ? BUTTON_ATTACK : 0;
+	}
+
+	cl->yaw = AngleMod(cl->yaw + cl->yawSpeed * MS2SEC(msec));
+
+	memset(cmd, 0, sizeof(usercmd_t));
+
+	cmd->msec = msec;
+	cmd->buttons = cl->buttons;
+	cmd->angles[YAW] = ANGLE2SHORT(cl->yaw);
+	cmd->forwardmove = cl->forwardMove;
+	cmd->sidemove = cl->sideMove;
+	cmd->upmove = cl->upMove;
+	cmd->lightlevel = 128;
+
+	if (cmd->buttons)
+		cmd->buttons |= BUTTON_ANY;
+}
+
+/*
+ =================
+ SV_LoadClientTransmit
+
+ Sends the reliable commands, along with the given user commands if any
+ =================
+*/
+static void SV_LoadClientTransmit (loadClient_t *cl, const void *data, int length){
+
+	int		index;
+
+	index = cl->netChan.outgoingSequence & LOADTEST_CMD_MASK;
+
+	if (length)
+		cl->cmdTimes[index] = Sys_GetClockTicks();
+	else
+		cl->cmdTimes[index] = 0.0;
+
+	cl->bytesSent += NetChan_Transmit(&cl->netChan, data, length);
+}
+
+/*
+ =================
+ SV_LoadClientSendCmd
+
+ Works like CL_SendCmd
+ =================
+*/
+static void SV_LoadClientSendCmd (loadClient_t *cl, int time){
+
+	msg_t		msg;
+	byte		data[128];
+	usercmd_t	*cmd, *oldCmd, nullCmd;
+	int			checksumIndex;
+
+	cmd = &cl->cmds[cl->netChan.outgoingSequence & LOADTEST_CMD_MASK];
+
+	SV_LoadClientMove(cl, cmd, time);
+
+	MSG_Init(&msg, data, sizeof(data), false);
+
+	// Begin a client move command
+	MSG_WriteByte(&msg, CLC_MOVE);
+
+	// Save the position for a checksum byte
+	checksumIndex = msg.curSize;
+	MSG_WriteByte(&msg, 0);
+
+	// Let the server know what the last frame we got was, so the next
+	// message can be delta compressed
+	if (!cl->frame)
+		MSG_WriteLong(&msg, -1);
+	else
+		MSG_WriteLong(&msg, cl->frame->serverFrame);
+
+	// Send this and the previous commands in the message, so if the
+	// last packet was dropped, it can be recovered
+	memset(&nullCmd, 0, sizeof(usercmd_t));
+
+	cmd = &cl->cmds[(cl->netChan.outgoingSequence-2) & LOADTEST_CMD_MASK];
+	MSG_WriteDeltaUserCmd(&msg, &nullCmd, cmd);
+
+	oldCmd = cmd;
+	cmd = &cl->cmds[(cl->netChan.outgoingSequence-1) & LOADTEST_CMD_MASK];
+	MSG_WriteDeltaUserCmd(&msg, oldCmd, cmd);
+
+	oldCmd = cmd;
+	cmd = &cl->cmds[(cl->netChan.outgoingSequence) & LOADTEST_CMD_MASK];
+	MSG_WriteDeltaUserCmd(&msg, oldCmd, cmd);
+
+	// Calculate a checksum over the move commands
+	msg.data[checksumIndex] = Com_BlockSequenceCRCByte(msg.data + checksumIndex + 1, msg.curSize - checksumIndex - 1, cl->netChan.outgoingSequence);
+
+	// Deliver the message
+	SV_LoadClientTransmit(cl, msg.data, msg.curSize);
+}
+
+/*
+ =================
+ SV_LoadClientSend
+ =================
+*/
+static void SV_LoadClientSend (loadClient_t *cl, int time){
+
+	char	userInfo[MAX_INFO_STRING];
+	int		interval;
+
+	switch (cl->state){
+	case LC_DISCONNECTED:
+
+		break;
+	case LC_CHALLENGING:
+		if (time - cl->lastResend < LOADTEST_RESEND)
+			break;
+
+		cl->lastResend = time;
+
+		NetChan_OutOfBandPrint(cl->netChan.sock, sv_loadTest.address, "getchallenge\n");
+
+		break;
+	case LC_CONNECTING:
+		if (time - cl->lastResend < LOADTEST_RESEND)
+			break;
+
+		cl->lastResend = time;
+
+		Q_snprintfz(userInfo, sizeof(userInfo), "\\name\\loadclient%i\\skin\\male/grunt\\rate\\%i\\msg\\1\\hand\\0\\fov\\90", cl->index, sv_loadTestRate->integerValue);
+
+		NetChan_OutOfBandPrint(cl->netChan.sock, sv_loadTest.address, "connect %i %i %i \"%s\" %i %i\n", PROTOCOL_VERSION, cl->qport, cl->challenge, userInfo, (sv_loadTestBitSnapshots->integerValue) ? PROTOCOL_VERSION_BITS : PROTOCOL_VERSION, MAX_MSGLEN);
+
+		break;
+	case LC_CONNECTED:
+		// Only send the reliable commands until the first frame arrives
+		if (cl->netChan.message.curSize || time - cl->netChan.lastSent > 1000)
+			SV_LoadClientTransmit(cl, NULL, 0);
+
+		break;
+	case LC_ACTIVE:
+		if (time < cl->nextCmdTime)
+			break;
+
+		interval = 1000 / Clamp(sv_loadTestCmdRate->integerValue, 1, 1000);
+
+		// Don't try to catch up if the server frame took too long
+		cl->nextCmdTime += interval;
+		if (cl->nextCmdTime <= time)
+			cl->nextCmdTime = time + interval;
+
+		SV_LoadClientSendCmd(cl, time);
+
+		break;
+	}
+}
+
+
+/*
+ =======================================================================
+
+ LOAD TEST
+
+ =======================================================================
+*/
+
+
+/*
+ =================
+ SV_PrintLoadTestReport
+ =================
+*/
+static void SV_PrintLoadTestReport (void){
+
+	loadClient_t	*cl;
+	float			seconds;
+	int				connected = 0, active = 0, errors = 0;
+	int				bytesSent = 0, bytesReceived = 0, maxReceived = 0;
+	int				numFrames = 0, numEntities = 0;
+	int				i;
+
+	seconds = MS2SEC(Sys_Milliseconds() - sv_loadTest.startTime);
+	if (seconds < 0.001f)
+		seconds = 0.001f;
+
+	for (i = 0, cl = sv_loadTest.clients; i < sv_loadTest.numClients; i++, cl++){
+		if (cl->bytesSent)
+			connected++;
+
+		if (cl->state == LC_ACTIVE)
+			active++;
+
+		if (cl->parseError)
+			errors++;
+
+		bytesSent += cl->bytesSent;
+		bytesReceived += cl->bytesReceived;
+
+		if (maxReceived < cl->bytesReceived)
+			maxReceived = cl->bytesReceived;
+
+		numFrames += cl->numFrames;
+		numEntities += cl->numEntities;
+	}
+
+	Com_Printf("\n");
+	Com_Printf("------------ Load Test ------------\n");
+	Com_Printf("%i clients, %i connected, %i active at the end, %.1f seconds\n", sv_loadTest.numClients, connected, active, seconds);
+
+	if (connected < sv_loadTest.numClients && sv_loadTest.lastPrint[0])
+		Com_Printf("Last server message: %s", sv_loadTest.lastPrint);
+
+	if (errors)
+		Com_Printf(S_COLOR_YELLOW "%i clients dropped on parse errors\n", errors);
+
+	SV_PrintHistogram("Server frame time", &sv_loadTest.frameTimes);
+
+	if (connected){
+		Com_Printf("Received per client: %i bytes/sec avg, %i bytes/sec max\n", (int)(bytesReceived / seconds / connected), (int)(maxReceived / seconds));
+		Com_Printf("Sent per client: %i bytes/sec avg\n", (int)(bytesSent / seconds / connected));
+		Com_Printf("Snapshots per client: %.1f/sec, %.1f entities each\n", numFrames / seconds / connected, (numFrames) ? (float)numEntities / numFrames : 0.0f);
+	}
+
+	SV_PrintHistogram("Snapshot latency", &sv_loadTest.latencies);
+
+	Com_Printf("-----------------------------------\n");
+}
+
+/*
+ =================
+ SV_StopLoadTest
+ =================
+*/
+static void SV_StopLoadTest (void){
+
+	loadClient_t	*cl;
+	byte			final[32];
+	int				i;
+
+	if (!sv_loadTest.active)
+		return;
+
+	SV_PrintLoadTestReport();
+
+	// Disconnect and close the sockets
+	final[0] = CLC_STRINGCMD;
+	Q_strncpyz((char *)final+1, "disconnect", sizeof(final)-1);
+
+	for (i = 0, cl = sv_loadTest.clients; i < sv_loadTest.numClients; i++, cl++){
+		if (cl->state >= LC_CONNECTED){
+			NetChan_Transmit(&cl->netChan, final, strlen((char *)final));
+			NetChan_Transmit(&cl->netChan, final, strlen((char *)final));
+			NetChan_Transmit(&cl->netChan, final, strlen((char *)final));
+		}
+
+		NET_CloseSocket(cl->netChan.sock);
+	}
+
+	Z_Free(sv_loadTest.clients);
+
+	memset(&sv_loadTest, 0, sizeof(loadTest_t));
+}
+
+/*
+ =================
+ SV_StartLoadTest
+ =================
+*/
+static void SV_StartLoadTest (int numClients, int seconds, const netAdr_t address){
+
+	loadClient_t	*cl;
+	int				time;
+	int				i;
+
+	memset(&sv_loadTest, 0, sizeof(loadTest_t));
+
+	sv_loadTest.address = address;
+
+	sv_loadTest.clients = Z_Malloc(numClients * sizeof(loadClient_t));
+	memset(sv_loadTest.clients, 0, numClients * sizeof(loadClient_t));
+
+	time = Sys_Milliseconds();
+
+	for (i = 0, cl = sv_loadTest.clients; i < numClients; i++, cl++){
+		if (!NET_OpenSocket(NS_LOADCLIENT + i)){
+			Com_Printf(S_COLOR_YELLOW "Couldn't open a socket for load client %i\n", i);
+			break;
+		}
+
+		cl->state = LC_CHALLENGING;
+		cl->index = i;
+		cl->qport = (Sys_Milliseconds() + i * 997) & 0xFFFF;
+		cl->lastResend = -99999;
+
+		cl->netChan.sock = NS_LOADCLIENT + i;
+
+		// Spread the user commands over the interval
+		cl->lastCmdTime = time;
+		cl->nextCmdTime = time + i * 1000 / (Clamp(sv_loadTestCmdRate->integerValue, 1, 1000) * numClients);
+		cl->yaw = i * 360.0f / numClients;
+	}
+
+	sv_loadTest.active = true;
+	sv_loadTest.numClients = i;
+
+	sv_loadTest.startTime = time;
+	sv_loadTest.endTime = time + SEC2MS(seconds);
+
+	sv_loadTest.frameTimes.bucketSize = 0.05f;
+	sv_loadTest.latencies.bucketSize = 1.0f;
+
+	Com_Printf("Load testing %s with %i clients for %i seconds\n", NET_AdrToString(address), sv_loadTest.numClients, seconds);
+}
+
+/*
+ =================
+ SV_LoadTestTimeout
+
+ Returns the given number of milliseconds, or less if a load test client
+ is due to send a user command sooner
+ =================
+*/
+int SV_LoadTestTimeout (int timeout){
+
+	loadClient_t	*cl;
+	int				time;
+	int				i;
+
+	if (!sv_loadTest.active)
+		return timeout;
+
+	time = Sys_Milliseconds();
+
+	for (i = 0, cl = sv_loadTest.clients; i < sv_loadTest.numClients; i++, cl++){
+		if (cl->state != LC_ACTIVE)
+			continue;
+
+		if (timeout > cl->nextCmdTime - time)
+			timeout = cl->nextCmdTime - time;
+	}
+
+	if (timeout < 0)
+		return 0;
+
+	return timeout;
+}
+
+/*
+ =================
+ SV_IsLoadTestAddress
+
+ Returns true if a packet could come from the load test clients. They send
+ from this machine, so the server can't tell them apart from other local
+ programs, and only trusts loopback addresses while a test is running.
+ =================
+*/
+qboolean SV_IsLoadTestAddress (const netAdr_t adr){
+
+	if (!sv_loadTest.active)
+		return false;
+
+	return (adr.type == NA_IP && adr.ip[0] == 127);
+}
+
+/*
+ =================
+ SV_LoadTestFrameTime
+
+ Called with the time in milliseconds the local server took to run a game
+ frame
+ =================
+*/
+void SV_LoadTestFrameTime (double msec){
+
+	if (!sv_loadTest.active)
+		return;
+
+	SV_AddSample(&sv_loadTest.frameTimes, msec);
+}
+
+/*
+ =================
+ SV_RunLoadTest
+
+ Called after every server frame, so the load test clients read the
+ snapshots right after they are sent
+ =================
+*/
+void SV_RunLoadTest (void){
+
+	loadClient_t	*cl;
+	int				time;
+	int				i;
+
+	if (!sv_loadTest.active)
+		return;
+
+	time = Sys_Milliseconds();
+
+	for (i = 0, cl = sv_loadTest.clients; i < sv_loadTest.numClients; i++, cl++){
+		if (cl->state == LC_DISCONNECTED)
+			continue;
+
+		SV_LoadClientReadPackets(cl);
+		SV_LoadClientSend(cl, time);
+	}
+
+	if (time >= sv_loadTest.endTime)
+		SV_StopLoadTest();
+}
+
+/*
+ =================
+ SV_LoadTest_f
+ =================
+*/
+void SV_LoadTest_f (void){
+
+	netAdr_t	address;
+	int			numClients, seconds;
+
+	if (Cmd_Argc() == 2 && !Q_stricmp(Cmd_Argv(1), "stop")){
+		if (!sv_loadTest.active){
+			Com_Printf("No load test running\n");
+			return;
+		}
+
+		SV_StopLoadTest();
+		return;
+	}
+
+	if (Cmd_Argc() < 3 || Cmd_Argc() > 4){
+		Com_Printf("Usage: loadTest <clients> <seconds> [server]\n");
+		Com_Printf("       loadTest stop\n");
+		return;
+	}
+
+	if (sv_loadTest.active){
+		Com_Printf("A load test is already running\n");
+		return;
+	}
+
+	numClients = atoi(Cmd_Argv(1));
+	if (numClients < 1 || numClients > MAX_LOAD_CLIENTS){
+		Com_Printf("Number of clients must be between 1 and %i\n", MAX_LOAD_CLIENTS);
+		return;
+	}
+
+	seconds = atoi(Cmd_Argv(2));
+	if (seconds < 1){
+		Com_Printf("Test must last at least one second\n");
+		return;
+	}
+
+	if (Cmd_Argc() == 4){
+		if (!NET_StringToAdr(Cmd_Argv(3), &address)){
+			Com_Printf("Bad server address\n");
+			return;
+		}
+	}
+	else
+		address.type = NA_LOOPBACK;
+
+	// The clients have their own sockets, so they reach the local server
+	// over UDP like remote clients do
+	if (address.type == NA_LOOPBACK){
+		if (!svs.initialized){
+			Com_Printf("Server is not running\n");
+			return;
+		}
+
+		NET_StringToAdr(va("127.0.0.1:%i", Cvar_GetInteger("net_port")), &address);
+	}
+
+	if (address.type != NA_IP){
+		Com_Printf("Load test clients can only connect over UDP\n");
+		return;
+	}
+
+	if (!address.port)
+		address.port = BigShort(PORT_SERVER);
+
+	SV_StartLoadTest(numClients, seconds, address);
+}
@@ -50,6 +50,16 @@ cvar_t	*sv_enforceTime;
 cvar_t	*sv_allowDownload;
 cvar_t	*sv_publicServer;
 cvar_t	*sv_rconPassword;
+cvar_t	*sv_snapshotThreads;
+cvar_t	*sv_bitSnapshots;
+cvar_t	*sv_compression;
+cvar_t	*sv_localSnapshots;
+cvar_t	*sv_queryRate;
+cvar_t	*sv_queryTotalRate;
+cvar_t	*sv_loadTestCmdRate;
+cvar_t	*sv_loadTestMoves;
+cvar_t	*sv_loadTestRate;
+cvar_t	*sv_loadTestBitSnapshots;
 
 
 /*
@@ -74,6 +84,148 @@ void SV_NextServer (void){
 	}
 }
 
+/*
+ =================
+ SV_AddressHash
+
+ Hashes a base address, without the port
+ =================
+*/
+static unsigned SV_AddressHash (const netAdr_t adr){
+
+	unsigned	hash;
+
+	hash = (adr.ip[0] << 24) | (adr.ip[1] << 16) | (adr.ip[2] << 8) | adr.ip[3];
+	hash ^= (hash >> 16) ^ adr.type;
+
+	return hash;
+}
+
+/*
+ =================
+ SV_ClientHashKey
+ =================
+*/
+static int SV_ClientHashKey (const netAdr_t adr, int qport){
+
+	unsigned	hash;
+
+	hash = SV_AddressHash(adr);
+	hash ^= qport * 31;
+	hash ^= (hash >> 10);
+
+	return hash & (CLIENT_HASH_SIZE-1);
+}
+
+/*
+ =================
+ SV_HashClient
+ =================
+*/
+static void SV_HashClient (client_t *cl){
+
+	int		key;
+
+	key = SV_ClientHashKey(cl->netChan.remoteAddress, cl->netChan.qport);
+
+	cl->nextHash = svs.clientHash[key];
+	svs.clientHash[key] = cl;
+}
+
+/*
+ =================
+ SV_UnhashClient
+ =================
+*/
+static void SV_UnhashClient (client_t *cl){
+
+	client_t	**prev;
+	int			key;
+
+	key = SV_ClientHashKey(cl->netChan.remoteAddress, cl->netChan.qport);
+
+	for (prev = &svs.clientHash[key]; *prev; prev = &(*prev)->nextHash){
+		if (*prev != cl)
+			continue;
+
+		*prev = cl->nextHash;
+		break;
+	}
+
+	cl->nextHash = NULL;
+}
+
+/*
+ =================
+ SV_FindClient
+
+ Returns the non-free client with the given base address and qport, or
+ NULL if there isn't one
+ =================
+*/
+static client_t *SV_FindClient (const netAdr_t adr, int qport){
+
+	client_t	*cl, *best = NULL;
+
+	for (cl = svs.clientHash[SV_ClientHashKey(adr, qport)]; cl; cl = cl->nextHash){
+		if (cl->netChan.qport != qport)
+			continue;
+
+		if (!NET_CompareBaseAdr(adr, cl->netChan.remoteAddress))
+			continue;
+
+		// Prefer the lowest slot, like a linear scan would
+		if (!best || cl < best)
+			best = cl;
+	}
+
+	return best;
+}
+
+/*
+ =================
+ SV_InitClientSnapshots
+
+ Gives a new client a snapshot buffer as large as its negotiated message
+ length, and forgets the deferred entities of the last client in the slot
+ =================
+*/
+void SV_InitClientSnapshots (client_t *cl){
+
+	int		i = cl - svs.clients;
+
+	cl->snapshotBuffer = Z_Malloc(cl->netChan.maxMessageLength);
+
+	cl->visibleEntities = svs.clientVisibleEntities + i * svs.maxClientEdicts;
+	cl->entityWait = svs.clientEntityWaits + i * svs.maxClientEdicts;
+
+	memset(cl->entityWait, 0, svs.maxClientEdicts);
+}
+
+/*
+ =================
+ SV_FreeClient
+
+ Makes a client slot available for reuse. Zombies stay hashed until they
+ are freed, so acknowledges for their final reliable message still get
+ processed.
+ =================
+*/
+void SV_FreeClient (client_t *cl){
+
+	if (cl->state == CS_FREE)
+		return;
+
+	SV_UnhashClient(cl);
+
+	if (cl->snapshotBuffer){
+		Z_Free(cl->snapshotBuffer);
+		cl->snapshotBuffer = NULL;
+	}
+
+	cl->state = CS_FREE;
+}
+
 /*
  =================
  SV_DropClient
@@ -90,8 +242,11 @@ void SV_DropClient (client_t *cl){
 
 	// Call the game function for removing a client.
 	// This will remove the body, among other things.
-	if (cl->state == CS_SPAWNED)
+	if (cl->state == CS_SPAWNED){
+		SV_RecordCmdDisconnect(cl);
+
 		ge->ClientDisconnect(cl->edict);
+	}
 
 	// Close download
 	if (cl->downloadFile){
@@ -116,6 +271,8 @@ void SV_UserInfoChanged (client_t *cl){
 	char	*val;
 
 	// Call game code to allow overrides
+	SV_RecordCmdUserInfo(cl);
+
 	ge->ClientUserinfoChanged(cl->edict, cl->userInfo);
 
 	// Name for C code
@@ -132,6 +289,13 @@ void SV_UserInfoChanged (client_t *cl){
 	val = Info_ValueForKey(cl->userInfo, "msg");
 	if (val[0])
 		cl->messageLevel = atoi(val);
+
+	// Compress command, never worth it for local clients
+	val = Info_ValueForKey(cl->userInfo, "compress");
+	if (sv_compression->integerValue && atoi(val) && !NET_IsLocalAddress(cl->netChan.remoteAddress))
+		cl->netChan.compression = true;
+	else
+		cl->netChan.compression = false;
 }
 
 /*
@@ -143,7 +307,7 @@ void SV_UserInfoChanged (client_t *cl){
 */
 static char *SV_StatusString (void){
 
-	static char	status[MAX_MSGLEN - 16];
+	static char	status[MAX_PACKETLEN - 16];
 	char		player[64];
 	int			statusLen;
 	int			playerLen;
@@ -178,7 +342,16 @@ static char *SV_StatusString (void){
 */
 static void SV_Status (void){
 
-	NetChan_OutOfBandPrint(NS_SERVER, net_from, "print\n%s", SV_StatusString());
+	// Build the response once per frame, no matter how many queries come
+	// in
+	if (sv.statusFrame != sv.frameNum + 1){
+		sv.statusFrame = sv.frameNum + 1;
+
+		Q_snprintfz(sv.statusResponse, sizeof(sv.statusResponse), "print\n%s", SV_StatusString());
+		sv.statusLength = strlen(sv.statusResponse);
+	}
+
+	NetChan_OutOfBand(NS_SERVER, net_from, sv.statusResponse, sv.statusLength);
 }
 
 /*
@@ -201,7 +374,6 @@ static void SV_Ack (void){
 */
 static void SV_Info (void){
 
-	char	string[64];
 	int		version, count = 0;
 	int		i;
 
@@ -210,18 +382,26 @@ static void SV_Info (void){
 
 	version = atoi(Cmd_Argv(1));
 
-	if (version != PROTOCOL_VERSION)
-		Q_snprintfz(string, sizeof(string), "%s: wrong version\n", sv_hostName->value, sizeof(string));
-	else {
+	if (version != PROTOCOL_VERSION){
+		NetChan_OutOfBandPrint(NS_SERVER, net_from, "info\n%s: wrong version\n", sv_hostName->value);
+		return;
+	}
+
+	// Build the response once per frame, no matter how many queries come
+	// in
+	if (sv.infoFrame != sv.frameNum + 1){
+		sv.infoFrame = sv.frameNum + 1;
+
 		for (i = 0; i < sv_maxClients->integerValue; i++){
 			if (svs.clients[i].state >= CS_CONNECTED)
 				count++;
 		}
 
-		Q_snprintfz(string, sizeof(string), "%16s %8s %2i/%2i\n", sv_hostName->value, sv.name, count, sv_maxClients->integerValue);
+		Q_snprintfz(sv.infoResponse, sizeof(sv.infoResponse), "info\n%16s %8s %2i/%2i\n", sv_hostName->value, sv.name, count, sv_maxClients->integerValue);
+		sv.infoLength = strlen(sv.infoResponse);
 	}
 
-	NetChan_OutOfBandPrint(NS_SERVER, net_from, "info\n%s", string);
+	NetChan_OutOfBand(NS_SERVER, net_from, sv.infoResponse, sv.infoLength);
 }
 
 /*
@@ -236,6 +416,72 @@ static void SV_Ping (void){
 	NetChan_OutOfBandPrint(NS_SERVER, net_from, "ack");
 }
 
+/*
+ =================
+ SV_ChallengeHashKey
+ =================
+*/
+static int SV_ChallengeHashKey (const netAdr_t adr){
+
+	unsigned	hash;
+
+	hash = SV_AddressHash(adr);
+	hash ^= (hash >> 10);
+
+	return hash & (CHALLENGE_HASH_SIZE-1);
+}
+
+/*
+ =================
+ SV_FindChallenge
+
+ Returns the challenge given to the base address of the given address, or
+ NULL if there isn't one
+ =================
+*/
+static challenge_t *SV_FindChallenge (const netAdr_t adr){
+
+	challenge_t	*challenge;
+
+	for (challenge = svs.challengeHash[SV_ChallengeHashKey(adr)]; challenge; challenge = challenge->nextHash){
+		if (NET_CompareBaseAdr(adr, challenge->adr))
+			return challenge;
+	}
+
+	return NULL;
+}
+
+/*
+ =================
+ SV_NewChallenge
+
+ Takes the slot that was taken the longest ago, which holds the oldest
+ challenge
+ =================
+*/
+static challenge_t *SV_NewChallenge (const netAdr_t adr){
+
+	challenge_t	*challenge, **prev;
+
+	challenge = &svs.challenges[svs.nextChallenge];
+	svs.nextChallenge = (svs.nextChallenge + 1) & (MAX_CHALLENGES-1);
+
+	// Remove it from the hash if in use
+	for (prev = &svs.challengeHash[SV_ChallengeHashKey(challenge->adr)]; *prev; prev = &(*prev)->nextHash){
+		if (*prev != challenge)
+			continue;
+
+		*prev = challenge->nextHash;
+		break;
+	}
+
+	challenge->adr = adr;
+	challenge->nextHash = svs.challengeHash[SV_ChallengeHashKey(adr)];
+	svs.challengeHash[SV_ChallengeHashKey(adr)] = challenge;
+
+	return challenge;
+}
+
 /*
  =================
  SV_GetChallenge
@@ -249,32 +495,25 @@ static void SV_Ping (void){
 */
 static void SV_GetChallenge (void){
 
-	int		i, oldest, oldestTime;
+	challenge_t	*challenge;
+	int			time;
 
-	oldest = 0;
-	oldestTime = 0x7FFFFFFF;
+	time = Sys_Milliseconds();
 
-	// See if we already have a challenge for this IP
-	for (i = 0; i < MAX_CHALLENGES; i++){
-		if (NET_CompareBaseAdr(net_from, svs.challenges[i].adr))
-			break;
+	// See if we already have a challenge for this IP, give a new one if it
+	// expired
+	challenge = SV_FindChallenge(net_from);
 
-		if (svs.challenges[i].time < oldestTime){
-			oldestTime = svs.challenges[i].time;
-			oldest = i;
-		}
-	}
+	if (!challenge || time - challenge->time > CHALLENGE_TIMEOUT){
+		if (!challenge)
+			challenge = SV_NewChallenge(net_from);
 
-	if (i == MAX_CHALLENGES){
-		// Overwrite the oldest
-		svs.challenges[oldest].challenge = rand() & 0x7FFF;
-		svs.challenges[oldest].adr = net_from;
-		svs.challenges[oldest].time = Sys_Milliseconds();
-		i = oldest;
+		challenge->challenge = rand() & 0x7FFF;
+		challenge->time = time;
 	}
 
 	// Send it back
-	NetChan_OutOfBandPrint(NS_SERVER, net_from, "challenge %i", svs.challenges[i].challenge);
+	NetChan_OutOfBandPrint(NS_SERVER, net_from, "challenge %i", challenge->challenge);
 }
 
 /*
@@ -288,6 +527,7 @@ static void SV_DirectConnect (void){
 
 	int			i;
 	client_t	*cl, *newCL = NULL;
+	challenge_t	*validChallenge;
 	char		userInfo[MAX_INFO_STRING];
 	edict_t		*ent;
 	int			version, qport, challenge;
@@ -317,22 +557,19 @@ static void SV_DirectConnect (void){
 
 	// See if the challenge is valid
 	if (!NET_IsLocalAddress(net_from)){
-		for (i = 0; i < MAX_CHALLENGES; i++){
-			if (NET_CompareBaseAdr(net_from, svs.challenges[i].adr)){
-				if (challenge == svs.challenges[i].challenge)
-					break;		// Good
-
-				NetChan_OutOfBandPrint(NS_SERVER, net_from, "print\nBad challenge\n");
-				Com_DPrintf("%s: bad challenge\n", NET_AdrToString(net_from));
-				return;
-			}
-		}
+		validChallenge = SV_FindChallenge(net_from);
 
-		if (i == MAX_CHALLENGES){
+		if (!validChallenge || Sys_Milliseconds() - validChallenge->time > CHALLENGE_TIMEOUT){
 			NetChan_OutOfBandPrint(NS_SERVER, net_from, "print\nNo challenge for address\n");
 			Com_DPrintf("%s: no challenge\n", NET_AdrToString(net_from));
 			return;
 		}
+
+		if (challenge != validChallenge->challenge){
+			NetChan_OutOfBandPrint(NS_SERVER, net_from, "print\nBad challenge\n");
+			Com_DPrintf("%s: bad challenge\n", NET_AdrToString(net_from));
+			return;
+		}
 	}
 
 	// If there is already a slot for this IP, reuse it
@@ -372,6 +609,8 @@ static void SV_DirectConnect (void){
 	// Build a new connection.
 	// Accept the new client.
 	// This is the only place a client_t is ever initialized.
+	SV_FreeClient(newCL);
+
 	memset(newCL, 0, sizeof(client_t));
 
 	i = newCL - svs.clients;
@@ -379,8 +618,17 @@ static void SV_DirectConnect (void){
 	newCL->edict = ent;
 	newCL->challenge = challenge;		// Save challenge for checksumming
 
+	// Clients that support bit packed snapshots ask for them after the
+	// user info
+	if (sv_bitSnapshots->integerValue && atoi(Cmd_Argv(5)) == PROTOCOL_VERSION_BITS)
+		newCL->protocol = PROTOCOL_VERSION_BITS;
+	else
+		newCL->protocol = PROTOCOL_VERSION;
+
 	// Get the game a chance to reject this connection or modify the
 	// user info
+	SV_RecordCmdConnect(newCL, userInfo, atoi(Cmd_Argv(6)));
+
 	if (!(ge->ClientConnect(ent, userInfo))){
 		if (*Info_ValueForKey(userInfo, "rejmsg"))
 			NetChan_OutOfBandPrint(NS_SERVER, net_from, "print\n%s\n", Info_ValueForKey(userInfo, "rejmsg"));
@@ -391,13 +639,21 @@ static void SV_DirectConnect (void){
 		return;
 	}
 
+	NetChan_Setup(NS_SERVER, &newCL->netChan, net_from, qport);
+
+	// Clients that can reassemble fragmented messages say how large a
+	// message they take after the protocol
+	NetChan_SetMaxMessageLength(&newCL->netChan, atoi(Cmd_Argv(6)));
+
 	// Parse some info from the info strings
 	Q_strncpyz(newCL->userInfo, userInfo, sizeof(newCL->userInfo));
 	SV_UserInfoChanged(newCL);
 
-	NetChan_Setup(NS_SERVER, &newCL->netChan, net_from, qport);
+	SV_HashClient(newCL);
 
-	MSG_Init(&newCL->datagram, newCL->datagramBuffer, sizeof(newCL->datagramBuffer), true);
+	MSG_Init(&newCL->datagram, newCL->datagramBuffer, newCL->netChan.maxMessageLength, true);
+
+	SV_InitClientSnapshots(newCL);
 
 	newCL->lastMessage = svs.realTime;	// Don't time-out
 	newCL->lastConnect = svs.realTime;
@@ -460,6 +716,138 @@ static void SV_RemoteCommand (void){
 	Com_EndRedirect();
 }
 
+/*
+ =================
+ SV_QueryHashKey
+ =================
+*/
+static int SV_QueryHashKey (const netAdr_t adr){
+
+	unsigned	hash;
+
+	hash = SV_AddressHash(adr);
+	hash ^= (hash >> 10);
+
+	return hash & (QUERY_HASH_SIZE-1);
+}
+
+/*
+ =================
+ SV_QueryBucket
+
+ Returns the token bucket of the base address of the given address. If
+ there isn't one, takes the slot that was taken the longest ago, with a
+ full bucket.
+ =================
+*/
+static queryBucket_t *SV_QueryBucket (const netAdr_t adr, int time){
+
+	queryBucket_t	*bucket, **prev;
+	int				key;
+
+	key = SV_QueryHashKey(adr);
+
+	for (bucket = svs.queryHash[key]; bucket; bucket = bucket->nextHash){
+		if (NET_CompareBaseAdr(adr, bucket->adr))
+			return bucket;
+	}
+
+	bucket = &svs.queryBuckets[svs.nextQueryBucket];
+	svs.nextQueryBucket = (svs.nextQueryBucket + 1) & (MAX_QUERY_ADDRESSES-1);
+
+	// Remove it from the hash if in use
+	for (prev = &svs.queryHash[SV_QueryHashKey(bucket->adr)]; *prev; prev = &(*prev)->nextHash){
+		if (*prev != bucket)
+			continue;
+
+		*prev = bucket->nextHash;
+		break;
+	}
+
+	bucket->adr = adr;
+	bucket->tokens = 0;
+	bucket->time = time - QUERY_BURST_MSEC;
+
+	bucket->nextHash = svs.queryHash[key];
+	svs.queryHash[key] = bucket;
+
+	return bucket;
+}
+
+/*
+ =================
+ SV_TakeQueryToken
+
+ Refills the given token bucket at the given rate in packets per second,
+ and takes a packet out of it. Returns false if the bucket is empty.
+ =================
+*/
+static qboolean SV_TakeQueryToken (queryBucket_t *bucket, int rate, int time){
+
+	int		msec;
+
+	rate = Clamp(rate, 1, 100000);
+
+	msec = time - bucket->time;
+	if (msec < 0 || msec > QUERY_BURST_MSEC)
+		msec = QUERY_BURST_MSEC;
+
+	bucket->time = time;
+
+	bucket->tokens += rate * msec;
+	if (bucket->tokens > rate * QUERY_BURST_MSEC)
+		bucket->tokens = rate * QUERY_BURST_MSEC;
+
+	if (bucket->tokens < 1000)
+		return false;
+
+	bucket->tokens -= 1000;
+
+	return true;
+}
+
+/*
+ =================
+ SV_AllowConnectionlessPacket
+
+ Rate limits connectionless packets from each address, and from all of
+ them together, so a flood of queries can't take up the server frame.
+ Connection attempts are budgeted apart from the queries, so a query flood
+ can't keep players from connecting.
+ =================
+*/
+static qboolean SV_AllowConnectionlessPacket (const char *cmd){
+
+	queryBucket_t	*bucket, *total;
+	int				time;
+
+	// Never limit the local client, or the load test clients while a test
+	// is running, as they connect all at once
+	if (NET_IsLocalAddress(net_from) || SV_IsLoadTestAddress(net_from))
+		return true;
+
+	time = Sys_Milliseconds();
+
+	if (sv_queryRate->integerValue > 0){
+		bucket = SV_QueryBucket(net_from, time);
+
+		if (!SV_TakeQueryToken(bucket, sv_queryRate->integerValue, time))
+			return false;
+	}
+
+	if (sv_queryTotalRate->integerValue > 0){
+		if (!Q_stricmp(cmd, "getchallenge") || !Q_stricmp(cmd, "connect"))
+			total = &svs.connectTotal;
+		else
+			total = &svs.queryTotal;
+
+		if (!SV_TakeQueryToken(total, sv_queryTotalRate->integerValue, time))
+			return false;
+	}
+
+	return true;
+}
+
 /*
  =================
  SV_ConnectionlessPacket
@@ -480,6 +868,10 @@ static void SV_ConnectionlessPacket (void){
 	Cmd_TokenizeString(s);
 
 	c = Cmd_Argv(0);
+
+	if (!SV_AllowConnectionlessPacket(c))
+		return;
+
 	Com_DPrintf("SV packet %s: %s\n", NET_AdrToString(net_from), c);
 
 	if (!Q_stricmp(c, "status"))
@@ -502,57 +894,88 @@ static void SV_ConnectionlessPacket (void){
 
 /*
  =================
- SV_ReadPackets
+ SV_PacketEvent
  =================
 */
-static void SV_ReadPackets (void){
+static void SV_PacketEvent (void){
 
-	int			i;
 	client_t	*cl;
 	int			qport;
 
-	while (NET_GetPacket(NS_SERVER, &net_from, &net_message)){
-		// Check for connectionless packet first
-		if (*(int *)net_message.data == -1){
-			SV_ConnectionlessPacket();
-			continue;
+	// Check for connectionless packet first
+	if (*(int *)net_message.data == -1){
+		SV_ConnectionlessPacket();
+		return;
+	}
+
+	// Read the qport out of the message so we can fix up stupid 
+	// address translating routers
+	MSG_BeginReading(&net_message);
+	MSG_ReadLong(&net_message);		// Sequence number
+	MSG_ReadLong(&net_message);		// Sequence number
+	qport = MSG_ReadShort(&net_message) & 0xFFFF;
+
+	// Check for packets from connected clients
+	cl = SV_FindClient(net_from, qport);
+	if (!cl)
+		return;
+
+	if (cl->netChan.remoteAddress.port != net_from.port){
+		Com_Printf(S_COLOR_YELLOW "SV_PacketEvent: fixing up a translated port\n");
+		cl->netChan.remoteAddress.port = net_from.port;
+	}
+
+	if (NetChan_Process(&cl->netChan, &net_message)){
+		// This is a valid sequenced packet, so process it
+		if (cl->state != CS_ZOMBIE){
+			cl->lastMessage = svs.realTime;	// Don't time-out
+
+			SV_ParseClientMessage(cl);
 		}
+	}
+}
+
+/*
+ =================
+ SV_ReadPackets
 
-		// Read the qport out of the message so we can fix up stupid 
-		// address translating routers
-		MSG_BeginReading(&net_message);
-		MSG_ReadLong(&net_message);		// Sequence number
-		MSG_ReadLong(&net_message);		// Sequence number
-		qport = MSG_ReadShort(&net_message) & 0xFFFF;
+ Drains the server socket in batches, processing each packet in turn
+ =================
+*/
+static void SV_ReadPackets (void){
 
-		// Check for packets from connected clients
-		for (i = 0, cl = svs.clients; i < sv_maxClients->integerValue; i++, cl++){
-			if (cl->state == CS_FREE)
-				continue;
+	static msg_t	packets[MAX_PACKET_BATCH];
+	static byte		packetBuffers[MAX_PACKET_BATCH][MAX_MSGLEN];
+	static netAdr_t	packetFrom[MAX_PACKET_BATCH];
+	static qboolean	initialized;
+	msg_t			message;
+	int				i, numPackets;
 
-			if (!NET_CompareBaseAdr(net_from, cl->netChan.remoteAddress))
-				continue;
+	if (!initialized){
+		initialized = true;
 
-			if (cl->netChan.qport != qport)
-				continue;
+		for (i = 0; i < MAX_PACKET_BATCH; i++)
+			MSG_Init(&packets[i], packetBuffers[i], sizeof(packetBuffers[i]), false);
+	}
 
-			if (cl->netChan.remoteAddress.port != net_from.port){
-				Com_Printf(S_COLOR_YELLOW "SV_ReadPackets: fixing up a translated port\n");
-				cl->netChan.remoteAddress.port = net_from.port;
-			}
+	// Point net_message at each buffer in turn, so packets don't need to
+	// be copied
+	message = net_message;
 
-			if (NetChan_Process(&cl->netChan, &net_message)){
-				// This is a valid sequenced packet, so process it
-				if (cl->state != CS_ZOMBIE){
-					cl->lastMessage = svs.realTime;	// Don't time-out
+	// Loopback packets are read in place
+	while (NET_ReadLoopPacket(NS_SERVER, &net_from, &net_message))
+		SV_PacketEvent();
 
-					SV_ParseClientMessage(cl);
-				}
-			}
+	while ((numPackets = NET_GetPackets(NS_SERVER, packetFrom, packets, MAX_PACKET_BATCH)) > 0){
+		for (i = 0; i < numPackets; i++){
+			net_from = packetFrom[i];
+			net_message = packets[i];
 
-			break;
+			SV_PacketEvent();
 		}
 	}
+
+	net_message = message;
 }
 
 /*
@@ -750,7 +1173,7 @@ static void SV_CheckTimeOuts (void){
 			cl->lastMessage = svs.realTime;
 
 		if (cl->state == CS_ZOMBIE && cl->lastMessage < zombiePoint){
-			cl->state = CS_FREE;	// Can now be reused
+			SV_FreeClient(cl);	// Can now be reused
 			continue;
 		}
 
@@ -758,7 +1181,7 @@ static void SV_CheckTimeOuts (void){
 			SV_BroadcastPrintf(PRINT_HIGH, "%s timed out\n", cl->name);
 			SV_DropClient(cl); 
 
-			cl->state = CS_FREE;	// Don't bother with zombie state
+			SV_FreeClient(cl);	// Don't bother with zombie state
 		}
 	}
 }
@@ -768,7 +1191,7 @@ static void SV_CheckTimeOuts (void){
  SV_ClearGameEvents
  =================
 */
-static void SV_ClearGameEvents (void){
+void SV_ClearGameEvents (void){
 
 	edict_t	*ent;
 	int		i;
@@ -797,6 +1220,8 @@ static void SV_RunGameFrame (void){
 	if (com_speeds->integerValue)
 		com_timeBeforeGame = Sys_Milliseconds();
 
+	SV_RecordCmdFrame();
+
 	ge->RunFrame();
 
 	if (com_speeds->integerValue)
@@ -836,14 +1261,42 @@ qboolean SV_AllowCheats (void){
 
 /*
  =================
- SV_Frame
+ SV_FrameTimeout
+
+ Returns the number of milliseconds until the next server frame is due
  =================
 */
-void SV_Frame (int msec){
+int SV_FrameTimeout (void){
 
-	// If server is not active, do nothing
 	if (!svs.initialized)
+		return SV_LoadTestTimeout(100);
+
+	if (com_timeDemo->integerValue)
+		return 0;
+
+	if (sv.time - svs.realTime > 100)
+		return SV_LoadTestTimeout(100);
+
+	return SV_LoadTestTimeout(sv.time - svs.realTime);
+}
+
+/*
+ =================
+ SV_RunFrame
+ =================
+*/
+static void SV_RunFrame (int msec){
+
+	double	startTime;
+
+	// If server is not active, throw away any packets that arrived so a
+	// dedicated server waiting on the socket doesn't wake up for them
+	if (!svs.initialized){
+		while (NET_GetPacket(NS_SERVER, &net_from, &net_message))
+			;
+
 		return;
+	}
 
     svs.realTime += msec;
 
@@ -865,6 +1318,8 @@ void SV_Frame (int msec){
 		return;
 	}
 
+	startTime = Sys_GetClockTicks();
+
 	// Update ping based on the last known frame from all clients
 	SV_CalcPings();
 
@@ -886,6 +1341,22 @@ void SV_Frame (int msec){
 
 	// Send a heartbeat to the masters if needed
 	SV_MasterHeartbeat();
+
+	SV_LoadTestFrameTime((Sys_GetClockTicks() - startTime) * 1000.0);
+}
+
+/*
+ =================
+ SV_Frame
+ =================
+*/
+void SV_Frame (int msec){
+
+	SV_RunFrame(msec);
+
+	// Run the load test clients right after the server, so they read the
+	// snapshots as soon as they are sent
+	SV_RunLoadTest();
 }
 
 /*
@@ -925,6 +1396,16 @@ void SV_Init (void){
 	sv_allowDownload = Cvar_Get("sv_allowDownload", "1", CVAR_ARCHIVE, "Allow file downloads to clients");
 	sv_publicServer = Cvar_Get("sv_publicServer", "1", 0, "Public server");
 	sv_rconPassword = Cvar_Get("rconPassword", "", 0, "Remote console password");
+	sv_snapshotThreads = Cvar_Get("sv_snapshotThreads", "0", CVAR_ARCHIVE, "Number of threads used to build client snapshots (0 = main thread only)");
+	sv_bitSnapshots = Cvar_Get("sv_bitSnapshots", "1", 0, "Send bit packed snapshots to clients that ask for them");
+	sv_compression = Cvar_Get("sv_compression", "1", 0, "Compress packets to clients that ask for it");
+	sv_localSnapshots = Cvar_Get("sv_localSnapshots", "1", 0, "Pass frames to the local client through the loopback buffers");
+	sv_queryRate = Cvar_Get("sv_queryRate", "10", 0, "Connectionless packets accepted per second from a single address (0 = no limit)");
+	sv_queryTotalRate = Cvar_Get("sv_queryTotalRate", "1000", 0, "Connectionless packets accepted per second from all addresses, counted apart for queries and connection attempts (0 = no limit)");
+	sv_loadTestCmdRate = Cvar_Get("sv_loadTestCmdRate", "30", 0, "User command packets per second sent by each load test client");
+	sv_loadTestMoves = Cvar_Get("sv_loadTestMoves", "0", 0, "Load test client moves (0 = random, 1 = scripted)");
+	sv_loadTestRate = Cvar_Get("sv_loadTestRate", "25000", 0, "Rate of the load test clients");
+	sv_loadTestBitSnapshots = Cvar_Get("sv_loadTestBitSnapshots", "1", 0, "Load test clients ask for bit packed snapshots");
 
 	Cmd_AddCommand("loadGame", SV_LoadGame_f, "Load a game");
 	Cmd_AddCommand("saveGame", SV_SaveGame_f, "Save a game");
@@ -940,6 +1421,10 @@ void SV_Init (void){
 	Cmd_AddCommand("serverStopRecord", SV_ServerStopRecord_f, "Stop recording a server demo");
 	Cmd_AddCommand("killServer", SV_KillServer_f, "Kill the server");
 	Cmd_AddCommand("sv", SV_ServerCommand_f, "Execute a game server command");
+	Cmd_AddCommand("loadTest", SV_LoadTest_f, "Connect headless clients to a server and report how it performs");
+	Cmd_AddCommand("serverRecordCmds", SV_ServerRecordCmds_f, "Restart the level and record the user commands of all clients");
+	Cmd_AddCommand("serverStopRecordCmds", SV_ServerStopRecordCmds_f, "Stop recording user commands");
+	Cmd_AddCommand("serverReplayCmds", SV_ServerReplayCmds_f, "Replay recorded user commands as fast as possible and report the frame costs");
 
 	if (com_dedicated->integerValue)
 		Cmd_AddCommand("say", SV_ConSay_f, "Send a chat message to everyone");
@@ -1005,6 +1490,12 @@ void SV_Shutdown (const char *message, qboolean reconnect){
 
 	Com_Printf("------- Server Shutdown -------\n");
 
+	// Send any packets left queued by an aborted frame
+	NET_FlushPackets(NS_SERVER);
+
+	// Free the clients of an aborted replay, they have nowhere to go
+	SV_StopCmdReplay();
+
 	// Send a final message
 	SV_FinalMessage(message, reconnect);
 
@@ -1024,21 +1515,47 @@ void SV_Shutdown (const char *message, qboolean reconnect){
 	if (svs.demoFile)
 		FS_CloseFile(svs.demoFile);
 
+	SV_StopCmdRecord();
+
 	if (svs.clients){
 		for (i = 0, cl = svs.clients; i < sv_maxClients->integerValue; i++, cl++){
 			if (cl->downloadFile)
 				FS_CloseFile(cl->downloadFile);
+
+			if (cl->snapshotBuffer)
+				Z_Free(cl->snapshotBuffer);
 		}
 
 		Z_Free(svs.clients);
 	}
 
-	if (svs.clientEntities)
-		Z_Free(svs.clientEntities);
+	if (svs.clientEntityNums)
+		Z_Free(svs.clientEntityNums);
+
+	if (svs.frameEntities)
+		Z_Free(svs.frameEntities);
+
+	if (svs.deltaCache)
+		Z_Free(svs.deltaCache);
+
+	if (svs.clientVis)
+		Z_Free(svs.clientVis);
+
+	if (svs.clientVisibleEntities)
+		Z_Free(svs.clientVisibleEntities);
+
+	if (svs.clientEntityWaits)
+		Z_Free(svs.clientEntityWaits);
+
+	for (i = 0; i <= MAX_JOB_THREADS; i++){
+		if (svs.snapshotScratch[i])
+			Z_Free(svs.snapshotScratch[i]);
+	}
 
 	memset(&svs, 0, sizeof(serverStatic_t));
 
 	// Free current level
+	SV_ShutdownWorld();
 	CM_UnloadMap();
 
 	// Set server state
@@ -0,0 +1,938 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+#include "server.h"
+
+
+/*
+ The serverRecordCmds command restarts the current level and logs every
+ call the server makes into the game on behalf of the clients: connects,
+ user info changes, begins, commands, user commands and disconnects, in
+ the order they happen, along with a marker for every game frame.
+
+ The serverReplayCmds command spawns the recorded level on a fresh game
+ and makes the same calls again, running the frames back to back without
+ any real clients or networking. The snapshots are still built and
+ written for every client as if it acknowledged each frame right away.
+ The time of each frame is split into the game, the world linking and
+ collision calls of the game, and the snapshots.
+
+ The random number generator is seeded again before every logged call,
+ both when recording and replaying, so the game takes the same decisions
+ no matter what else the server did in between. Replaying the same log
+ twice gives the same world, which is reported as a checksum.
+
+ This only works if the game calls the same rand() as the engine. A game
+ library linked with its own C runtime, as can happen on Windows, never
+ sees the seeds, so neither the recorded decisions nor the checksums can
+ be reproduced. Both commands warn when that is the case.
+*/
+
+#define CMDLOG_IDENT			(('D'<<24)+('M'<<16)+('C'<<8)+'U')	// "UCMD"
+#define CMDLOG_VERSION			1
+
+#define CMDLOG_EXTENSION		".ucmd"
+
+typedef enum {
+	CE_END,
+	CE_CONNECT,
+	CE_USERINFO,
+	CE_BEGIN,
+	CE_COMMAND,
+	CE_MOVE,
+	CE_DISCONNECT,
+	CE_FRAME
+} cmdEvent_t;
+
+typedef enum {
+	PHASE_GAME,
+	PHASE_LINK,
+	PHASE_CLIP,
+	PHASE_SNAPSHOT,
+	PHASE_TOTAL,
+	MAX_PHASES
+} replayPhase_t;
+
+typedef struct {
+	qboolean		pending;				// Recording starts when the level is spawned
+	char			name[MAX_OSPATH];
+
+	fileHandle_t	file;
+	int				seed;
+	int				numEvents;
+	int				numFrames;
+
+	msg_t			msg;
+	byte			buffer[MAX_MSGLEN];
+
+	usercmd_t		cmds[MAX_CLIENTS];		// Last user command of each client, to delta from
+} cmdRecord_t;
+
+typedef struct {
+	qboolean		spawning;				// The recorded level is being spawned
+	byte			*data;					// The log being replayed, freed if the replay is aborted
+	int				seed;
+	int				numEvents;
+
+	usercmd_t		cmds[MAX_CLIENTS];
+
+	qboolean		sharedRand;				// The game is seeded along with the engine
+
+	// Statistics
+	int				numFrames;
+	int				numCmds;
+	int				numClients;
+	int				firstFrameTime;			// Recorded server time of the first and last frames
+	int				lastFrameTime;
+
+	double			gameTime;				// Time spent in the game for the current frame
+
+	double			phaseTotals[MAX_PHASES];
+	double			phaseMax[MAX_PHASES];
+
+	int				numLinks;
+	int				numClips;
+	int				numSnapshots;
+	int				snapshotBytes;
+} cmdReplay_t;
+
+static const char	*sv_phaseNames[MAX_PHASES] = {"game", "linking", "collision", "snapshots", "total"};
+
+static cmdRecord_t	sv_cmdRecord;
+static cmdReplay_t	sv_cmdReplay;
+
+
+/*
+ =======================================================================
+
+ RECORDING
+
+ =======================================================================
+*/
+
+
+/*
+ =================
+ SV_FlushCmdRecord
+ =================
+*/
+static void SV_FlushCmdRecord (void){
+
+	if (!sv_cmdRecord.msg.curSize)
+		return;
+
+	FS_Write(sv_cmdRecord.msg.data, sv_cmdRecord.msg.curSize, sv_cmdRecord.file);
+
+	MSG_Clear(&sv_cmdRecord.msg);
+}
+
+/*
+ =================
+ SV_WriteCmdEvent
+
+ Returns false if not recording. Otherwise seeds the random number
+ generator for the call the event is logged for, and writes the event and
+ client number.
+ =================
+*/
+static qboolean SV_WriteCmdEvent (cmdEvent_t event, const client_t *cl){
+
+	if (!sv_cmdRecord.file)
+		return false;
+
+	// Make sure the largest event fits
+	if (sv_cmdRecord.msg.curSize > sv_cmdRecord.msg.maxSize - MAX_STRING_CHARS * 2)
+		SV_FlushCmdRecord();
+
+	srand(sv_cmdRecord.seed + sv_cmdRecord.numEvents++);
+
+	MSG_WriteByte(&sv_cmdRecord.msg, event);
+
+	if (cl)
+		MSG_WriteByte(&sv_cmdRecord.msg, cl - svs.clients);
+
+	return true;
+}
+
+/*
+ =================
+ SV_RecordCmdConnect
+ =================
+*/
+void SV_RecordCmdConnect (const client_t *cl, const char *userInfo, int maxMessageLength){
+
+	if (!SV_WriteCmdEvent(CE_CONNECT, cl))
+		return;
+
+	MSG_WriteByte(&sv_cmdRecord.msg, cl->protocol);
+	MSG_WriteLong(&sv_cmdRecord.msg, maxMessageLength);
+	MSG_WriteString(&sv_cmdRecord.msg, userInfo);
+
+	memset(&sv_cmdRecord.cmds[cl - svs.clients], 0, sizeof(usercmd_t));
+}
+
+/*
+ =================
+ SV_RecordCmdSpawn
+
+ Called right before the game spawns the entities of a new level. Stops
+ the recording of the last level and starts a pending one, or seeds the
+ random number generator the same way when replaying.
+ =================
+*/
+void SV_RecordCmdSpawn (serverState_t serverState){
+
+	client_t	*cl;
+	int			i;
+
+	if (sv_cmdReplay.spawning){
+		sv_cmdReplay.spawning = false;
+
+		srand(sv_cmdReplay.seed);
+		sv_cmdReplay.numEvents = 1;
+		return;
+	}
+
+	if (sv_cmdRecord.file)
+		SV_StopCmdRecord();
+
+	if (!sv_cmdRecord.pending)
+		return;
+
+	sv_cmdRecord.pending = false;
+
+	if (serverState != SS_GAME)
+		return;
+
+	FS_OpenFile(sv_cmdRecord.name, &sv_cmdRecord.file, FS_WRITE);
+	if (!sv_cmdRecord.file){
+		Com_Printf("Couldn't open %s\n", sv_cmdRecord.name);
+		return;
+	}
+
+	Com_Printf("Recording user commands to %s\n", sv_cmdRecord.name);
+
+	if (!Sys_GameSharesRand())
+		Com_Printf(S_COLOR_YELLOW "The game has its own random number generator, replays of this log won't be deterministic\n");
+
+	sv_cmdRecord.seed = Sys_Milliseconds();
+	sv_cmdRecord.numEvents = 1;
+	sv_cmdRecord.numFrames = 0;
+
+	MSG_Init(&sv_cmdRecord.msg, sv_cmdRecord.buffer, sizeof(sv_cmdRecord.buffer), false);
+
+	// Write the header
+	MSG_WriteLong(&sv_cmdRecord.msg, CMDLOG_IDENT);
+	MSG_WriteLong(&sv_cmdRecord.msg, CMDLOG_VERSION);
+	MSG_WriteLong(&sv_cmdRecord.msg, sv_cmdRecord.seed);
+	MSG_WriteLong(&sv_cmdRecord.msg, sv_maxClients->integerValue);
+	MSG_WriteString(&sv_cmdRecord.msg, Cvar_GetString("fs_game"));
+	MSG_WriteString(&sv_cmdRecord.msg, sv.name);
+	MSG_WriteString(&sv_cmdRecord.msg, Cvar_ServerInfo());
+
+	// Clients that stay connected through the level change are connected
+	// from the start of the replay
+	for (i = 0, cl = svs.clients; i < sv_maxClients->integerValue; i++, cl++){
+		if (cl->state < CS_CONNECTED)
+			continue;
+
+		SV_RecordCmdConnect(cl, cl->userInfo, cl->netChan.maxMessageLength);
+	}
+
+	srand(sv_cmdRecord.seed);
+}
+
+/*
+ =================
+ SV_RecordCmdUserInfo
+ =================
+*/
+void SV_RecordCmdUserInfo (const client_t *cl){
+
+	if (!SV_WriteCmdEvent(CE_USERINFO, cl))
+		return;
+
+	MSG_WriteString(&sv_cmdRecord.msg, cl->userInfo);
+}
+
+/*
+ =================
+ SV_RecordCmdBegin
+ =================
+*/
+void SV_RecordCmdBegin (const client_t *cl){
+
+	SV_WriteCmdEvent(CE_BEGIN, cl);
+}
+
+/*
+ =================
+ SV_RecordCmdCommand
+ =================
+*/
+void SV_RecordCmdCommand (const client_t *cl, const char *text){
+
+	if (!SV_WriteCmdEvent(CE_COMMAND, cl))
+		return;
+
+	MSG_WriteString(&sv_cmdRecord.msg, text);
+}
+
+/*
+ =================
+ SV_RecordCmdMove
+ =================
+*/
+void SV_RecordCmdMove (const client_t *cl, const usercmd_t *cmd){
+
+	usercmd_t	*oldCmd;
+
+	if (!SV_WriteCmdEvent(CE_MOVE, cl))
+		return;
+
+	oldCmd = &sv_cmdRecord.cmds[cl - svs.clients];
+
+	MSG_WriteDeltaUserCmd(&sv_cmdRecord.msg, oldCmd, cmd);
+	*oldCmd = *cmd;
+}
+
+/*
+ =================
+ SV_RecordCmdDisconnect
+ =================
+*/
+void SV_RecordCmdDisconnect (const client_t *cl){
+
+	SV_WriteCmdEvent(CE_DISCONNECT, cl);
+}
+
+/*
+ =================
+ SV_RecordCmdFrame
+
+ Called right before the game runs a frame
+ =================
+*/
+void SV_RecordCmdFrame (void){
+
+	if (!SV_WriteCmdEvent(CE_FRAME, NULL))
+		return;
+
+	MSG_WriteLong(&sv_cmdRecord.msg, svs.realTime);
+
+	sv_cmdRecord.numFrames++;
+}
+
+/*
+ =================
+ SV_StopCmdRecord
+ =================
+*/
+void SV_StopCmdRecord (void){
+
+	sv_cmdRecord.pending = false;
+
+	if (!sv_cmdRecord.file)
+		return;
+
+	MSG_WriteByte(&sv_cmdRecord.msg, CE_END);
+	SV_FlushCmdRecord();
+
+	FS_CloseFile(sv_cmdRecord.file);
+	sv_cmdRecord.file = 0;
+
+	Com_Printf("Stopped recording user commands, %i frames recorded\n", sv_cmdRecord.numFrames);
+}
+
+/*
+ =================
+ SV_ServerRecordCmds_f
+
+ Restarts the current level and records the user commands of all clients
+ until the level changes
+ =================
+*/
+void SV_ServerRecordCmds_f (void){
+
+	if (Cmd_Argc() != 2){
+		Com_Printf("Usage: serverRecordCmds <name>\n");
+		return;
+	}
+
+	if (sv_cmdRecord.file || sv_cmdRecord.pending){
+		Com_Printf("Already recording user commands\n");
+		return;
+	}
+
+	if (sv.state != SS_GAME){
+		Com_Printf("You must be in a level to record\n");
+		return;
+	}
+
+	Q_snprintfz(sv_cmdRecord.name, sizeof(sv_cmdRecord.name), "demos/%s", Cmd_Argv(1));
+	Com_DefaultExtension(sv_cmdRecord.name, sizeof(sv_cmdRecord.name), CMDLOG_EXTENSION);
+
+	sv_cmdRecord.pending = true;
+
+	// Restart the level so the replay starts from the same state
+	SV_Map(sv.name, false, false);
+}
+
+/*
+ =================
+ SV_ServerStopRecordCmds_f
+ =================
+*/
+void SV_ServerStopRecordCmds_f (void){
+
+	if (!sv_cmdRecord.file && !sv_cmdRecord.pending){
+		Com_Printf("Not recording user commands\n");
+		return;
+	}
+
+	SV_StopCmdRecord();
+}
+
+
+/*
+ =======================================================================
+
+ REPLAY
+
+ =======================================================================
+*/
+
+
+/*
+ =================
+ SV_ReplayCmdClient
+
+ Returns the client an event is for
+ =================
+*/
+static client_t *SV_ReplayCmdClient (msg_t *msg){
+
+	int		clientNum;
+
+	clientNum = MSG_ReadByte(msg);
+	if (clientNum < 0 || clientNum >= sv_maxClients->integerValue)
+		Com_Error(ERR_DROP, "SV_ReplayCmdClient: bad client number %i", clientNum);
+
+	return &svs.clients[clientNum];
+}
+
+/*
+ =================
+ SV_ReplayCmdConnect
+
+ Sets up a client without a remote side. Its snapshots are written but
+ never sent.
+ =================
+*/
+static void SV_ReplayCmdConnect (client_t *cl, msg_t *msg){
+
+	netAdr_t	address;
+	int			protocol, maxMessageLength;
+
+	protocol = MSG_ReadByte(msg);
+	maxMessageLength = MSG_ReadLong(msg);
+
+	SV_FreeClient(cl);
+
+	memset(cl, 0, sizeof(client_t));
+
+	cl->edict = EDICT_NUM(cl - svs.clients + 1);
+	cl->protocol = protocol;
+	cl->lastFrame = -1;
+
+	memset(&address, 0, sizeof(netAdr_t));
+	address.type = NA_IP;
+
+	NetChan_Setup(NS_SERVER, &cl->netChan, address, 0);
+	NetChan_SetMaxMessageLength(&cl->netChan, maxMessageLength);
+
+	MSG_Init(&cl->datagram, cl->datagramBuffer, cl->netChan.maxMessageLength, true);
+
+	Q_strncpyz(cl->userInfo, MSG_ReadString(msg), sizeof(cl->userInfo));
+
+	memset(&sv_cmdReplay.cmds[cl - svs.clients], 0, sizeof(usercmd_t));
+
+	if (!ge->ClientConnect(cl->edict, cl->userInfo))
+		return;
+
+	SV_InitClientSnapshots(cl);
+
+	cl->state = CS_CONNECTED;
+
+	sv_cmdReplay.numClients++;
+}
+
+/*
+ =================
+ SV_ReplayCmdPhase
+ =================
+*/
+static void SV_ReplayCmdPhase (replayPhase_t phase, double time){
+
+	time *= 1000.0;
+
+	sv_cmdReplay.phaseTotals[phase] += time;
+
+	if (sv_cmdReplay.phaseMax[phase] < time)
+		sv_cmdReplay.phaseMax[phase] = time;
+}
+
+/*
+ =================
+ SV_ReplayCmdFrame
+
+ Runs a game frame, then writes the snapshots of all the spawned clients
+ =================
+*/
+static void SV_ReplayCmdFrame (int frameTime){
+
+	client_t	*cl;
+	client_t	*snapshotClients[MAX_CLIENTS];
+	double		time, gameTime, snapshotTime;
+	int			numSnapshotClients = 0;
+	int			i;
+
+	if (!sv_cmdReplay.numFrames)
+		sv_cmdReplay.firstFrameTime = frameTime;
+
+	sv_cmdReplay.lastFrameTime = frameTime;
+	sv_cmdReplay.numFrames++;
+
+	sv.frameNum++;
+	sv.time = sv.frameNum * 100;
+
+	time = Sys_GetClockTicks();
+
+	ge->RunFrame();
+
+	gameTime = sv_cmdReplay.gameTime + Sys_GetClockTicks() - time;
+
+	// Write the snapshots as if every client acknowledged the last one
+	time = Sys_GetClockTicks();
+
+	SV_FlushConfigStrings();
+
+	for (i = 0, cl = svs.clients; i < sv_maxClients->integerValue; i++, cl++){
+		if (cl->state != CS_SPAWNED)
+			continue;
+
+		cl->snapshotBudget = -1;
+
+		snapshotClients[numSnapshotClients++] = cl;
+	}
+
+	if (numSnapshotClients)
+		SV_WriteClientDatagrams(snapshotClients, numSnapshotClients);
+
+	snapshotTime = Sys_GetClockTicks() - time;
+
+	for (i = 0; i < numSnapshotClients; i++){
+		cl = snapshotClients[i];
+
+		if (cl->snapshotFailed)
+			Com_Error(ERR_DROP, "SV_ReplayCmdFrame: couldn't write the snapshot of %s", cl->name);
+
+		sv_cmdReplay.numSnapshots++;
+		sv_cmdReplay.snapshotBytes += cl->snapshot.curSize;
+
+		cl->lastFrame = sv.frameNum;
+
+		MSG_Clear(&cl->snapshot);
+		MSG_Clear(&cl->netChan.message);
+	}
+
+	SV_ClearGameEvents();
+
+	// The world linking and collision calls are made from the game
+	SV_ReplayCmdPhase(PHASE_GAME, gameTime - sv_worldTimes.linkTime - sv_worldTimes.clipTime);
+	SV_ReplayCmdPhase(PHASE_LINK, sv_worldTimes.linkTime);
+	SV_ReplayCmdPhase(PHASE_CLIP, sv_worldTimes.clipTime);
+	SV_ReplayCmdPhase(PHASE_SNAPSHOT, snapshotTime);
+	SV_ReplayCmdPhase(PHASE_TOTAL, gameTime + snapshotTime);
+
+	sv_cmdReplay.numLinks += sv_worldTimes.numLinks;
+	sv_cmdReplay.numClips += sv_worldTimes.numClips;
+
+	sv_cmdReplay.gameTime = 0.0;
+
+	sv_worldTimes.linkTime = 0.0;
+	sv_worldTimes.clipTime = 0.0;
+	sv_worldTimes.numLinks = 0;
+	sv_worldTimes.numClips = 0;
+}
+
+/*
+ =================
+ SV_ReplayCmdEvents
+
+ Makes the logged calls into the game until the end of the log
+ =================
+*/
+static void SV_ReplayCmdEvents (msg_t *msg){
+
+	client_t	*cl;
+	usercmd_t	*oldCmd, cmd;
+	double		time;
+	int			event;
+
+	while (1){
+		if (msg->readCount >= msg->curSize){
+			Com_Printf(S_COLOR_YELLOW "User command log is truncated\n");
+			break;
+		}
+
+		event = MSG_ReadByte(msg);
+		if (event == CE_END)
+			break;
+
+		srand(sv_cmdReplay.seed + sv_cmdReplay.numEvents++);
+
+		if (event == CE_FRAME){
+			SV_ReplayCmdFrame(MSG_ReadLong(msg));
+			continue;
+		}
+
+		cl = SV_ReplayCmdClient(msg);
+
+		time = Sys_GetClockTicks();
+
+		switch (event){
+		case CE_CONNECT:
+			SV_ReplayCmdConnect(cl, msg);
+
+			break;
+		case CE_USERINFO:
+			Q_strncpyz(cl->userInfo, MSG_ReadString(msg), sizeof(cl->userInfo));
+
+			if (cl->state >= CS_CONNECTED)
+				SV_UserInfoChanged(cl);
+
+			break;
+		case CE_BEGIN:
+			if (cl->state != CS_CONNECTED)
+				break;
+
+			cl->state = CS_SPAWNED;
+
+			ge->ClientBegin(cl->edict);
+
+			break;
+		case CE_COMMAND:
+			Cmd_TokenizeString(MSG_ReadString(msg));
+
+			if (cl->state >= CS_CONNECTED)
+				ge->ClientCommand(cl->edict);
+
+			break;
+		case CE_MOVE:
+			oldCmd = &sv_cmdReplay.cmds[cl - svs.clients];
+
+			MSG_ReadDeltaUserCmd(msg, oldCmd, &cmd);
+			*oldCmd = cmd;
+
+			if (cl->state != CS_SPAWNED)
+				break;
+
+			ge->ClientThink(cl->edict, &cmd);
+
+			sv_cmdReplay.numCmds++;
+
+			break;
+		case CE_DISCONNECT:
+			if (cl->state == CS_SPAWNED)
+				ge->ClientDisconnect(cl->edict);
+
+			SV_FreeClient(cl);
+
+			break;
+		default:
+			Com_Error(ERR_DROP, "SV_ReplayCmdEvents: bad event %i", event);
+		}
+
+		sv_cmdReplay.gameTime += Sys_GetClockTicks() - time;
+	}
+}
+
+/*
+ =================
+ SV_WorldChecksum
+
+ Sums up the state of all the entities in use, to tell whether two
+ replays ended in the same world
+ =================
+*/
+static unsigned SV_WorldChecksum (void){
+
+	edict_t		*ent;
+	unsigned	checksum = 0;
+	int			i;
+
+	for (i = 0; i < ge->num_edicts; i++){
+		ent = EDICT_NUM(i);
+		if (!ent->inuse)
+			continue;
+
+		checksum = checksum * 31 + Com_BlockChecksum(&ent->s, sizeof(entity_state_t));
+	}
+
+	return checksum;
+}
+
+/*
+ =================
+ SV_PrintReplayReport
+ =================
+*/
+static void SV_PrintReplayReport (double seconds, unsigned checksum){
+
+	float	recorded;
+	int		i;
+
+	if (seconds < 0.001)
+		seconds = 0.001;
+
+	recorded = MS2SEC(sv_cmdReplay.lastFrameTime - sv_cmdReplay.firstFrameTime);
+
+	Com_Printf("\n");
+	Com_Printf("-------------- Replay --------------\n");
+	Com_Printf("%i frames, %i clients, %i user commands\n", sv_cmdReplay.numFrames, sv_cmdReplay.numClients, sv_cmdReplay.numCmds);
+	Com_Printf("%.1f seconds of play replayed in %.2f seconds, %.1f frames/sec\n", recorded, seconds, sv_cmdReplay.numFrames / seconds);
+
+	if (sv_cmdReplay.numFrames){
+		Com_Printf("phase        avg ms   max ms   share\n");
+
+		for (i = 0; i < MAX_PHASES; i++)
+			Com_Printf("%-10s %8.3f %8.3f  %5.1f%%\n", sv_phaseNames[i], sv_cmdReplay.phaseTotals[i] / sv_cmdReplay.numFrames, sv_cmdReplay.phaseMax[i], (sv_cmdReplay.phaseTotals[PHASE_TOTAL] > 0.0) ? sv_cmdReplay.phaseTotals[i] * 100.0 / sv_cmdReplay.phaseTotals[PHASE_TOTAL] : 0.0);
+
+		Com_Printf("%.1f links and %.1f collision calls per frame\n", (float)sv_cmdReplay.numLinks / sv_cmdReplay.numFrames, (float)sv_cmdReplay.numClips / sv_cmdReplay.numFrames);
+	}
+
+	if (sv_cmdReplay.numSnapshots)
+		Com_Printf("%i snapshots, %i bytes each\n", sv_cmdReplay.numSnapshots, sv_cmdReplay.snapshotBytes / sv_cmdReplay.numSnapshots);
+
+	Com_Printf("World checksum: %08x\n", checksum);
+
+	if (!sv_cmdReplay.sharedRand)
+		Com_Printf(S_COLOR_YELLOW "The game has its own random number generator, the checksum can differ between replays\n");
+	Com_Printf("------------------------------------\n");
+}
+
+/*
+ =================
+ SV_StopCmdReplay
+
+ Called when the server shuts down, which is also how an error aborts a
+ replay
+ =================
+*/
+void SV_StopCmdReplay (void){
+
+	client_t	*cl;
+	int			i;
+
+	sv_worldTimes.enabled = false;
+
+	if (!sv_cmdReplay.data)
+		return;
+
+	FS_FreeFile(sv_cmdReplay.data);
+	sv_cmdReplay.data = NULL;
+
+	// Any clients left are replayed ones
+	for (i = 0, cl = svs.clients; i < sv_maxClients->integerValue; i++, cl++)
+		SV_FreeClient(cl);
+}
+
+/*
+ =================
+ SV_ServerReplayCmds_f
+
+ Spawns the recorded level on a fresh game and replays the recorded calls
+ as fast as possible
+ =================
+*/
+void SV_ServerReplayCmds_f (void){
+
+	static char			*serverInfoVars[] = {"deathmatch", "coop", "skill", "dmflags", "fraglimit", "timelimit", "sv_cheats", NULL};
+	char				name[MAX_OSPATH], mapName[MAX_QPATH];
+	char				serverInfo[MAX_INFO_STRING], *value;
+	byte				*data;
+	msg_t				msg;
+	client_t			*cl;
+	double				startTime, seconds;
+	unsigned			checksum;
+	int					length, headerSize, seed, maxClients;
+	int					i;
+
+	if (Cmd_Argc() != 2){
+		Com_Printf("Usage: serverReplayCmds <name>\n");
+		return;
+	}
+
+	if (sv_cmdRecord.file || sv_cmdRecord.pending){
+		Com_Printf("Can't replay while recording user commands\n");
+		return;
+	}
+
+	// The level is spawned again and the replayed clients take over the
+	// slots, so there can't be any real clients around
+	if (svs.initialized){
+		for (i = 0, cl = svs.clients; i < sv_maxClients->integerValue; i++, cl++){
+			if (cl->state != CS_FREE)
+				break;
+		}
+
+		if (i != sv_maxClients->integerValue){
+			Com_Printf("Can't replay while clients are connected\n");
+			return;
+		}
+	}
+
+	Q_snprintfz(name, sizeof(name), "demos/%s", Cmd_Argv(1));
+	Com_DefaultExtension(name, sizeof(name), CMDLOG_EXTENSION);
+
+	length = FS_LoadFile(name, (void **)&data);
+	if (!data){
+		Com_Printf("Couldn't find %s\n", name);
+		return;
+	}
+
+	MSG_Init(&msg, data, length, false);
+	msg.curSize = length;
+
+	MSG_BeginReading(&msg);
+
+	// Parse the header
+	if (MSG_ReadLong(&msg) != CMDLOG_IDENT){
+		Com_Printf("%s is not a user command log\n", name);
+		FS_FreeFile(data);
+		return;
+	}
+
+	i = MSG_ReadLong(&msg);
+	if (i != CMDLOG_VERSION){
+		Com_Printf("%s has wrong version number (%i should be %i)\n", name, i, CMDLOG_VERSION);
+		FS_FreeFile(data);
+		return;
+	}
+
+	seed = MSG_ReadLong(&msg);
+
+	maxClients = MSG_ReadLong(&msg);
+	if (maxClients < 1 || maxClients > MAX_CLIENTS){
+		Com_Printf("%s has a bad number of clients (%i)\n", name, maxClients);
+		FS_FreeFile(data);
+		return;
+	}
+
+	if (Q_stricmp(MSG_ReadString(&msg), Cvar_GetString("fs_game")))
+		Com_Printf(S_COLOR_YELLOW "%s was recorded with a different game\n", name);
+
+	Q_strncpyz(mapName, MSG_ReadString(&msg), sizeof(mapName));
+	Q_strncpyz(serverInfo, MSG_ReadString(&msg), sizeof(serverInfo));
+
+	headerSize = msg.readCount;
+
+	FS_FreeFile(data);
+
+	if (!FS_FileExists(va("maps/%s.bsp", mapName))){
+		Com_Printf("Can't find maps/%s.bsp\n", mapName);
+		return;
+	}
+
+	// Set up the game the way it was recorded
+	for (i = 0; serverInfoVars[i]; i++){
+		value = Info_ValueForKey(serverInfo, serverInfoVars[i]);
+		if (value[0])
+			Cvar_ForceSet(serverInfoVars[i], value);
+	}
+
+	Cvar_ForceSet("maxclients", va("%i", maxClients));
+
+	Com_Printf("Replaying %s on %s\n", name, mapName);
+
+	memset(&sv_cmdReplay, 0, sizeof(cmdReplay_t));
+
+	sv_cmdReplay.spawning = true;
+	sv_cmdReplay.seed = seed;
+
+	// Spawn the level on a fresh game
+	sv.state = SS_DEAD;
+	Com_SetServerState(sv.state);
+
+	SV_Map(mapName, false, false);
+
+	if (sv.state != SS_GAME || sv_maxClients->integerValue != maxClients){
+		Com_Printf("Couldn't set up the recorded game\n");
+		return;
+	}
+
+	sv_cmdReplay.sharedRand = Sys_GameSharesRand();
+	if (!sv_cmdReplay.sharedRand)
+		Com_Printf(S_COLOR_YELLOW "The game has its own random number generator, the replay won't be deterministic\n");
+
+	// Load the log again, now that spawning the level can't shut down the
+	// server and leak it. It is kept where SV_StopCmdReplay can free it if
+	// an error aborts the replay.
+	if (FS_LoadFile(name, (void **)&sv_cmdReplay.data) != length){
+		Com_Printf("Couldn't reload %s\n", name);
+		SV_StopCmdReplay();
+		return;
+	}
+
+	MSG_Init(&msg, sv_cmdReplay.data, length, false);
+	msg.curSize = length;
+
+	MSG_BeginReading(&msg);
+	msg.readCount = headerSize;
+
+	// Run it
+	memset(&sv_worldTimes, 0, sizeof(worldTimes_t));
+	sv_worldTimes.enabled = true;
+
+	startTime = Sys_GetClockTicks();
+
+	SV_ReplayCmdEvents(&msg);
+
+	seconds = Sys_GetClockTicks() - startTime;
+
+	sv_worldTimes.enabled = false;
+
+	checksum = SV_WorldChecksum();
+
+	SV_PrintReplayReport(seconds, checksum);
+
+	// Remove the replayed clients so the level can go on
+	for (i = 0, cl = svs.clients; i < sv_maxClients->integerValue; i++, cl++){
+		if (cl->state == CS_SPAWNED)
+			ge->ClientDisconnect(cl->edict);
+
+		SV_FreeClient(cl);
+		cl->name[0] = 0;
+	}
+
+	SV_StopCmdReplay();
+}
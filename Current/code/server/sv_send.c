@@ -157,6 +157,119 @@ void SV_BroadcastCommand (const char *fmt, ...){
 	SV_Multicast(NULL, MULTICAST_ALL_R);
 }
 
+/*
+ =================
+ SV_ClientLocation
+
+ Updates the cluster and area of the client entity if it has moved since
+ the last time it was checked
+ =================
+*/
+static void SV_ClientLocation (client_t *cl){
+
+	int		leafNum;
+
+	if (cl->locationValid && VectorCompare(cl->locationOrigin, cl->edict->s.origin))
+		return;
+
+	leafNum = SV_PointLeafNum(cl->edict->s.origin);
+
+	cl->locationValid = true;
+	VectorCopy(cl->edict->s.origin, cl->locationOrigin);
+	cl->locationCluster = CM_LeafCluster(leafNum);
+	cl->locationArea = CM_LeafArea(leafNum);
+}
+
+/*
+ =================
+ SV_ConfigStringChanged
+
+ Marks a config string to be sent to everyone with the next flush. Clients
+ get all the strings of the level when they connect, so nothing is sent
+ while loading.
+ =================
+*/
+void SV_ConfigStringChanged (int index){
+
+	if (sv.state == SS_LOADING)
+		return;
+
+	sv.configStringsChanged[index >> 5] |= 1 << (index & 31);
+	sv.configStringsPending = true;
+}
+
+/*
+ =================
+ SV_WriteConfigStrings
+ =================
+*/
+static void SV_WriteConfigStrings (const msg_t *msg){
+
+	client_t	*cl;
+	int			i;
+
+	// If doing a serverrecord, store everything
+	if (svs.demoFile)
+		MSG_Write(&svs.demoMulticast, msg->data, msg->curSize);
+
+	for (i = 0, cl = svs.clients; i < sv_maxClients->integerValue; i++, cl++){
+		if (cl->state == CS_FREE || cl->state == CS_ZOMBIE)
+			continue;
+
+		MSG_Write(&cl->netChan.message, msg->data, msg->curSize);
+	}
+}
+
+/*
+ =================
+ SV_FlushConfigStrings
+
+ Sends the final value of every config string changed since the last
+ flush to everyone, packed together. Called once per frame, and before
+ any reliable message from the game that may refer to them.
+ =================
+*/
+void SV_FlushConfigStrings (void){
+
+	byte	data[MAX_MSGLEN];
+	msg_t	msg;
+	int		i, length;
+
+	if (!sv.configStringsPending)
+		return;
+
+	sv.configStringsPending = false;
+
+	MSG_Init(&msg, data, sizeof(data), false);
+
+	for (i = 0; i < MAX_CONFIGSTRINGS; i++){
+		if (!sv.configStringsChanged[i >> 5]){
+			i |= 31;
+			continue;
+		}
+
+		if (!(sv.configStringsChanged[i >> 5] & (1 << (i & 31))))
+			continue;
+
+		// The status bar string spans several config strings
+		length = strlen(sv.configStrings[i]);
+
+		if (msg.curSize + length + 4 > msg.maxSize){
+			SV_WriteConfigStrings(&msg);
+			MSG_Clear(&msg);
+		}
+
+		MSG_WriteByte(&msg, SVC_CONFIGSTRING);
+		MSG_WriteShort(&msg, i);
+		MSG_WriteString(&msg, sv.configStrings[i]);
+	}
+
+	memset(sv.configStringsChanged, 0, sizeof(sv.configStringsChanged));
+
+	if (msg.curSize)
+		SV_WriteConfigStrings(&msg);
+}
+
 /*
  =================
  SV_Multicast
@@ -172,13 +285,13 @@ void SV_BroadcastCommand (const char *fmt, ...){
 void SV_Multicast (vec3_t origin, multicast_t to){
 
 	client_t	*cl;
-	byte		*mask;
-	int			leafNum, cluster, area1, area2;
+	byte		*mask = NULL;
+	int			leafNum, cluster, area1;
 	int			i;
 	qboolean	reliable = false;
 
 	if (to != MULTICAST_ALL_R && to != MULTICAST_ALL){
-		leafNum = CM_PointLeafNum(origin);
+		leafNum = SV_PointLeafNum(origin);
 		area1 = CM_LeafArea(leafNum);
 	}
 	else {
@@ -186,6 +299,11 @@ void SV_Multicast (vec3_t origin, multicast_t to){
 		area1 = 0;
 	}
 
+	// A reliable message may refer to config strings that haven't been
+	// sent yet
+	if (to == MULTICAST_ALL_R || to == MULTICAST_PHS_R || to == MULTICAST_PVS_R)
+		SV_FlushConfigStrings();
+
 	// If doing a serverrecord, store everything
 	if (svs.demoFile)
 		MSG_Write(&svs.demoMulticast, sv.multicast.data, sv.multicast.curSize);
@@ -203,7 +321,6 @@ void SV_Multicast (vec3_t origin, multicast_t to){
 		reliable = true;	// Intentional fallthrough
 
 	case MULTICAST_PHS:
-		leafNum = CM_PointLeafNum(origin);
 		cluster = CM_LeafCluster(leafNum);
 		mask = CM_ClusterPHS(cluster);
 
@@ -212,7 +329,6 @@ void SV_Multicast (vec3_t origin, multicast_t to){
 		reliable = true;	// Intentional fallthrough
 
 	case MULTICAST_PVS:
-		leafNum = CM_PointLeafNum(origin);
 		cluster = CM_LeafCluster(leafNum);
 		mask = CM_ClusterPVS(cluster);
 
@@ -230,14 +346,12 @@ void SV_Multicast (vec3_t origin, multicast_t to){
 			continue;
 
 		if (mask){
-			leafNum = CM_PointLeafNum(cl->edict->s.origin);
-			cluster = CM_LeafCluster(leafNum);
-			area2 = CM_LeafArea(leafNum);
+			SV_ClientLocation(cl);
 
-			if (!CM_AreasConnected(area1, area2))
+			if (!(mask[cl->locationCluster>>3] & (1<<(cl->locationCluster&7))))
 				continue;
 
-			if (!(mask[cluster>>3] & (1<<(cluster&7))))
+			if (!CM_AreasConnected(area1, cl->locationArea))
 				continue;
 		}
 
@@ -377,42 +491,108 @@ void SV_StartSound (vec3_t origin, edict_t *entity, int channel, int sound, floa
 
 /*
  =================
- SV_SendClientDatagram
+ SV_WriteClientDatagram
+
+ Writes the snapshot and the accumulated multicast datagram for a client.
+ Safe to run on any thread.
  =================
 */
-static void SV_SendClientDatagram (client_t *cl){
+static void SV_WriteClientDatagram (int job, int thread, void *data){
 
-	byte	data[MAX_MSGLEN];
-	msg_t	msg;
+	client_t	*cl = ((client_t **)data)[job];
+	msg_t		*msg = &cl->snapshot;
+
+	cl->scratch = svs.snapshotScratch[thread];
 
-	MSG_Init(&msg, data, sizeof(data), true);
+	MSG_Init(msg, cl->snapshotBuffer, cl->netChan.maxMessageLength, true);
 
 	// Send over all the relevant entity_state_t and the player_state_t
-	SV_BuildClientFrame(cl);
-	SV_WriteFrameToClient(cl, &msg);
+	SV_WriteFrameToClient(cl, msg);
 
 	// Copy the accumulated multicast datagram for this client out to 
 	// the message.
 	// It is necessary for this to be after the SV_WriteFrameToClient so
 	// that entity references will be current.
-	if (cl->datagram.overflowed)
-		Com_Printf(S_COLOR_YELLOW "WARNING: datagram overflowed for %s\n", cl->name);
-	else
-		MSG_Write(&msg, cl->datagram.data, cl->datagram.curSize);
+	cl->datagramOverflowed = cl->datagram.overflowed;
+
+	if (!cl->datagramOverflowed)
+		MSG_Write(msg, cl->datagram.data, cl->datagram.curSize);
 
 	MSG_Clear(&cl->datagram);
+}
+
+/*
+ =================
+ SV_WriteClientDatagrams
+
+ Builds and writes the snapshots on sv_snapshotThreads threads, leaving
+ them in the snapshot message of each client
+ =================
+*/
+void SV_WriteClientDatagrams (client_t **clients, int numClients){
+
+	int		i, numThreads;
+
+	SV_BuildClientFrames(clients, numClients);
+
+	// Make sure every thread that can take a job has scratch space
+	numThreads = sv_snapshotThreads->integerValue;
+	if (numThreads < 1 || numClients <= 1)
+		numThreads = 1;
+	else if (numThreads > MAX_JOB_THREADS + 1)
+		numThreads = MAX_JOB_THREADS + 1;
 
-	if (msg.overflowed){
-		// Must have room left for the packet header
-		Com_Printf(S_COLOR_YELLOW "WARNING: msg overflowed for %s\n", cl->name);
-		MSG_Clear(&msg);
+	for (i = 0; i < numThreads; i++){
+		if (!svs.snapshotScratch[i])
+			svs.snapshotScratch[i] = Z_Malloc(sizeof(snapshotScratch_t));
 	}
 
-	// Send the datagram
-	NetChan_Transmit(&cl->netChan, msg.data, msg.curSize);
+	Com_RunJobs(sv_snapshotThreads->integerValue, numClients, SV_WriteClientDatagram, clients);
+}
 
-	// Record the size for rate estimation
-	cl->messageSize[sv.frameNum % RATE_MESSAGES] = msg.curSize;
+/*
+ =================
+ SV_SendClientDatagrams
+
+ Writes the snapshots, then sends them in client order
+ =================
+*/
+static void SV_SendClientDatagrams (client_t **clients, int numClients){
+
+	client_t	*cl;
+	int			i, bytes;
+
+	SV_WriteClientDatagrams(clients, numClients);
+
+	for (i = 0; i < numClients; i++){
+		cl = clients[i];
+
+		// The job couldn't write the snapshot, so just send the
+		// disconnect
+		if (cl->snapshotFailed){
+			cl->snapshotFailed = false;
+
+			MSG_Clear(&cl->snapshot);
+			SV_BroadcastPrintf(PRINT_HIGH, "%s dropped: bad snapshot\n", cl->name);
+			SV_DropClient(cl);
+		}
+
+		if (cl->datagramOverflowed)
+			Com_Printf(S_COLOR_YELLOW "WARNING: datagram overflowed for %s\n", cl->name);
+
+		if (cl->snapshot.overflowed){
+			// Must have room left for the packet header
+			Com_Printf(S_COLOR_YELLOW "WARNING: msg overflowed for %s\n", cl->name);
+			MSG_Clear(&cl->snapshot);
+		}
+
+		// Send the datagram, taking what went on the wire out of the
+		// token bucket
+		bytes = NetChan_Transmit(&cl->netChan, cl->snapshot.data, cl->snapshot.curSize);
+
+		if (cl->snapshotBudget >= 0)
+			cl->rateTokens -= bytes;
+	}
 }
 
 /*
@@ -432,30 +612,40 @@ static void SV_DemoCompleted (void){
 
 /*
  =================
- SV_RateDrop
+ SV_RateBudget
 
- Returns true if the client is over its current bandwidth estimation and 
- should not be sent another packet
+ Refills the token bucket of the client at its rate, and sets how many
+ bytes the next snapshot can use. The bucket holds at most RATE_BURST_MSEC
+ worth of bytes, and the bytes actually sent are taken out of it. A
+ snapshot is always sent, the entities that don't fit are deferred.
  =================
 */
-static qboolean SV_RateDrop (client_t *cl){
+static void SV_RateBudget (client_t *cl){
 
-	int		i, total = 0;
+	int		msec, burst;
 
-	// Never drop over the loopback
-	if (NET_IsLocalAddress(cl->netChan.remoteAddress))
-		return false;
+	// Never limit the loopback
+	if (NET_IsLocalAddress(cl->netChan.remoteAddress)){
+		cl->snapshotBudget = -1;
+		return;
+	}
 
-	for (i = 0; i < RATE_MESSAGES; i++)
-		total += cl->messageSize[i];
+	msec = svs.realTime - cl->rateTime;
+	if (msec < 0 || msec > RATE_BURST_MSEC)
+		msec = RATE_BURST_MSEC;
 
-	if (total > cl->rate){
-		cl->suppressCount++;
-		cl->messageSize[sv.frameNum % RATE_MESSAGES] = 0;
-		return true;
-	}
+	cl->rateTime = svs.realTime;
+
+	burst = cl->rate * RATE_BURST_MSEC / 1000;
 
-	return false;
+	cl->rateTokens += cl->rate * msec / 1000;
+	if (cl->rateTokens > burst)
+		cl->rateTokens = burst;
+
+	if (cl->rateTokens > 0)
+		cl->snapshotBudget = cl->rateTokens;
+	else
+		cl->snapshotBudget = 0;
 }
 
 /*
@@ -466,8 +656,10 @@ static qboolean SV_RateDrop (client_t *cl){
 void SV_SendClientMessages (void){
 
 	client_t	*cl;
+	client_t	*snapshotClients[MAX_CLIENTS];
 	byte		data[MAX_MSGLEN];
 	int			i, r, len = 0;
+	int			numSnapshotClients = 0;
 
 	// Read the next demo message if needed
 	if ((sv.state == SS_DEMO && sv.demoFile) && !com_paused->integerValue){
@@ -493,6 +685,12 @@ void SV_SendClientMessages (void){
 		}
 	}
 
+	// Send the config strings changed during the frame
+	SV_FlushConfigStrings();
+
+	// Queue up the datagrams so they all go out at once
+	NET_QueuePackets(NS_SERVER);
+
 	// Send a message to each connected client
 	for (i = 0, cl = svs.clients; i < sv_maxClients->integerValue; i++, cl++){
 		if (cl->state == CS_FREE)
@@ -510,10 +708,9 @@ void SV_SendClientMessages (void){
 			NetChan_Transmit(&cl->netChan, data, len);
 		else if (cl->state == CS_SPAWNED){
 			// Don't overrun bandwidth
-			if (SV_RateDrop(cl))
-				continue;
+			SV_RateBudget(cl);
 
-			SV_SendClientDatagram(cl);
+			snapshotClients[numSnapshotClients++] = cl;
 		}
 		else {
 			// Just update reliable	if needed
@@ -521,4 +718,11 @@ void SV_SendClientMessages (void){
 				NetChan_Transmit(&cl->netChan, NULL, 0);
 		}
 	}
+
+	// Snapshots are built and sent together, so the work can be spread
+	// over several threads
+	if (numSnapshotClients)
+		SV_SendClientDatagrams(snapshotClients, numSnapshotClients);
+
+	NET_FlushPackets(NS_SERVER);
 }
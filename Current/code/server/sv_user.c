@@ -65,7 +65,7 @@ static void SV_New_f (void){
 
 	// Send the server data
 	MSG_WriteByte(&sv_client->netChan.message, SVC_SERVERDATA);
-	MSG_WriteLong(&sv_client->netChan.message, PROTOCOL_VERSION);
+	MSG_WriteLong(&sv_client->netChan.message, sv_client->protocol);
 	MSG_WriteLong(&sv_client->netChan.message, svs.spawnCount);
 	MSG_WriteByte(&sv_client->netChan.message, sv.attractLoop);
 	MSG_WriteString(&sv_client->netChan.message, Cvar_GetString("fs_game"));
@@ -116,7 +116,7 @@ static void SV_ConfigStrings_f (void){
 		start = MAX_CONFIGSTRINGS;
 
 	// Write a packet full of data
-	while (sv_client->netChan.message.curSize < MAX_MSGLEN/2 && start < MAX_CONFIGSTRINGS){
+	while (sv_client->netChan.message.curSize < sv_client->netChan.message.maxSize/2 && start < MAX_CONFIGSTRINGS){
 		if (sv.configStrings[start][0]){
 			MSG_WriteByte(&sv_client->netChan.message, SVC_CONFIGSTRING);
 			MSG_WriteShort(&sv_client->netChan.message, start);
@@ -169,7 +169,7 @@ static void SV_BaseLines_f (void){
 	memset(&nullState, 0, sizeof(entity_state_t));
 
 	// Write a packet full of data
-	while (sv_client->netChan.message.curSize < MAX_MSGLEN/2 && start < MAX_EDICTS){
+	while (sv_client->netChan.message.curSize < sv_client->netChan.message.maxSize/2 && start < MAX_EDICTS){
 		base = &sv.baselines[start];
 		if (base->modelindex || base->sound || base->effects){
 			MSG_WriteByte(&sv_client->netChan.message, SVC_SPAWNBASELINE);
@@ -208,6 +208,8 @@ static void SV_Begin_f (void){
 	sv_client->state = CS_SPAWNED;
 
 	// Call the game begin function
+	SV_RecordCmdBegin(sv_client);
+
 	ge->ClientBegin(sv_player);
 
 	Cbuf_InsertFromDefer();
@@ -392,8 +394,11 @@ static void SV_ExecuteUserCommand (char *s){
 		}
 	}
 
-	if (!ucmd->name && sv.state == SS_GAME)
+	if (!ucmd->name && sv.state == SS_GAME){
+		SV_RecordCmdCommand(sv_client, s);
+
 		ge->ClientCommand(sv_player);
+	}
 }
 
 /*
@@ -410,6 +415,8 @@ static void SV_ClientThink (client_t *cl, usercmd_t *cmd){
 		return;
 	}
 
+	SV_RecordCmdMove(cl, cmd);
+
 	ge->ClientThink(cl->edict, cmd);
 }
 
@@ -59,6 +59,29 @@ static edict_t		**sv_areaList;
 static int			sv_areaCount, sv_areaMaxCount;
 static int			sv_areaType;
 
+typedef struct {
+	int		numClusters;		// -1 = in the head node list
+	int		clusters[MAX_ENT_CLUSTERS];
+} entityClusters_t;
+
+static int			sv_numClusters;
+static unsigned		*sv_clusterEntities;		// [numClusters][EDICT_WORDS]
+static int			*sv_clusterEntityCounts;	// [numClusters]
+static unsigned		sv_headNodeEntities[EDICT_WORDS];
+static entityClusters_t	sv_entityClusters[MAX_EDICTS];
+
+#define	POINT_LEAF_HASH_SIZE	1024
+
+typedef struct {
+	vec3_t	point;
+	int		leafNum;			// -1 = empty
+} pointLeaf_t;
+
+static pointLeaf_t	sv_pointLeafs[POINT_LEAF_HASH_SIZE];
+
+// Game traces don't share the collision state with the local client
+static traceContext_t	sv_traceContext;
+
 
 /*
  =================
@@ -140,6 +163,115 @@ static areaNode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs){
 	return areaNode;
 }
 
+/*
+ =================
+ SV_UnlinkEdictClusters
+ =================
+*/
+static void SV_UnlinkEdictClusters (int num){
+
+	entityClusters_t	*entityClusters = &sv_entityClusters[num];
+	int					i, cluster;
+
+	if (entityClusters->numClusters == -1){
+		sv_headNodeEntities[num >> 5] &= ~(1 << (num & 31));
+
+		entityClusters->numClusters = 0;
+		return;
+	}
+
+	for (i = 0; i < entityClusters->numClusters; i++){
+		cluster = entityClusters->clusters[i];
+
+		sv_clusterEntities[cluster * EDICT_WORDS + (num >> 5)] &= ~(1 << (num & 31));
+		sv_clusterEntityCounts[cluster]--;
+	}
+
+	entityClusters->numClusters = 0;
+}
+
+/*
+ =================
+ SV_LinkEdictClusters
+
+ Adds the entity to the cluster index, so SV_ClusterEntities can find it
+ without looking at every entity
+ =================
+*/
+static void SV_LinkEdictClusters (edict_t *ent){
+
+	entityClusters_t	*entityClusters;
+	int					i, num, cluster;
+
+	num = NUM_FOR_EDICT(ent);
+	if (num < 0 || num >= MAX_EDICTS)
+		return;
+
+	SV_UnlinkEdictClusters(num);
+
+	entityClusters = &sv_entityClusters[num];
+
+	if (ent->num_clusters == -1){
+		sv_headNodeEntities[num >> 5] |= 1 << (num & 31);
+
+		entityClusters->numClusters = -1;
+		return;
+	}
+
+	for (i = 0; i < ent->num_clusters; i++){
+		cluster = ent->clusternums[i];
+		if (cluster < 0 || cluster >= sv_numClusters)
+			continue;
+
+		sv_clusterEntities[cluster * EDICT_WORDS + (num >> 5)] |= 1 << (num & 31);
+		sv_clusterEntityCounts[cluster]++;
+
+		entityClusters->clusters[entityClusters->numClusters++] = cluster;
+	}
+}
+
+/*
+ =================
+ SV_ClusterEntities
+
+ Adds all the entities touching any of the clusters set in the given bit
+ vector to the given entity bit vector, along with all the entities that
+ touch too many leafs to be indexed by cluster. The result may include
+ entities that have been freed or changed since they were linked, so the
+ caller must still check the entities individually.
+ =================
+*/
+void SV_ClusterEntities (const byte *bitVector, unsigned *entities){
+
+	unsigned	bits, *row;
+	int			i, j, k, cluster;
+
+	for (i = 0; i < EDICT_WORDS; i++)
+		entities[i] |= sv_headNodeEntities[i];
+
+	for (i = 0; i < (sv_numClusters+31)>>5; i++){
+		bits = ((const unsigned *)bitVector)[i];
+		if (!bits)
+			continue;
+
+		for (j = 0; j < 32; j++){
+			if (!(bits & (1 << j)))
+				continue;
+
+			cluster = (i << 5) + j;
+			if (cluster >= sv_numClusters)
+				break;
+
+			if (!sv_clusterEntityCounts[cluster])
+				continue;
+
+			row = sv_clusterEntities + cluster * EDICT_WORDS;
+			for (k = 0; k < EDICT_WORDS; k++)
+				entities[k] |= row[k];
+		}
+	}
+}
+
 /*
  =================
  SV_ClearWorld
@@ -151,6 +283,73 @@ void SV_ClearWorld (void){
 	sv_numAreaNodes = 0;
 
 	SV_CreateAreaNode(0, sv.models[1]->mins, sv.models[1]->maxs);
+
+	// Clear the cluster index and the point leaf cache
+	SV_ShutdownWorld();
+
+	sv_numClusters = CM_NumClusters();
+
+	if (sv_numClusters){
+		sv_clusterEntities = Z_Malloc(sv_numClusters * EDICT_WORDS * sizeof(unsigned));
+		sv_clusterEntityCounts = Z_Malloc(sv_numClusters * sizeof(int));
+
+		memset(sv_clusterEntities, 0, sv_numClusters * EDICT_WORDS * sizeof(unsigned));
+		memset(sv_clusterEntityCounts, 0, sv_numClusters * sizeof(int));
+	}
+}
+
+/*
+ =================
+ SV_ShutdownWorld
+ =================
+*/
+void SV_ShutdownWorld (void){
+
+	int		i;
+
+	if (sv_clusterEntities)
+		Z_Free(sv_clusterEntities);
+	if (sv_clusterEntityCounts)
+		Z_Free(sv_clusterEntityCounts);
+
+	sv_clusterEntities = NULL;
+	sv_clusterEntityCounts = NULL;
+	sv_numClusters = 0;
+
+	CM_FreeTraceContext(&sv_traceContext);
+
+	memset(sv_headNodeEntities, 0, sizeof(sv_headNodeEntities));
+	memset(sv_entityClusters, 0, sizeof(sv_entityClusters));
+
+	for (i = 0; i < POINT_LEAF_HASH_SIZE; i++)
+		sv_pointLeafs[i].leafNum = -1;
+}
+
+/*
+ =================
+ SV_PointLeafNum
+
+ Same as CM_PointLeafNum, but remembers the leafs of recently used points.
+ Multicasts and the game PVS checks ask for the same few origins (the
+ clients, monsters and their targets) many times per frame.
+ =================
+*/
+int SV_PointLeafNum (const vec3_t p){
+
+	pointLeaf_t	*pointLeaf;
+	unsigned	hash;
+
+	hash = ((*(unsigned *)&p[0]) * 73856093U) ^ ((*(unsigned *)&p[1]) * 19349663U) ^ ((*(unsigned *)&p[2]) * 83492791U);
+	hash = (hash ^ (hash >> 16)) & (POINT_LEAF_HASH_SIZE-1);
+
+	pointLeaf = &sv_pointLeafs[hash];
+
+	if (pointLeaf->leafNum == -1 || !VectorCompare(pointLeaf->point, p)){
+		VectorCopy(p, pointLeaf->point);
+		pointLeaf->leafNum = CM_PointLeafNum(p);
+	}
+
+	return pointLeaf->leafNum;
 }
 
 /*
@@ -317,6 +516,8 @@ void SV_LinkEdict (edict_t *ent){
 		}
 	}
 
+	SV_LinkEdictClusters(ent);
+
 	// If first time, make sure old_origin is valid
 	if (!ent->linkcount)
 		VectorCopy(ent->s.origin, ent->s.old_origin);
@@ -451,7 +652,7 @@ static int SV_HullForEntity (edict_t *ent){
 	}
 
 	// Create a temp hull from bounding box sizes
-	return CM_HeadNodeForBox(ent->mins, ent->maxs);
+	return CM_HeadNodeForBoxEx(&sv_traceContext, ent->mins, ent->maxs);
 }
 
 /*
@@ -464,7 +665,7 @@ static void SV_ClipMoveToEntities (moveClip_t *clip){
 	trace_t		trace;
 	int			i, num, headNode;
 	edict_t		*touchList[MAX_EDICTS], *touch;
-	float		*angles;
+	const float	*mins, *maxs;
 
 	num = SV_AreaEdicts(clip->boxMins, clip->boxMaxs, touchList, MAX_EDICTS, AREA_SOLID);
 
@@ -492,16 +693,24 @@ static void SV_ClipMoveToEntities (moveClip_t *clip){
 		if (!(clip->contentMask & CONTENTS_DEADMONSTER) && (touch->svflags & SVF_DEADMONSTER))
 			continue;
 
-		// Might intersect, so do an exact clip
-		headNode = SV_HullForEntity(touch);
-		angles = touch->s.angles;
-		if (touch->solid != SOLID_BSP)
-			angles = vec3_origin;	// Boxes don't rotate
+		if (touch->svflags & SVF_MONSTER){
+			mins = clip->mins2;
+			maxs = clip->maxs2;
+		}
+		else {
+			mins = clip->mins;
+			maxs = clip->maxs;
+		}
+
+		// Might intersect, so do an exact clip. Boxes don't rotate, and are
+		// clipped directly instead of through a temporary hull.
+		if (touch->solid == SOLID_BSP){
+			headNode = SV_HullForEntity(touch);
 
-		if (touch->svflags & SVF_MONSTER)
-			trace = CM_TransformedBoxTrace(clip->start, clip->end, clip->mins2, clip->maxs2, headNode, clip->contentMask, touch->s.origin, angles);
+			trace = CM_TransformedBoxTraceEx(&sv_traceContext, clip->start, clip->end, mins, maxs, headNode, clip->contentMask, touch->s.origin, touch->s.angles);
+		}
 		else
-			trace = CM_TransformedBoxTrace(clip->start, clip->end, clip->mins, clip->maxs, headNode,  clip->contentMask, touch->s.origin, angles);
+			trace = CM_BoxTraceToBoxEx(&sv_traceContext, clip->start, clip->end, mins, maxs, touch->mins, touch->maxs, clip->contentMask, touch->s.origin);
 
 		if (trace.allsolid || trace.startsolid || trace.fraction < clip->trace.fraction){
 			trace.ent = touch;
@@ -538,7 +747,7 @@ trace_t SV_Trace (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, edict_t *p
 	memset(&clip, 0, sizeof(moveClip_t));
 
 	// Clip to world
-	clip.trace = CM_BoxTrace(start, end, mins, maxs, 0, contentMask);
+	clip.trace = CM_BoxTraceEx(&sv_traceContext, start, end, mins, maxs, 0, contentMask);
 	clip.trace.ent = ge->edicts;
 	if (clip.trace.fraction == 0)
 		return clip.trace;		// Blocked by the world
@@ -584,7 +793,7 @@ int SV_PointContents (vec3_t p){
 	float		*angles;
 
 	// Get base contents from world
-	contents = CM_PointContents(p, sv.models[1]->headNode);
+	contents = CM_PointContentsEx(&sv_traceContext, p, sv.models[1]->headNode);
 
 	// Or in contents from all the other entities
 	num = SV_AreaEdicts(p, p, touch, MAX_EDICTS, AREA_SOLID);
@@ -598,7 +807,7 @@ int SV_PointContents (vec3_t p){
 		if (hit->solid != SOLID_BSP)
 			angles = vec3_origin;	// Boxes don't rotate
 
-		contents |= CM_TransformedPointContents(p, headNode, hit->s.origin, hit->s.angles);
+		contents |= CM_TransformedPointContentsEx(&sv_traceContext, p, headNode, hit->s.origin, hit->s.angles);
 	}
 
 	return contents;
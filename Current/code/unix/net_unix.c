@@ -0,0 +1,857 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+// net_unix.c -- BSD sockets network layer
+
+
+#ifdef __linux__
+#define _GNU_SOURCE			// For recvmmsg and sendmmsg
+#endif
+
+#include "../qcommon/qcommon.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+typedef struct {
+	qboolean			active;
+
+	int					numPackets;
+	byte				data[MAX_PACKET_BATCH][MAX_PACKETLEN];
+	int					dataLen[MAX_PACKET_BATCH];
+	struct sockaddr_in	addrs[MAX_PACKET_BATCH];
+} sendQueue_t;
+
+static sendQueue_t	net_sendQueues[NS_LOADCLIENT];
+static int			net_sockets[NS_MAXSOCKETS];
+
+cvar_t	*net_ip;
+cvar_t	*net_port;
+cvar_t	*net_clientPort;
+
+
+/*
+ =================
+ NET_ErrorString
+ =================
+*/
+static const char *NET_ErrorString (void){
+
+	return strerror(errno);
+}
+
+/*
+ =================
+ NET_NetadrToSockadr
+ =================
+*/
+static void NET_NetadrToSockadr (const netAdr_t *adr, struct sockaddr_in *s){
+
+	memset(s, 0, sizeof(*s));
+
+	if (adr->type == NA_BROADCAST){
+		s->sin_family = AF_INET;
+		s->sin_port = adr->port;
+		s->sin_addr.s_addr = INADDR_BROADCAST;
+	}
+	else if (adr->type == NA_IP){
+		s->sin_family = AF_INET;
+		memcpy(&s->sin_addr.s_addr, adr->ip, 4);
+		s->sin_port = adr->port;
+	}
+}
+
+/*
+ =================
+ NET_SockadrToNetadr
+ =================
+*/
+static void NET_SockadrToNetadr (const struct sockaddr_in *s, netAdr_t *adr){
+
+	memset(adr, 0, sizeof(*adr));
+
+	if (s->sin_family == AF_INET){
+		adr->type = NA_IP;
+		memcpy(adr->ip, &s->sin_addr.s_addr, 4);
+		adr->port = s->sin_port;
+	}
+}
+
+/*
+ =================
+ NET_StringToSockaddr
+
+ localhost
+ idnewt
+ idnewt:28000
+ 192.246.40.70
+ 192.246.40.70:28000
+ =================
+*/
+static qboolean NET_StringToSockaddr (const char *string, struct sockaddr_in *s){
+
+	struct hostent	*h;
+	char			*colon;
+	char			copy[128];
+	
+	memset(s, 0, sizeof(*s));
+
+	s->sin_family = AF_INET;
+	s->sin_port = 0;
+
+	Q_strncpyz(copy, string, sizeof(copy));
+
+	// Strip off a trailing :port if present
+	for (colon = copy; *colon; colon++){
+		if (*colon == ':'){
+			*colon = 0;
+			s->sin_port = htons((short)atoi(colon+1));	
+		}
+	}
+		
+	if (copy[0] >= '0' && copy[0] <= '9')
+		s->sin_addr.s_addr = inet_addr(copy);
+	else {
+		if (!(h = gethostbyname(copy)))
+			return false;
+
+		memcpy(&s->sin_addr.s_addr, h->h_addr_list[0], 4);
+	}
+	
+	return true;
+}
+
+/*
+ =================
+ NET_CompareAdr
+ =================
+*/
+qboolean NET_CompareAdr (const netAdr_t a, const netAdr_t b){
+
+	if (a.type != b.type)
+		return false;
+
+	if (a.type == NA_LOOPBACK)
+		return true;
+	else if (a.type == NA_IP){
+		if (!memcmp(a.ip, b.ip, 4) && a.port == b.port)
+			return true;
+
+		return false;
+	}
+	else {
+		Com_Printf(S_COLOR_RED "NET_CompareAdr: bad address type\n");
+		return false;
+	}
+}
+
+/*
+ =================
+ NET_CompareBaseAdr
+
+ Compare without the port
+ =================
+*/
+qboolean NET_CompareBaseAdr (const netAdr_t a, const netAdr_t b){
+
+	if (a.type != b.type)
+		return false;
+
+	if (a.type == NA_LOOPBACK)
+		return true;
+	else if (a.type == NA_IP){
+		if (!memcmp(a.ip, b.ip, 4))
+			return true;
+
+		return false;
+	}
+	else {
+		Com_Printf(S_COLOR_RED "NET_CompareBaseAdr: bad address type\n");
+		return false;
+	}
+}
+
+/*
+ =================
+ NET_IsLocalAddress
+ =================
+*/
+qboolean NET_IsLocalAddress (const netAdr_t adr){
+
+	return (adr.type == NA_LOOPBACK);
+}
+
+/*
+ =================
+ NET_AdrToString
+ =================
+*/
+char *NET_AdrToString (const netAdr_t adr){
+
+	static char	string[64];
+
+	if (adr.type == NA_LOOPBACK)
+		Q_snprintfz(string, sizeof(string), "loopback");
+	else if (adr.type == NA_IP)
+		Q_snprintfz(string, sizeof(string), "%i.%i.%i.%i:%i", adr.ip[0], adr.ip[1], adr.ip[2], adr.ip[3], ntohs(adr.port));
+	else
+		string[0] = 0;
+
+	return string;
+}
+
+/*
+ =================
+ NET_StringToAdr
+
+ localhost
+ idnewt
+ idnewt:28000
+ 192.246.40.70
+ 192.246.40.70:28000
+ =================
+*/
+qboolean NET_StringToAdr (const char *string, netAdr_t *adr){
+
+	struct sockaddr_in	s;
+	
+	if (!Q_stricmp(string, "localhost")){
+		memset(adr, 0, sizeof(netAdr_t));
+		adr->type = NA_LOOPBACK;
+		return true;
+	}
+
+	if (!NET_StringToSockaddr(string, &s))
+		return false;
+	
+	NET_SockadrToNetadr(&s, adr);
+
+	return true;
+}
+
+
+/*
+ =================
+ NET_GetPacket
+ =================
+*/
+qboolean NET_GetPacket (netSrc_t sock, netAdr_t *from, msg_t *msg){
+
+	int 				ret;
+	struct sockaddr_in	addr;
+	socklen_t			addrLen;
+	int					net_socket;
+
+	if (NET_GetLoopPacket(sock, from, msg))
+		return true;
+
+	net_socket = net_sockets[sock];
+	if (net_socket == -1)
+		return false;
+
+	addrLen = sizeof(addr);
+	ret = recvfrom(net_socket, msg->data, msg->maxSize, 0, (struct sockaddr *)&addr, &addrLen);
+
+	if (ret == -1){
+		// EWOULDBLOCK and ECONNREFUSED are silent
+		if (errno == EWOULDBLOCK || errno == EAGAIN || errno == ECONNREFUSED)
+			return false;
+
+		NET_SockadrToNetadr(&addr, from);
+
+		Com_Printf(S_COLOR_RED "NET_GetPacket: %s from %s\n", NET_ErrorString(), NET_AdrToString(*from));
+		return false;
+	}
+
+	NET_SockadrToNetadr(&addr, from);
+
+	if (ret == msg->maxSize){
+		Com_Printf(S_COLOR_RED "NET_GetPacket: oversize packet from %s\n", NET_AdrToString(*from));
+		return false;
+	}
+
+	msg->curSize = ret;
+	return true;
+}
+
+/*
+ =================
+ NET_GetPackets
+
+ Reads up to maxPackets datagrams into the given messages, using a single
+ system call where available. Returns the number of packets read.
+ =================
+*/
+int NET_GetPackets (netSrc_t sock, netAdr_t *from, msg_t *msgs, int maxPackets){
+
+#ifdef __linux__
+	struct mmsghdr		hdrs[MAX_PACKET_BATCH];
+	struct iovec		iovs[MAX_PACKET_BATCH];
+	struct sockaddr_in	addrs[MAX_PACKET_BATCH];
+	int					ret, len;
+	int					i, count = 0;
+	int					net_socket;
+
+	if (maxPackets > MAX_PACKET_BATCH)
+		maxPackets = MAX_PACKET_BATCH;
+
+	// Loopback packets go first
+	while (count < maxPackets){
+		if (!NET_GetLoopPacket(sock, &from[count], &msgs[count]))
+			break;
+
+		count++;
+	}
+
+	if (count == maxPackets)
+		return count;
+
+	net_socket = net_sockets[sock];
+	if (net_socket == -1)
+		return count;
+
+	for (i = 0; i < maxPackets - count; i++){
+		iovs[i].iov_base = msgs[count+i].data;
+		iovs[i].iov_len = msgs[count+i].maxSize;
+
+		memset(&hdrs[i], 0, sizeof(hdrs[i]));
+		hdrs[i].msg_hdr.msg_name = &addrs[i];
+		hdrs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+		hdrs[i].msg_hdr.msg_iov = &iovs[i];
+		hdrs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	ret = recvmmsg(net_socket, hdrs, maxPackets - count, MSG_DONTWAIT, NULL);
+
+	if (ret == -1){
+		// EWOULDBLOCK and ECONNREFUSED are silent
+		if (errno == EWOULDBLOCK || errno == EAGAIN || errno == ECONNREFUSED)
+			return count;
+
+		Com_Printf(S_COLOR_RED "NET_GetPackets: %s\n", NET_ErrorString());
+		return count;
+	}
+
+	// Copy the packets down over any oversize ones we drop
+	for (i = 0; i < ret; i++){
+		NET_SockadrToNetadr(&addrs[i], &from[count]);
+
+		len = hdrs[i].msg_len;
+		if (len == iovs[i].iov_len){
+			Com_Printf(S_COLOR_RED "NET_GetPackets: oversize packet from %s\n", NET_AdrToString(from[count]));
+			continue;
+		}
+
+		if (iovs[i].iov_base != msgs[count].data)
+			memcpy(msgs[count].data, iovs[i].iov_base, len);
+
+		msgs[count].curSize = len;
+		msgs[count].readCount = 0;
+		msgs[count].bit = 0;
+
+		count++;
+	}
+
+	return count;
+#else
+	int		count;
+
+	for (count = 0; count < maxPackets; count++){
+		if (!NET_GetPacket(sock, &from[count], &msgs[count]))
+			break;
+
+		msgs[count].readCount = 0;
+		msgs[count].bit = 0;
+	}
+
+	return count;
+#endif
+}
+
+/*
+ =================
+ NET_SendErrorIsSilent
+ =================
+*/
+static qboolean NET_SendErrorIsSilent (int error, const netAdr_t to){
+
+	// EWOULDBLOCK is silent
+	if (error == EWOULDBLOCK || error == EAGAIN)
+		return true;
+
+	// Some PPP links don't allow broadcasts
+	if (error == EADDRNOTAVAIL && to.type == NA_BROADCAST)
+		return true;
+
+	return false;
+}
+
+/*
+ =================
+ NET_SendQueuedPackets
+ =================
+*/
+static void NET_SendQueuedPackets (netSrc_t sock){
+
+	sendQueue_t		*queue = &net_sendQueues[sock];
+	netAdr_t		to;
+	int				net_socket;
+#ifdef __linux__
+	struct mmsghdr	hdrs[MAX_PACKET_BATCH];
+	struct iovec	iovs[MAX_PACKET_BATCH];
+	int				i, ret, sent = 0;
+#else
+	int				i, ret;
+#endif
+
+	if (!queue->numPackets)
+		return;
+
+	net_socket = net_sockets[sock];
+	if (net_socket == -1){
+		queue->numPackets = 0;
+		return;
+	}
+
+#ifdef __linux__
+	for (i = 0; i < queue->numPackets; i++){
+		iovs[i].iov_base = queue->data[i];
+		iovs[i].iov_len = queue->dataLen[i];
+
+		memset(&hdrs[i], 0, sizeof(hdrs[i]));
+		hdrs[i].msg_hdr.msg_name = &queue->addrs[i];
+		hdrs[i].msg_hdr.msg_namelen = sizeof(queue->addrs[i]);
+		hdrs[i].msg_hdr.msg_iov = &iovs[i];
+		hdrs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	// The kernel may stop at the first packet that fails, so skip over it
+	// and keep going
+	while (sent < queue->numPackets){
+		ret = sendmmsg(net_socket, &hdrs[sent], queue->numPackets - sent, 0);
+		if (ret > 0){
+			sent += ret;
+			continue;
+		}
+
+		if (ret == 0 || errno == EWOULDBLOCK || errno == EAGAIN)
+			break;
+
+		NET_SockadrToNetadr(&queue->addrs[sent], &to);
+
+		if (!NET_SendErrorIsSilent(errno, to))
+			Com_Printf(S_COLOR_RED "NET_SendQueuedPackets: %s to %s\n", NET_ErrorString(), NET_AdrToString(to));
+
+		sent++;
+	}
+#else
+	for (i = 0; i < queue->numPackets; i++){
+		ret = sendto(net_socket, queue->data[i], queue->dataLen[i], 0, (struct sockaddr *)&queue->addrs[i], sizeof(queue->addrs[i]));
+		if (ret != -1)
+			continue;
+
+		NET_SockadrToNetadr(&queue->addrs[i], &to);
+
+		if (!NET_SendErrorIsSilent(errno, to))
+			Com_Printf(S_COLOR_RED "NET_SendQueuedPackets: %s to %s\n", NET_ErrorString(), NET_AdrToString(to));
+	}
+#endif
+
+	queue->numPackets = 0;
+}
+
+/*
+ =================
+ NET_QueuePacket
+ =================
+*/
+static void NET_QueuePacket (netSrc_t sock, const netAdr_t to, const void *data, int length){
+
+	sendQueue_t	*queue = &net_sendQueues[sock];
+
+	if (length > MAX_PACKETLEN)
+		Com_Error(ERR_FATAL, "NET_QueuePacket: length = %i", length);
+
+	if (queue->numPackets == MAX_PACKET_BATCH)
+		NET_SendQueuedPackets(sock);
+
+	memcpy(queue->data[queue->numPackets], data, length);
+	queue->dataLen[queue->numPackets] = length;
+	NET_NetadrToSockadr(&to, &queue->addrs[queue->numPackets]);
+
+	queue->numPackets++;
+}
+
+/*
+ =================
+ NET_SendPacket
+ =================
+*/
+void NET_SendPacket (netSrc_t sock, const netAdr_t to, const void *data, int length){
+
+	int					ret;
+	struct sockaddr_in	addr;
+	int					net_socket;
+
+	if (NET_SendLoopPacket(sock, to, data, length))
+		return;
+
+	if (to.type != NA_BROADCAST && to.type != NA_IP)
+		Com_Error(ERR_FATAL, "NET_SendPacket: bad address type");
+
+	net_socket = net_sockets[sock];
+	if (net_socket == -1)
+		return;
+
+	// Queue the packet if batching
+	if (sock < NS_LOADCLIENT && net_sendQueues[sock].active){
+		NET_QueuePacket(sock, to, data, length);
+		return;
+	}
+
+	NET_NetadrToSockadr(&to, &addr);
+
+	ret = sendto(net_socket, data, length, 0, (struct sockaddr *)&addr, sizeof(addr));
+
+	if (ret == -1){
+		if (NET_SendErrorIsSilent(errno, to))
+			return;
+
+		Com_Printf(S_COLOR_RED "NET_SendPacket: %s to %s\n", NET_ErrorString(), NET_AdrToString(to));
+	}
+}
+
+
+/*
+ =================
+ NET_QueuePackets
+
+ Packets sent on the given socket are queued until NET_FlushPackets is
+ called, so they can all be sent with a single system call
+ =================
+*/
+void NET_QueuePackets (netSrc_t sock){
+
+	net_sendQueues[sock].active = true;
+}
+
+/*
+ =================
+ NET_FlushPackets
+
+ Sends all the queued packets and stops queuing
+ =================
+*/
+void NET_FlushPackets (netSrc_t sock){
+
+	NET_SendQueuedPackets(sock);
+
+	net_sendQueues[sock].active = false;
+}
+
+/*
+ =================
+ NET_Sleep
+
+ Blocks until a packet arrives on the server socket or a load test client
+ socket, or the given time has elapsed
+ =================
+*/
+void NET_Sleep (int msec){
+
+	struct timeval	timeout;
+	fd_set			readFDs;
+	int				net_socket, maxSocket;
+	int				i;
+
+	if (msec <= 0)
+		return;
+
+	// Don't sleep if there are loopback packets waiting
+	if (NET_LoopPacketsPending(NS_SERVER))
+		return;
+
+	timeout.tv_sec = msec / 1000;
+	timeout.tv_usec = (msec % 1000) * 1000;
+
+	FD_ZERO(&readFDs);
+
+	maxSocket = -1;
+
+	// A dedicated server also wakes up for console input
+	if (com_dedicated->integerValue && Sys_StdinActive()){
+		FD_SET(STDIN_FILENO, &readFDs);
+
+		maxSocket = STDIN_FILENO;
+	}
+
+	for (i = NS_SERVER; i < NS_MAXSOCKETS; i++){
+		net_socket = net_sockets[i];
+		if (net_socket == -1 || net_socket >= FD_SETSIZE)
+			continue;
+
+		FD_SET(net_socket, &readFDs);
+
+		if (maxSocket < net_socket)
+			maxSocket = net_socket;
+	}
+
+	if (maxSocket == -1){
+		select(0, NULL, NULL, NULL, &timeout);
+		return;
+	}
+
+	select(maxSocket + 1, &readFDs, NULL, NULL, &timeout);
+}
+
+
+// =====================================================================
+
+
+/*
+ =================
+ NET_UDPSocket
+ =================
+*/
+static int NET_UDPSocket (const char *netInterface, int port){
+
+	struct sockaddr_in	addr;
+	int					_true = 1;
+	int					net_socket;
+
+	Com_DPrintf("NET_UDPSocket( %s, %i )\n", netInterface, port);
+
+	if ((net_socket = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1){
+		if (errno != EAFNOSUPPORT)
+			Com_DPrintf(S_COLOR_YELLOW "NET_UDPSocket: socket = %s\n", NET_ErrorString());
+
+		return -1;
+	}
+
+	// Make it non-blocking
+	if (ioctl(net_socket, FIONBIO, &_true) == -1){
+		Com_DPrintf(S_COLOR_YELLOW "NET_UDPSocket: ioctl FIONBIO = %s\n", NET_ErrorString());
+		close(net_socket);
+		return -1;
+	}
+
+	// Make it broadcast capable
+	if (setsockopt(net_socket, SOL_SOCKET, SO_BROADCAST, (char *)&_true, sizeof(_true)) == -1){
+		Com_DPrintf(S_COLOR_YELLOW "NET_UDPSocket: setsockopt SO_BROADCAST = %s\n", NET_ErrorString());
+		close(net_socket);
+		return -1;
+	}
+
+	if (!netInterface[0] || !Q_stricmp(netInterface, "localhost"))
+		addr.sin_addr.s_addr = INADDR_ANY;
+	else
+		NET_StringToSockaddr(netInterface, &addr);
+
+	if (port == PORT_ANY)
+		addr.sin_port = 0;
+	else
+		addr.sin_port = htons((short)port);
+
+	addr.sin_family = AF_INET;
+
+	if (bind(net_socket, (struct sockaddr *)&addr, sizeof(addr)) == -1){
+		Com_DPrintf(S_COLOR_YELLOW "NET_UDPSocket: bind = %s\n", NET_ErrorString());
+		close(net_socket);
+		return -1;
+	}
+
+	return net_socket;
+}
+
+/*
+ =================
+ NET_OpenUDP
+ =================
+*/
+static void NET_OpenUDP (void){
+
+	net_sockets[NS_SERVER] = NET_UDPSocket(net_ip->value, net_port->integerValue);
+	if (net_sockets[NS_SERVER] == -1)
+		Com_Printf(S_COLOR_YELLOW "WARNING: failed to open server UDP socket\n");
+
+	// Dedicated servers don't need client ports
+	if (com_dedicated->integerValue)
+		return;
+
+	net_sockets[NS_CLIENT] = NET_UDPSocket(net_ip->value, net_clientPort->integerValue);
+	if (net_sockets[NS_CLIENT] == -1){
+		net_sockets[NS_CLIENT] = NET_UDPSocket(net_ip->value, PORT_ANY);
+		if (net_sockets[NS_CLIENT] != -1)
+			Com_Printf(S_COLOR_YELLOW "WARNING: failed to open client UDP socket\n");
+	}
+}
+
+/*
+ =================
+ NET_CloseUDP
+ =================
+*/
+static void NET_CloseUDP (void){
+
+	int		i;
+
+	for (i = 0; i < NS_MAXSOCKETS; i++){
+		if (net_sockets[i] == -1)
+			continue;
+
+		close(net_sockets[i]);
+		net_sockets[i] = -1;
+	}
+}
+
+/*
+ =================
+ NET_OpenSocket
+
+ Opens a UDP socket on any free port for one of the load test clients
+ =================
+*/
+qboolean NET_OpenSocket (netSrc_t sock){
+
+	if (sock < NS_LOADCLIENT || sock >= NS_MAXSOCKETS)
+		Com_Error(ERR_FATAL, "NET_OpenSocket: bad socket %i", sock);
+
+	if (net_sockets[sock] == -1)
+		net_sockets[sock] = NET_UDPSocket(net_ip->value, PORT_ANY);
+
+	return (net_sockets[sock] != -1);
+}
+
+/*
+ =================
+ NET_CloseSocket
+ =================
+*/
+void NET_CloseSocket (netSrc_t sock){
+
+	if (sock < NS_LOADCLIENT || sock >= NS_MAXSOCKETS)
+		Com_Error(ERR_FATAL, "NET_CloseSocket: bad socket %i", sock);
+
+	if (net_sockets[sock] == -1)
+		return;
+
+	close(net_sockets[sock]);
+	net_sockets[sock] = -1;
+}
+
+/*
+ =================
+ NET_ShowIP_f
+ =================
+*/
+static void NET_ShowIP_f (void){
+
+	char			s[256];
+	int				i;
+	struct hostent	*h;
+	struct in_addr	in;
+
+	if (gethostname(s, sizeof(s)) == -1){
+		Com_Printf("Can't get host name\n");
+		return;
+	}
+
+	if (!(h = gethostbyname(s))){
+		Com_Printf("Can't get host\n");
+		return;
+	}
+
+	Com_Printf("HostName: %s\n", h->h_name);
+
+	for (i = 0; h->h_aliases[i]; i++)
+		Com_Printf("Alias: %s\n", h->h_aliases[i]);
+
+	for (i = 0; h->h_addr_list[i]; i++){
+		memcpy(&in.s_addr, h->h_addr_list[i], 4);
+		Com_Printf("IP: %s\n", inet_ntoa(in));
+	}
+}
+
+/*
+ =================
+ NET_Restart_f
+ =================
+*/
+static void NET_Restart_f (void){
+
+	NET_Shutdown();
+	NET_Init();
+}
+
+/*
+ =================
+ NET_Init
+ =================
+*/
+void NET_Init (void){
+
+	int		i;
+
+	Com_Printf("------- Network Initialization -------\n");
+
+	// Register our variables and commands
+	net_ip = Cvar_Get("net_ip", "localhost", CVAR_LATCH, "IP address");
+	net_port = Cvar_Get("net_port", va("%i", PORT_SERVER), CVAR_LATCH, "Server port");
+	net_clientPort = Cvar_Get("net_clientPort", va("%i", PORT_CLIENT), CVAR_LATCH, "Client port");
+
+	Cmd_AddCommand("showIp", NET_ShowIP_f, "Show host name and current IP address");
+	Cmd_AddCommand("net_restart", NET_Restart_f, "Restart the network system");
+
+	// Open sockets
+	for (i = 0; i < NS_MAXSOCKETS; i++)
+		net_sockets[i] = -1;
+
+	NET_OpenUDP();
+
+	NET_ShowIP_f();
+
+	Com_Printf("--------------------------------------\n");
+}
+
+/*
+ =================
+ NET_Shutdown
+ =================
+*/
+void NET_Shutdown (void){
+
+	Cmd_RemoveCommand("showIp");
+	Cmd_RemoveCommand("net_restart");
+
+	// Close sockets
+	NET_CloseUDP();
+
+	// Free the loopback buffers
+	NET_ShutdownLoopback();
+}
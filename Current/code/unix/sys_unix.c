@@ -0,0 +1,1027 @@
+/*
+Copyright (C) 1997-2001 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+
+// sys_unix.c -- POSIX system layer for the dedicated server
+
+
+#include "../qcommon/qcommon.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/utsname.h>
+
+
+#if defined __i386__
+#define GAMENAME				"gamei386.so"
+#elif defined __x86_64__
+#define GAMENAME				"gamex86_64.so"
+#elif defined __axp__
+#define GAMENAME				"gameaxp.so"
+#else
+#define GAMENAME				"game.so"
+#endif
+
+#define MAX_CONSOLE_INPUT				256
+
+static qboolean		sys_stdinActive = true;		// Cleared at end of file
+static volatile int	sys_quitSignal;
+
+static void			*sys_gameLibrary;
+
+
+/*
+ =======================================================================
+
+ DEDICATED CONSOLE
+
+ =======================================================================
+*/
+
+
+/*
+ =================
+ Sys_ConsoleOutput
+ =================
+*/
+static void Sys_ConsoleOutput (const char *text){
+
+	char	buffer[MAX_PRINTMSG];
+	int		length = 0;
+
+	// Copy into an intermediate buffer
+	while (*text && (length < MAX_PRINTMSG - 1)){
+		// Ignore color escape sequences
+		if (Q_IsColorString(text)){
+			text += 2;
+			continue;
+		}
+
+		// Ignore non-printable characters
+		if (*text < ' ' && *text != '\n' && *text != '\t'){
+			text += 1;
+			continue;
+		}
+
+		// Copy the character
+		buffer[length++] = *text++;
+	}
+
+	fwrite(buffer, 1, length, stdout);
+	fflush(stdout);
+}
+
+/*
+ =================
+ Sys_StdinActive
+
+ Returns true if the terminal is still read for console input
+ =================
+*/
+qboolean Sys_StdinActive (void){
+
+	return sys_stdinActive;
+}
+
+/*
+ =================
+ Sys_ConsoleInput
+
+ Returns a line of text typed at the terminal, if any
+ =================
+*/
+static char *Sys_ConsoleInput (void){
+
+	static char		buffer[MAX_CONSOLE_INPUT];
+	fd_set			fdSet;
+	struct timeval	timeOut;
+	int				length;
+
+	if (!sys_stdinActive)
+		return NULL;
+
+	FD_ZERO(&fdSet);
+	FD_SET(STDIN_FILENO, &fdSet);
+
+	timeOut.tv_sec = 0;
+	timeOut.tv_usec = 0;
+
+	if (select(STDIN_FILENO + 1, &fdSet, NULL, NULL, &timeOut) == -1 || !FD_ISSET(STDIN_FILENO, &fdSet))
+		return NULL;
+
+	length = read(STDIN_FILENO, buffer, sizeof(buffer) - 1);
+	if (length == 0){
+		// End of file, so stop polling the terminal
+		sys_stdinActive = false;
+		return NULL;
+	}
+
+	if (length < 1)
+		return NULL;
+
+	// Strip the trailing newline
+	if (buffer[length-1] == '\n')
+		length--;
+
+	buffer[length] = 0;
+
+	return buffer;
+}
+
+/*
+ =================
+ Sys_ShowConsole
+
+ The dedicated console is the terminal we were started from
+ =================
+*/
+void Sys_ShowConsole (qboolean show){
+
+}
+
+
+/*
+ =======================================================================
+
+ FILE SYSTEM
+
+ =======================================================================
+*/
+
+#define MAX_LIST_FILES			65536
+
+
+/*
+ =================
+ Sys_IsDirectory
+ =================
+*/
+static qboolean Sys_IsDirectory (const char *path){
+
+	struct stat	st;
+
+	if (stat(path, &st) == -1)
+		return false;
+
+	return S_ISDIR(st.st_mode);
+}
+
+/*
+ =================
+ Sys_RecursiveListFilteredFiles
+ =================
+*/
+static int Sys_RecursiveListFilteredFiles (const char *directory, const char *subdirectory, const char *filter, char **files, int fileCount){
+
+	DIR				*dir;
+	struct dirent	*entry;
+	char			name[MAX_OSPATH];
+	char			path[MAX_OSPATH];
+
+	if (subdirectory[0])
+		Q_snprintfz(path, sizeof(path), "%s/%s", directory, subdirectory);
+	else
+		Q_snprintfz(path, sizeof(path), "%s", directory);
+
+	dir = opendir(path);
+	if (!dir)
+		return fileCount;
+
+	while ((entry = readdir(dir)) != NULL){
+		// Check for invalid file name
+		if (!Q_stricmp(entry->d_name, ".") || !Q_stricmp(entry->d_name, ".."))
+			continue;
+
+		if (subdirectory[0])
+			Q_snprintfz(name, sizeof(name), "%s/%s", subdirectory, entry->d_name);
+		else
+			Q_snprintfz(name, sizeof(name), "%s", entry->d_name);
+
+		// If a directory, recurse into it
+		if (Sys_IsDirectory(va("%s/%s", directory, name)))
+			fileCount = Sys_RecursiveListFilteredFiles(directory, name, filter, files, fileCount);
+
+		if (fileCount == MAX_LIST_FILES - 1)
+			break;
+
+		// Match filter
+		if (!Q_MatchFilter(name, filter, false))
+			continue;
+
+		// Add it to the list
+		files[fileCount++] = CopyString(name);
+	}
+
+	closedir(dir);
+
+	return fileCount;
+}
+
+/*
+ =================
+ Sys_ListFilteredFiles
+
+ Returns a list of files and subdirectories that match the given filter.
+ The returned list can optionally be sorted.
+ =================
+*/
+char **Sys_ListFilteredFiles (const char *directory, const char *filter, qboolean sort, int *numFiles){
+
+	char	**fileList;
+	char	*files[MAX_LIST_FILES];
+	int		fileCount = 0;
+	int		i;
+
+	// List files
+	fileCount = Sys_RecursiveListFilteredFiles(directory, "", filter, files, 0);
+	if (!fileCount){
+		*numFiles = 0;
+		return NULL;
+	}
+
+	// Sort the list if needed
+	if (sort)
+		qsort(files, fileCount, sizeof(char *), (int (*)(const void *, const void *))Q_SortStrcmp);
+
+	// Copy the list
+	fileList = Z_Malloc((fileCount + 1) * sizeof(char *));
+
+	for (i = 0; i < fileCount; i++)
+		fileList[i] = files[i];
+
+	fileList[i] = NULL;
+
+	*numFiles = fileCount;
+
+	return fileList;
+}
+
+/*
+ =================
+ Sys_ListFiles
+
+ Returns a list of files and subdirectories that match the given
+ extension (which must include a leading '.' and must not contain
+ wildcards).
+ If extension is NULL, all the files will be returned and all the
+ subdirectories ignored.
+ If extension is "/", all the subdirectories will be returned and all
+ the files ignored.
+ The returned list can optionally be sorted.
+ =================
+*/
+char **Sys_ListFiles (const char *directory, const char *extension, qboolean sort, int *numFiles){
+
+	DIR				*dir;
+	struct dirent	*entry;
+	qboolean		listDirectories, listFiles;
+	char			name[MAX_OSPATH];
+	char			**fileList;
+	char			*files[MAX_LIST_FILES];
+	int				fileCount = 0;
+	int				i;
+
+	if (extension != NULL && !Q_stricmp(extension, "/")){
+		listDirectories = true;
+		listFiles = false;
+	}
+	else {
+		listDirectories = false;
+		listFiles = true;
+	}
+
+	dir = opendir(directory);
+	if (!dir){
+		*numFiles = 0;
+		return NULL;
+	}
+
+	while ((entry = readdir(dir)) != NULL){
+		// Check for invalid file name
+		if (!Q_stricmp(entry->d_name, ".") || !Q_stricmp(entry->d_name, ".."))
+			continue;
+
+		if (fileCount == MAX_LIST_FILES - 1)
+			break;
+
+		// Add it to the list
+		if (Sys_IsDirectory(va("%s/%s", directory, entry->d_name))){
+			if (listDirectories)
+				files[fileCount++] = CopyString(entry->d_name);
+		}
+		else {
+			if (listFiles){
+				if (extension){
+					Com_FileExtension(entry->d_name, name, sizeof(name));
+					if (!Q_stricmp(extension, name))
+						files[fileCount++] = CopyString(entry->d_name);
+				}
+				else
+					files[fileCount++] = CopyString(entry->d_name);
+			}
+		}
+	}
+
+	closedir(dir);
+
+	if (!fileCount){
+		*numFiles = fileCount;
+		return NULL;
+	}
+
+	// Sort the list if needed
+	if (sort)
+		qsort(files, fileCount, sizeof(char *), (int (*)(const void *, const void *))Q_SortStrcmp);
+
+	// Copy the list
+	fileList = Z_Malloc((fileCount + 1) * sizeof(char *));
+
+	for (i = 0; i < fileCount; i++)
+		fileList[i] = files[i];
+
+	fileList[i] = NULL;
+
+	*numFiles = fileCount;
+
+	return fileList;
+}
+
+/*
+ =================
+ Sys_FreeFileList
+
+ Frees the memory allocated by Sys_ListFilteredFiles and Sys_ListFiles
+ =================
+*/
+void Sys_FreeFileList (char **fileList){
+
+	int		i;
+
+	if (!fileList)
+		return;
+
+	for (i = 0; fileList[i]; i++)
+		FreeString(fileList[i]);
+
+	Z_Free(fileList);
+}
+
+/*
+ =================
+ Sys_CreateDirectory
+ =================
+*/
+void Sys_CreateDirectory (const char *directory){
+
+	mkdir(directory, 0777);
+}
+
+/*
+ =================
+ Sys_GetCurrentDirectory
+ =================
+*/
+char *Sys_GetCurrentDirectory (void){
+
+	static char	directory[MAX_OSPATH];
+
+	if (!getcwd(directory, sizeof(directory)))
+		Com_Error(ERR_FATAL, "Couldn't get current working directory");
+
+	return directory;
+}
+
+/*
+ =================
+ Sys_ScanForCD
+
+ Servers are never installed from a CD
+ =================
+*/
+char *Sys_ScanForCD (void){
+
+	static char	directory[MAX_OSPATH];
+
+	directory[0] = 0;
+
+	return directory;
+}
+
+
+// =====================================================================
+
+
+/*
+ =================
+ Sys_Print
+ =================
+*/
+void Sys_Print (const char *text){
+
+	Sys_ConsoleOutput(text);
+}
+
+/*
+ =================
+ Sys_Error
+ =================
+*/
+void Sys_Error (const char *fmt, ...){
+
+	char	string[MAX_PRINTMSG];
+	va_list	argPtr;
+
+	// Make sure all subsystems are down
+	Com_Shutdown();
+
+	// Get the message
+	va_start(argPtr, fmt);
+	vsnprintf(string, sizeof(string), fmt, argPtr);
+	va_end(argPtr);
+
+	// Echo to console
+	fprintf(stderr, "\nERROR: %s\n\n", string);
+
+	exit(1);
+}
+
+/*
+ =================
+ Sys_GetClipboardText
+
+ There is no clipboard on a dedicated server
+ =================
+*/
+char *Sys_GetClipboardText (void){
+
+	return NULL;
+}
+
+/*
+ =================
+ Sys_ShellExecute
+ =================
+*/
+void Sys_ShellExecute (const char *path, const char *parms, qboolean quit){
+
+	Com_Printf("Sys_ShellExecute: not supported on this platform\n");
+
+	if (quit)
+		Sys_Quit();
+}
+
+/*
+ =================
+ Sys_Milliseconds
+
+ Uses the monotonic clock so the server time is never affected by
+ adjustments of the system clock
+ =================
+*/
+int Sys_Milliseconds (void){
+
+	static qboolean	initialized;
+	static time_t	base;
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	if (!initialized){
+		initialized = true;
+		base = ts.tv_sec;
+	}
+
+	return (ts.tv_sec - base) * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ =================
+ Sys_GetClockTicks
+ =================
+*/
+double Sys_GetClockTicks (void){
+
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 0.000000001;
+}
+
+/*
+ =================
+ Sys_GetEvents
+ =================
+*/
+int Sys_GetEvents (void){
+
+	char	*cmd;
+
+	// Quit if we received a termination signal
+	if (sys_quitSignal){
+		Com_Printf("Received signal %i, exiting...\n", sys_quitSignal);
+		Sys_Quit();
+	}
+
+	// Check for console commands
+	cmd = Sys_ConsoleInput();
+	if (cmd){
+		Cbuf_AddText(cmd);
+		Cbuf_AddText("\n");
+	}
+
+	// Return the current time
+	return Sys_Milliseconds();
+}
+
+/*
+ =================
+ Sys_SignalHandler
+
+ Only flags the signal, the actual shutdown is done from the main loop
+ =================
+*/
+static void Sys_SignalHandler (int sig){
+
+	sys_quitSignal = sig;
+}
+
+/*
+ =================
+ Sys_DetectCPU
+ =================
+*/
+static void Sys_DetectCPU (char *cpuString, int maxSize){
+
+	FILE	*f;
+	char	line[256], *s;
+
+	Q_strncpyz(cpuString, "Unknown", maxSize);
+
+	f = fopen("/proc/cpuinfo", "r");
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f)){
+		if (Q_strnicmp(line, "model name", 10))
+			continue;
+
+		s = strchr(line, ':');
+		if (!s)
+			break;
+
+		s++;
+		while (*s == ' ' || *s == '\t')
+			s++;
+
+		Q_strncpyz(cpuString, s, maxSize);
+
+		s = strchr(cpuString, '\n');
+		if (s)
+			*s = 0;
+
+		break;
+	}
+
+	fclose(f);
+}
+
+/*
+ =================
+ Sys_Init
+ =================
+*/
+void Sys_Init (void){
+
+	struct utsname	info;
+	char			string[256];
+	char			*name;
+
+	Com_Printf("------- System Initialization -------\n");
+
+	// Get OS version
+	if (uname(&info) == -1)
+		Q_strncpyz(string, "Unknown", sizeof(string));
+	else
+		Q_snprintfz(string, sizeof(string), "%s %s %s", info.sysname, info.release, info.machine);
+
+	Com_Printf("OS: %s\n", string);
+	Cvar_Get("sys_osVersion", string, CVAR_ROM, "OS version");
+
+	// Detect CPU
+	Sys_DetectCPU(string, sizeof(string));
+	Com_Printf("Processor: %s\n", string);
+	Cvar_Get("sys_cpuString", string, CVAR_ROM, "CPU string");
+
+	// Get physical memory
+	Q_snprintfz(string, sizeof(string), "%u", (unsigned)(((unsigned long long)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE)) >> 20) + 1);
+	Com_Printf("RAM: %s MB\n", string);
+	Cvar_Get("sys_ramMegs", string, CVAR_ROM, "MB of RAM");
+
+	// Get user name
+	name = getenv("USER");
+	if (name)
+		Cvar_Get("sys_userName", name, CVAR_ROM, "User name");
+	else
+		Cvar_Get("sys_userName", "", CVAR_ROM, "User name");
+
+	// Shut down cleanly when asked to
+	signal(SIGINT, Sys_SignalHandler);
+	signal(SIGTERM, Sys_SignalHandler);
+	signal(SIGHUP, Sys_SignalHandler);
+	signal(SIGPIPE, SIG_IGN);
+
+	Com_Printf("-------------------------------------\n");
+}
+
+/*
+ =================
+ Sys_Quit
+ =================
+*/
+void Sys_Quit (void){
+
+	Com_Shutdown();
+	exit(0);
+}
+
+
+/*
+ =======================================================================
+
+ THREADS
+
+ =======================================================================
+*/
+
+typedef struct {
+	pthread_t		thread;
+
+	void			(*func)(void *data);
+	void			*data;
+} sysThread_t;
+
+static pthread_t	sys_mainThread;
+
+
+/*
+ =================
+ Sys_ThreadProc
+ =================
+*/
+static void *Sys_ThreadProc (void *param){
+
+	sysThread_t	*thread = param;
+
+	thread->func(thread->data);
+
+	return NULL;
+}
+
+/*
+ =================
+ Sys_CreateThread
+ =================
+*/
+void *Sys_CreateThread (void (*func)(void *data), void *data){
+
+	sysThread_t	*thread;
+
+	thread = malloc(sizeof(sysThread_t));
+	if (!thread)
+		Com_Error(ERR_FATAL, "Sys_CreateThread: out of memory");
+
+	thread->func = func;
+	thread->data = data;
+
+	if (pthread_create(&thread->thread, NULL, Sys_ThreadProc, thread))
+		Com_Error(ERR_FATAL, "Sys_CreateThread: %s", strerror(errno));
+
+	return thread;
+}
+
+/*
+ =================
+ Sys_WaitForThread
+
+ Waits for the thread to finish and frees it
+ =================
+*/
+void Sys_WaitForThread (void *thread){
+
+	sysThread_t	*t = thread;
+
+	pthread_join(t->thread, NULL);
+
+	free(t);
+}
+
+/*
+ =================
+ Sys_IsMainThread
+ =================
+*/
+qboolean Sys_IsMainThread (void){
+
+	return pthread_equal(pthread_self(), sys_mainThread);
+}
+
+/*
+ =================
+ Sys_CreateMutex
+
+ Mutexes are recursive, so the owning thread may lock them again
+ =================
+*/
+void *Sys_CreateMutex (void){
+
+	pthread_mutex_t		*mutex;
+	pthread_mutexattr_t	attr;
+
+	mutex = malloc(sizeof(pthread_mutex_t));
+	if (!mutex)
+		Com_Error(ERR_FATAL, "Sys_CreateMutex: out of memory");
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	return mutex;
+}
+
+/*
+ =================
+ Sys_DestroyMutex
+ =================
+*/
+void Sys_DestroyMutex (void *mutex){
+
+	pthread_mutex_destroy(mutex);
+
+	free(mutex);
+}
+
+/*
+ =================
+ Sys_LockMutex
+ =================
+*/
+void Sys_LockMutex (void *mutex){
+
+	pthread_mutex_lock(mutex);
+}
+
+/*
+ =================
+ Sys_TryLockMutex
+
+ Returns false instead of waiting if another thread owns the mutex
+ =================
+*/
+qboolean Sys_TryLockMutex (void *mutex){
+
+	return (pthread_mutex_trylock(mutex) == 0);
+}
+
+/*
+ =================
+ Sys_UnlockMutex
+ =================
+*/
+void Sys_UnlockMutex (void *mutex){
+
+	pthread_mutex_unlock(mutex);
+}
+
+/*
+ =================
+ Sys_CreateSemaphore
+ =================
+*/
+void *Sys_CreateSemaphore (int count){
+
+	sem_t	*semaphore;
+
+	semaphore = malloc(sizeof(sem_t));
+	if (!semaphore)
+		Com_Error(ERR_FATAL, "Sys_CreateSemaphore: out of memory");
+
+	if (sem_init(semaphore, 0, count))
+		Com_Error(ERR_FATAL, "Sys_CreateSemaphore: %s", strerror(errno));
+
+	return semaphore;
+}
+
+/*
+ =================
+ Sys_DestroySemaphore
+ =================
+*/
+void Sys_DestroySemaphore (void *semaphore){
+
+	sem_destroy(semaphore);
+
+	free(semaphore);
+}
+
+/*
+ =================
+ Sys_WaitSemaphore
+ =================
+*/
+void Sys_WaitSemaphore (void *semaphore){
+
+	while (sem_wait(semaphore)){
+		if (errno != EINTR)
+			break;
+	}
+}
+
+/*
+ =================
+ Sys_PostSemaphore
+ =================
+*/
+void Sys_PostSemaphore (void *semaphore){
+
+	sem_post(semaphore);
+}
+
+/*
+ =================
+ Sys_AtomicRead
+ =================
+*/
+int Sys_AtomicRead (volatile int *value){
+
+	return __sync_fetch_and_add(value, 0);
+}
+
+/*
+ =================
+ Sys_AtomicCompareExchange
+
+ Stores exchange in value if it equals comparand. Returns the previous
+ value.
+ =================
+*/
+int Sys_AtomicCompareExchange (volatile int *value, int comparand, int exchange){
+
+	return __sync_val_compare_and_swap(value, comparand, exchange);
+}
+
+
+/*
+ =======================================================================
+
+ GAME LIBRARY LOADING
+
+ =======================================================================
+*/
+
+
+/*
+ =================
+ Sys_LoadGame
+ =================
+*/
+void *Sys_LoadGame (void *import){
+
+	void	*(*GetGameAPI)(void *);
+	char	name[MAX_OSPATH];
+	char	*path = NULL;
+
+	Com_Printf("Loading game library...\n");
+
+	if (sys_gameLibrary)
+		Com_Error(ERR_FATAL, "Sys_LoadGame: '%s' already loaded", GAMENAME);
+
+	// Run through the search paths
+	while (1){
+		path = FS_NextPath(path);
+		if (!path)		// Couldn't find one anywhere
+			Com_Error(ERR_FATAL, "Sys_LoadGame: dlopen() failed for '%s'", GAMENAME);
+
+		Q_snprintfz(name, sizeof(name), "%s/%s", path, GAMENAME);
+		if ((sys_gameLibrary = dlopen(name, RTLD_NOW)) != NULL)
+			break;
+
+		Com_DPrintf("Sys_LoadGame: %s\n", dlerror());
+	}
+
+	if ((GetGameAPI = (void *)dlsym(sys_gameLibrary, "GetGameAPI")) == NULL){
+		dlclose(sys_gameLibrary);
+		sys_gameLibrary = NULL;
+
+		Com_Error(ERR_FATAL, "Sys_LoadGame: dlsym() failed for 'GetGameAPI'");
+	}
+
+	return GetGameAPI(import);
+}
+
+/*
+ =================
+ Sys_UnloadGame
+ =================
+*/
+void Sys_UnloadGame (void){
+
+	Com_Printf("Unloading game library...\n");
+
+	if (!sys_gameLibrary)
+		Com_Error(ERR_FATAL, "Sys_UnloadGame: '%s' not loaded", GAMENAME);
+
+	if (dlclose(sys_gameLibrary))
+		Com_Error(ERR_FATAL, "Sys_UnloadGame: dlclose() failed for '%s'", GAMENAME);
+
+	sys_gameLibrary = NULL;
+}
+
+/*
+ =================
+ Sys_GameSharesRand
+
+ Returns true if the game library calls the same rand() as the engine, so
+ seeding it with srand() also seeds the game
+ =================
+*/
+qboolean Sys_GameSharesRand (void){
+
+	if (!sys_gameLibrary)
+		return false;
+
+	return (dlsym(sys_gameLibrary, "rand") == (void *)rand);
+}
+
+
+// =====================================================================
+
+
+/*
+ =================
+ main
+ =================
+*/
+int main (int argc, char **argv){
+
+	static char	cmdLine[MAX_STRING_CHARS];
+	int			i;
+
+	sys_mainThread = pthread_self();
+
+	// This is a dedicated server binary, so force it on before anything
+	// else gets a chance to look at it
+	Q_strncpyz(cmdLine, "+set dedicated 1", sizeof(cmdLine));
+
+	// Quote the arguments with spaces so the command parser keeps them
+	// together
+	for (i = 1; i < argc; i++){
+		Q_strncatz(cmdLine, " ", sizeof(cmdLine));
+
+		if (strpbrk(argv[i], " \t")){
+			Q_strncatz(cmdLine, "\"", sizeof(cmdLine));
+			Q_strncatz(cmdLine, argv[i], sizeof(cmdLine));
+			Q_strncatz(cmdLine, "\"", sizeof(cmdLine));
+		}
+		else
+			Q_strncatz(cmdLine, argv[i], sizeof(cmdLine));
+	}
+
+	// Initialize all the subsystems
+	Com_Init(cmdLine);
+
+	// Main loop
+	while (1)
+		Com_Frame();
+
+	// Never gets here
+	return 0;
+}
@@ -23,21 +23,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "../qcommon/qcommon.h"
 
 
-#define	MAX_LOOPBACK	4
-
-typedef struct {
-	byte		data[MAX_MSGLEN];
-	int			dataLen;
-} loopMsg_t;
-
-typedef struct {
-	loopMsg_t	msgs[MAX_LOOPBACK];
-	int			get;
-	int			send;
-} loopback_t;
-
-static loopback_t	net_loopbacks[2];
-static int			net_sockets[2];
+static int			net_sockets[NS_MAXSOCKETS];
 
 cvar_t	*net_ip;
 cvar_t	*net_port;
@@ -294,73 +280,6 @@ qboolean NET_StringToAdr (const char *string, netAdr_t *adr){
 }
 
 
-/*
- =======================================================================
-
- LOOPBACK BUFFERS FOR LOCAL PLAYER
-
- =======================================================================
-*/
-
-
-/*
- =================
- NET_GetLoopPacket
- =================
-*/
-static qboolean NET_GetLoopPacket (netSrc_t sock, netAdr_t *from, msg_t *msg){
-
-	int			i;
-	loopback_t	*loop;
-
-	loop = &net_loopbacks[sock];
-
-	if (loop->send - loop->get > MAX_LOOPBACK)
-		loop->get = loop->send - MAX_LOOPBACK;
-
-	if (loop->get >= loop->send)
-		return false;
-
-	i = loop->get & (MAX_LOOPBACK-1);
-	loop->get++;
-
-	memcpy(msg->data, loop->msgs[i].data, loop->msgs[i].dataLen);
-	msg->curSize = loop->msgs[i].dataLen;
-
-	memset(from, 0, sizeof(netAdr_t));
-	from->type = NA_LOOPBACK;
-
-	return true;
-}
-
-/*
- =================
- NET_SendLoopPacket
- =================
-*/
-static qboolean NET_SendLoopPacket (netSrc_t sock, const netAdr_t to, const void *data, int length){
-
-	int			i;
-	loopback_t	*loop;
-
-	if (to.type != NA_LOOPBACK)
-		return false;
-
-	loop = &net_loopbacks[sock^1];
-
-	i = loop->send & (MAX_LOOPBACK-1);
-	loop->send++;
-
-	memcpy(loop->msgs[i].data, data, length);
-	loop->msgs[i].dataLen = length;
-
-	return true;
-}
-
-
-// =====================================================================
-
-
 /*
  =================
  NET_GetPacket
@@ -405,6 +324,29 @@ qboolean NET_GetPacket (netSrc_t sock, netAdr_t *from, msg_t *msg){
 	return true;
 }
 
+/*
+ =================
+ NET_GetPackets
+
+ Reads up to maxPackets datagrams into the given messages. Returns the
+ number of packets read.
+ =================
+*/
+int NET_GetPackets (netSrc_t sock, netAdr_t *from, msg_t *msgs, int maxPackets){
+
+	int		count;
+
+	for (count = 0; count < maxPackets; count++){
+		if (!NET_GetPacket(sock, &from[count], &msgs[count]))
+			break;
+
+		msgs[count].readCount = 0;
+		msgs[count].bit = 0;
+	}
+
+	return count;
+}
+
 /*
  =================
  NET_SendPacket
@@ -446,6 +388,67 @@ void NET_SendPacket (netSrc_t sock, const netAdr_t to, const void *data, int len
 }
 
 
+/*
+ =================
+ NET_QueuePackets
+
+ Winsock has no batched send, so packets are always sent immediately
+ =================
+*/
+void NET_QueuePackets (netSrc_t sock){
+
+}
+
+/*
+ =================
+ NET_FlushPackets
+ =================
+*/
+void NET_FlushPackets (netSrc_t sock){
+
+}
+
+/*
+ =================
+ NET_Sleep
+
+ Blocks until a packet arrives on the server socket or a load test client
+ socket, or the given time has elapsed
+ =================
+*/
+void NET_Sleep (int msec){
+
+	struct timeval	timeout;
+	fd_set			readFDs;
+	int				i;
+
+	if (msec <= 0)
+		return;
+
+	// Don't sleep if there are loopback packets waiting
+	if (NET_LoopPacketsPending(NS_SERVER))
+		return;
+
+	// Winsock sets hold the first FD_SETSIZE sockets added
+	FD_ZERO(&readFDs);
+
+	for (i = NS_SERVER; i < NS_MAXSOCKETS; i++){
+		if (net_sockets[i])
+			FD_SET(net_sockets[i], &readFDs);
+	}
+
+	if (!readFDs.fd_count){
+		Sleep(msec);
+		return;
+	}
+
+	timeout.tv_sec = msec / 1000;
+	timeout.tv_usec = (msec % 1000) * 1000;
+
+	select(0, &readFDs, NULL, NULL, &timeout);
+}
+
+
 // =====================================================================
 
 
@@ -536,17 +539,52 @@ static void NET_OpenUDP (void){
 */
 static void NET_CloseUDP (void){
 
-	if (net_sockets[NS_SERVER]){
-		closesocket(net_sockets[NS_SERVER]);
-		net_sockets[NS_SERVER] = 0;
-	}
+	int		i;
+
+	for (i = 0; i < NS_MAXSOCKETS; i++){
+		if (!net_sockets[i])
+			continue;
 
-	if (net_sockets[NS_CLIENT]){
-		closesocket(net_sockets[NS_CLIENT]);
-		net_sockets[NS_CLIENT] = 0;
+		closesocket(net_sockets[i]);
+		net_sockets[i] = 0;
 	}
 }
 
+/*
+ =================
+ NET_OpenSocket
+
+ Opens a UDP socket on any free port for one of the load test clients
+ =================
+*/
+qboolean NET_OpenSocket (netSrc_t sock){
+
+	if (sock < NS_LOADCLIENT || sock >= NS_MAXSOCKETS)
+		Com_Error(ERR_FATAL, "NET_OpenSocket: bad socket %i", sock);
+
+	if (!net_sockets[sock])
+		net_sockets[sock] = NET_UDPSocket(net_ip->value, PORT_ANY);
+
+	return (net_sockets[sock] != 0);
+}
+
+/*
+ =================
+ NET_CloseSocket
+ =================
+*/
+void NET_CloseSocket (netSrc_t sock){
+
+	if (sock < NS_LOADCLIENT || sock >= NS_MAXSOCKETS)
+		Com_Error(ERR_FATAL, "NET_CloseSocket: bad socket %i", sock);
+
+	if (!net_sockets[sock])
+		return;
+
+	closesocket(net_sockets[sock]);
+	net_sockets[sock] = 0;
+}
+
 /*
  =================
  NET_ShowIP_f
@@ -640,6 +678,9 @@ void NET_Shutdown (void){
 	// Close sockets
 	NET_CloseUDP();
 
+	// Free the loopback buffers
+	NET_ShutdownLoopback();
+
 	// Shutdown Winsock
 	WSACleanup();
 }
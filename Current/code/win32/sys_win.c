@@ -1343,6 +1343,223 @@ void Sys_Quit (void) {
 }
 
 
+/*
+ =======================================================================
+
+ THREADS
+
+ =======================================================================
+*/
+
+typedef struct {
+	HANDLE			handle;
+
+	void			(*func)(void *data);
+	void			*data;
+} sysThread_t;
+
+static DWORD	sys_mainThreadId;
+
+
+/*
+ ==============
+ Sys_ThreadProc
+ ==============
+*/
+static DWORD WINAPI Sys_ThreadProc (LPVOID param) {
+
+	sysThread_t	*thread = param;
+
+	thread->func (thread->data);
+
+	return 0;
+}
+
+/*
+ ================
+ Sys_CreateThread
+ ================
+*/
+void *Sys_CreateThread (void (*func)(void *data), void *data) {
+
+	sysThread_t	*thread;
+
+	thread = malloc (sizeof(sysThread_t));
+	if (!thread)
+		Com_Error (ERR_FATAL, "Sys_CreateThread: out of memory");
+
+	thread->func = func;
+	thread->data = data;
+
+	thread->handle = CreateThread (NULL, 0, Sys_ThreadProc, thread, 0, NULL);
+	if (!thread->handle)
+		Com_Error (ERR_FATAL, "Sys_CreateThread: CreateThread failed");
+
+	return thread;
+}
+
+/*
+ =================
+ Sys_WaitForThread
+
+ Waits for the thread to finish and frees it
+ =================
+*/
+void Sys_WaitForThread (void *thread) {
+
+	sysThread_t	*t = thread;
+
+	WaitForSingleObject (t->handle, INFINITE);
+	CloseHandle (t->handle);
+
+	free (t);
+}
+
+/*
+ ================
+ Sys_IsMainThread
+ ================
+*/
+qboolean Sys_IsMainThread (void) {
+
+	return (GetCurrentThreadId () == sys_mainThreadId);
+}
+
+/*
+ ===============
+ Sys_CreateMutex
+
+ Critical sections are recursive, so the owning thread may lock them
+ again
+ ===============
+*/
+void *Sys_CreateMutex (void) {
+
+	CRITICAL_SECTION	*mutex;
+
+	mutex = malloc (sizeof(CRITICAL_SECTION));
+	if (!mutex)
+		Com_Error (ERR_FATAL, "Sys_CreateMutex: out of memory");
+
+	InitializeCriticalSection (mutex);
+
+	return mutex;
+}
+
+/*
+ ================
+ Sys_DestroyMutex
+ ================
+*/
+void Sys_DestroyMutex (void *mutex) {
+
+	DeleteCriticalSection (mutex);
+
+	free (mutex);
+}
+
+/*
+ =============
+ Sys_LockMutex
+ =============
+*/
+void Sys_LockMutex (void *mutex) {
+
+	EnterCriticalSection (mutex);
+}
+
+/*
+ ================
+ Sys_TryLockMutex
+
+ Returns false instead of waiting if another thread owns the mutex
+ ================
+*/
+qboolean Sys_TryLockMutex (void *mutex) {
+
+	return (TryEnterCriticalSection (mutex) != 0);
+}
+
+/*
+ ===============
+ Sys_UnlockMutex
+ ===============
+*/
+void Sys_UnlockMutex (void *mutex) {
+
+	LeaveCriticalSection (mutex);
+}
+
+/*
+ ===================
+ Sys_CreateSemaphore
+ ===================
+*/
+void *Sys_CreateSemaphore (int count) {
+
+	HANDLE	semaphore;
+
+	semaphore = CreateSemaphore (NULL, count, 0x7FFFFFFF, NULL);
+	if (!semaphore)
+		Com_Error (ERR_FATAL, "Sys_CreateSemaphore: CreateSemaphore failed");
+
+	return semaphore;
+}
+
+/*
+ ====================
+ Sys_DestroySemaphore
+ ====================
+*/
+void Sys_DestroySemaphore (void *semaphore) {
+
+	CloseHandle (semaphore);
+}
+
+/*
+ =================
+ Sys_WaitSemaphore
+ =================
+*/
+void Sys_WaitSemaphore (void *semaphore) {
+
+	WaitForSingleObject (semaphore, INFINITE);
+}
+
+/*
+ =================
+ Sys_PostSemaphore
+ =================
+*/
+void Sys_PostSemaphore (void *semaphore) {
+
+	ReleaseSemaphore (semaphore, 1, NULL);
+}
+
+/*
+ =================
+ Sys_AtomicRead
+ =================
+*/
+int Sys_AtomicRead (volatile int *value) {
+
+	return InterlockedCompareExchange ((volatile LONG *)value, 0, 0);
+}
+
+/*
+ =================
+ Sys_AtomicCompareExchange
+
+ Stores exchange in value if it equals comparand. Returns the previous
+ value.
+ =================
+*/
+int Sys_AtomicCompareExchange (volatile int *value, int comparand, int exchange) {
+
+	return InterlockedCompareExchange ((volatile LONG *)value, exchange, comparand);
+}
+
+
 /*
  =======================================================================
 
@@ -1427,6 +1644,50 @@ void Sys_UnloadGame (void) {
 	sys.hInstGame = NULL;
 }
 
+/*
+ ==============
+ Sys_GameSharesRand
+
+ Returns true if the game library calls the same rand() as the engine, so
+ seeding it with srand() also seeds the game. A game linked with its own
+ C runtime doesn't import rand() from the engine's one, so its import
+ table is searched for it.
+ ==============
+*/
+qboolean Sys_GameSharesRand (void) {
+
+	byte						*base = (byte *)sys.hInstGame;
+	IMAGE_NT_HEADERS			*nt;
+	IMAGE_DATA_DIRECTORY		*dir;
+	IMAGE_IMPORT_DESCRIPTOR		*imp;
+	IMAGE_THUNK_DATA			*names, *funcs;
+	IMAGE_IMPORT_BY_NAME		*byName;
+
+	if (!base)
+		return false;
+
+	nt = (IMAGE_NT_HEADERS *)(base + ((IMAGE_DOS_HEADER *)base)->e_lfanew);
+	dir = &nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+	if (!dir->VirtualAddress)
+		return false;
+
+	for (imp = (IMAGE_IMPORT_DESCRIPTOR *)(base + dir->VirtualAddress); imp->Name; imp++) {
+		names = (IMAGE_THUNK_DATA *)(base + ((imp->OriginalFirstThunk) ? imp->OriginalFirstThunk : imp->FirstThunk));
+		funcs = (IMAGE_THUNK_DATA *)(base + imp->FirstThunk);
+
+		for ( ; names->u1.AddressOfData; names++, funcs++) {
+			if (IMAGE_SNAP_BY_ORDINAL (names->u1.Ordinal))
+				continue;
+
+			byName = (IMAGE_IMPORT_BY_NAME *)(base + names->u1.AddressOfData);
+			if (!strcmp ((const char *)byName->Name, "rand"))
+				return ((void *)funcs->u1.Function == (void *)rand);
+		}
+	}
+
+	return false;	// Has its own rand()
+}
+
 
 // =====================================================================
 
@@ -1443,6 +1704,7 @@ int WINAPI WinMain (HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLin
 		return FALSE;
 
 	sys.hInstance = hInstance;
+	sys_mainThreadId = GetCurrentThreadId ();
 
 	// No abort/retry/fail errors
 	SetErrorMode (SEM_FAILCRITICALERRORS);
@@ -1455,8 +1717,9 @@ int WINAPI WinMain (HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLin
 
 	// Main message loop
 	while (1) {
-		// If not active or running a dedicated server, sleep a bit
-		if (!sys.activeApp || com_dedicated->integerValue)
+		// If not active, sleep a bit. A dedicated server sleeps on the
+		// network socket in Com_Frame instead.
+		if (!sys.activeApp && !com_dedicated->integerValue)
 			Sleep(5);
 
 		// Run a frame